@@ -29,6 +29,9 @@
 // enable output via PWM
 //#define OUTPUT_VIA_PWM
 
+// noise-shaped PWM output: 2nd-order error feedback at a 4x higher carrier rate, levels loaded by DMA
+//#define NOISE_SHAPED_PWM
+
 // enable output via PCM5102-DAC
 //#define USE_DAC
 
@@ -44,6 +47,18 @@
 // enable support of special 8-bit DAC mode
 #define SID_DAC_MODE_SUPPORT
 
+// enable adaptive emulation quality depending on the time left per sample
+#define ADAPTIVE_QUALITY
+
+// serve OSC3 reads with the value predicted for the cycle of the read (instead of the last emulated one)
+#define PREDICT_OSC3
+
+// stop clocking the SIDs while the output is silent and the envelopes are at zero (requires PREDICT_OSC3)
+#define ENGINE_SLEEP
+
+// measure the CPU cycles spent per path in handleBus and count overruns of the C64 half-cycle (debugging)
+//#define BUS_TIMING_PROFILE
+
 // enable RGB LED on GPIO 23 (do not use this with original Pico)
 //#define USE_RGB_LED
 
@@ -65,12 +80,35 @@
 #include "hardware/adc.h"
 #include "hardware/resets.h"
 #include "hardware/watchdog.h"
+#include "hardware/structs/systick.h"
 
 #include "prgslots.h"
+#include "governor.h"
+#include "cmdqueue.h"
+#include "exodecr.h"
+#include "samplefifo.h"
+#include "busdefs.h"
+#include "asrc.h"
+#include "digidetect.h"
+#ifdef SID_DAC_MODE_SUPPORT
+#include "blep.h"
+#include "dacmode.h"
+#endif
+#ifdef NOISE_SHAPED_PWM
+#ifndef OUTPUT_VIA_PWM
+#error "NOISE_SHAPED_PWM requires OUTPUT_VIA_PWM"
+#endif
+#include "hardware/dma.h"
+#include "noiseshape.h"
+#endif
 
 uint8_t  prgLaunch = 0, 
 		 currentPRG = 254;		// 255 = config tool, else PRG slot
-uint8_t  decompressConfig = 0;
+volatile uint8_t decompressConfig = 0;	// 1 = requested by core1, 2 = in progress on core0
+
+// the config tool is decrunched in slices between two samples
+#define EXO_SLICE_BYTES	64
+EXO_DECRUNCH configDecrunch;
 uint16_t prgCode_sizeM;
 
 #include "fmopl.h"
@@ -87,11 +125,6 @@ uint8_t DELAY_READ_BUS, DELAY_PHI2;
 
 // support straight DAC output
 #ifdef SID_DAC_MODE_SUPPORT
-#define SID_DAC_OFF      0
-#define SID_DAC_MONO8    1
-#define SID_DAC_STEREO8  2
-#define SID_DAC_MONO16   4
-#define SID_DAC_STEREO16 8
 uint8_t sidDACMode = SID_DAC_OFF;
 #endif
 
@@ -108,7 +141,7 @@ static const __not_in_flash( "mydata" ) unsigned char VERSION_STR[ VERSION_STR_S
   0x53, 0x4b, 0x10, 0x09, 0x03, 0x0f, 0x00, 0x00,   // signature + extension version 0
   0, 14,                                            // firmware version with stepping = 0.12
 #ifdef SID_DAC_MODE_SUPPORT                         // support DAC modes? which?
-  SID_DAC_MONO8 | SID_DAC_STEREO8,
+  SID_DAC_MONO8 | SID_DAC_STEREO8 | SID_DAC_MONO16 | SID_DAC_STEREO16,
 #else
   0,
 #endif
@@ -124,41 +157,22 @@ extern void writeReSID( uint8_t A, uint8_t D );
 extern void writeReSID2( uint8_t A, uint8_t D );
 extern void outputReSID( int16_t *left, int16_t *right );
 extern void readRegs( uint8_t *p1, uint8_t *p2 );
+extern void setVoice3ReadbackReSID( uint8_t sid1, uint8_t sid2 );
+extern void setQualityReSID( uint8_t tier );
+extern uint8_t qualityTiersReSID();
+#ifdef PREDICT_OSC3
+#include "osc3predict.h"
+extern void readOSC3StateReSID( OSC3_STATE *st1, OSC3_STATE *st2, uint32_t cycle );
+#endif
+#ifdef ENGINE_SLEEP
+#ifndef PREDICT_OSC3
+#error "ENGINE_SLEEP requires PREDICT_OSC3 (OSC3 reads are served from the published state while sleeping)"
+#endif
+extern uint8_t idleReSID();
+extern void fastForwardReSID( uint64_t cycles );
+#endif
 
 
-#define D0			0
-#define A0			16
-#define A5			14
-#define A8			15
-#define OE_DATA		8
-#define RW			9
-#define PHI			12
-#define AUDIO_PIN	13
-#define SID			21
-#define LED_BUILTIN 25
-#define POTX		( 10 )
-#define POTY		( 11 )
-#define bSID		( 1 << SID )
-#define bPHI		( 1 << PHI )
-#define bRW			( 1 << RW )
-#define bOE			( 1 << OE_DATA )
-#define bPOTX		( 1 << POTX )
-#define bPOTY		( 1 << POTY )
-
-#define AUDIO_I2S_CLOCK_PIN_BASE 26
-#define AUDIO_I2S_DATA_PIN	28
-
-#define DAC_BITS	( ( 3 << AUDIO_I2S_CLOCK_PIN_BASE ) | ( 1 << AUDIO_I2S_DATA_PIN ) )
-#define bPWN_POT	( ( 1 << AUDIO_PIN ) | bPOTX | bPOTY | DAC_BITS )
-
-#define VIC_HALF_CYCLE( g )	( !( (g) & bPHI ) )
-#define CPU_HALF_CYCLE( g )	(  ( (g) & bPHI ) )
-#define WRITE_ACCESS( g )	( !( (g) & bRW ) )
-#define READ_ACCESS( g )	(  ( (g) & bRW ) )
-#define SID_ACCESS( g )		( !( (g) & bSID ) )
-#define SID_ADDRESS( g )	(  ( (g) >> A0 ) & 0x1f )
-#define SID_RESET( g )	    ( !( (g) & bRESET ) )
-
 #define WAIT_FOR_VIC_HALF_CYCLE { do { g = *gpioInAddr; } while ( !( VIC_HALF_CYCLE( g ) ) ); }
 #define WAIT_FOR_CPU_HALF_CYCLE { do { g = *gpioInAddr; } while ( !( CPU_HALF_CYCLE( g ) ) ); }
 
@@ -170,14 +184,14 @@ const __not_in_flash( "mydata" ) uint32_t  sidFlags[ 6 ] = { bSID, ( 1 << A5 ),
 extern uint32_t SID2_FLAG;
 extern uint8_t  SID2_IOx_global;
 
-// audio settings
-#define AUDIO_RATE (44100)
+// audio settings (the sample rate AUDIO_RATE is set from the configuration)
 #define AUDIO_VALS 2834
 #define AUDIO_BITS 11
 #define AUDIO_BIAS ( AUDIO_VALS / 2 )
 #define SAMPLES_PER_BUFFER (256)
 
 extern uint32_t C64_CLOCK;
+extern uint32_t AUDIO_RATE;
 
 #define SET_CLOCK_125MHZ set_sys_clock_pll( 1500000000, 6, 2 );
 #define SET_CLOCK_FAST   set_sys_clock_pll( 1500000000, 5, 1 );
@@ -229,9 +243,12 @@ void initPotGPIOs()
 
 audio_buffer_pool_t *ap;
 
+// the I2S consumer adapts its PIO clock when sample_freq is changed
+audio_format_t audio_format = { .format = AUDIO_BUFFER_FORMAT_PCM_S16, .sample_freq = 44100, .channel_count = 2 };
+
 audio_buffer_pool_t *initI2S() 
 {
-	static audio_format_t audio_format = { .format = AUDIO_BUFFER_FORMAT_PCM_S16, .sample_freq = 44100, .channel_count = 2 };
+	audio_format.sample_freq = AUDIO_RATE;
 	static audio_buffer_format_t producer_format = { .format = &audio_format, .sample_stride = 8 };
 	audio_buffer_pool_t *pool = audio_new_producer_pool( &producer_format, 3, SAMPLES_PER_BUFFER ); 
 
@@ -251,9 +268,6 @@ audio_buffer_pool_t *initI2S()
 	return pool;
 }
 
-uint16_t audioPos = 0, 
-		 audioOutPos = 0;
-uint32_t audioBuffer[ SAMPLES_PER_BUFFER ];
 uint8_t  firstOutput = 1;
 
 #endif
@@ -264,12 +278,91 @@ uint8_t  firstOutput = 1;
 
 uint64_t c64CycleCounter = 0;
 
-volatile int32_t newSample = 0xffff, newLEDValue;
+int32_t newLEDValue;
 volatile uint64_t lastSIDEmulationCycle = 0;
+volatile uint32_t sampleTickCycle = 0;		// cycle of the last sample tick
+volatile uint32_t sampleTickPhase = 0;		// the exact sample time is sampleTickPhase / AUDIO_RATE cycles before
+
+SAMPLE_FIFO sampleFifo;						// also counts the samples requested by core1 (ticks)
+
+#ifdef ADAPTIVE_QUALITY
+volatile uint8_t qualityTiers;					// quality tiers used with the current configuration, see qgSetTiers
+#endif
+
+#ifdef NOISE_SHAPED_PWM
+// two DMA channels chained to each other load the PWM levels from the ring, each restarts at the
+// beginning of the ring as the transfer count is a multiple of its size
+#define NS_DMA_COUNT	0x40000000
+
+NOISE_SHAPER noiseShaper __attribute__( ( aligned( NS_RING_SIZE * 4 ) ) );
+int nsDMA[ 2 ];
+
+void initNoiseShapedPWM( uint32_t slice )
+{
+	nsInit( &noiseShaper, pwm_gpio_to_channel( AUDIO_PIN ), clock_get_hz( clk_sys ) / ( NS_PWM_WRAP + 1 ), AUDIO_RATE );
+
+	nsDMA[ 0 ] = dma_claim_unused_channel( true );
+	nsDMA[ 1 ] = dma_claim_unused_channel( true );
+	for ( int i = 0; i < 2; i++ )
+	{
+		dma_channel_config c = dma_channel_get_default_config( nsDMA[ i ] );
+		channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+		channel_config_set_read_increment( &c, true );
+		channel_config_set_write_increment( &c, false );
+		channel_config_set_ring( &c, false, NS_RING_LOG2 + 2 );
+		channel_config_set_dreq( &c, pwm_get_dreq( slice ) );
+		channel_config_set_chain_to( &c, nsDMA[ i ^ 1 ] );
+		dma_channel_configure( nsDMA[ i ], &c, &pwm_hw->slice[ slice ].cc, noiseShaper.ring, NS_DMA_COUNT, i == 0 );
+	}
+}
+
+// ring index the DMA reads next (the idle channel points to the beginning of the ring)
+static inline uint32_t nsReadIndex()
+{
+	uint32_t addr = dma_channel_is_busy( nsDMA[ 0 ] ) ? dma_hw->ch[ nsDMA[ 0 ] ].read_addr : dma_hw->ch[ nsDMA[ 1 ] ].read_addr;
+	return ( ( addr - (uint32_t)noiseShaper.ring ) >> 2 ) & NS_RING_MASK;
+}
+#endif
+
+#ifdef USE_DAC
+// resampling from the C64-derived sample rate to the I2S rate, the ratio is tracked by measuring
+// phi2 against the Pico's timer every ASRC_MEASURE_BUFFERS I2S buffers (approx. 0.37s)
+#define ASRC_MEASURE_BUFFERS	64
+
+ASRC	 asrc;
+uint32_t phi2Hz = 0;
+uint32_t phi2LastCycle;
+uint64_t phi2LastTime;
+uint8_t  asrcBufferCnt = 0;
+
+void trackPhi2Clock()
+{
+	uint32_t cycle = (uint32_t)c64CycleCounter;
+	uint64_t time = time_us_64();
+
+	if ( phi2Hz < C64_CLOCK - C64_CLOCK / 10 || phi2Hz > C64_CLOCK + C64_CLOCK / 10 )
+	{
+		// initialization or clock speed setting changed
+		phi2Hz = C64_CLOCK;
+	} else
+	{
+		uint32_t hz = (uint32_t)( (uint64_t)( cycle - phi2LastCycle ) * 1000000 / ( time - phi2LastTime ) );
+
+		// ignore implausible measurements (e.g. the bus handling was busy with transfers)
+		if ( hz > C64_CLOCK - C64_CLOCK / 10 && hz < C64_CLOCK + C64_CLOCK / 10 )
+			phi2Hz += ( (int32_t)hz - (int32_t)phi2Hz ) / 8;
+	}
+
+	phi2LastCycle = cycle;
+	phi2LastTime = time;
+	asrcSetRatio( &asrc, phi2Hz, C64_CLOCK );
+}
+#endif
 
 uint8_t outRegisters[ 34 * 2 ];
 uint8_t *outRegisters_2 = &outRegisters[ 34 ];
 
+FM_OPL  *pOPL = NULL;
 uint8_t fmFakeOutput = 0;
 uint8_t fmAutoDetectStep = 0;
 uint8_t hack_OPL_Sample_Value[ 2 ];
@@ -277,47 +370,86 @@ uint8_t hack_OPL_Sample_Enabled;
 
 #define sidAutoDetectRegs outRegisters
 
-#define SID_MODEL_DETECT_VALUE_8580 2
-#define SID_MODEL_DETECT_VALUE_6581 3
-#define REG_AUTO_DETECT_STEP		32
-#define REG_MODEL_DETECT_VALUE		33
+#ifdef PREDICT_OSC3
+// published by core0 after each emulation step: [ buffer ][ SID ]
+OSC3_STATE osc3State[ 2 ][ 2 ];
+volatile uint8_t osc3Published = 0;
+// cycle of the last write to $0e-$12 per SID (core1), states older than this are not used for prediction
+volatile uint32_t osc3WriteCycle[ 2 ] = { 0, 0 };
+
+void publishOSC3State()
+{
+	uint8_t b = osc3Published ^ 1;
+	readOSC3StateReSID( &osc3State[ b ][ 0 ], &osc3State[ b ][ 1 ], (uint32_t)lastSIDEmulationCycle );
+	// SID #2 is not emulated when FM is enabled
+	if ( FM_ENABLE )
+		osc3State[ b ][ 1 ].waveform = 0;
+	__dmb();
+	osc3Published = b;
+}
+#endif
+
+#ifdef ENGINE_SLEEP
+// sleep after this many constant output samples if the SIDs are idle (approx. 93ms at 44.1kHz)
+#define SLEEP_SILENCE	4096
+
+uint8_t  engineSleeping = 0;
+uint64_t sleepCycles = 0;		// cycles not emulated while sleeping
+
+// catch up with the C64 before the next register write
+void wakeEngine()
+{
+	fastForwardReSID( sleepCycles );
+	sleepCycles = 0;
+	engineSleeping = 0;
+	readRegs( &outRegisters[ 0x1b ], &outRegisters_2[ 0x1b ] );
+	publishOSC3State();
+}
+#endif
+
+// OSC3/ENV3 reads per SID, set by core1: a masked voice 3 is only clocked while they are being read
+volatile uint8_t voice3Read[ 2 ] = { 0, 0 };
+uint64_t voice3ReadCycle[ 2 ] = { 0, 0 };
+uint8_t  voice3Readback = 3;
+#define VOICE3_READBACK_CYCLES	1000000		// approx. 1s after the last read
+
+// called by core0 before each emulation step
+void updateVoice3Readback( uint64_t cycle )
+{
+	uint8_t readback = 0;
+	for ( int i = 0; i < 2; i++ )
+	{
+		if ( voice3Read[ i ] )
+		{
+			voice3Read[ i ] = 0;
+			voice3ReadCycle[ i ] = cycle;
+		}
+		if ( cycle - voice3ReadCycle[ i ] < VOICE3_READBACK_CYCLES )
+			readback |= 1 << i;
+	}
+
+	if ( readback != voice3Readback )
+	{
+		#ifdef ENGINE_SLEEP
+		if ( engineSleeping )
+			wakeEngine();
+		#endif
+		voice3Readback = readback;
+		setVoice3ReadbackReSID( readback & 1, readback >> 1 );
+	}
+}
 
 uint8_t busValue = 0;
 int32_t busValueTTL = 0;
 
 uint16_t SID_CMD = 0xffff;
 
-#define  RING_SIZE 256
-uint16_t ringBuf[ RING_SIZE ];
-uint32_t ringTime[ RING_SIZE ];
-uint8_t  ringWrite = 0;
-uint8_t  ringRead  = 0;
+// register writes from core1 to core0
+CMD_QUEUE cmdQueue;
 
 uint8_t stateGoingTowardsTransferMode = 0;
 
-typedef enum {
-	DD_IDLE = 0,
-	DD_PREP,
-	DD_CONF,
-	DD_PREP2,
-	DD_CONF2,
-	DD_SET,
-	DD_VAR1,
-	DD_VAR2
-} DD_STATE;
-
-DD_STATE ddTB_state[ 3 ] = { DD_IDLE, DD_IDLE, DD_IDLE };
-uint64_t ddTB_cycle[ 3 ] = { 0, 0, 0 };
-uint8_t  ddTB_sample[ 3 ] = { 0, 0, 0 };
-
-DD_STATE ddPWM_state[ 3 ] = { DD_IDLE, DD_IDLE, DD_IDLE };
-uint64_t ddPWM_cycle[ 3 ] = { 0, 0, 0 };
-uint8_t  ddPWM_sample[ 3 ] = { 0, 0, 0 };
-
-#define DD_TB_TIMEOUT0	135
-// def 22 and 12
-#define DD_TB_TIMEOUT	22
-#define DD_PWM_TIMEOUT	22
+DD_VOICE ddVoice[ 3 ][ DD_TECHNIQUES ];
 
 uint8_t  ddActive[ 3 ];
 uint64_t ddCycle[ 3 ] = { 0, 0, 0 };
@@ -325,6 +457,11 @@ uint8_t	 sampleValue[ 3 ] = { 0 };
 
 extern void outputDigi( uint8_t voice, int32_t value );
 
+// Mahoney's technique detected: the SID's mixer outputs the settled level for each $d418 write
+extern void setDirectMixerReSID( uint8_t enable, uint8_t enable2 );
+uint8_t  d418Direct = 0;
+#define D418_TIMEOUT	1536
+
 extern uint8_t POT_FILTER_global;
 uint8_t paddleFilterMode = 0;
 uint8_t SID2_IOx;
@@ -352,6 +489,15 @@ void updateEmulationParameters()
 	SID2_IOx = SID2_IOx_global;
 }
 
+void muteOPL()
+{
+	for ( int i = 0x40; i < 0x56; i++ )
+	{
+		ym3812_write( pOPL, 0, i );
+		ym3812_write( pOPL, 1, 63 );
+	}
+}
+
 #define RGB24( r, g, b ) ( ( (uint32_t)(r)<<8 ) | ( (uint32_t)(g)<<16 ) | (uint32_t)(b) )
 
 uint8_t smoothPotValues = 0;
@@ -376,6 +522,61 @@ inline uint8_t median( uint8_t *x )
 	return sum - minV - maxV;
 }
 
+#ifdef SID_DAC_MODE_SUPPORT
+BLEP dacBlep[ 2 ];
+DAC_DECODER dacDecoder;
+
+// applies all DAC mode writes up to the sample that is rendered next (the 'rendered'-th tick) as band-limited
+// steps at their time stamps, converted to the time before this sample in 1/BLEP_POS_ONE samples
+void drainDACWrites( uint32_t rendered )
+{
+	uint32_t ticks, tickCycle, tickPhase;
+
+	// core1 updates these back-to-back, re-read until we have a consistent set
+	do {
+		ticks = sampleFifo.ticks;
+		tickCycle = sampleTickCycle;
+		tickPhase = sampleTickPhase;
+	} while ( ticks != sampleFifo.ticks || tickCycle != sampleTickCycle || tickPhase != sampleTickPhase );
+
+	uint32_t back = ticks - rendered;
+
+	// the mode is switched by core1 ($d41f writes), which are not queued
+	dacSetMode( &dacDecoder, sidDACMode );
+
+	while ( cqCount( &cmdQueue ) )
+	{
+		// time from the write to the sample, in 1/C64_CLOCK samples
+		int32_t dc = (int32_t)( tickCycle - (uint32_t)cqPeekTime( &cmdQueue ) );
+		int64_t ds = (int64_t)dc * AUDIO_RATE - tickPhase - (int64_t)back * C64_CLOCK;
+
+		// belongs to a later sample
+		if ( ds < 0 )
+			break;
+
+		// writes older than one sample (only if we were late) are placed as early as possible
+		uint32_t x = ds >= C64_CLOCK ? BLEP_POS_ONE - 1 : ( ( (uint32_t)ds << 8 ) / ( C64_CLOCK >> BLEP_PHASES_LOG2 ) );
+		if ( x >= BLEP_POS_ONE )
+			x = BLEP_POS_ONE - 1;
+
+		register uint16_t cmd = cqPop( &cmdQueue );
+
+		if ( cmd & ( 1 << 15 ) )
+		{
+			if ( FM_ENABLE )
+				ym3812_write( pOPL, ( ( cmd >> 8 ) >> 4 ) & 1, cmd & 255 ); else
+				writeReSID2( ( cmd >> 8 ) & 0x1f, cmd & 255 );
+			continue;
+		}
+
+		int32_t level;
+		int ch = dacWrite( &dacDecoder, ( cmd >> 8 ) & 0x1f, cmd & 255, &level );
+		if ( ch >= 0 )
+			blepStep( &dacBlep[ ch ], level, x );
+	}
+}
+#endif
+
 void runEmulation()
 {
 	irq_set_mask_enabled( 0xffffffff, 0 );
@@ -401,10 +602,17 @@ void runEmulation()
 	int audio_pin_slice = pwm_gpio_to_slice_num( AUDIO_PIN );
 	pwm_config config = pwm_get_default_config();
 	pwm_config_set_clkdiv( &config, 1 );
+	#ifdef NOISE_SHAPED_PWM
+	pwm_config_set_wrap( &config, NS_PWM_WRAP );
+	#else
 	pwm_config_set_wrap( &config, AUDIO_VALS );
+	#endif
 	pwm_init( audio_pin_slice, &config, true );
 	gpio_set_drive_strength( AUDIO_PIN, GPIO_DRIVE_STRENGTH_12MA );
 	pwm_set_gpio_level( AUDIO_PIN, 0 );
+	#ifdef NOISE_SHAPED_PWM
+	initNoiseShapedPWM( audio_pin_slice );
+	#endif
 
 	static const uint32_t PIN_DCDC_PSM_CTRL = 23;
 	gpio_init( PIN_DCDC_PSM_CTRL );
@@ -420,7 +628,6 @@ void runEmulation()
 	#endif
 
 	// decompress config-tool
-	extern char *exo_decrunch( const char *in, char *out );
 	exo_decrunch( &prgCodeCompressed[ prgCodeCompressed_size ], &prgCode[ prgCode_size ] );
 	decompressConfig = 0;
 	prgLaunch = 0;
@@ -428,12 +635,9 @@ void runEmulation()
 
 	initReSID();
 	
-	FM_OPL *pOPL = ym3812_init( 3579545, AUDIO_RATE );
-	for ( int i = 0x40; i < 0x56; i++ )
-	{
-		ym3812_write( pOPL, 0, i );
-		ym3812_write( pOPL, 1, 63 );
-	}
+	pOPL = ym3812_init( 3579545, AUDIO_RATE );
+	muteOPL();
+	uint32_t audioRate = AUDIO_RATE;
 	fmFakeOutput = 0;
 	hack_OPL_Sample_Value[ 0 ] = hack_OPL_Sample_Value[ 1 ] = 64;
 	hack_OPL_Sample_Enabled = 0;
@@ -441,6 +645,7 @@ void runEmulation()
 	updateEmulationParameters();
 
 	#ifdef USE_DAC  
+	asrcInit( &asrc );
 	ap = initI2S();
 	#endif
 	#ifdef USE_SPDIF
@@ -451,7 +656,10 @@ void runEmulation()
 	#endif
 
 	#ifdef SID_DAC_MODE_SUPPORT
-	int32_t DAC_L = 0, DAC_R = 0;
+	blepInitKernel();
+	blepInit( &dacBlep[ 0 ] );
+	blepInit( &dacBlep[ 1 ] );
+	dacInit( &dacDecoder );
 	#endif
 
 	extern uint8_t SID_DIGI_DETECT;	// from config: heuristics activated?
@@ -460,7 +668,24 @@ void runEmulation()
 	uint16_t ramp = 0;
 	int32_t  lastS = 0;
 
+	#ifdef ADAPTIVE_QUALITY
+	QUALITY_GOVERNOR qualityGovernor;
+	qgInit( &qualityGovernor );
+	qualityTiers = qualityTiersReSID();
+	qgSetTiers( &qualityGovernor, qualityTiers );
+	uint8_t qualityTier = QG_TIER_FULL;
+
+	// core0's SysTick counts the processor cycles spent on each sample (24 bit, counting down),
+	// loop iterations which only poll for work are not counted
+	systick_hw->rvr = 0xffffff;
+	systick_hw->cvr = 0;
+	systick_hw->csr = 5;
+	uint32_t renderBudget = clock_get_hz( clk_sys ) / AUDIO_RATE;
+	uint32_t renderCycles = 0;
+	#endif
+
 	uint64_t lastD418Cycle = 0;
+	uint32_t samplesRendered = 0;
 	#ifdef USE_RGB_LED
 	uint8_t  digiD418Visualization = 0;
 	#endif
@@ -472,12 +697,15 @@ void runEmulation()
 
 	while ( 1 )
 	{
+		#ifdef ADAPTIVE_QUALITY
+		uint32_t loopStart = systick_hw->cvr;
+		uint8_t  working = 0;
+		#endif
 
-		if ( decompressConfig )
+		if ( decompressConfig == 1 )
 		{
-			extern char *exo_decrunch( const char *in, char *out );
-			exo_decrunch( &prgCodeCompressed[ prgCodeCompressed_size ], &prgCode[ prgCode_size ] );
-			decompressConfig = 0;
+			exo_decrunch_init( &configDecrunch, &prgCodeCompressed[ prgCodeCompressed_size ], &prgCode[ prgCode_size ] );
+			decompressConfig = 2;
 		}
 
 		// paddle/mouse-smoothing 
@@ -552,41 +780,51 @@ void runEmulation()
 			watchdog_reboot( 0, 0, 0 );
 		}
 
+		// the SIDs are emulated up to the tick of the next requested sample (or up to now if there is none),
+		// i.e. each sample is rendered from the emulation state at the cycle it was requested, also if core0
+		// is late; reading the cycle counter before the ticks ensures that we never emulate beyond a tick
 		uint64_t targetEmulationCycle = c64CycleCounter;
-		while ( ringRead != ringWrite )
+		__dmb();
+		uint32_t pendingTicks = sampleFifo.ticks - samplesRendered;
+		uint64_t tickCycle = 0;
+		if ( pendingTicks )
 		{
-			#ifdef SID_DAC_MODE_SUPPORT
-			// this is placed here, as we don't use time stamps in DAC mode
-			if ( sidDACMode && !( ringBuf[ ringRead ] & ( 1 << 15 ) ) )
-			{
-				register uint16_t cmd = ringBuf[ ringRead ++ ];
-				uint8_t reg = ( cmd >> 8 ) & 0x1f;
+			// samples core1 could not wait for are not rendered late
+			uint32_t stale = sfStaleTicks( &sampleFifo, pendingTicks );
+			samplesRendered += stale;
+			pendingTicks -= stale;
 
-				if ( sidDACMode == SID_DAC_STEREO8 )
-				{
-					if ( reg == 0x18 )
-						DAC_L = ( (int)( cmd & 255 ) - 128 ) << 7;
-					if ( reg == 0x19 )
-						DAC_R = ( (int)( cmd & 255 ) - 128 ) << 7; 
-				} else
-				if ( sidDACMode == SID_DAC_MONO8 && reg == 0x18 )
-				{
-					DAC_L = DAC_R = ( (int)( cmd & 255 ) - 128 ) << 7;
-				}
-				continue;
-			} 
+			tickCycle = targetEmulationCycle - (uint32_t)( (uint32_t)targetEmulationCycle - sfTickCycle( &sampleFifo, samplesRendered ) );
+			targetEmulationCycle = tickCycle;
+		}
+
+		while ( cqCount( &cmdQueue ) )
+		{
+			#ifdef SID_DAC_MODE_SUPPORT
+			// in DAC mode the writes are applied when rendering the samples (drainDACWrites)
+			if ( sidDACMode )
+				break;
 			#endif
 
 
-			uint64_t cmdTime = (uint64_t)ringTime[ ringRead ];
+			uint64_t cmdTime = cqPeekTime( &cmdQueue );
 
 			if ( cmdTime > lastSIDEmulationCycle )
 			{
-				targetEmulationCycle = cmdTime;
+				if ( cmdTime < targetEmulationCycle )
+					targetEmulationCycle = cmdTime;
 				break;
 			}
 			
-			register uint16_t cmd = ringBuf[ ringRead ++ ];
+			register uint16_t cmd = cqPop( &cmdQueue );
+			#ifdef ADAPTIVE_QUALITY
+			working = 1;
+			#endif
+
+			#ifdef ENGINE_SLEEP
+			if ( engineSleeping )
+				wakeEngine();
+			#endif
 
 			if ( cmd & ( 1 << 15 ) )
 			{
@@ -603,20 +841,32 @@ void runEmulation()
 			{
 				uint8_t reg = cmd >> 8;
 
-				#ifdef USE_RGB_LED
+				#if defined( USE_RGB_LED ) || defined( SUPPORT_DIGI_DETECT )
 				if ( reg == 0x18 )
 				{
-					if ( ( targetEmulationCycle - lastD418Cycle ) < 1536 )
+					uint8_t d418Digi = 0;
+					if ( ( targetEmulationCycle - lastD418Cycle ) < D418_TIMEOUT )
 					{
-						digiD418Visualization = 1;
+						d418Digi = 1;
 
 						// heuristic to detect Mahoney's technique based on findings by Jürgen Wothke used in WebSid (https://bitbucket.org/wothke/websid/src/master/) )
 						if ( ( 0x17[ outRegisters ] == 0x3 ) && ( 0x15[ outRegisters ] >= 0xfe ) && ( 0x16[ outRegisters ] >= 0xfe ) &&
 							 ( 0x06[ outRegisters ] >= 0xfb ) && ( 0x06[ outRegisters ] == 0x0d[ outRegisters ] ) && ( 0x06[ outRegisters ] == 0x14[ outRegisters ] ) &&
 							 ( 0x04[ outRegisters ] == 0x49 ) && ( 0x0b[ outRegisters ] == 0x49 ) && ( 0x12[ outRegisters ] == 0x49 ) )
-							digiD418Visualization = 2;
-					} else
-						digiD418Visualization = 0;
+							d418Digi = 2;
+					}
+					#ifdef USE_RGB_LED
+					digiD418Visualization = d418Digi;
+					#endif
+
+					#ifdef SUPPORT_DIGI_DETECT
+					// the voices are constant, the filter's transients would only smear the samples
+					if ( ( SID_DIGI_DETECT && d418Digi == 2 ) != d418Direct )
+					{
+						d418Direct = !d418Direct;
+						setDirectMixerReSID( d418Direct, d418Direct && SID2_FLAG == ( 1 << 31 ) );
+					}
+					#endif
 
 					lastD418Cycle = targetEmulationCycle;
 				}
@@ -641,90 +891,12 @@ void runEmulation()
 					if ( reg >  6 && reg < 14 ) { voice = 1; reg -= 7; }
 					if ( reg > 13 && reg < 21 ) { voice = 2; reg -= 14; }
 
-					//
-					// test-bit technique
-
-					#define DD_STATE_TBC( state, cycle )	{ ddTB_state[ voice ] = state; ddTB_cycle[ voice ] = cycle; }
-					#define DD_STATE_TB( state )			{ ddTB_state[ voice ] = state; }
-					#define DD_NO_TIMEOUT( threshold )		( ( c64CycleCounter - ddTB_cycle[ voice ] ) < threshold )
-					
-					#define DD_GET_SAMPLE( s )	{	DD_STATE_TBC( DD_IDLE, 0 );					\
-													ddActive[ voice ] = sampleTechnique = 2;	\
-													sampleValue[ voice ] = s;					\
-													ddCycle[ voice ] = c64CycleCounter; }
-
-					if ( reg == 4 )	
-					{	
-						uint8_t v = cmd & 0x19;
-						switch ( v ) 
-						{
-						case 0x11:	
-							DD_STATE_TBC( DD_PREP, c64CycleCounter );
-							break;
-						case 0x8: case 0x9:	
-							if ( ddTB_state[ voice ] == DD_PREP && DD_NO_TIMEOUT( DD_TB_TIMEOUT0 ) )
-								DD_STATE_TBC( DD_SET, c64CycleCounter - 4 ) else
-								DD_STATE_TB( DD_IDLE )
-							break;
-						case 0x1:	// GATE
-							if ( ddTB_state[ voice ] == DD_SET && DD_NO_TIMEOUT( DD_TB_TIMEOUT ) )
-								DD_STATE_TB( DD_VAR1 ) else
-							if ( ddTB_state[ voice ] == DD_VAR2 && DD_NO_TIMEOUT( DD_TB_TIMEOUT ) )
-								DD_GET_SAMPLE( ddTB_sample[ voice ] ) else
-								DD_STATE_TB( DD_IDLE )
-							break;
-						case 0x0:	
-							if ( ddTB_state[ voice ] == DD_VAR2 && DD_NO_TIMEOUT( DD_TB_TIMEOUT ) )
-								DD_GET_SAMPLE( ddTB_sample[ voice ] )
-							break;
-						}
-					} else
-					if ( reg == 1 ) 
-					{	
-						if ( ddTB_state[ voice ] == DD_SET && DD_NO_TIMEOUT( DD_TB_TIMEOUT ) )
-						{
-							ddTB_sample[ voice ] = cmd & 255;
-							DD_STATE_TBC( DD_VAR2, c64CycleCounter )
-						} else 
-						if ( ddTB_state[ voice ] == DD_VAR1 && DD_NO_TIMEOUT( DD_TB_TIMEOUT ) )
-							DD_GET_SAMPLE( cmd & 255 )
-					}
-
-					//
-					// pulse modulation technique
-					
-					#define DD_PWM_STATE_TBC( state, cycle )	{ ddPWM_state[ voice ] = state; ddPWM_cycle[ voice ] = cycle; }
-					#define DD_PWM_STATE_TB( state )			{ ddPWM_state[ voice ] = state; }
-					#define DD_PWM_NO_TIMEOUT( threshold )		( ( c64CycleCounter - ddPWM_cycle[ voice ] ) < threshold )
-
-					#define DD_PWM_GET_SAMPLE( s )	{	DD_PWM_STATE_TBC( DD_IDLE, 0 );				\
-														ddActive[ voice ] = sampleTechnique = 1;	\
-														sampleValue[ voice ] = s;					\
-														ddCycle[ voice ] = c64CycleCounter; }
-
-					if ( reg == 4 ) 
+					uint8_t sample, technique = ddWrite( ddVoice[ voice ], reg, cmd & 255, (uint32_t)c64CycleCounter, &sample );
+					if ( technique )
 					{
-						uint8_t v = cmd & 0x49;	
-						switch ( v ) 
-						{
-						case 0x49:	
-							if ( ( ddPWM_state[ voice ] == DD_PREP ) && DD_PWM_NO_TIMEOUT( DD_PWM_TIMEOUT ) )
-								DD_PWM_STATE_TBC( DD_CONF, c64CycleCounter ) else
-								DD_PWM_STATE_TBC( DD_PREP2, c64CycleCounter ) 
-							break;
-						case 0x41:	
-							if ( ( ddPWM_state[ voice ] == DD_CONF || ddPWM_state[ voice ] == DD_CONF2 ) && DD_PWM_NO_TIMEOUT( DD_PWM_TIMEOUT ) )
-								DD_PWM_GET_SAMPLE( ddPWM_sample[ voice ] ) else
-								DD_PWM_STATE_TB( DD_IDLE )
-							break;
-						}
-					} else 
-					if ( reg == 2 ) 
-					{
-						if ( ( ddPWM_state[ voice ] == DD_PREP2 ) && DD_PWM_NO_TIMEOUT( DD_PWM_TIMEOUT ) )
-							DD_PWM_STATE_TBC( DD_CONF2, c64CycleCounter ) else
-							DD_PWM_STATE_TBC( DD_PREP, c64CycleCounter )
-						ddPWM_sample[ voice ] = cmd & 255;
+						ddActive[ voice ] = sampleTechnique = technique;
+						sampleValue[ voice ] = sample;
+						ddCycle[ voice ] = c64CycleCounter;
 					}
 				}
 				#endif
@@ -739,6 +911,12 @@ void runEmulation()
 		if ( lastSIDEmulationCycle < curCycleCount )
 		{
 			#ifdef SUPPORT_DIGI_DETECT
+			if ( d418Direct && ( curCycleCount - lastD418Cycle ) >= D418_TIMEOUT )
+			{
+				d418Direct = 0;
+				setDirectMixerReSID( 0, 0 );
+			}
+
 			if ( SID_DIGI_DETECT )
 			{
 				uint16_t v;
@@ -757,24 +935,68 @@ void runEmulation()
 			}
 			#endif
 
+			updateVoice3Readback( curCycleCount );
+
 			uint64_t cyclesToEmulate = curCycleCount - lastSIDEmulationCycle;
 			lastSIDEmulationCycle = curCycleCount;
-			if ( FM_ENABLE )
-				emulateCyclesReSIDSingle( cyclesToEmulate ); else
-				emulateCyclesReSID( cyclesToEmulate );
-			readRegs( &outRegisters[ 0x1b ], &outRegisters_2[ 0x1b ] );
+			#ifdef ADAPTIVE_QUALITY
+			working = 1;
+			#endif
+			#ifdef ENGINE_SLEEP
+			if ( engineSleeping )
+				sleepCycles += cyclesToEmulate; else
+			#endif
+			{
+				if ( FM_ENABLE )
+					emulateCyclesReSIDSingle( cyclesToEmulate ); else
+					emulateCyclesReSID( cyclesToEmulate );
+				readRegs( &outRegisters[ 0x1b ], &outRegisters_2[ 0x1b ] );
+				#ifdef PREDICT_OSC3
+				publishOSC3State();
+				#endif
+			}
 		}
 
 
-		if ( newSample == 0xfffe )
+		uint8_t renderSample = pendingTicks && lastSIDEmulationCycle >= tickCycle;
+		#ifdef SID_DAC_MODE_SUPPORT
+		if ( sidDACMode )
+			renderSample = pendingTicks > 0;
+		#endif
+
+		if ( renderSample )
 		{
 			int16_t L, R;
 
+			// sample rate changed in configuration (the SIDs are already set up by updateConfiguration)
+			if ( audioRate != AUDIO_RATE )
+			{
+				audioRate = AUDIO_RATE;
+				ym3812_set_rate( pOPL, audioRate );
+				ym3812_reset_chip( pOPL );
+				muteOPL();
+				#ifdef USE_DAC
+				audio_format.sample_freq = audioRate;
+				asrcInit( &asrc );
+				#endif
+				#ifdef NOISE_SHAPED_PWM
+				nsSetRate( &noiseShaper, clock_get_hz( clk_sys ) / ( NS_PWM_WRAP + 1 ), audioRate );
+				#endif
+				#ifdef ADAPTIVE_QUALITY
+				renderBudget = clock_get_hz( clk_sys ) / audioRate;
+				#endif
+			}
+
+			samplesRendered ++;
+
 			#ifdef SID_DAC_MODE_SUPPORT
 			if ( sidDACMode )
 			{
-				L = DAC_L;
-				R = DAC_R;
+				drainDACWrites( samplesRendered );
+				L = blepSample( &dacBlep[ 0 ] );
+				R = blepSample( &dacBlep[ 1 ] );
+				if ( sidDACMode & ( SID_DAC_MONO8 | SID_DAC_MONO16 ) )
+					R = L;
 				#ifdef USE_RGB_LED
 				digiD418Visualization = 2;
 				#endif
@@ -795,34 +1017,25 @@ void runEmulation()
 
 			#if defined( USE_DAC ) 
 
-			// fill buffer, skip/stretch as needed
-			if ( audioPos < 256 )
-				audioBuffer[ audioPos ] = ( ( *(uint16_t *)&R ) << 16 ) | ( *(uint16_t *)&L );
-
-			audioPos ++;
+			// resample to the I2S rate
+			asrcPut( &asrc, ( ( *(uint16_t *)&R ) << 16 ) | ( *(uint16_t *)&L ) );
 
 			audio_buffer_t *buffer = take_audio_buffer( ap, false );
 			if ( buffer )
 			{
-				int32_t discrepancy = 0;
-
 				if ( firstOutput )
 					audio_i2s_set_enabled( true );
 				firstOutput = 0;
 
-				int16_t *samples = (int16_t *)buffer->buffer->bytes;
-				audioOutPos = 0;
-				for ( uint i = 0; i < buffer->max_sample_count; i++ )
-				{
-					*(uint32_t *)&samples[ i * 2 + 0 ] = audioBuffer[ audioOutPos ];
-					if ( audioOutPos < audioPos - 1 ) audioOutPos ++; else discrepancy ++;
-				}
+				if ( asrcBufferCnt ++ == 0 )
+					trackPhi2Clock();
+				if ( asrcBufferCnt >= ASRC_MEASURE_BUFFERS )
+					asrcBufferCnt = 0;
 
-				discrepancy += (int32_t)audioOutPos - (int32_t)audioPos;
+				asrcRender( &asrc, (int16_t *)buffer->buffer->bytes, buffer->max_sample_count );
 
 				buffer->sample_count = buffer->max_sample_count;
 				give_audio_buffer( ap, buffer );
-				audioOutPos = audioPos = 0;
 			}
 
 			#endif
@@ -843,6 +1056,11 @@ void runEmulation()
 			#define RAMP_BITS 9
 			#define RAMP_LENGTH ( 1 << RAMP_BITS )
 
+			#ifdef ENGINE_SLEEP
+			if ( !engineSleeping && silence > SLEEP_SILENCE && idleReSID() )
+				engineSleeping = 1;
+			#endif
+
 			if ( silence > 16384 ) {
 				if ( ramp ) ramp --;
 			} else {
@@ -851,7 +1069,15 @@ void runEmulation()
 			
 			if ( ramp < ( RAMP_LENGTH - 1 ) ) s = ( s * ramp ) >> RAMP_BITS;
 
-			newSample = s;
+			int32_t pwmLevel = s;
+
+			#ifdef NOISE_SHAPED_PWM
+			{
+				int32_t x = nsLevel( s_ );
+				if ( ramp < ( RAMP_LENGTH - 1 ) ) x = (int32_t)( ( (int64_t)x * ramp ) >> RAMP_BITS );
+				nsRender( &noiseShaper, x, nsReadIndex() );
+			}
+			#endif
 
 			s = ( s_ >> ( 1 + 16 - AUDIO_BITS ) );
 			if ( ramp < ( RAMP_LENGTH - 1 ) ) s = ( s * ramp ) >> RAMP_BITS;
@@ -860,6 +1086,20 @@ void runEmulation()
 			s >>= ( AUDIO_BITS - 5 );
 			newLEDValue += s;
 
+			sfPush( &sampleFifo, SAMPLE_ENTRY( pwmLevel, newLEDValue ) );
+
+			// next slice of the config tool, the sample for this period is already delivered
+			#ifdef ENGINE_SLEEP
+			uint32_t sliceBytes = engineSleeping ? EXO_SLICE_BYTES * 4 : EXO_SLICE_BYTES;
+			#else
+			uint32_t sliceBytes = EXO_SLICE_BYTES;
+			#endif
+			if ( decompressConfig == 2 && exo_decrunch_step( &configDecrunch, sliceBytes ) )
+			{
+				__dmb();
+				decompressConfig = 0;
+			}
+
 			#ifdef USE_RGB_LED
 			extern int32_t voiceOutAcc[ 3 ], nSamplesAcc;
 
@@ -905,6 +1145,29 @@ void runEmulation()
 			}
 			#endif
 		}
+
+		#ifdef ADAPTIVE_QUALITY
+		// slack = processor cycles per sample period minus the cycles spent since the last sample
+		// (command processing, emulation and rendering), independent of how full the sample FIFO is; the
+		// governor looks at the mean slack and at the FIFO reserve, which absorbs single expensive samples
+		if ( working || renderSample )
+		{
+			renderCycles += ( loopStart - systick_hw->cvr ) & 0xffffff;
+			if ( renderSample )
+			{
+				if ( qualityTiers != qualityGovernor.tiers )
+					qgSetTiers( &qualityGovernor, qualityTiers );
+				uint8_t tier = qgUpdate( &qualityGovernor, (int32_t)renderBudget - (int32_t)renderCycles, renderBudget,
+										 sfReserve( &sampleFifo ), sampleFifo.ahead );
+				renderCycles = 0;
+				if ( tier != qualityTier )
+				{
+					qualityTier = tier;
+					setQualityReSID( tier );
+				}
+			}
+		}
+		#endif
 	}
 }
 
@@ -926,6 +1189,64 @@ uint8_t  transferReg[ 32 ] = {
 
 const uint8_t __not_in_flash( "mydata" ) jmpCode[ 3 ] = { 0x4c, 0x00, 0xd4 }; // jmp $d400
 
+//
+// bus timing profile: every path in handleBus has to be done within its budget, otherwise the next half-cycle
+// starts too late for the bus timing. With BUS_TIMING_PROFILE the SysTick timer of core1 measures each
+// half-cycle from detecting the edge to the end of the work done, and keeps the maximum and the number of
+// budget overruns per path (readable with a debugger). The paths and their budgets are in busdefs.h, their
+// bodies are in busaccess.h and are also run by the host bus simulator (tests/test_bustiming.c).
+//
+#ifdef BUS_TIMING_PROFILE
+volatile uint32_t busPathMaxCycles[ BUS_PATHS ];
+volatile uint32_t busPathOverruns[ BUS_PATHS ];
+uint32_t busPathBudget[ BUS_PATHS ];
+uint8_t  busPath;						// path of the current half-cycle, also set in busaccess.h
+
+void initBusTimingProfile()
+{
+	// SysTick: 24 bit, counting down at the processor clock
+	systick_hw->rvr = 0xffffff;
+	systick_hw->cvr = 0;
+	systick_hw->csr = 5;
+
+	uint32_t halfCycle = clock_get_hz( clk_sys ) / C64_CLOCK / 2;
+	for ( int i = 0; i < BUS_PATHS; i++ )
+	{
+		busPathMaxCycles[ i ] = busPathOverruns[ i ] = 0;
+		busPathBudget[ i ] = BUS_PATH_BUDGET( i, halfCycle );
+	}
+}
+
+#define BUS_PROFILE_VARS		uint32_t busPathT0 = 0;
+#define BUS_PROFILE_START( p )	{ busPathT0 = systick_hw->cvr; busPath = p; }
+#define BUS_PROFILE_PATH( p )	{ busPath = p; }
+#define BUS_PROFILE_END			{ uint32_t dt = ( busPathT0 - systick_hw->cvr ) & 0xffffff;	\
+								  if ( dt > busPathMaxCycles[ busPath ] ) busPathMaxCycles[ busPath ] = dt;	\
+								  if ( dt > busPathBudget[ busPath ] ) busPathOverruns[ busPath ] ++; }
+#else
+#define BUS_PROFILE_VARS
+#define BUS_PROFILE_START( p )
+#define BUS_PROFILE_PATH( p )
+#define BUS_PROFILE_END
+#endif
+
+#define BUS_GPIO_IN()			( sio_hw->gpio_in )
+#define BUS_DATA_OUTPUT()		gpio_set_dir_masked( 0xff, 0xff )
+#define BUS_SET_DATA( D )		SET_DATA( D )
+#define BUS_DELAY( n )			DELAY_Nx3p2_CYCLES( n )
+#define BUS_ADC_RESULT()		( adc_hw->result )
+#if defined( OUTPUT_VIA_PWM ) && !defined( NOISE_SHAPED_PWM ) && defined( FLASH_LED )
+#define BUS_SAMPLE_OUT( e )		{ pwm_set_gpio_level( AUDIO_PIN, SAMPLE_LEVEL( e ) ); pwm_set_gpio_level( LED_BUILTIN, SAMPLE_LED( e ) ); }
+#elif defined( OUTPUT_VIA_PWM ) && !defined( NOISE_SHAPED_PWM )
+#define BUS_SAMPLE_OUT( e )		pwm_set_gpio_level( AUDIO_PIN, SAMPLE_LEVEL( e ) )
+#elif defined( FLASH_LED )
+#define BUS_SAMPLE_OUT( e )		pwm_set_gpio_level( LED_BUILTIN, SAMPLE_LED( e ) )
+#else
+#define BUS_SAMPLE_OUT( e )		{}
+#endif
+
+#include "busaccess.h"
+
 void handleBus()
 {
 	irq_set_mask_enabled( 0xffffffff, 0 );
@@ -944,19 +1265,15 @@ void handleBus()
 	outRegisters[ REG_MODEL_DETECT_VALUE ] = ( config[ /*CFG_SID1_TYPE*/0 ] == 0 ) ? SID_MODEL_DETECT_VALUE_6581 : SID_MODEL_DETECT_VALUE_8580;
 	outRegisters[ REG_MODEL_DETECT_VALUE + 34 ] = ( config[ /*CFG_SID2_TYPE*/8 ] == 0 ) ? SID_MODEL_DETECT_VALUE_6581 : SID_MODEL_DETECT_VALUE_8580;
 
-	register uint32_t gpioDir = bOE | bPWN_POT | ( 1 << LED_BUILTIN ), gpioDirCur = 0;
+	BUS_STATE bus = busInit( bOE | bPWN_POT | ( 1 << LED_BUILTIN ) );
+
+	register uint32_t gpioDirCur = 0;
 	register uint32_t g;
 	register uint32_t A;
 	register uint8_t  DELAY_READ_BUS_local = DELAY_READ_BUS,
 		DELAY_PHI2_local = DELAY_PHI2;
 	register uint8_t  D;
 	volatile const uint32_t *gpioInAddr = &sio_hw->gpio_in;
-	register volatile uint8_t newPotCounter = 0, disableDataLines = 0;
-	register uint32_t curSample = 0;
-
-	// variables for potentiometer handling and filtering
-	uint8_t potCycleCounter = 0;
-	uint8_t skipMeasurements = 0;
 
 	potXExtrema[ 0 ] = potYExtrema[ 0 ] = 128 - 30;
 	potXExtrema[ 1 ] = potYExtrema[ 1 ] = 128 + 30;
@@ -968,7 +1285,12 @@ void handleBus()
 	int16_t  stateInConfigMode = 0;
 	uint32_t stateConfigRegisterAccess = 0;
 
-	gpio_set_dir_all_bits( gpioDir );
+	BUS_PROFILE_VARS
+	#ifdef BUS_TIMING_PROFILE
+	initBusTimingProfile();
+	#endif
+
+	gpio_set_dir_all_bits( bus.gpioDir );
 	sio_hw->gpio_clr = bOE;
 
 	SID2_IOx = SID2_IOx_global;
@@ -1018,11 +1340,12 @@ handleSIDCommunication:
 		// wait for VIC-halfcycle
 		//
 		WAIT_FOR_VIC_HALF_CYCLE
+		BUS_PROFILE_START( BUS_PATH_VIC )
 
-		if ( disableDataLines )
+		if ( bus.disableDataLines )
 		{
 			gpio_set_dir_masked( 0xff, 0 );
-			disableDataLines = 0;
+			bus.disableDataLines = 0;
 
 			if ( stateGoingTowardsTransferMode == 3 )
 			{
@@ -1031,13 +1354,13 @@ handleSIDCommunication:
 			}
 		}
 
-		if ( gpioDir != gpioDirCur )
+		if ( bus.gpioDir != gpioDirCur )
 		{
-			gpioDirCur = gpioDir;
+			gpioDirCur = bus.gpioDir;
 
 			if ( config[ 57 ] )
 			{
-				if ( gpioDir & bPOTY )
+				if ( gpioDirCur & bPOTY )
 				{
 					iobank0_hw->io[ POTY ].ctrl = GPIO_FUNC_SIO << IO_BANK0_GPIO0_CTRL_FUNCSEL_LSB;
 					gpio_set_dir_masked( bPOTY, 0xffffffff );
@@ -1047,307 +1370,34 @@ handleSIDCommunication:
 					hw_clear_bits( &padsbank0_hw->io[ POTY ], PADS_BANK0_GPIO0_IE_BITS );
 				}
 
-				gpio_set_dir_masked( bPOTX, gpioDir );
+				gpio_set_dir_masked( bPOTX, gpioDirCur );
 			} else
 			{
-				gpio_set_dir_masked( bPOTX | bPOTY, gpioDir );
+				gpio_set_dir_masked( bPOTX | bPOTY, gpioDirCur );
 			}
 		}
 
-
-		if ( newSample < 0xfffe )
-		{
-			#ifdef OUTPUT_VIA_PWM
-			pwm_set_gpio_level( AUDIO_PIN, newSample );
-			#endif
-			#ifdef FLASH_LED
-			pwm_set_gpio_level( LED_BUILTIN, newLEDValue );
-			#endif
-
-			newSample = 0xffff;
-		}
-
-		// we have to generate a new sample after C64_CLOCK / AUDIO_RATE cycles
-		++ c64CycleCounter;
-		curSample += AUDIO_RATE;
-		if ( curSample > C64_CLOCK )
-		{
-			curSample -= C64_CLOCK;
-			newSample = 0xfffe;
-		}
-
-		if ( busValueTTL < 0 )
-		{
-			busValue = 0;
-		} else
-			busValueTTL --;
-
-		static uint16_t resetCnt = 0;
-		if ( SID_RESET( g ) )
-			resetCnt ++; else
-			resetCnt = 0;
-
-		if ( resetCnt > 100 && doReset == 0 )
-		{
-			doReset = 1;
-		}
+		bus = busVICHalfCycle( bus, g );
 
 		register uint8_t CPUWritesDelay = DELAY_READ_BUS_local;
 
+		BUS_PROFILE_END
+
 		//
 		// wait for CPU-halfcycle
 		//
 		WAIT_FOR_CPU_HALF_CYCLE
+		BUS_PROFILE_START( BUS_PATH_IDLE )
 
-		DELAY_Nx3p2_CYCLES( DELAY_PHI2_local )
-
-		g = *gpioInAddr;
-		A = SID_ADDRESS( g );
-
-		uint8_t *reg;
-
-		
-		if ( SID2_IOx )
+		bus = busCPUHalfCycle( bus, DELAY_PHI2_local, CPUWritesDelay );
+		if ( bus.enterConfig )
 		{
-			if ( SID_ACCESS( g ) )
-			{
-				g &= ~SID2_FLAG;
-				goto HANDLE_SID_ACCESS;
-			} else
-			// fancy remapping to handle all SID2-addresses in the same way
-			if ( !( g & SID2_FLAG ) )
-			{
-				g ^= SID2_FLAG | bSID;
-				goto HANDLE_SID_ACCESS;
-			} 
+			bus.enterConfig = 0;
+			stateInConfigMode = CONFIG_MODE_CYCLES; // SID remains in config mode for 1/40sec
+			goto configWaitForVIC_Halfcycle;
 		}
 
-		if ( SID_ACCESS( g ) )
-		{
-			HANDLE_SID_ACCESS:
-			reg = outRegisters + ( ( g & SID2_FLAG ) ? 34 : 0 );
-			if ( READ_ACCESS( g ) )
-			{
-				if ( ( g & SID2_FLAG ) && (FM_ENABLE > 1) ) 
-				{
-					gpio_set_dir_masked( 0xff, 0xff );
-					if ( g & ( 1 << A5 ) && !( ( g >> A0 ) & 15 ) )
-					{
-						D = fmFakeOutput;
-						fmFakeOutput = 0xc0 - fmFakeOutput;
-					} else
-						D = 0xff;
-					SET_DATA( D );
-					disableDataLines = 1;
-				} else
-				if ( !( g & SID2_FLAG ) || config[ 8/*CFG_SID2_TYPE*/ ] < 3 )
-				{
-					gpio_set_dir_masked( 0xff, 0xff );
-					if ( A >= 0x1d )
-					{
-						D = jmpCode[ A - 0x1d ];
-						stateGoingTowardsTransferMode ++;
-					} else
-					{
-						if ( reg[ REG_AUTO_DETECT_STEP ] == 1 && ( A == 0x1b ) )
-						{
-							reg[ REG_AUTO_DETECT_STEP ] = 0;
-							D = reg[ REG_MODEL_DETECT_VALUE ];
-						} else
-						{
-							if ( A >= 0x19 && A <= 0x1c )
-								D = reg[ A ]; else
-								D = busValue;
-						}
-						stateGoingTowardsTransferMode = 0;
-					}
-					SET_DATA( D );
-					disableDataLines = 1;
-				}
-			} else
-			//if ( WRITE_ACCESS( g ) )
-			{
-				DELAY_Nx3p2_CYCLES( CPUWritesDelay )
-
-				stateGoingTowardsTransferMode = 0;
-
-				D = ( *gpioInAddr ) & 255;
-
-				if ( A == 0x1f )
-				{
-					if ( D == 0xff )
-					{
-						stateInConfigMode = CONFIG_MODE_CYCLES; // SID remains in config mode for 1/40sec
-						goto configWaitForVIC_Halfcycle;
-					}
-					#ifdef SID_DAC_MODE_SUPPORT
-					else if ( D == 0xfc )
-					{
-						sidDACMode = SID_DAC_MONO8;
-					} else
-					if ( D == 0xfb )
-					{
-						sidDACMode = SID_DAC_STEREO8;
-					}
-					#endif
-				} else
-				{
-					if ( (g & SID2_FLAG) && FM_ENABLE )
-					{
-						if ( (g & ( 1 << A5 )) && !( ( g >> A0 ) & 15 ) )
-						{
-
-							static uint8_t mOPL_addr = 0;
-							if ( ( A & 16 ) == 0 )
-							{
-								mOPL_addr = D;
-							} else
-							{
-								if ( mOPL_addr == 1 )
-								{
-									if ( D == 4 )
-										hack_OPL_Sample_Enabled = 128;  else
-										hack_OPL_Sample_Enabled = 0;
-								}
-								if ( hack_OPL_Sample_Enabled && ( mOPL_addr == 0xa0 || mOPL_addr == 0xa1 ) ) // digi hack
-								{
-									hack_OPL_Sample_Enabled |= 1 << ( mOPL_addr - 0xa0 );
-									hack_OPL_Sample_Value[ mOPL_addr - 0xa0 ] = D;
-								} else
-								{
-									hack_OPL_Sample_Value[ 0 ] = hack_OPL_Sample_Value[ 1 ] = 0;
-								}
-							}
-
-							SID_CMD = ( A << 8 ) | D | ( 1 << 15 );
-							ringTime[ ringWrite ] = (uint64_t)c64CycleCounter;
-							ringBuf[ ringWrite ++ ] = SID_CMD;
-						}
-
-						if ( ( g & ( 1 << ( A0 + 4 ) ) ) == 0 && D == 0x04 )
-							fmAutoDetectStep = 1;
-						if ( ( g & ( 1 << ( A0 + 4 ) ) ) > 0 && D == 0x60 && fmAutoDetectStep == 1 )
-							fmAutoDetectStep = 2;
-						if ( ( g & ( 1 << ( A0 + 4 ) ) ) == 0 && D == 0x04 && fmAutoDetectStep == 2 )
-							fmAutoDetectStep = 3;
-						if ( ( g & ( 1 << ( A0 + 4 ) ) ) > 0 && D == 0x80 && fmAutoDetectStep == 3 )
-						{
-							fmAutoDetectStep = 4;
-							fmFakeOutput = 0;
-						}
-
-					} else
-					{
-						SID_CMD = ( A << 8 ) | D;
-						if ( g & SID2_FLAG ) SID_CMD |= 1 << 15;
-
-						ringTime[ ringWrite ] = (uint64_t)c64CycleCounter;
-						ringBuf[ ringWrite ++ ] = SID_CMD;
-
-						if ( REG_AUTO_DETECT_STEP[ reg ] == 0 &&
-							 0x12[ reg ] == 0xff &&
-							 0x0e[ reg ] == 0xff &&
-							 0x0f[ reg ] == 0xff &&
-							 A == 0x12 && D == 0x20 )
-						{
-							reg[ REG_AUTO_DETECT_STEP ] = 1;
-						}
-						reg[ A ] = D;
-					}
-				}
-				disableDataLines = 1;
-				busValue = D;
-				//if ( outRegisters[ REG_MODEL_DETECT_VALUE ] == SID_MODEL_DETECT_VALUE_8580 )
-					//busValueTTL = 0xa2000; else
-					//busValueTTL = 0x1d00;
-
-				// fixed large value avoids artifacts in some old tunes
-				busValueTTL = 0x100000;
-			}
-		}
-
-		/*   __   __  ___  ___      ___    __         ___ ___  ___  __
-			|__) /  \  |  |__  |\ |  |  | /  \  |\/| |__   |  |__  |__)
-			|    \__/  |  |___ | \|  |  | \__/  |  | |___  |  |___ |  \
-		*/
-		if ( potCycleCounter == 0 )
-		{
-			if ( newPotCounter & 4 )			// in phase 2?
-			{
-				gpioDir |= bPOTX | bPOTY;       // enter phase 1
-				newPotCounter = 0;
-
-				if ( POT_OUTLIER_REJECTION > 1 )
-				{
-					#define GUARD 8
-					if ( ( newPotXCandidate < ( 64 - GUARD ) || newPotXCandidate > ( 192 + GUARD ) ) ||
-						 ( newPotYCandidate < ( 64 - GUARD ) || newPotYCandidate > ( 192 + GUARD ) ) )
-						skipMeasurements = 2;
-				}
-
-				if ( skipMeasurements )
-				{
-					skipMeasurements --;
-					skipSmoothing = 1;
-				} else
-				{
-					skipSmoothing = 0;
-
-					if ( !paddleFilterMode )
-					{
-						outRegisters[ 25 ] = newPotXCandidate;
-						outRegisters[ 26 ] = newPotYCandidate;
-					} else
-					if ( !smoothPotValues )
-					{
-						newPotXCandidate2S = newPotXCandidate;
-						newPotYCandidate2S = newPotYCandidate;
-						smoothPotValues = 1;
-					}
-				}
-			} else
-			{
-				gpioDir &= ~( bPOTX | bPOTY );  // enter phase 2
-				newPotCounter = 0b111;
-			}
-		} else
-		if ( newPotCounter & 4 )				// in phase 2, but cycle counter != 0
-		{
-			if ( ( newPotCounter & 1 ) && ( ( g & bPOTX ) || potCycleCounter == 255 ) )
-			{
-				newPotXCandidate = potCycleCounter;
-				newPotCounter &= 0b110;
-			}
-
-			uint8_t potYState = 0;
-
-			if ( config[ 57 ] )
-				potYState = ( ( newPotCounter & 2 ) && ( ( (uint16_t)adc_hw->result > 1024 + config[ 57 ] * 64 ) || potCycleCounter == 255 ) ); else
-				potYState = ( ( newPotCounter & 2 ) && ( ( g & bPOTY ) || potCycleCounter == 255 ) );
-
-			if ( potYState )
-			{
-				newPotYCandidate = potCycleCounter;
-				newPotCounter &= 0b101;
-			} else
-
-			// test validity of measurements
-			if ( POT_OUTLIER_REJECTION )
-			{
-				uint8_t potYState = 0;
-
-				if ( config[ 57 ] )
-					potYState = ( !( newPotCounter & 2 ) && !( (uint16_t)adc_hw->result > 1024 + config[ 57 ] * 64 - 256 ) ); else
-					potYState = ( !( newPotCounter & 2 ) && !( ( g & bPOTY ) ) );
-
-				if ( ( !( newPotCounter & 1 ) && !( g & bPOTX ) && potCycleCounter == ( ( newPotXCandidate + 255 ) >> 1 ) ) ||
-					 ( potYState && potCycleCounter == ( ( newPotYCandidate + 255 ) >> 1 ) ) )
-					skipMeasurements = 2;
-			}
-		}
-
-
-		potCycleCounter ++;
+		BUS_PROFILE_END
 
 	} // while ( true )
 
@@ -1364,10 +1414,10 @@ handleSIDCommunication:
 		//
 		WAIT_FOR_VIC_HALF_CYCLE
 
-		if ( disableDataLines )
+		if ( bus.disableDataLines )
 		{
 			DELAY_Nx3p2_CYCLES( 3 )
-			disableDataLines = 0;
+			bus.disableDataLines = 0;
 			gpio_set_dir_masked( 0xff, 0 );
 		}
 
@@ -1377,6 +1427,7 @@ handleSIDCommunication:
 		// wait for CPU-halfcycle
 		//
 		WAIT_FOR_CPU_HALF_CYCLE
+		BUS_PROFILE_START( BUS_PATH_TRANSFER )
 
 		DELAY_Nx3p2_CYCLES( DELAY_PHI2_local )
 
@@ -1389,7 +1440,7 @@ handleSIDCommunication:
 
 			// output first, then update
 			SET_DATA( transferReg[ A ] );
-			disableDataLines = 1;
+			bus.disableDataLines = 1;
 
 			stateInConfigMode = TRANSFER_MODE_CYCLES;
 
@@ -1398,6 +1449,13 @@ handleSIDCommunication:
 			case 2:
 				if ( transferData >= transferDataEnd )
 				{
+					if ( transferStage == 0 && decompressConfig )
+					{
+						// config tool not completely decrunched yet: let the C64 store the last byte of the launcher again
+						transferData = transferDataEnd - 1;
+						transferReg[ 4 ] = *transferData;
+						( *(uint16_t *)&transferReg[ 8 ] ) --;
+					} else
 					if ( transferStage == 0 )
 					{
 						transferStage = 1;
@@ -1433,6 +1491,8 @@ handleSIDCommunication:
 		if ( SID_ACCESS( g ) )
 			stateInConfigMode = TRANSFER_MODE_CYCLES;
 
+		BUS_PROFILE_END
+
 		if ( --stateInConfigMode <= 0 || ( SID_ACCESS( g ) && !READ_ACCESS( g ) ) )
 		{
 			stateGoingTowardsTransferMode = 0;
@@ -1454,10 +1514,10 @@ handleSIDCommunication:
 	configWaitForVIC_Halfcycle:
 		WAIT_FOR_VIC_HALF_CYCLE
 
-		if ( disableDataLines )
+		if ( bus.disableDataLines )
 		{
 			DELAY_Nx3p2_CYCLES( 3 )
-			disableDataLines = 0;
+			bus.disableDataLines = 0;
 			gpio_set_dir_masked( 0xff, 0 );
 		}
 
@@ -1467,6 +1527,7 @@ handleSIDCommunication:
 		// wait for CPU-halfcycle
 		//
 		WAIT_FOR_CPU_HALF_CYCLE
+		BUS_PROFILE_START( BUS_PATH_CONFIG )
 		DELAY_Nx3p2_CYCLES( DELAY_PHI2_local )
 
 		register uint32_t g2, gA5A6A8;
@@ -1516,7 +1577,7 @@ handleSIDCommunication:
 				gpio_set_dir_masked( 0xff, 0xff );
 				SET_DATA( D );
 
-				disableDataLines = 1;
+				bus.disableDataLines = 1;
 			} else
 			//if ( WRITE_ACCESS( g ) )
 			{
@@ -1542,12 +1603,16 @@ handleSIDCommunication:
 					{
 						// update settings and write / do not write to flash
 						updateConfiguration();
+						#ifdef ADAPTIVE_QUALITY
+						qualityTiers = qualityTiersReSID();
+						#endif
 						initPotGPIOs();
 						updateEmulationParameters();
 						if ( D == 0xff ) writeConfiguration();
-						skipMeasurements = 3;
+						bus.skipMeasurements = 3;
 						WAIT_FOR_VIC_HALF_CYCLE
 						WAIT_FOR_CPU_HALF_CYCLE
+						BUS_PROFILE_START( BUS_PATH_CONFIG )	// deliberately resynchronized
 						stateInConfigMode = 0;
 					} else if ( D == 0xfa )
 					{
@@ -1598,10 +1663,12 @@ handleSIDCommunication:
 
 		// for checking if signal levels at A5, A6 and/or A8/IO have changed
 		// trying to avoid problems due to unconnected/swapped wires
-		gA5A6A8 = gpioDir;
+		gA5A6A8 = bus.gpioDir;
 		addrLines &= 0b00111111 | ( ( ( g >> A5 ) & 3 ) << 6 );
 		addrLines |= ( ( g >> A5 ) & 3 ) << 4;
 
+		BUS_PROFILE_END
+
 		if ( --stateInConfigMode <= 0 )
 			goto handleSIDCommunication;
 
@@ -1663,6 +1730,8 @@ int main()
 	initPotGPIOs();
 
 	// start bus handling and emulation
+	cqInit( &cmdQueue, c64CycleCounter );
+	sfInit( &sampleFifo, SAMPLE_FIFO_AHEAD );
 	multicore_launch_core1( handleBus );
 	bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_PROC1_BITS;
 
@@ -0,0 +1,186 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  asrc.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASRC_h_
+#define ASRC_h_
+
+#include <stdint.h>
+
+//
+// asynchronous sample rate converter for the I2S output
+//
+// Samples are produced at the C64-derived rate (one per C64_CLOCK / AUDIO_RATE cycles of the actual phi2),
+// but the I2S output runs from the Pico's clock. The converter resamples with 4-point cubic (Catmull-Rom)
+// interpolation, the step (input samples per output sample) is
+// - the nominal ratio of the two rates, set from the measured phi2 frequency (asrcSetRatio), plus
+// - a PI-controller keeping the number of buffered input samples at ASRC_TARGET, which absorbs the
+//   remaining error of the measurement and of the I2S clock
+// Input samples are packed stereo frames as in the I2S buffers: left in the lower, right in the upper half.
+//
+// There are no dependencies on the SDK, i.e. it can be driven with simulated clock ratios on host.
+//
+
+#define ASRC_SIZE_LOG2		10
+#define ASRC_SIZE			( 1 << ASRC_SIZE_LOG2 )
+#define ASRC_MASK			( ASRC_SIZE - 1 )
+
+// fill level kept by the controller, must exceed the number of frames rendered at once (one I2S buffer)
+#define ASRC_TARGET			384
+
+// step and position are Q4.28 fixed-point
+#define ASRC_FRAC_BITS		28
+#define ASRC_ONE			( 1u << ASRC_FRAC_BITS )
+
+// controller gains: step correction per sample of level error, per accumulated error
+#define ASRC_KP_SHIFT		13
+#define ASRC_KI_SHIFT		5
+#define ASRC_INTEGRAL_MAX	( 1 << 17 )
+
+typedef struct
+{
+	uint32_t buf[ ASRC_SIZE ];
+	uint32_t write;				// index of the next input frame
+	uint32_t read;				// integer part of the read position (frame read - 1, read, read + 1, read + 2 are used)
+	uint32_t frac;				// fractional part of the read position
+	uint32_t stepNominal;
+	uint32_t step;
+	int32_t  integral;
+	uint8_t  primed;
+	uint32_t underruns, overflows;
+} ASRC;
+
+static inline void asrcInit( ASRC *a )
+{
+	for ( uint32_t i = 0; i < ASRC_SIZE; i++ )
+		a->buf[ i ] = 0;
+	a->write = 0;
+	a->read = 1;
+	a->frac = 0;
+	a->stepNominal = a->step = ASRC_ONE;
+	a->integral = 0;
+	a->primed = 0;
+	a->underruns = a->overflows = 0;
+}
+
+// sets the nominal step to inRate / outRate (rates in arbitrary, but identical units)
+static inline void asrcSetRatio( ASRC *a, uint32_t inRate, uint32_t outRate )
+{
+	a->stepNominal = (uint32_t)( ( (uint64_t)inRate << ASRC_FRAC_BITS ) / outRate );
+}
+
+// number of input frames not consumed yet
+static inline int32_t asrcLevel( const ASRC *a )
+{
+	return (int32_t)( a->write - a->read );
+}
+
+static inline void asrcPut( ASRC *a, uint32_t frame )
+{
+	// the reader is far behind: drop the oldest frame
+	if ( asrcLevel( a ) >= ASRC_SIZE - 4 )
+	{
+		a->read ++;
+		a->overflows ++;
+	}
+	a->buf[ a->write & ASRC_MASK ] = frame;
+	a->write ++;
+}
+
+#define ASRC_L( f )		( (int32_t)(int16_t)( (f) & 0xffff ) )
+#define ASRC_R( f )		( (int32_t)(int16_t)( (f) >> 16 ) )
+
+static inline int16_t asrcClip( int32_t v )
+{
+	if ( v > 32767 ) return 32767;
+	if ( v < -32768 ) return -32768;
+	return (int16_t)v;
+}
+
+// renders n output frames (interleaved stereo), the controller is updated once per call
+static inline void asrcRender( ASRC *a, int16_t *out, uint32_t n )
+{
+	int32_t level = asrcLevel( a );
+
+	if ( !a->primed )
+	{
+		if ( level < ASRC_TARGET )
+		{
+			for ( uint32_t i = 0; i < n * 2; i++ )
+				out[ i ] = 0;
+			return;
+		}
+		// start exactly at the target level, the integral keeps the correction learned before an underrun
+		a->primed = 1;
+		a->read = a->write - ASRC_TARGET;
+		a->frac = 0;
+	}
+
+	// PI-controller: more frames buffered than wanted => consume faster
+	int32_t e = level - ASRC_TARGET;
+	a->integral += e;
+	if ( a->integral > ASRC_INTEGRAL_MAX ) a->integral = ASRC_INTEGRAL_MAX;
+	if ( a->integral < -ASRC_INTEGRAL_MAX ) a->integral = -ASRC_INTEGRAL_MAX;
+	a->step = a->stepNominal + e * ( 1 << ASRC_KP_SHIFT ) + a->integral * ( 1 << ASRC_KI_SHIFT );
+
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		// frames read - 1 ... read + 2 must be available
+		if ( (int32_t)( a->write - a->read ) < 3 )
+		{
+			a->underruns ++;
+			a->primed = 0;
+			for ( ; i < n; i++ )
+				out[ i * 2 + 0 ] = out[ i * 2 + 1 ] = 0;
+			return;
+		}
+
+		uint32_t f0 = a->buf[ ( a->read - 1 ) & ASRC_MASK ];
+		uint32_t f1 = a->buf[ ( a->read + 0 ) & ASRC_MASK ];
+		uint32_t f2 = a->buf[ ( a->read + 1 ) & ASRC_MASK ];
+		uint32_t f3 = a->buf[ ( a->read + 2 ) & ASRC_MASK ];
+
+		// Catmull-Rom weights, Q14 (they sum up to 1)
+		int32_t t  = a->frac >> ( ASRC_FRAC_BITS - 14 );
+		int32_t t2 = ( t * t ) >> 14;
+		int32_t t3 = ( t2 * t ) >> 14;
+		int32_t w0 = ( -t3 + 2 * t2 - t ) >> 1;
+		int32_t w1 = ( 3 * t3 - 5 * t2 + ( 2 << 14 ) ) >> 1;
+		int32_t w2 = ( -3 * t3 + 4 * t2 + t ) >> 1;
+		int32_t w3 = ( t3 - t2 ) >> 1;
+
+		int32_t l = w0 * ASRC_L( f0 ) + w1 * ASRC_L( f1 ) + w2 * ASRC_L( f2 ) + w3 * ASRC_L( f3 );
+		int32_t r = w0 * ASRC_R( f0 ) + w1 * ASRC_R( f1 ) + w2 * ASRC_R( f2 ) + w3 * ASRC_R( f3 );
+
+		out[ i * 2 + 0 ] = asrcClip( ( l + ( 1 << 13 ) ) >> 14 );
+		out[ i * 2 + 1 ] = asrcClip( ( r + ( 1 << 13 ) ) >> 14 );
+
+		a->frac += a->step;
+		a->read += a->frac >> ASRC_FRAC_BITS;
+		a->frac &= ASRC_ONE - 1;
+	}
+}
+
+#endif
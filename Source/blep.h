@@ -0,0 +1,153 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  blep.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLEP_h_
+#define BLEP_h_
+
+#include <stdint.h>
+#include <math.h>
+
+//
+// band-limited steps for the DAC modes
+//
+// The DAC value changes at arbitrary cycles, point sampling it at the output rate aliases and jitters by up
+// to one sample. Instead each change is added as a band-limited step: the difference to the previous value
+// times the derivative of the step response of a windowed-sinc lowpass (cutoff 0.45 * sample rate), placed
+// with sub-sample precision (linear interpolation between BLEP_PHASES kernels) into a buffer of per-sample
+// differences. Output samples are the running sum of these differences, delayed by BLEP_TAPS / 2 samples
+// such that the kernel is causal.
+// The cost is BLEP_TAPS interpolations and multiply-adds per change and one addition per output sample.
+// The interpolated kernel sums up to exactly 1.0, i.e. the output settles on the DAC value without drift.
+//
+
+#define BLEP_TAPS			32
+#define BLEP_PHASES_LOG2	6
+#define BLEP_PHASES			( 1 << BLEP_PHASES_LOG2 )
+#define BLEP_INTERP_BITS	8
+
+// positions of steps are given in 1/BLEP_POS_ONE samples
+#define BLEP_POS_BITS		( BLEP_PHASES_LOG2 + BLEP_INTERP_BITS )
+#define BLEP_POS_ONE		( 1 << BLEP_POS_BITS )
+#define BLEP_FRAC_BITS		12
+
+#define BLEP_BUF_SIZE		64
+#define BLEP_BUF_MASK		( BLEP_BUF_SIZE - 1 )
+
+static int16_t blepKernel[ BLEP_PHASES + 1 ][ BLEP_TAPS ];
+
+typedef struct
+{
+	int32_t  buf[ BLEP_BUF_SIZE ];	// differences per output sample (Q12)
+	uint32_t n;						// index of the current sample (the one at the next tick)
+	int32_t  sum;					// running sum of emitted differences (Q12)
+	int32_t  level;					// DAC value after the last step
+} BLEP;
+
+// computes the kernels, phase p is a step ( p / BLEP_PHASES ) samples after the sample before the current one
+// (phase BLEP_PHASES is phase 0 one sample later, for the interpolation)
+static inline void blepInitKernel()
+{
+	const float fc = 0.45f;
+	const int sub = 16;
+
+	for ( int p = 0; p <= BLEP_PHASES; p++ )
+	{
+		float acc = 0.0f;
+		int32_t prev = 0;
+		for ( int j = 0; j < BLEP_TAPS; j++ )
+		{
+			// integral of the windowed sinc over the j-th sample interval
+			float u = (float)( j - BLEP_TAPS / 2 + 1 ) - (float)p / BLEP_PHASES;
+			for ( int s = 0; s < sub; s++ )
+			{
+				float v = u - 1.0f + ( s + 0.5f ) / sub;
+				if ( v <= -BLEP_TAPS / 2 || v >= BLEP_TAPS / 2 )
+					continue;
+				float x = 3.14159265f * 2.0f * fc * v;
+				float h = 2.0f * fc * ( fabsf( x ) < 1e-6f ? 1.0f : sinf( x ) / x );
+				float w = 0.42f + 0.5f * cosf( 3.14159265f * v / ( BLEP_TAPS / 2 ) ) + 0.08f * cosf( 2.0f * 3.14159265f * v / ( BLEP_TAPS / 2 ) );
+				acc += h * w / sub;
+			}
+			// round the step response, not the differences, and end exactly at 1.0
+			int32_t cur = j == BLEP_TAPS - 1 ? ( 1 << BLEP_FRAC_BITS ) : (int32_t)lroundf( acc * ( 1 << BLEP_FRAC_BITS ) );
+			blepKernel[ p ][ j ] = cur - prev;
+			prev = cur;
+		}
+	}
+}
+
+static inline void blepInit( BLEP *b )
+{
+	for ( int i = 0; i < BLEP_BUF_SIZE; i++ )
+		b->buf[ i ] = 0;
+	b->n = 0;
+	b->sum = 0;
+	b->level = 0;
+}
+
+// changes the value to 'level', 'x' < BLEP_POS_ONE is the time of the change before the current sample
+static inline void blepStep( BLEP *b, int32_t level, uint32_t x )
+{
+	int32_t d = level - b->level;
+	if ( !d )
+		return;
+	b->level = level;
+
+	uint32_t pos = x ? BLEP_POS_ONE - x : 0;
+	int32_t  f = pos & ( ( 1 << BLEP_INTERP_BITS ) - 1 );
+	const int16_t *k0 = blepKernel[ pos >> BLEP_INTERP_BITS ];
+	const int16_t *k1 = k0 + BLEP_TAPS;
+
+	uint32_t n = b->n - ( x ? 1 : 0 ) - BLEP_TAPS / 2 + 1;
+	int32_t  acc = 0, total = 0;
+	for ( int j = 0; j < BLEP_TAPS - 1; j++ )
+	{
+		// interpolate and round the step response, not the differences: rounding errors of the taps
+		// would otherwise add up in the last tap and shift the step in time
+		acc += ( k0[ j ] << BLEP_INTERP_BITS ) + ( k1[ j ] - k0[ j ] ) * f;
+		int32_t k = ( ( acc + ( 1 << ( BLEP_INTERP_BITS - 1 ) ) ) >> BLEP_INTERP_BITS ) - total;
+		total += k;
+		b->buf[ ( n + j ) & BLEP_BUF_MASK ] += d * k;
+	}
+	// the last tap completes the step exactly
+	b->buf[ ( n + BLEP_TAPS - 1 ) & BLEP_BUF_MASK ] += d * ( ( 1 << BLEP_FRAC_BITS ) - total );
+}
+
+// returns the output for the current sample (delayed by BLEP_TAPS / 2) and advances to the next one
+static inline int32_t blepSample( BLEP *b )
+{
+	uint32_t i = ( b->n - BLEP_TAPS / 2 ) & BLEP_BUF_MASK;
+	b->sum += b->buf[ i ];
+	b->buf[ i ] = 0;
+	b->n ++;
+
+	int32_t s = ( b->sum + ( 1 << ( BLEP_FRAC_BITS - 1 ) ) ) >> BLEP_FRAC_BITS;
+	if ( s < -32768 ) s = -32768;
+	if ( s > 32767 ) s = 32767;
+	return s;
+}
+
+#endif
@@ -0,0 +1,459 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  busaccess.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BUSACCESS_h_
+#define BUSACCESS_h_
+
+#include <stdint.h>
+
+//
+// the paths through handleBus while communicating with the C64 as SID (VIC half-cycle, CPU half-cycle with
+// SID read/write/FM write or paddle sampling)
+//
+// The bodies do not use the SDK directly, i.e. they can be run by the host bus simulator. The includer
+// provides the pin mapping (busdefs.h), the globals of the bus handling and the hardware access:
+//   BUS_GPIO_IN()			current state of the GPIOs
+//   BUS_DATA_OUTPUT()		enable the outputs of the data lines
+//   BUS_SET_DATA( D )		put D on the data lines
+//   BUS_DELAY( n )			busy wait of 3n+2 processor cycles
+//   BUS_SAMPLE_OUT( e )	output of a sample entry (PWM and/or LED)
+//   BUS_ADC_RESULT()		last result of the ADC (POTY via ADC)
+//   BUS_PROFILE_PATH( p )	see BUS_TIMING_PROFILE
+// Waiting for the PHI2 edges, changing the POT line directions and the transfer/config modes remain in handleBus.
+//
+
+//
+// The state is passed by value and returned by each body (all of them are always_inline), i.e. its fields are
+// locals of handleBus which the compiler can keep in registers, as no pointer to them exists.
+//
+
+typedef struct
+{
+	uint32_t curSample;				// sample clock: AUDIO_RATE per cycle, a sample is due every C64_CLOCK
+	uint32_t gpioDir;				// wanted direction of the GPIOs (POT lines), applied in the VIC half-cycle
+	uint16_t resetCnt;				// consecutive VIC half-cycles with reset asserted
+	uint8_t  disableDataLines;		// data lines are driven and have to be released in the next VIC half-cycle
+	uint8_t  newPotCounter;			// bit 2: phase 2 (measuring), bit 1/0: POTY/POTX not yet measured
+	uint8_t  potCycleCounter;
+	uint8_t  skipMeasurements;
+	uint8_t  oplAddr;				// last address written to the FM
+	uint8_t  afterWrite;			// the last CPU half-cycle was a write
+	uint8_t  osc3Sid;				// SID whose OSC3 is predicted ahead (PREDICT_OSC3)
+	uint8_t  osc3Value;				// OSC3 of this SID predicted for the current cycle
+	uint16_t osc3Active;			// VIC half-cycles left to predict OSC3, restarted by each read
+	uint8_t  enterConfig;			// set by busCPUHalfCycle: write of $ff to $1f
+} BUS_STATE;
+
+// OSC3 is predicted ahead while it is being read (approx. 66ms after the last read)
+#define BUS_OSC3_ACTIVE		0xffff
+
+static inline BUS_STATE busInit( uint32_t gpioDir )
+{
+	BUS_STATE b;
+	b.curSample = 0;
+	b.gpioDir = gpioDir;
+	b.resetCnt = 0;
+	b.disableDataLines = 0;
+	b.newPotCounter = 0;
+	b.potCycleCounter = 0;
+	b.skipMeasurements = 0;
+	b.oplAddr = 0;
+	b.afterWrite = 0;
+	b.osc3Sid = 0;
+	b.osc3Value = 0;
+	b.osc3Active = 0;
+	b.enterConfig = 0;
+	return b;
+}
+
+#ifdef PREDICT_OSC3
+static inline uint8_t readOSC3( uint8_t sid, uint32_t cycle, uint8_t fallback )
+{
+	const OSC3_STATE *s = &osc3State[ osc3Published ][ sid ];
+	if ( (int32_t)( s->cycle - osc3WriteCycle[ sid ] ) < 0 )
+		return fallback;
+	return predictOSC3( s, cycle );
+}
+#endif
+
+// VIC half-cycle: audio sample tick, OSC3 prediction, decay of the bus value, reset detection
+static inline __attribute__( ( always_inline ) ) BUS_STATE busVICHalfCycle( BUS_STATE b, uint32_t g )
+{
+	// we have to output a sample and request a new one after C64_CLOCK / AUDIO_RATE cycles
+	++ c64CycleCounter;
+
+	#ifdef PREDICT_OSC3
+	// predicted here, as there is not enough time between decoding a read and setting up its data (not needed
+	// after a write, as the 6510 never reads in the next cycle, which leaves more time to the write)
+	if ( b.osc3Active && !b.afterWrite )
+	{
+		BUS_PROFILE_PATH( BUS_PATH_VIC_OSC3 )
+		b.osc3Active --;
+		b.osc3Value = readOSC3( b.osc3Sid, (uint32_t)c64CycleCounter, outRegisters[ b.osc3Sid * 34 + 0x1b ] );
+	}
+	#endif
+
+	b.curSample += AUDIO_RATE;
+	if ( b.curSample > C64_CLOCK )
+	{
+		b.curSample -= C64_CLOCK;
+		sampleTickCycle = (uint32_t)c64CycleCounter;
+		sampleTickPhase = b.curSample;
+		sfTick( &sampleFifo, (uint32_t)c64CycleCounter );
+
+		uint32_t e;
+		if ( sfPop( &sampleFifo, &e ) )
+			BUS_SAMPLE_OUT( e );
+	}
+
+	if ( busValueTTL < 0 )
+	{
+		busValue = 0;
+	} else
+		busValueTTL --;
+
+	if ( SID_RESET( g ) )
+		b.resetCnt ++; else
+		b.resetCnt = 0;
+
+	b.afterWrite = 0;
+
+	if ( b.resetCnt > 100 && doReset == 0 )
+	{
+		doReset = 1;
+	}
+
+	return b;
+}
+
+// SID read: put the value on the data lines
+static inline __attribute__( ( always_inline ) ) BUS_STATE busSIDRead( BUS_STATE b, uint32_t g, uint32_t A, uint8_t *reg )
+{
+	uint8_t D;
+
+	BUS_PROFILE_PATH( BUS_PATH_SID_READ )
+	if ( ( g & SID2_FLAG ) && (FM_ENABLE > 1) ) 
+	{
+		BUS_DATA_OUTPUT();
+		if ( g & ( 1 << A5 ) && !( ( g >> A0 ) & 15 ) )
+		{
+			D = fmFakeOutput;
+			fmFakeOutput = 0xc0 - fmFakeOutput;
+		} else
+			D = 0xff;
+		BUS_SET_DATA( D );
+		b.disableDataLines = 1;
+	} else
+	if ( !( g & SID2_FLAG ) || config[ 8/*CFG_SID2_TYPE*/ ] < 3 )
+	{
+		BUS_DATA_OUTPUT();
+		if ( A >= 0x1d )
+		{
+			D = jmpCode[ A - 0x1d ];
+			stateGoingTowardsTransferMode ++;
+		} else
+		{
+			if ( reg[ REG_AUTO_DETECT_STEP ] == 1 && ( A == 0x1b ) )
+			{
+				reg[ REG_AUTO_DETECT_STEP ] = 0;
+				D = reg[ REG_MODEL_DETECT_VALUE ];
+			} else
+			{
+				#ifdef PREDICT_OSC3
+				// the first read after a pause (or of the other SID) gets the published value
+				if ( A == 0x1b )
+				{
+					uint8_t sid = ( g & SID2_FLAG ) ? 1 : 0;
+					D = ( b.osc3Active && b.osc3Sid == sid ) ? b.osc3Value : reg[ A ];
+					b.osc3Sid = sid;
+					b.osc3Active = BUS_OSC3_ACTIVE;
+				} else
+				#endif
+				if ( A >= 0x19 && A <= 0x1c )
+					D = reg[ A ]; else
+					D = busValue;
+			}
+			stateGoingTowardsTransferMode = 0;
+		}
+		BUS_SET_DATA( D );
+		b.disableDataLines = 1;
+
+		// voice 3 of this SID has to be clocked for OSC3/ENV3 readback
+		if ( A == 0x1b || A == 0x1c )
+			voice3Read[ ( g & SID2_FLAG ) ? 1 : 0 ] = 1;
+	}
+
+	return b;
+}
+
+// SID write: sample the data lines after 'delay' and pass the write to core0, sets enterConfig if the C64
+// requested the config mode
+static inline __attribute__( ( always_inline ) ) BUS_STATE busSIDWrite( BUS_STATE b, uint32_t g, uint32_t A, uint8_t *reg, uint8_t delay )
+{
+	BUS_PROFILE_PATH( BUS_PATH_SID_WRITE )
+	BUS_DELAY( delay );
+
+	stateGoingTowardsTransferMode = 0;
+
+	uint8_t D = BUS_GPIO_IN() & 255;
+
+	if ( A == 0x1f )
+	{
+		if ( D == 0xff )
+		{
+			b.enterConfig = 1; // SID remains in config mode for 1/40sec
+			return b;
+		}
+		#ifdef SID_DAC_MODE_SUPPORT
+		else if ( D == 0xfc )
+		{
+			sidDACMode = SID_DAC_MONO8;
+		} else
+		if ( D == 0xfb )
+		{
+			sidDACMode = SID_DAC_STEREO8;
+		} else
+		if ( D == 0xfe )
+		{
+			sidDACMode = SID_DAC_MONO16;
+		} else
+		if ( D == 0xfd )
+		{
+			sidDACMode = SID_DAC_STEREO16;
+		}
+		#endif
+	} else
+	{
+		if ( (g & SID2_FLAG) && FM_ENABLE )
+		{
+			BUS_PROFILE_PATH( BUS_PATH_FM_WRITE )
+			if ( (g & ( 1 << A5 )) && !( ( g >> A0 ) & 15 ) )
+			{
+				if ( ( A & 16 ) == 0 )
+				{
+					b.oplAddr = D;
+				} else
+				{
+					if ( b.oplAddr == 1 )
+					{
+						if ( D == 4 )
+							hack_OPL_Sample_Enabled = 128;  else
+							hack_OPL_Sample_Enabled = 0;
+					}
+					if ( hack_OPL_Sample_Enabled && ( b.oplAddr == 0xa0 || b.oplAddr == 0xa1 ) ) // digi hack
+					{
+						hack_OPL_Sample_Enabled |= 1 << ( b.oplAddr - 0xa0 );
+						hack_OPL_Sample_Value[ b.oplAddr - 0xa0 ] = D;
+					} else
+					{
+						hack_OPL_Sample_Value[ 0 ] = hack_OPL_Sample_Value[ 1 ] = 0;
+					}
+				}
+
+				SID_CMD = ( A << 8 ) | D | ( 1 << 15 );
+				cqPush( &cmdQueue, SID_CMD, (uint32_t)c64CycleCounter );
+			}
+
+			if ( ( g & ( 1 << ( A0 + 4 ) ) ) == 0 && D == 0x04 )
+				fmAutoDetectStep = 1;
+			if ( ( g & ( 1 << ( A0 + 4 ) ) ) > 0 && D == 0x60 && fmAutoDetectStep == 1 )
+				fmAutoDetectStep = 2;
+			if ( ( g & ( 1 << ( A0 + 4 ) ) ) == 0 && D == 0x04 && fmAutoDetectStep == 2 )
+				fmAutoDetectStep = 3;
+			if ( ( g & ( 1 << ( A0 + 4 ) ) ) > 0 && D == 0x80 && fmAutoDetectStep == 3 )
+			{
+				fmAutoDetectStep = 4;
+				fmFakeOutput = 0;
+			}
+
+		} else
+		{
+			SID_CMD = ( A << 8 ) | D;
+			if ( g & SID2_FLAG ) SID_CMD |= 1 << 15;
+
+			cqPush( &cmdQueue, SID_CMD, (uint32_t)c64CycleCounter );
+
+			#ifdef PREDICT_OSC3
+			if ( A >= 0x0e && A <= 0x12 )
+				osc3WriteCycle[ ( g & SID2_FLAG ) ? 1 : 0 ] = (uint32_t)c64CycleCounter;
+			#endif
+
+			if ( REG_AUTO_DETECT_STEP[ reg ] == 0 &&
+				 0x12[ reg ] == 0xff &&
+				 0x0e[ reg ] == 0xff &&
+				 0x0f[ reg ] == 0xff &&
+				 A == 0x12 && D == 0x20 )
+			{
+				reg[ REG_AUTO_DETECT_STEP ] = 1;
+			}
+			reg[ A ] = D;
+		}
+	}
+	b.disableDataLines = 1;
+	b.afterWrite = 1;
+	busValue = D;
+	//if ( outRegisters[ REG_MODEL_DETECT_VALUE ] == SID_MODEL_DETECT_VALUE_8580 )
+		//busValueTTL = 0xa2000; else
+		//busValueTTL = 0x1d00;
+
+	// fixed large value avoids artifacts in some old tunes
+	busValueTTL = 0x100000;
+
+	return b;
+}
+
+/*   __   __  ___  ___      ___    __         ___ ___  ___  __
+	|__) /  \  |  |__  |\ |  |  | /  \  |\/| |__   |  |__  |__)
+	|    \__/  |  |___ | \|  |  | \__/  |  | |___  |  |___ |  \
+*/
+
+// paddle sampling, once per CPU half-cycle (g: state of the GPIOs in this half-cycle)
+static inline __attribute__( ( always_inline ) ) BUS_STATE busPotHalfCycle( BUS_STATE b, uint32_t g )
+{
+	if ( b.potCycleCounter == 0 )
+	{
+		if ( b.newPotCounter & 4 )			// in phase 2?
+		{
+			b.gpioDir |= bPOTX | bPOTY;       // enter phase 1
+			b.newPotCounter = 0;
+
+			if ( POT_OUTLIER_REJECTION > 1 )
+			{
+				#define GUARD 8
+				if ( ( newPotXCandidate < ( 64 - GUARD ) || newPotXCandidate > ( 192 + GUARD ) ) ||
+					 ( newPotYCandidate < ( 64 - GUARD ) || newPotYCandidate > ( 192 + GUARD ) ) )
+					b.skipMeasurements = 2;
+			}
+
+			if ( b.skipMeasurements )
+			{
+				b.skipMeasurements --;
+				skipSmoothing = 1;
+			} else
+			{
+				skipSmoothing = 0;
+
+				if ( !paddleFilterMode )
+				{
+					outRegisters[ 25 ] = newPotXCandidate;
+					outRegisters[ 26 ] = newPotYCandidate;
+				} else
+				if ( !smoothPotValues )
+				{
+					newPotXCandidate2S = newPotXCandidate;
+					newPotYCandidate2S = newPotYCandidate;
+					smoothPotValues = 1;
+				}
+			}
+		} else
+		{
+			b.gpioDir &= ~( bPOTX | bPOTY );  // enter phase 2
+			b.newPotCounter = 0b111;
+		}
+	} else
+	if ( b.newPotCounter & 4 )				// in phase 2, but cycle counter != 0
+	{
+		if ( ( b.newPotCounter & 1 ) && ( ( g & bPOTX ) || b.potCycleCounter == 255 ) )
+		{
+			newPotXCandidate = b.potCycleCounter;
+			b.newPotCounter &= 0b110;
+		}
+
+		uint8_t potYState = 0;
+
+		if ( config[ 57 ] )
+			potYState = ( ( b.newPotCounter & 2 ) && ( ( (uint16_t)BUS_ADC_RESULT() > 1024 + config[ 57 ] * 64 ) || b.potCycleCounter == 255 ) ); else
+			potYState = ( ( b.newPotCounter & 2 ) && ( ( g & bPOTY ) || b.potCycleCounter == 255 ) );
+
+		if ( potYState )
+		{
+			newPotYCandidate = b.potCycleCounter;
+			b.newPotCounter &= 0b101;
+		} else
+
+		// test validity of measurements
+		if ( POT_OUTLIER_REJECTION )
+		{
+			uint8_t potYState = 0;
+
+			if ( config[ 57 ] )
+				potYState = ( !( b.newPotCounter & 2 ) && !( (uint16_t)BUS_ADC_RESULT() > 1024 + config[ 57 ] * 64 - 256 ) ); else
+				potYState = ( !( b.newPotCounter & 2 ) && !( ( g & bPOTY ) ) );
+
+			if ( ( !( b.newPotCounter & 1 ) && !( g & bPOTX ) && b.potCycleCounter == ( ( newPotXCandidate + 255 ) >> 1 ) ) ||
+				 ( potYState && b.potCycleCounter == ( ( newPotYCandidate + 255 ) >> 1 ) ) )
+				b.skipMeasurements = 2;
+		}
+	}
+
+	b.potCycleCounter ++;
+
+	return b;
+}
+
+// CPU half-cycle: SID access or paddle sampling, 'phi2Delay' and 'writeDelay' are the bus timings
+// (DELAY_PHI2, DELAY_READ_BUS), sets enterConfig if the C64 requested the config mode
+static inline __attribute__( ( always_inline ) ) BUS_STATE busCPUHalfCycle( BUS_STATE b, uint8_t phi2Delay, uint8_t writeDelay )
+{
+	BUS_DELAY( phi2Delay );
+
+	uint32_t g = BUS_GPIO_IN();
+	uint32_t A = SID_ADDRESS( g );
+
+	if ( SID2_IOx )
+	{
+		if ( SID_ACCESS( g ) )
+		{
+			g &= ~SID2_FLAG;
+			goto HANDLE_SID_ACCESS;
+		} else
+		// fancy remapping to handle all SID2-addresses in the same way
+		if ( !( g & SID2_FLAG ) )
+		{
+			g ^= SID2_FLAG | bSID;
+			goto HANDLE_SID_ACCESS;
+		} 
+	}
+
+	if ( SID_ACCESS( g ) )
+	{
+		HANDLE_SID_ACCESS:;
+		uint8_t *reg = outRegisters + ( ( g & SID2_FLAG ) ? 34 : 0 );
+		if ( READ_ACCESS( g ) )
+			b = busSIDRead( b, g, A, reg ); else
+		//if ( WRITE_ACCESS( g ) )
+		{
+			b = busSIDWrite( b, g, A, reg, writeDelay );
+			if ( b.enterConfig )
+				return b;
+		}
+	}
+
+	return busPotHalfCycle( b, g );
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  busdefs.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BUSDEFS_h_
+#define BUSDEFS_h_
+
+//
+// pin mapping, decoding of the GPIO state and constants of the bus handling, shared by the firmware and the
+// host bus simulator (RESET comes from the board configuration)
+//
+
+#define D0			0
+#define A0			16
+#define A5			14
+#define A8			15
+#define OE_DATA		8
+#define RW			9
+#define PHI			12
+#define AUDIO_PIN	13
+#define SID			21
+#define LED_BUILTIN 25
+#define POTX		( 10 )
+#define POTY		( 11 )
+#define bSID		( 1 << SID )
+#define bPHI		( 1 << PHI )
+#define bRW			( 1 << RW )
+#define bOE			( 1 << OE_DATA )
+#define bPOTX		( 1 << POTX )
+#define bPOTY		( 1 << POTY )
+
+#define AUDIO_I2S_CLOCK_PIN_BASE 26
+#define AUDIO_I2S_DATA_PIN	28
+
+#define DAC_BITS	( ( 3 << AUDIO_I2S_CLOCK_PIN_BASE ) | ( 1 << AUDIO_I2S_DATA_PIN ) )
+#define bPWN_POT	( ( 1 << AUDIO_PIN ) | bPOTX | bPOTY | DAC_BITS )
+
+#define VIC_HALF_CYCLE( g )	( !( (g) & bPHI ) )
+#define CPU_HALF_CYCLE( g )	(  ( (g) & bPHI ) )
+#define WRITE_ACCESS( g )	( !( (g) & bRW ) )
+#define READ_ACCESS( g )	(  ( (g) & bRW ) )
+#define SID_ACCESS( g )		( !( (g) & bSID ) )
+#define SID_ADDRESS( g )	(  ( (g) >> A0 ) & 0x1f )
+#define SID_RESET( g )	    ( !( (g) & bRESET ) )
+
+// support straight DAC output
+#define SID_DAC_OFF      0
+#define SID_DAC_MONO8    1
+#define SID_DAC_STEREO8  2
+#define SID_DAC_MONO16   4
+#define SID_DAC_STEREO16 8
+
+#define SID_MODEL_DETECT_VALUE_8580 2
+#define SID_MODEL_DETECT_VALUE_6581 3
+#define REG_AUTO_DETECT_STEP		32
+#define REG_MODEL_DETECT_VALUE		33
+
+// paths through handleBus, see BUS_TIMING_PROFILE
+#define BUS_PATH_VIC		0	// VIC half-cycle: audio sample tick, POT line direction, reset detection
+#define BUS_PATH_IDLE		1	// CPU half-cycle without SID access (paddle sampling)
+#define BUS_PATH_SID_READ	2
+#define BUS_PATH_SID_WRITE	3
+#define BUS_PATH_FM_WRITE	4
+#define BUS_PATH_CONFIG		5
+#define BUS_PATH_TRANSFER	6
+#define BUS_PATH_VIC_OSC3	7	// VIC half-cycle which also predicts OSC3 (PREDICT_OSC3)
+#define BUS_PATHS			8
+
+// budget of a path in processor cycles, with 'halfCycle' processor cycles per C64 half-cycle: the waits for
+// PHI2 are level-triggered, i.e. a path taking longer delays the next one. Writes may extend into the following
+// VIC half-cycle, leaving BUS_VIC_RESERVE cycles to it: its data is sampled late in the CPU half-cycle, and the
+// 6510 never reads in the cycle after a write, at most it writes again (read-modify-write), which tolerates a
+// late start for the same reason
+#define BUS_VIC_RESERVE		64
+#define BUS_PATH_BUDGET( p, halfCycle )	\
+	( ( (p) == BUS_PATH_SID_WRITE || (p) == BUS_PATH_FM_WRITE ) ? 2 * (halfCycle) - BUS_VIC_RESERVE : (halfCycle) )
+
+#endif
@@ -0,0 +1,172 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  cmdqueue.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CMDQUEUE_h_
+#define CMDQUEUE_h_
+
+#include <stdint.h>
+
+//
+// single-producer/single-consumer queue for register writes from core1 (bus handling) to core0 (emulation)
+//
+// read and write are free running indices, each written by one side only. The producer fills the entry
+// before publishing it with the write index, the consumer reads the entry before releasing it with the
+// read index; the memory barriers keep these orders on the RP2040. A full queue drops the new entry
+// (instead of silently overwriting unprocessed ones) and counts it in 'overflows'; 'highWater' is the
+// maximum fill level seen by the producer.
+//
+// Each entry is one 32-bit word: the 16-bit command in the lower half, and the number of cycles since the
+// previous entry in the upper half. Larger gaps are sent as an extension entry (upper half CQ_EXTENSION,
+// lower half bits 16..31 of the gap) published together with the entry it belongs to. The producer works
+// on the lower 32 bits of the cycle counter (modular arithmetic, i.e. wrap-safe for gaps below 2^32 cycles;
+// longer gaps are shortened, such that a write is applied early), the consumer accumulates the deltas
+// into a 64-bit time.
+//
+
+#define CMD_QUEUE_DEPTH_LOG2	8
+#define CMD_QUEUE_DEPTH			( 1 << CMD_QUEUE_DEPTH_LOG2 )
+#define CMD_QUEUE_MASK			( CMD_QUEUE_DEPTH - 1 )
+
+#define CQ_EXTENSION			0xffff
+
+#if PICO_ON_DEVICE
+#include "hardware/sync.h"
+#define CQ_BARRIER()	__dmb()
+#else
+#define CQ_BARRIER()	__sync_synchronize()
+#endif
+
+typedef struct
+{
+	uint32_t entry[ CMD_QUEUE_DEPTH ];
+
+	volatile uint32_t write;		// producer only
+	volatile uint32_t read;			// consumer only
+
+	uint32_t lastCycle;				// producer only: cycle of the last entry
+	uint64_t time;					// consumer only: cycle of the last entry
+
+	uint32_t overflows;				// producer only
+	uint32_t highWater;				// producer only
+} CMD_QUEUE;
+
+static inline void cqInit( CMD_QUEUE *q, uint64_t cycle )
+{
+	q->write = q->read = 0;
+	q->lastCycle = (uint32_t)cycle;
+	q->time = cycle;
+	q->overflows = q->highWater = 0;
+}
+
+//
+// producer side
+//
+
+// returns 0 if the queue was full and the command has been dropped
+static inline uint8_t cqPush( CMD_QUEUE *q, uint16_t cmd, uint32_t cycle )
+{
+	uint32_t w = q->write;
+	uint32_t used = w - q->read;
+	uint32_t delta = cycle - q->lastCycle;
+
+	if ( delta < CQ_EXTENSION )
+	{
+		if ( used >= CMD_QUEUE_DEPTH )
+		{
+			q->overflows ++;
+			return 0;
+		}
+		q->entry[ w & CMD_QUEUE_MASK ] = ( delta << 16 ) | cmd;
+		w ++;
+	} else
+	{
+		if ( used >= CMD_QUEUE_DEPTH - 1 )
+		{
+			q->overflows ++;
+			return 0;
+		}
+		q->entry[ w & CMD_QUEUE_MASK ] = ( CQ_EXTENSION << 16 ) | ( delta >> 16 );
+		q->entry[ ( w + 1 ) & CMD_QUEUE_MASK ] = ( delta << 16 ) | cmd;
+		w += 2;
+	}
+
+	q->lastCycle = cycle;
+	if ( w - q->read > q->highWater )
+		q->highWater = w - q->read;
+
+	CQ_BARRIER();
+	q->write = w;
+	return 1;
+}
+
+//
+// consumer side
+//
+
+// number of entries ready to be read (0 = empty)
+static inline uint32_t cqCount( CMD_QUEUE *q )
+{
+	uint32_t n = q->write - q->read;
+	CQ_BARRIER();
+	return n;
+}
+
+static inline uint16_t cqPeekCmd( const CMD_QUEUE *q )
+{
+	uint32_t r = q->read;
+	uint32_t e = q->entry[ r & CMD_QUEUE_MASK ];
+	if ( ( e >> 16 ) == CQ_EXTENSION )
+		e = q->entry[ ( r + 1 ) & CMD_QUEUE_MASK ];
+	return e & 0xffff;
+}
+
+// cycle of the oldest command
+static inline uint64_t cqPeekTime( const CMD_QUEUE *q )
+{
+	uint32_t r = q->read;
+	uint32_t e = q->entry[ r & CMD_QUEUE_MASK ];
+	if ( ( e >> 16 ) == CQ_EXTENSION )
+		return q->time + ( ( e & 0xffff ) << 16 ) + ( q->entry[ ( r + 1 ) & CMD_QUEUE_MASK ] >> 16 );
+	return q->time + ( e >> 16 );
+}
+
+// removes the oldest command and returns it, requires cqCount() > 0
+static inline uint16_t cqPop( CMD_QUEUE *q )
+{
+	uint32_t r = q->read;
+	uint32_t e = q->entry[ r & CMD_QUEUE_MASK ];
+	if ( ( e >> 16 ) == CQ_EXTENSION )
+	{
+		q->time += ( e & 0xffff ) << 16;
+		e = q->entry[ ( ++ r ) & CMD_QUEUE_MASK ];
+	}
+	q->time += e >> 16;
+	CQ_BARRIER();
+	q->read = r + 1;
+	return e & 0xffff;
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  dacmode.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DACMODE_h_
+#define DACMODE_h_
+
+#include <stdint.h>
+#include "busdefs.h"
+
+//
+// decoding of the register writes in the DAC modes into output levels (16-bit signed scale)
+//
+// 8-bit modes: $18 = mono or left channel, $19 = right channel (stereo only), unsigned samples.
+// 16-bit modes: signed samples, low byte first, a sample is complete with its high byte; $18/$19 = mono or
+// left channel, $1a/$1b = right channel (stereo only). A high byte without a new low byte reuses the last one.
+// The low bytes are cleared when the mode changes, a sample never combines bytes written in different modes.
+//
+
+typedef struct
+{
+	uint8_t mode;		// SID_DAC_*
+	uint8_t lo[ 2 ];	// last low byte per channel (16-bit modes)
+} DAC_DECODER;
+
+static inline void dacInit( DAC_DECODER *d )
+{
+	d->mode = SID_DAC_OFF;
+	d->lo[ 0 ] = d->lo[ 1 ] = 0;
+}
+
+static inline void dacSetMode( DAC_DECODER *d, uint8_t mode )
+{
+	if ( mode == d->mode )
+		return;
+	d->mode = mode;
+	d->lo[ 0 ] = d->lo[ 1 ] = 0;
+}
+
+// decodes a write to 'reg', returns the channel (0 = mono/left, 1 = right) and sets 'level' if it completes a
+// sample, -1 otherwise
+static inline int dacWrite( DAC_DECODER *d, uint8_t reg, uint8_t value, int32_t *level )
+{
+	if ( d->mode & ( SID_DAC_MONO8 | SID_DAC_STEREO8 ) )
+	{
+		if ( reg != 0x18 && ( reg != 0x19 || d->mode != SID_DAC_STEREO8 ) )
+			return -1;
+		*level = ( (int32_t)value - 128 ) << 7;
+		return reg & 1;
+	}
+
+	if ( !( d->mode & ( SID_DAC_MONO16 | SID_DAC_STEREO16 ) ) || reg < 0x18 || reg > 0x1b )
+		return -1;
+
+	int ch = ( reg >> 1 ) & 1;
+	if ( ch && d->mode != SID_DAC_STEREO16 )
+		return -1;
+
+	if ( !( reg & 1 ) )
+	{
+		d->lo[ ch ] = value;
+		return -1;
+	}
+	*level = (int16_t)( ( value << 8 ) | d->lo[ ch ] );
+	return ch;
+}
+
+#endif
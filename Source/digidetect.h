@@ -0,0 +1,172 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  digidetect.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DIGIDETECT_h_
+#define DIGIDETECT_h_
+
+#include <stdint.h>
+
+//
+// table-driven detection of digi-playing techniques
+// (the heuristics are based on the findings by Jürgen Wothke used in WebSid (https://bitbucket.org/wothke/websid/src/master/) )
+//
+// Each technique is a list of rules, each voice has one small state per technique. On a write to a voice
+// register, the rules of each technique are checked in order and the first one which matches is applied:
+// a rule matches if the register is the same, ( value & mask ) == match, the voice is in one of the states
+// in 'from', and (if 'timeout' is not 0) less than 'timeout' cycles have passed since the state was stamped.
+// Applying a rule sets the next state and optionally stamps the current cycle (minus 'back'), latches the
+// written value, or emits a sample (the latched or the written value), which returns to DD_IDLE.
+// The cost per write is bounded by the length of the rule lists; techniques which do not use the written
+// register are skipped by their register mask.
+//
+
+typedef enum {
+	DD_IDLE = 0,
+	DD_PREP,
+	DD_CONF,
+	DD_PREP2,
+	DD_CONF2,
+	DD_SET,
+	DD_VAR1,
+	DD_VAR2
+} DD_STATE;
+
+#define DD_FROM( s )		( 1 << (s) )
+#define DD_FROM_ANY			0xff
+
+// actions
+#define DD_STAMP			1		// remember cycle of this write (minus 'back')
+#define DD_LATCH			2		// remember written value as sample
+#define DD_EMIT_LATCHED		4		// output the latched sample
+#define DD_EMIT_VALUE		8		// output the written value as sample
+
+typedef struct
+{
+	uint8_t reg;			// voice register 0..6
+	uint8_t mask, match;
+	uint8_t from;			// states in which the rule applies
+	uint8_t timeout;		// max. cycles since stamp, 0 = none
+	uint8_t to;				// next state (emitting always returns to DD_IDLE)
+	uint8_t action;
+	uint8_t back;			// cycles subtracted when stamping
+} DD_RULE;
+
+typedef struct
+{
+	const DD_RULE *rule;
+	uint8_t nRules;
+	uint8_t regMask;		// registers used by the rules
+	uint8_t id;				// technique reported with the sample (sampleTechnique)
+} DD_TECHNIQUE;
+
+// per voice and technique
+typedef struct
+{
+	uint8_t  state;
+	uint8_t  sample;		// latched sample
+	uint32_t cycle;			// lower 32 bits of the stamped cycle
+} DD_VOICE;
+
+//
+// test-bit technique
+//
+static const DD_RULE ddRulesTestBit[] = {
+	// reg  mask  match from                                 timeout to       action                    back
+	{ 4, 0x19, 0x11, DD_FROM_ANY,                               0, DD_PREP, DD_STAMP,                    0 },
+	{ 4, 0x19, 0x08, DD_FROM( DD_PREP ),                      135, DD_SET,  DD_STAMP,                    4 },
+	{ 4, 0x19, 0x08, DD_FROM_ANY,                               0, DD_IDLE, 0,                           0 },
+	{ 4, 0x19, 0x09, DD_FROM( DD_PREP ),                      135, DD_SET,  DD_STAMP,                    4 },
+	{ 4, 0x19, 0x09, DD_FROM_ANY,                               0, DD_IDLE, 0,                           0 },
+	{ 4, 0x19, 0x01, DD_FROM( DD_SET ),                        22, DD_VAR1, 0,                           0 },
+	{ 4, 0x19, 0x01, DD_FROM( DD_VAR2 ),                       22, DD_IDLE, DD_EMIT_LATCHED,             0 },
+	{ 4, 0x19, 0x01, DD_FROM_ANY,                               0, DD_IDLE, 0,                           0 },
+	{ 4, 0x19, 0x00, DD_FROM( DD_VAR2 ),                       22, DD_IDLE, DD_EMIT_LATCHED,             0 },
+	{ 1, 0x00, 0x00, DD_FROM( DD_SET ),                        22, DD_VAR2, DD_STAMP | DD_LATCH,         0 },
+	{ 1, 0x00, 0x00, DD_FROM( DD_VAR1 ),                       22, DD_IDLE, DD_EMIT_VALUE,               0 },
+};
+
+//
+// pulse modulation technique
+//
+static const DD_RULE ddRulesPulse[] = {
+	// reg  mask  match from                                 timeout to       action                    back
+	{ 4, 0x49, 0x49, DD_FROM( DD_PREP ),                       22, DD_CONF,  DD_STAMP,                   0 },
+	{ 4, 0x49, 0x49, DD_FROM_ANY,                               0, DD_PREP2, DD_STAMP,                   0 },
+	{ 4, 0x49, 0x41, DD_FROM( DD_CONF ) | DD_FROM( DD_CONF2 ), 22, DD_IDLE,  DD_EMIT_LATCHED,            0 },
+	{ 4, 0x49, 0x41, DD_FROM_ANY,                               0, DD_IDLE,  0,                          0 },
+	{ 2, 0x00, 0x00, DD_FROM( DD_PREP2 ),                      22, DD_CONF2, DD_STAMP | DD_LATCH,        0 },
+	{ 2, 0x00, 0x00, DD_FROM_ANY,                               0, DD_PREP,  DD_STAMP | DD_LATCH,        0 },
+};
+
+#define DD_RULES( r )	r, sizeof( r ) / sizeof( DD_RULE )
+
+// order matters: if several techniques emit a sample on the same write, the last one is reported
+#define DD_TECHNIQUES	2
+static const DD_TECHNIQUE ddTechniques[ DD_TECHNIQUES ] = {
+	{ DD_RULES( ddRulesTestBit ), ( 1 << 1 ) | ( 1 << 4 ), 2 },
+	{ DD_RULES( ddRulesPulse ),   ( 1 << 2 ) | ( 1 << 4 ), 1 },
+};
+
+// processes a write of 'value' to voice register 'reg' at cycle 'now', returns the id of the technique which
+// detected a sample (stored in *sample), or 0
+static inline uint8_t ddWrite( DD_VOICE v[ DD_TECHNIQUES ], uint8_t reg, uint8_t value, uint32_t now, uint8_t *sample )
+{
+	uint8_t id = 0;
+
+	for ( int t = 0; t < DD_TECHNIQUES; t++ )
+	{
+		const DD_TECHNIQUE *tq = &ddTechniques[ t ];
+		if ( !( tq->regMask & ( 1 << reg ) ) )
+			continue;
+
+		DD_VOICE *s = &v[ t ];
+		for ( const DD_RULE *r = tq->rule; r < tq->rule + tq->nRules; r++ )
+		{
+			if ( r->reg != reg || ( value & r->mask ) != r->match || !( r->from & DD_FROM( s->state ) ) )
+				continue;
+			if ( r->timeout && ( now - s->cycle ) >= r->timeout )
+				continue;
+
+			s->state = r->to;
+			if ( r->action & DD_STAMP )
+				s->cycle = now - r->back;
+			if ( r->action & DD_LATCH )
+				s->sample = value;
+			if ( r->action & ( DD_EMIT_LATCHED | DD_EMIT_VALUE ) )
+			{
+				*sample = ( r->action & DD_EMIT_VALUE ) ? value : s->sample;
+				s->state = DD_IDLE;
+				s->cycle = 0;
+				id = tq->id;
+			}
+			break;
+		}
+	}
+	return id;
+}
+
+#endif
@@ -27,6 +27,7 @@
 /*
     minimal changes have been made for use in the SIDKick pico firmware, marked with "FR", to reduce compiled code size
     also "__attribute__( ( optimize( "Os" ) ) )" has been added
+    the decruncher state has been moved into EXO_DECRUNCH such that decrunching can be split into steps
 */
 
 /**
@@ -36,13 +37,15 @@
  */
 #include "exodecr.h"
 
-static unsigned short int base[52];
-static char bits[52];
-static unsigned char bit_buffer;
+/* FR: states of the resumable decruncher */
+#define EXO_START   0
+#define EXO_TOKEN   1
+#define EXO_COPY    2
+#define EXO_DONE    3
 
 static int 
 /* FR */ __attribute__( ( optimize( "Os" ) ) )
-bitbuffer_rotate(int carry)
+bitbuffer_rotate(EXO_DECRUNCH *ctx, int carry)
 {
     /* rol */
 
@@ -59,23 +62,23 @@ bitbuffer_rotate(int carry)
     
     /*FR new:*/ 
     unsigned char carry_out;
-    carry_out = bit_buffer >> 7;
-    bit_buffer = ( bit_buffer << 1 ) + carry;
+    carry_out = ctx->bit_buffer >> 7;
+    ctx->bit_buffer = ( ctx->bit_buffer << 1 ) + carry;
 
     return carry_out;
 }
 
 static unsigned char 
 /* FR */ __attribute__( ( optimize( "Os" ) ) )
-read_byte(const char **inp)
+read_byte(EXO_DECRUNCH *ctx)
 {
-    unsigned char val = *--( *inp ) & 0xff;
+    unsigned char val = *--( ctx->in ) & 0xff;
     return val;
 }
 
 static unsigned short int
 /* FR */ __attribute__( ( optimize( "Os" ) ) )
-read_bits(const char **inp, int bit_count)
+read_bits(EXO_DECRUNCH *ctx, int bit_count)
 {
     /* FR */ // unsigned short int bits = 0;
     /* FR */ int bits = 0;
@@ -84,11 +87,11 @@ read_bits(const char **inp, int bit_count)
 
     while(bit_count-- > 0)
     {
-        int carry = bitbuffer_rotate(0);
-        if (bit_buffer == 0)
+        int carry = bitbuffer_rotate(ctx, 0);
+        if (ctx->bit_buffer == 0)
         {
-            bit_buffer = read_byte(inp);
-            carry = bitbuffer_rotate(1);
+            ctx->bit_buffer = read_byte(ctx);
+            carry = bitbuffer_rotate(ctx, 1);
         }
         bits <<= 1;
         bits |= carry;
@@ -96,14 +99,14 @@ read_bits(const char **inp, int bit_count)
     if (byte_copy != 0)
     {
         bits <<= 8;
-        bits |= read_byte(inp);
+        bits |= read_byte(ctx);
     }
     return bits;
 }
 
 static void 
 /* FR */ __attribute__( ( optimize( "Os" ) ) )
-init_table(const char **inp)
+init_table(EXO_DECRUNCH *ctx)
 {
     int i;
     /*FR*/ //unsigned short int b2;
@@ -117,105 +120,144 @@ init_table(const char **inp)
         {
             b2 = 1;
         }
-        base[i] = b2;
+        ctx->base[i] = b2;
 
-        b1 = read_bits(inp, 3);
-        b1 |= read_bits(inp, 1) << 3;
-        bits[i] = b1;
+        b1 = read_bits(ctx, 3);
+        b1 |= read_bits(ctx, 1) << 3;
+        ctx->bits[i] = b1;
 
         b2 += 1 << b1;
     }
 }
 
-char *
+void
 /* FR */ __attribute__( ( optimize( "Os" ) ) )
-exo_decrunch(const char *in, char *out)
+exo_decrunch_init(EXO_DECRUNCH *ctx, const char *in, char *out)
 {
-    /* FR original
-    unsigned short int index;
-    unsigned short int length;
-    unsigned short int offset;
-    */
-    /* FR new */
-    int index;
-    int length;
-    int offset;
-
-    char c;
-    char literal = 1;
-    char reuse_offset_state = 1;
-
-    bit_buffer = read_byte(&in);
+    ctx->in = in;
+    ctx->out = out;
+    ctx->state = EXO_START;
+}
 
-    init_table(&in);
+int
+/* FR */ __attribute__( ( optimize( "Os" ) ) )
+exo_decrunch_step(EXO_DECRUNCH *ctx, int budget)
+{
+    int index;
 
-    goto implicit_literal_byte;
     for(;;)
     {
-        literal = read_bits(&in, 1);
-        if(literal == 1)
-        {
-        implicit_literal_byte:
-            /* literal byte */
-            length = 1;
-            goto copy;
-        }
-        index = 0;
-        while(read_bits(&in, 1) == 0)
-        {
-            ++index;
-        }
-        if(index == 16)
+        switch(ctx->state)
         {
+        case EXO_START:
+            ctx->literal = 1;
+            ctx->reuse_offset_state = 1;
+
+            ctx->bit_buffer = read_byte(ctx);
+
+            init_table(ctx);
+
+            /* implicit literal byte */
+            ctx->length = 1;
+            ctx->state = EXO_COPY;
             break;
-        }
-        if(index == 17)
-        {
-            literal = 1;
-            length = read_byte(&in) << 8;
-            length |= read_byte(&in);
-            goto copy;
-        }
-        length = base[index];
-        length += read_bits(&in, bits[index]);
 
-        if ((reuse_offset_state & 3) != 1 || !read_bits(&in, 1))
-        {
-            switch(length)
+        case EXO_TOKEN:
+            ctx->literal = read_bits(ctx, 1);
+            if(ctx->literal == 1)
             {
-            case 1:
-                index = read_bits(&in, 2);
-                index += 48;
+                /* literal byte */
+                ctx->length = 1;
+                ctx->state = EXO_COPY;
                 break;
-            case 2:
-                index = read_bits(&in, 4);
-                index += 32;
+            }
+            index = 0;
+            while(read_bits(ctx, 1) == 0)
+            {
+                ++index;
+            }
+            if(index == 16)
+            {
+                ctx->state = EXO_DONE;
                 break;
-            default:
-                index = read_bits(&in, 4);
-                index += 16;
+            }
+            if(index == 17)
+            {
+                ctx->literal = 1;
+                ctx->length = read_byte(ctx) << 8;
+                ctx->length |= read_byte(ctx);
+                ctx->state = EXO_COPY;
                 break;
             }
-            offset = base[index];
-            offset += read_bits(&in, bits[index]);
-        }
-    copy:
-        do
-        {
-            --out;
-            if(literal)
+            ctx->length = ctx->base[index];
+            ctx->length += read_bits(ctx, ctx->bits[index]);
+
+            if ((ctx->reuse_offset_state & 3) != 1 || !read_bits(ctx, 1))
             {
-                c = read_byte(&in);
+                switch(ctx->length)
+                {
+                case 1:
+                    index = read_bits(ctx, 2);
+                    index += 48;
+                    break;
+                case 2:
+                    index = read_bits(ctx, 4);
+                    index += 32;
+                    break;
+                default:
+                    index = read_bits(ctx, 4);
+                    index += 16;
+                    break;
+                }
+                ctx->offset = ctx->base[index];
+                ctx->offset += read_bits(ctx, ctx->bits[index]);
             }
-            else
+            ctx->state = EXO_COPY;
+            break;
+
+        case EXO_COPY:
+            /* FR: the copy may be split across calls */
+            do
             {
-                c = out[offset];
+                char c;
+                if(budget <= 0)
+                {
+                    return 0;
+                }
+                --budget;
+
+                --ctx->out;
+                if(ctx->literal)
+                {
+                    c = read_byte(ctx);
+                }
+                else
+                {
+                    c = ctx->out[ctx->offset];
+                }
+                *ctx->out = c;
             }
-            *out = c;
+            while(--ctx->length > 0);
+
+            ctx->reuse_offset_state = (ctx->reuse_offset_state << 1) | ctx->literal;
+            ctx->state = EXO_TOKEN;
+            break;
+
+        default:
+            return 1;
         }
-        while(--length > 0);
+    }
+}
 
-        reuse_offset_state = (reuse_offset_state << 1) | literal;
+char *
+/* FR */ __attribute__( ( optimize( "Os" ) ) )
+exo_decrunch(const char *in, char *out)
+{
+    EXO_DECRUNCH ctx;
+
+    exo_decrunch_init(&ctx, in, out);
+    while(!exo_decrunch_step(&ctx, 0x7fffffff))
+    {
     }
-    return out;
+    return ctx.out;
 }
@@ -34,4 +34,26 @@
  */
 char *exo_decrunch(const char *in, char *out);
 
+/*
+ * FR: resumable decruncher, exo_decrunch_step() writes at most 'budget' bytes per call and
+ * returns 1 once decrunching is complete. The output is written backwards, i.e. the
+ * beginning of the decrunched data is available last.
+ */
+typedef struct
+{
+    const char *in;
+    char *out;
+    unsigned short int base[52];
+    char bits[52];
+    unsigned char bit_buffer;
+    char literal;
+    char reuse_offset_state;
+    char state;
+    int length;
+    int offset;
+} EXO_DECRUNCH;
+
+void exo_decrunch_init(EXO_DECRUNCH *ctx, const char *in, char *out);
+int exo_decrunch_step(EXO_DECRUNCH *ctx, int budget);
+
 #endif /* EXO_DECRUNCH_ALREADY_INCLUDED */
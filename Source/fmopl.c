@@ -83,8 +83,14 @@ Revision History:
 #include <string.h>
 
 #include "fmopl.h"
+#include "interp.h"
 
+#if PICO_ON_DEVICE
 #include <pico/platform.h>
+#else
+#include <stdint.h>
+#define __not_in_flash(group)
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846f
@@ -723,18 +729,20 @@ __attribute__( ( always_inline ) ) inline static signed int op_calc(UINT32 phase
 
     //p = (env << 4) + sin_tab[wave_tab + ((((signed int)((phase & ~FREQ_MASK) + (pm << 16))) >> FREQ_SH ) & SIN_MASK)];
 
-    int i = ( ( ( (signed int)( ( phase & ~FREQ_MASK ) + ( pm << 16 ) ) ) >> FREQ_SH ) & SIN_MASK );
+    INTERP_ACCUM( INTERP0, 0, phase + ( pm << 16 ) );
+    const uint16_t *sin_p = (const uint16_t *)INTERP_PEEK( INTERP0, 0 );
+    int i = sin_p - sin_tab;
 
     switch ( wave_tab )
     {
     default:
     case 0:
-        p = sin_tab[ i ];
+        p = *sin_p;
         break;
     case 1:
         if ( i & ( 1 << ( SIN_BITS - 1 ) ) )
             return 0;
-        p = sin_tab[ i ];
+        p = *sin_p;
         break;
     case 2:
         p = sin_tab[ i & ( SIN_MASK >> 1 ) ];
@@ -754,9 +762,9 @@ __attribute__( ( always_inline ) ) inline static signed int op_calc(UINT32 phase
     }
 
     int16_t sign = p & 1;
-    p >>= 1;
-    uint8_t s = p >> 8;
-    p = tl_tab[ p & 255 ] >> s;
+    uint8_t s = p >> 9;
+    INTERP_ACCUM( INTERP0, 1, p );
+    p = *(const int16_t *)INTERP_PEEK( INTERP0, 1 ) >> s;
     if ( sign ) p = -p;
     return p;
 }
@@ -767,18 +775,20 @@ __attribute__( ( always_inline ) ) inline static signed int op_calc1(UINT32 phas
 
     //p = (env << 4) + sin_tab[wave_tab + ((((signed int)((phase & ~FREQ_MASK) + pm)) >> FREQ_SH ) & SIN_MASK)];
 
-    int i = ( ( ( (signed int)( ( phase & ~FREQ_MASK ) + pm ) ) >> FREQ_SH ) & SIN_MASK );
+    INTERP_ACCUM( INTERP0, 0, ( phase & ~FREQ_MASK ) + pm );
+    const uint16_t *sin_p = (const uint16_t *)INTERP_PEEK( INTERP0, 0 );
+    int i = sin_p - sin_tab;
 
     switch ( wave_tab )
     {
     default:
     case 0:
-        p = sin_tab[ i ];
+        p = *sin_p;
         break;
     case 1:
         if ( i & ( 1 << ( SIN_BITS - 1 ) ) )
             return 0;
-        p = sin_tab[ i ];
+        p = *sin_p;
         break;
     case 2:
         p = sin_tab[ i & ( SIN_MASK >> 1 ) ];
@@ -797,9 +807,9 @@ __attribute__( ( always_inline ) ) inline static signed int op_calc1(UINT32 phas
         return 0;
     }
     int16_t sign = p & 1;
-    p >>= 1;
-    uint8_t s = p >> 8;
-    p = tl_tab[ p & 255 ] >> s;
+    uint8_t s = p >> 9;
+    INTERP_ACCUM( INTERP0, 1, p );
+    p = *(const int16_t *)INTERP_PEEK( INTERP0, 1 ) >> s;
     if ( sign ) p = -p;
     return p;
 }
@@ -1145,6 +1155,11 @@ static int init_tables(void)
     }
 #endif
 
+    /* table lookups in op_calc via interpolator 0 (set up on the core running ym3812_update_one): */
+    /* lane 0: &sin_tab[(accum >> FREQ_SH) & SIN_MASK], lane 1: &tl_tab[(accum >> 1) & 255] */
+    interpSetupLane(INTERP0, 0, FREQ_SH - 1, 1, SIN_BITS, sin_tab);
+    interpSetupLane(INTERP0, 1, 0, 1, 8, tl_tab);
+
     return 1;
 }
 
@@ -1234,6 +1249,23 @@ __attribute__( ( always_inline ) ) inline static void FM_KEYOFF(OPL_SLOT *SLOT,
     }
 }
 
+/* frequency increment base of a channel for block+fnum */
+__attribute__( ( always_inline ) ) inline static UINT32 calc_fc(FM_OPL *OPL, UINT32 block_fnum)
+{
+    UINT8 block = block_fnum >> 10;
+#ifndef EVAL_FN_TAB
+    return OPL->fn_tab[block_fnum & 0x03ff] >> (7 - block);
+#else
+    //3579545, AUDIO_RATE
+    //OPL->freqbase = ( OPL->rate ) ? ( (float)OPL->clock / 72.0f ) / OPL->rate : 0;
+
+    // for 44.1kHz freqbase = 73882 / 64 / 1024
+    uint32_t i = block_fnum & 0x03ff;
+    uint32_t tmp = (UINT32)( i * 73882 / 1024 * ( 1 << ( FREQ_SH - 10 ) ) ); /* -10 because chip works with 10.10 fixed point, while we use 16.16 */
+    return tmp >> ( 7 - block );
+#endif
+}
+
 /* update phase increment counter of operator (also update the EG rates if necessary) */
 __attribute__( ( always_inline ) ) inline static void CALC_FCSLOT(OPL_CH *CH, OPL_SLOT *SLOT)
 {
@@ -1532,22 +1564,10 @@ static void OPLWriteReg(FM_OPL *OPL, int r, int v)
             }
             /* update */
             if (CH->block_fnum != (UINT32)block_fnum) {
-                UINT8 block = block_fnum >> 10;
-
                 CH->block_fnum = (UINT32)block_fnum;
 
                 CH->ksl_base = (UINT32)(ksl_tab[block_fnum >> 6]);
-            #ifndef EVAL_FN_TAB
-                CH->fc = OPL->fn_tab[block_fnum & 0x03ff] >> (7 - block);
-            #else
-                //3579545, AUDIO_RATE
-                //OPL->freqbase = ( OPL->rate ) ? ( (float)OPL->clock / 72.0f ) / OPL->rate : 0;
-
-                // for 44.1kHz freqbase = 73882 / 64 / 1024
-                uint32_t i = block_fnum & 0x03ff;
-                uint32_t tmp = (UINT32)( i * 73882 / 1024 * ( 1 << ( FREQ_SH - 10 ) ) ); /* -10 because chip works with 10.10 fixed point, while we use 16.16 */
-                CH->fc = tmp >> ( 7 - block );
-            #endif
+                CH->fc = calc_fc(OPL, block_fnum);
 
                 /* BLK 2,1,0 bits -> bits 3,2,1 of kcode */
                 CH->kcode = (CH->block_fnum & 0x1c00) >> 9;
@@ -1811,6 +1831,12 @@ FM_OPL *ym3812_init(UINT32 clock, UINT32 rate)
     return YM3812;
 }
 
+void ym3812_set_rate(FM_OPL *chip, UINT32 rate)
+{
+    chip->rate = rate;
+    OPL_initalize(chip);
+}
+
 int connect1_is_output0(int *connect)
 {
     if (connect == &output[0]) {
@@ -1828,6 +1854,138 @@ void set_connect1(FM_OPL *chip, int x, int y, int output0)
     }
 }
 
+void ym3812_read_state(FM_OPL *chip, OPL_STATE *state)
+{
+    int x, y;
+
+    memset(state, 0, sizeof(OPL_STATE));
+    state->version = OPL_STATE_VERSION;
+    for (x = 0; x < 9; x++) {
+        OPL_CH *CH = &chip->P_CH[x];
+        OPL_CH_STATE *c = &state->ch[x];
+
+        c->block_fnum = (UINT16)CH->block_fnum;
+        c->kcode = CH->kcode;
+        for (y = 0; y < 2; y++) {
+            OPL_SLOT *SLOT = &CH->SLOT[y];
+            OPL_SLOT_STATE *s = &c->slot[y];
+
+            s->Cnt = SLOT->Cnt;
+            s->op1_out[0] = SLOT->op1_out[0];
+            s->op1_out[1] = SLOT->op1_out[1];
+            s->volume = SLOT->volume;
+            s->key = SLOT->key;
+            s->TL = SLOT->TL;
+            s->sl = SLOT->sl;
+            s->ar = (UINT8)SLOT->ar;
+            s->dr = (UINT8)SLOT->dr;
+            s->rr = (UINT8)SLOT->rr;
+            s->KSR = SLOT->KSR;
+            s->ksl = SLOT->ksl;
+            s->mul = SLOT->mul;
+            s->FB = SLOT->FB;
+            s->CON = SLOT->CON;
+            s->eg_type = SLOT->eg_type;
+            s->state = SLOT->state;
+            s->vib = SLOT->vib;
+            s->am = SLOT->AMmask ? 1 : 0;
+            s->wavetable = (UINT8)SLOT->wavetable;
+            if (connect1_is_output0(SLOT->connect1)) {
+                state->connect1_output0 |= 1 << (x * 2 + y);
+            }
+        }
+    }
+
+    state->eg_cnt = chip->eg_cnt;
+    state->eg_timer = chip->eg_timer;
+    state->lfo_am_cnt = chip->lfo_am_cnt;
+    state->lfo_pm_cnt = chip->lfo_pm_cnt;
+    state->noise_rng = chip->noise_rng;
+    state->noise_p = chip->noise_p;
+    state->T[0] = chip->T[0];
+    state->T[1] = chip->T[1];
+    state->rhythm = chip->rhythm;
+    state->lfo_am_depth = chip->lfo_am_depth;
+    state->lfo_pm_depth_range = chip->lfo_pm_depth_range;
+    state->wavesel = chip->wavesel;
+    state->st[0] = chip->st[0];
+    state->st[1] = chip->st[1];
+    state->address = chip->address;
+    state->status = chip->status;
+    state->statusmask = chip->statusmask;
+    state->mode = chip->mode;
+}
+
+int ym3812_write_state(FM_OPL *chip, const OPL_STATE *state)
+{
+    int x, y;
+
+    if (state->version != OPL_STATE_VERSION) {
+        return -1;
+    }
+
+    for (x = 0; x < 9; x++) {
+        OPL_CH *CH = &chip->P_CH[x];
+        const OPL_CH_STATE *c = &state->ch[x];
+
+        CH->block_fnum = c->block_fnum;
+        CH->kcode = c->kcode;
+        CH->ksl_base = (UINT32)(ksl_tab[CH->block_fnum >> 6]);
+        CH->fc = calc_fc(chip, CH->block_fnum);
+        for (y = 0; y < 2; y++) {
+            OPL_SLOT *SLOT = &CH->SLOT[y];
+            const OPL_SLOT_STATE *s = &c->slot[y];
+
+            SLOT->Cnt = s->Cnt;
+            SLOT->op1_out[0] = s->op1_out[0];
+            SLOT->op1_out[1] = s->op1_out[1];
+            SLOT->volume = s->volume;
+            SLOT->key = s->key;
+            SLOT->TL = s->TL;
+            SLOT->sl = s->sl;
+            SLOT->ar = s->ar;
+            SLOT->dr = s->dr;
+            SLOT->rr = s->rr;
+            SLOT->KSR = s->KSR;
+            SLOT->ksl = s->ksl;
+            SLOT->mul = s->mul;
+            SLOT->FB = s->FB;
+            SLOT->CON = s->CON;
+            SLOT->eg_type = s->eg_type;
+            SLOT->state = s->state;
+            SLOT->vib = s->vib;
+            SLOT->AMmask = s->am ? ~0 : 0;
+            SLOT->wavetable = s->wavetable;
+            set_connect1(chip, x, y, (state->connect1_output0 >> (x * 2 + y)) & 1);
+
+            /* derived from the above: total level, phase increment, EG rates (ksr is recomputed) */
+            SLOT->TLL = SLOT->TL + (CH->ksl_base >> SLOT->ksl);
+            SLOT->ksr = 0xff;
+            CALC_FCSLOT(CH, SLOT);
+        }
+    }
+
+    chip->eg_cnt = state->eg_cnt;
+    chip->eg_timer = state->eg_timer;
+    chip->lfo_am_cnt = state->lfo_am_cnt;
+    chip->lfo_pm_cnt = state->lfo_pm_cnt;
+    chip->noise_rng = state->noise_rng;
+    chip->noise_p = state->noise_p;
+    chip->T[0] = state->T[0];
+    chip->T[1] = state->T[1];
+    chip->rhythm = state->rhythm;
+    chip->lfo_am_depth = state->lfo_am_depth;
+    chip->lfo_pm_depth_range = state->lfo_pm_depth_range;
+    chip->wavesel = state->wavesel;
+    chip->st[0] = state->st[0];
+    chip->st[1] = state->st[1];
+    chip->address = state->address;
+    chip->status = state->status;
+    chip->statusmask = state->statusmask;
+    chip->mode = state->mode;
+    return 0;
+}
+
 void ym3812_shutdown(FM_OPL *chip)
 {
     OPLDestroy(chip);
@@ -1920,6 +2078,23 @@ void ym3812_update_one(FM_OPL *chip, OPLSAMPLE *buffer, int length)
     }
 }
 
+/*
+** Advance one of the YM3812's by 'length' samples without generating output
+**
+** phase counters, envelopes, LFO and noise generator advance exactly as in
+** ym3812_update_one, the operator feedback history (op1_out) is not updated
+*/
+void ym3812_fast_forward(FM_OPL *chip, int length)
+{
+    FM_OPL *OPL = (FM_OPL *)chip;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        advance_lfo(OPL);
+        advance(OPL);
+    }
+}
+
 #if 0
 FM_OPL *ym3526_init(UINT32 clock, UINT32 rate)
 {
@@ -138,6 +138,17 @@ extern int ym3812_timer_over(FM_OPL *chip, int c);
  */
 extern void ym3812_update_one(FM_OPL *chip, OPLSAMPLE *buffer, int length);
 
+/*
+ * Advance one of the YM3812's by 'length' samples without generating output
+ */
+extern void ym3812_fast_forward(FM_OPL *chip, int length);
+
+/*
+ * Change the sampling rate of one of the YM3812's
+ * (frequencies of playing notes are updated with the next write of their F-number)
+ */
+extern void ym3812_set_rate(FM_OPL *chip, UINT32 rate);
+
 /*
  * Initialize YM3526 emulator.
  *
@@ -173,4 +184,63 @@ extern void ym3526_update_one(FM_OPL *chip, OPLSAMPLE *buffer, int length);
 extern int connect1_is_output0(int *connect);
 extern void set_connect1(FM_OPL *chip, int x, int y, int output0);
 
+/*
+ * State of one YM3812: the register settings and the dynamic state of the
+ * operators, channels, envelope generator, LFO, noise generator and timers.
+ * Everything derived from the chip clock and the sampling rate (frequency
+ * base, increments, fnum table) or from the stored values (phase increments,
+ * EG rates, TLL, ksl_base) is not part of the state, it is recomputed by
+ * ym3812_write_state for the restoring chip. The connect1 pointers of the
+ * slots are stored as flags (bit 2*channel+slot set = connected to output).
+ */
+#define OPL_STATE_VERSION 2
+
+typedef struct {
+    UINT32 Cnt;
+    INT32 op1_out[2];
+    INT32 volume;
+    UINT32 key;
+    UINT32 TL;
+    UINT32 sl;
+    UINT8 ar, dr, rr;
+    UINT8 KSR, ksl, mul;
+    UINT8 FB, CON;
+    UINT8 eg_type, state;
+    UINT8 vib, am;
+    UINT8 wavetable;
+} OPL_SLOT_STATE;
+
+typedef struct {
+    OPL_SLOT_STATE slot[2];
+    UINT16 block_fnum;
+    UINT8 kcode;
+} OPL_CH_STATE;
+
+typedef struct {
+    UINT32 version;
+    UINT32 connect1_output0;
+    OPL_CH_STATE ch[9];
+
+    UINT32 eg_cnt;
+    UINT32 eg_timer;
+    UINT32 lfo_am_cnt;
+    UINT32 lfo_pm_cnt;
+    UINT32 noise_rng;
+    UINT32 noise_p;
+    UINT32 T[2];
+
+    UINT8 rhythm;
+    UINT8 lfo_am_depth;
+    UINT8 lfo_pm_depth_range;
+    UINT8 wavesel;
+    UINT8 st[2];
+    UINT8 address;
+    UINT8 status;
+    UINT8 statusmask;
+    UINT8 mode;
+} OPL_STATE;
+
+extern void ym3812_read_state(FM_OPL *chip, OPL_STATE *state);
+extern int ym3812_write_state(FM_OPL *chip, const OPL_STATE *state);
+
 #endif /* VICE_FMOPL_H */
@@ -0,0 +1,138 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  governor.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GOVERNOR_h_
+#define GOVERNOR_h_
+
+#include <stdint.h>
+
+//
+// adaptive quality governor
+//
+// core0 reports the slack of each sample, i.e. the processor cycles of one sample period (the budget)
+// minus the cycles it actually spent on the sample (negative if rendering is too slow to keep up), together
+// with the budget and the reserve of the sample FIFO, i.e. the number of samples queued ahead of the output
+// (sfReserve) out of the render-ahead. Per block of QG_BLOCK_SIZE samples:
+// - mean slack below 1/8 of the budget, or less than half of the render-ahead left: drop one quality tier
+// - mean slack above 1/2 of the budget and more than 3/4 of the render-ahead left for QG_HOLD_BLOCKS
+//   consecutive blocks: go up one tier again
+// Single expensive samples (OPL writes, slices of the config tool decruncher) are absorbed by the FIFO and
+// hardly move the mean; they only drop a tier if they eat up the render-ahead. The gap between the
+// thresholds and the hold time provide the hysteresis.
+//
+// Only the tiers which change anything with the current configuration are used (qgSetTiers): with the
+// defaults (point sampling, linear filter) this is QG_TIER_FULL only and the governor never switches.
+//
+// This is a pure function of its inputs and can be driven with a synthetic budget on host.
+//
+
+// quality tiers, see SID16::set_quality (decimation is only used if configured, see CFG_SID_SAMPLING in reSIDWrapper.cc)
+#define QG_TIER_FULL		0	// decimation with 8-cycle steps, filter as configured
+#define QG_TIER_COARSE		1	// decimation with one step per half-sample window
+#define QG_TIER_LINEAR		2	// additionally linear filter instead of 6581 non-linear
+#define QG_TIER_POINT		3	// additionally point sampling once per sample
+#define QG_TIERS			4
+
+#define QG_BLOCK_SIZE_LOG2	6
+#define QG_BLOCK_SIZE		( 1 << QG_BLOCK_SIZE_LOG2 )
+#define QG_HOLD_BLOCKS		32
+
+typedef struct
+{
+	uint8_t tier;
+	uint8_t tiers;				// bit n set: tier n is used
+	uint8_t nSamples;
+	uint8_t goodBlocks;
+	int32_t sumSlack;
+	uint32_t minReserve;
+} QUALITY_GOVERNOR;
+
+static inline void qgInit( QUALITY_GOVERNOR *qg )
+{
+	qg->tier = QG_TIER_FULL;
+	qg->tiers = ( 1 << QG_TIERS ) - 1;
+	qg->nSamples = 0;
+	qg->goodBlocks = 0;
+	qg->sumSlack = 0;
+	qg->minReserve = 0xffffffff;
+}
+
+// restricts the governor to the tiers in 'tiers' (bit n = tier n, full quality is always used); if the
+// current tier is not among them, it moves to the next cheaper one that is, or back to full quality
+static inline void qgSetTiers( QUALITY_GOVERNOR *qg, uint8_t tiers )
+{
+	qg->tiers = tiers | ( 1 << QG_TIER_FULL );
+	while ( !( qg->tiers & ( 1 << qg->tier ) ) )
+		qg->tier = qg->tier < QG_TIERS - 1 ? qg->tier + 1 : QG_TIER_FULL;
+	qg->goodBlocks = 0;
+}
+
+// returns the tier to use from now on
+static inline uint8_t qgUpdate( QUALITY_GOVERNOR *qg, int32_t slack, int32_t budget, uint32_t reserve, uint32_t ahead )
+{
+	qg->sumSlack += slack;
+	if ( reserve < qg->minReserve )
+		qg->minReserve = reserve;
+
+	if ( ++ qg->nSamples < QG_BLOCK_SIZE )
+		return qg->tier;
+
+	// end of block
+	int32_t meanSlack = qg->sumSlack >> QG_BLOCK_SIZE_LOG2;
+
+	if ( meanSlack < ( budget >> 3 ) || qg->minReserve < ( ahead >> 1 ) )
+	{
+		for ( uint8_t t = qg->tier + 1; t < QG_TIERS; t++ )
+			if ( qg->tiers & ( 1 << t ) )
+			{
+				qg->tier = t;
+				break;
+			}
+		qg->goodBlocks = 0;
+	} else
+	if ( meanSlack > ( budget >> 1 ) && qg->minReserve > ahead - ( ahead >> 2 ) )
+	{
+		if ( ++ qg->goodBlocks >= QG_HOLD_BLOCKS )
+		{
+			for ( int8_t t = qg->tier - 1; t >= QG_TIER_FULL; t-- )
+				if ( qg->tiers & ( 1 << t ) )
+				{
+					qg->tier = t;
+					break;
+				}
+			qg->goodBlocks = 0;
+		}
+	} else
+		qg->goodBlocks = 0;
+
+	qg->nSamples = 0;
+	qg->sumSlack = 0;
+	qg->minReserve = 0xffffffff;
+
+	return qg->tier;
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  interp.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INTERP_h_
+#define INTERP_h_
+
+#include <stdint.h>
+
+//
+// table lookups via the RP2040 interpolators
+//
+// Only the subset used for table lookups is exposed: per lane a right shift and a bit mask, and
+//   PEEK = BASE + ( ( ACCUM >> shift ) & mask )
+// which turns "shift, mask, scale by element size, add table address" into one store and one load
+// of single-cycle SIO registers. The interpolators are per core, the lanes must be set up on the
+// core that uses them. On host a software model with identical semantics is used instead.
+//
+
+#if PICO_ON_DEVICE
+
+#include "hardware/interp.h"
+
+typedef interp_hw_t INTERP;
+
+#define INTERP0		interp0
+#define INTERP1		interp1
+
+static inline void interpSetupLane( INTERP *ip, uint8_t lane, uint8_t shift, uint8_t maskLSB, uint8_t maskMSB, const void *base )
+{
+	interp_config cfg = interp_default_config();
+	interp_config_set_shift( &cfg, shift );
+	interp_config_set_mask( &cfg, maskLSB, maskMSB );
+	interp_set_config( ip, lane, &cfg );
+	ip->base[ lane ] = (uint32_t)base;
+}
+
+#define INTERP_ACCUM( ip, lane, v )	( (ip)->accum[ lane ] = (uint32_t)(v) )
+#define INTERP_PEEK( ip, lane )		( (ip)->peek[ lane ] )
+
+#else
+
+// software model
+typedef struct
+{
+	uint32_t  accum[ 2 ];
+	uintptr_t base[ 2 ];
+	uint8_t   shift[ 2 ];
+	uint32_t  mask[ 2 ];
+} INTERP;
+
+static INTERP interpModel[ 2 ];
+
+#define INTERP0		( &interpModel[ 0 ] )
+#define INTERP1		( &interpModel[ 1 ] )
+
+static inline void interpSetupLane( INTERP *ip, uint8_t lane, uint8_t shift, uint8_t maskLSB, uint8_t maskMSB, const void *base )
+{
+	ip->shift[ lane ] = shift;
+	ip->mask[ lane ] = ( 0xffffffffu >> ( 31 - maskMSB ) ) & ( 0xffffffffu << maskLSB );
+	ip->base[ lane ] = (uintptr_t)base;
+}
+
+static inline uintptr_t interpPeek( const INTERP *ip, uint8_t lane )
+{
+	return ip->base[ lane ] + ( ( ip->accum[ lane ] >> ip->shift[ lane ] ) & ip->mask[ lane ] );
+}
+
+#define INTERP_ACCUM( ip, lane, v )	( (ip)->accum[ lane ] = (uint32_t)(v) )
+#define INTERP_PEEK( ip, lane )		interpPeek( ip, lane )
+
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  noiseshape.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef NOISESHAPE_h_
+#define NOISESHAPE_h_
+
+#include <stdint.h>
+
+//
+// noise-shaped PWM output
+//
+// Instead of one PWM level per sample at approx. 106kHz with AUDIO_VALS levels, the PWM runs with fewer
+// levels at a 4x higher carrier rate and a DMA channel loads a new level from a ring buffer at every wrap.
+// core0 fills the ring with the output of a 2nd-order error feedback quantizer (noise transfer function
+// (1-z^-1)^2) running at the carrier rate, with the current sample held for the carrier periods it covers.
+// The quantization noise is moved above the audio band, with a 423kHz carrier this leaves approx. 4 bits
+// more in-band resolution than plain truncation at the lower carrier rate.
+//
+// The number of periods per sample follows the nominal ratio (phase accumulator), the fill level of the
+// ring is kept at NS_AHEAD by adding or dropping single periods, which absorbs the drift between phi2 and
+// the Pico's clock. If core0 fell behind (or skipped samples), the missing periods are filled with the
+// current sample at once. The read position is passed in as an index into the ring, i.e. there are no
+// dependencies on the SDK and the modulator can be run on host.
+//
+
+// PWM wrap value: levels 0..NS_PWM_WRAP, carrier = clk_sys / ( NS_PWM_WRAP + 1 ) = 423kHz at 300MHz
+#define NS_PWM_WRAP			708
+
+#define NS_FRAC_BITS		12
+#define NS_ONE				( 1 << NS_FRAC_BITS )
+
+#define NS_RING_LOG2		11
+#define NS_RING_SIZE		( 1 << NS_RING_LOG2 )
+#define NS_RING_MASK		( NS_RING_SIZE - 1 )
+
+// periods buffered ahead of the DMA (approx. 2.4ms), tolerance before adding/dropping a period
+#define NS_AHEAD			( NS_RING_SIZE / 2 )
+#define NS_SLACK			64
+
+typedef struct
+{
+	uint32_t ring[ NS_RING_SIZE ];	// must be aligned to its size (DMA ring)
+	uint32_t write;					// index of the next period
+	uint32_t phase;					// Q16 fraction of carrier periods
+	uint32_t phaseInc;				// Q16 carrier periods per sample
+	int32_t  e1, e2;				// quantization errors of the last two periods (Q12)
+	uint8_t  shift;					// 0 or 16: PWM channel A or B in the counter compare register
+	uint32_t underruns;
+} NOISE_SHAPER;
+
+static inline void nsSetRate( NOISE_SHAPER *ns, uint32_t carrierHz, uint32_t sampleRate )
+{
+	ns->phaseInc = (uint32_t)( ( (uint64_t)carrierHz << 16 ) / sampleRate );
+}
+
+static inline void nsInit( NOISE_SHAPER *ns, uint8_t channel, uint32_t carrierHz, uint32_t sampleRate )
+{
+	for ( uint32_t i = 0; i < NS_RING_SIZE; i++ )
+		ns->ring[ i ] = 0;
+	ns->write = NS_AHEAD;
+	ns->phase = 0;
+	ns->e1 = ns->e2 = 0;
+	ns->shift = channel ? 16 : 0;
+	ns->underruns = 0;
+	nsSetRate( ns, carrierHz, sampleRate );
+}
+
+// converts a sample (L + R, i.e. 17 bits signed) to the modulator input: a Q12 level in [2, NS_PWM_WRAP - 2]
+// (the headroom keeps the quantizer from clipping)
+static inline int32_t nsLevel( int32_t s )
+{
+	return ( ( ( s + 65536 ) * ( NS_PWM_WRAP - 4 ) ) >> ( 17 - NS_FRAC_BITS ) ) + 2 * NS_ONE;
+}
+
+// renders the carrier periods of one sample with Q12 level x, 'read' is the index the DMA reads next
+static inline void nsRender( NOISE_SHAPER *ns, int32_t x, uint32_t read )
+{
+	uint32_t fill = ( ns->write - read ) & NS_RING_MASK;
+
+	// the DMA has overtaken the write position
+	if ( fill > NS_RING_SIZE - NS_RING_SIZE / 4 )
+	{
+		ns->underruns ++;
+		ns->write = read;
+		fill = 0;
+	}
+
+	ns->phase += ns->phaseInc;
+	uint32_t n = ns->phase >> 16;
+	ns->phase &= 0xffff;
+
+	if ( fill + n < NS_AHEAD / 2 )
+		n = NS_AHEAD - fill; else
+	if ( fill + n < NS_AHEAD - NS_SLACK )
+		n ++; else
+	if ( fill + n > NS_AHEAD + NS_SLACK && n )
+		n --;
+
+	int32_t  e1 = ns->e1, e2 = ns->e2;
+	uint32_t w = ns->write;
+	while ( n -- )
+	{
+		int32_t u = x - 2 * e1 + e2;
+		int32_t q = ( u + NS_ONE / 2 ) >> NS_FRAC_BITS;
+		if ( q < 0 ) q = 0;
+		if ( q > NS_PWM_WRAP ) q = NS_PWM_WRAP;
+
+		int32_t e = ( q << NS_FRAC_BITS ) - u;
+		if ( e < -NS_ONE ) e = -NS_ONE;
+		if ( e > NS_ONE ) e = NS_ONE;
+		e2 = e1;
+		e1 = e;
+
+		ns->ring[ w & NS_RING_MASK ] = (uint32_t)q << ns->shift;
+		w ++;
+	}
+	ns->write = w;
+	ns->e1 = e1;
+	ns->e2 = e2;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  osc3predict.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OSC3PREDICT_h_
+#define OSC3PREDICT_h_
+
+#include <stdint.h>
+
+//
+// OSC3 readback predicted for the current cycle
+//
+// core0 publishes the state of oscillator 3 after each emulation step, together with the cycle it belongs
+// to. For triangle, sawtooth and pulse (without test bit, sync or ring modulation) core1 advances the
+// accumulator to the current cycle, otherwise and for ENV3 the published values are used. core1 does this in
+// each VIC half-cycle while OSC3 of a SID is being read, such that a $d41b read only puts the value on the
+// bus; the first read after a pause gets the published value.
+// ENV3 is not predicted: stepping the envelope needs the rate, exponential and pipeline counters of
+// envelope.h, which does not fit into the half-cycle budget of core1. It is exact while the envelope rests
+// (sustain level, or frozen at zero) and lags by the envelope steps since the last emulation step while the
+// envelope moves (tests/test_osc3predict.cc measures both).
+// The state is double-buffered: core0 fills the inactive buffer and then flips the index. core0 publishes
+// at most once per emulation step, which takes far longer than core1 needs to read a buffer.
+//
+
+typedef struct
+{
+	uint32_t cycle;			// lower 32 bits of the C64 cycle the state belongs to
+	uint32_t accumulator;
+	uint32_t freq;
+	uint16_t pw;
+	uint8_t  waveform;		// 1 = triangle, 2 = sawtooth, 4 = pulse, 0 = not predictable
+	uint8_t  osc3;			// OSC3 at 'cycle'
+	uint8_t  env3;			// ENV3 at 'cycle'
+} OSC3_STATE;
+
+static inline uint8_t predictOSC3( const OSC3_STATE *s, uint32_t cycle )
+{
+	uint32_t dt = cycle - s->cycle;
+
+	// not predictable, or state is newer than the cycle asked for
+	if ( !s->waveform || (int32_t)dt <= 0 )
+		return s->osc3;
+
+	uint32_t acc = ( s->accumulator + s->freq * dt ) & 0xffffff;
+
+	if ( s->waveform == 1 )
+		return ( ( acc ^ -( acc >> 23 ) ) >> 15 ) & 0xff;
+	if ( s->waveform == 2 )
+		return acc >> 16;
+	return ( ( acc >> 12 ) >= s->pw ) ? 0xff : 0x00;
+}
+
+#endif
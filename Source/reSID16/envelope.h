@@ -100,6 +100,7 @@ protected:
     //static unsigned short model_dac[ 2 ][ 1 << 8 ];
 
     friend class SID16;
+    friend class SIDBank;
 };
 
 
@@ -20,6 +20,8 @@
 #define __EXTFILT_CC__
 #include "extfilt.h"
 
+ExternalFilter::Transition ExternalFilter::transition[DT_TABLE_SIZE];
+bool ExternalFilter::class_init;
 
 // ----------------------------------------------------------------------------
 // Constructor.
@@ -37,6 +39,31 @@ ExternalFilter::ExternalFilter()
 
   w0lp = 104858;
   w0hp = 105;
+
+  if (!class_init) {
+    // Transition table for delta_t cycle clocking: apply m steps of 8 cycles
+    // to the unit vectors of u = Vlp - Vi and v = Vhp - Vi, using the same
+    // fixpoint step coefficients as in clock(delta_t, Vi).
+    const double a = double(w0lp*8 >> 8)/(1 << 12);
+    const double c = double(w0hp*8)/(1 << 20);
+
+    double uu = 1, vu = 0;
+    double vv = 1;
+
+    for (int m = 0; m < DT_TABLE_SIZE; m++) {
+      // u' = u - a*u;
+      // v' = v + c*(u - v);
+      vu += c*(uu - vu);
+      uu -= a*uu;
+      vv -= c*vv;
+
+      transition[m].lp_lp = sound_sample(uu*(1 << DT_LP_SHIFT) + 0.5);
+      transition[m].hp_lp = sound_sample(vu*(1 << DT_HP_SHIFT) + 0.5);
+      transition[m].hp_hp = -sound_sample((1 - vv)*(1 << DT_HP_SHIFT) + 0.5);
+    }
+
+    class_init = true;
+  }
 }
 
 
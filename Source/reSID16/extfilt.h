@@ -66,7 +66,26 @@ protected:
   sound_sample w0lp;
   sound_sample w0hp;
 
+  // Transition coefficients for delta_t cycle clocking.
+  // Since w0lp and w0hp are constant, m consecutive 8-cycle steps with
+  // constant input are a fixed linear map of (Vlp - Vi, Vhp - Vi). The maps
+  // for m = 1 .. DT_TABLE_SIZE are computed once; hp_hp is stored as
+  // deviation from identity.
+  static const int DT_TABLE_SIZE = 8;
+  static const int DT_LP_SHIFT = 13;
+  static const int DT_HP_SHIFT = 18;
+
+  struct Transition
+  {
+    sound_sample lp_lp;
+    sound_sample hp_lp, hp_hp;
+  };
+
+  static Transition transition[DT_TABLE_SIZE];
+  static bool class_init;
+
 friend class SID16;
+friend class SIDBank;
 };
 
 
@@ -123,30 +142,38 @@ void ExternalFilter::clock(cycle_count delta_t,
   }
 
   // Maximum delta cycles for the external filter to work satisfactorily
-  // is approximately 8.
-  cycle_count delta_t_flt = 8;
-
-  while (delta_t) {
-    if (delta_t < delta_t_flt) {
-      delta_t_flt = delta_t;
+  // is approximately 8. All 8-cycle steps but the last one are taken from
+  // the transition table.
+  if (delta_t > 8) {
+    cycle_count m = (delta_t - 1) >> 3;
+    delta_t -= m << 3;
+
+    while (m) {
+      cycle_count m_flt = m < DT_TABLE_SIZE ? m : DT_TABLE_SIZE;
+      const Transition& t = transition[m_flt - 1];
+
+      sound_sample u = Vlp - Vi;
+      sound_sample v = Vhp - Vi;
+      Vlp = Vi + (t.lp_lp*u >> DT_LP_SHIFT);
+      Vhp += (t.hp_lp*u + t.hp_hp*v) >> DT_HP_SHIFT;
+
+      m -= m_flt;
     }
+  }
 
-    // delta_t is converted to seconds given a 1MHz clock by dividing
-    // with 1 000 000.
-
-    // Calculate filter outputs.
-    // Vo  = Vlp - Vhp;
-    // Vlp = Vlp + w0lp*(Vi - Vlp)*delta_t;
-    // Vhp = Vhp + w0hp*(Vlp - Vhp)*delta_t;
+  // delta_t is converted to seconds given a 1MHz clock by dividing
+  // with 1 000 000.
 
-    sound_sample dVlp = (w0lp*delta_t_flt >> 8)*(Vi - Vlp) >> 12;
-    sound_sample dVhp = w0hp*delta_t_flt*(Vlp - Vhp) >> 20;
-    Vo = Vlp - Vhp;
-    Vlp += dVlp;
-    Vhp += dVhp;
+  // Calculate filter outputs.
+  // Vo  = Vlp - Vhp;
+  // Vlp = Vlp + w0lp*(Vi - Vlp)*delta_t;
+  // Vhp = Vhp + w0hp*(Vlp - Vhp)*delta_t;
 
-    delta_t -= delta_t_flt;
-  }
+  sound_sample dVlp = (w0lp*delta_t >> 8)*(Vi - Vlp) >> 12;
+  sound_sample dVhp = w0hp*delta_t*(Vlp - Vhp) >> 20;
+  Vo = Vlp - Vhp;
+  Vlp += dVlp;
+  Vhp += dVhp;
 }
 
 
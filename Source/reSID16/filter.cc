@@ -19,6 +19,7 @@
 
 #define __FILTER_CC__
 #include "filter.h"
+#include <math.h>
 
 // Maximum cutoff frequency is specified as
 // FCmax = 2.6e-5/C = 2.6e-5/2200e-12 = 11818.
@@ -104,6 +105,51 @@ fc_point Filter::f0_points_8580[] =
   { 2047, 12500 }    // 0xff 0x07 - repeated end point
 };
 
+// Transfer function of the MOS6581 filter op-amps (NMOS inverters with low
+// open loop gain), as measured for reSID 1.0. The working point, where input
+// and output voltage are equal, is at 4.53V.
+//
+// The non-linear filter model derives the mapping from integrator charge to
+// output voltage from this curve: with open loop gain g the output follows
+// the charge with a slope of g/(1 + g), which approaches zero towards the
+// output rails.
+//
+// One voice spans 1.05V (see voice.cc), i.e. 8192/1050 filter units per mV.
+
+fc_point Filter::opamp_points_6581[] =
+{
+  //  Vi     Vo
+  // [10mV] [mV]
+  // ----------
+  {   75, 10020 },   // repeated end point
+  {   75, 10020 },   // approximate start of actual range
+  {  250, 10130 },
+  {  275, 10120 },
+  {  290, 10040 },
+  {  300,  9920 },
+  {  310,  9740 },
+  {  325,  9400 },
+  {  350,  8680 },
+  {  400,  6900 },
+  {  425,  5880 },
+  {  453,  4530 },   // working point (Vi = Vo)
+  {  475,  3200 },
+  {  490,  2300 },   // change of curvature
+  {  495,  2050 },
+  {  500,  1900 },
+  {  510,  1710 },
+  {  525,  1570 },
+  {  550,  1410 },
+  {  600,  1230 },
+  {  750,  1020 },
+  {  850,   930 },
+  { 1000,   750 },   // approximate end of actual range
+  { 1000,   750 }    // repeated end point
+};
+
+sound_sample* Filter::opamp_6581 = 0;
+sound_sample* Filter::vcr_gain_6581 = 0;
+
 
 // ----------------------------------------------------------------------------
 // Constructor.
@@ -128,7 +174,12 @@ Filter::Filter()
   Vlp = 0;
   Vnf = 0;
 
+  Vbp_x = 0;
+  Vlp_x = 0;
+
   enable_filter(true);
+  nonlinear_enabled = false;
+  nonlinear = false;
 
   // Create mappings from FC to cutoff frequency.
   interpolate(f0_points_6581, f0_points_6581
@@ -142,6 +193,82 @@ Filter::Filter()
 }
 
 
+// ----------------------------------------------------------------------------
+// Build the tables of the non-linear MOS6581 filter. This is done on first
+// use only, so the tables take no memory as long as the non-linear filter is
+// not enabled.
+// ----------------------------------------------------------------------------
+void Filter::init_nonlinear()
+{
+  if (opamp_6581) {
+    return;
+  }
+
+  opamp_6581 = new sound_sample[OPAMP_TABLE_SIZE + 1];
+  vcr_gain_6581 = new sound_sample[VCR_TABLE_SIZE];
+
+  // Op-amp table: integrate the charge x along the op-amp curve,
+  // dx = k*(1 + g)/g*dVo, starting from the working point in both
+  // directions, and resample x -> Vo onto the table grid. k normalizes the
+  // slope at the working point to 1.
+  const int vi_wp = 453, vi_min = 250, vi_max = 999;
+  const double units_per_mV = 8192.0/1050;
+  const sound_sample center = OPAMP_TABLE_SIZE >> 1;
+  const double grid = 1 << OPAMP_X_SHIFT;
+
+  sound_sample* vo = new sound_sample[1001];
+  interpolate(opamp_points_6581, opamp_points_6581
+	      + sizeof(opamp_points_6581)/sizeof(*opamp_points_6581) - 1,
+	      PointPlotter<sound_sample>(vo), 1.0);
+
+  double g_wp = (vo[vi_wp - 1] - vo[vi_wp + 1])/20.0;
+  double k = g_wp/(1 + g_wp);
+
+  for (int dir = -1; dir <= 1; dir += 2) {
+    double x0 = 0, y0 = 0;
+    sound_sample j = center;
+
+    for (int vi = vi_wp + dir; vi >= vi_min && vi <= vi_max; vi += dir) {
+      double g = (vo[vi - 1] - vo[vi + 1])/20.0;
+      if (g < 0.01) {
+	break;
+      }
+      // Output rises for falling op-amp input.
+      double y1 = (vo[vi] - vo[vi_wp])*units_per_mV;
+      double x1 = x0 + (y1 - y0)*k*(1 + g)/g;
+
+      while (j >= 0 && j <= OPAMP_TABLE_SIZE && (j - center)*grid*-dir <= x1*-dir) {
+	opamp_6581[j] = sound_sample(y0 + (y1 - y0)*((j - center)*grid - x0)/(x1 - x0));
+	j -= dir;
+      }
+      x0 = x1;
+      y0 = y1;
+    }
+
+    // Saturated output beyond the end of the curve.
+    for (; j >= 0 && j <= OPAMP_TABLE_SIZE; j -= dir) {
+      opamp_6581[j] = sound_sample(y0);
+    }
+  }
+
+  delete[] vo;
+
+  // VCR table: the triode region drain current of the cutoff FET is
+  // proportional to (Vgst - Vmid)*Vds, where Vmid is the mean of source
+  // and drain voltage. The relative conductance 1 - Vmid/Vgst is indexed
+  // by r = Vmid/Vgst in [-2, 2) and smoothly limited to the subthreshold
+  // region for r > 1, and to 2 for r < -1. 1.12 fixpoint.
+  for (int i = 0; i < VCR_TABLE_SIZE; i++) {
+    double r = double(i - (VCR_TABLE_SIZE >> 1))/64;
+    double gain = 0.1*log(1 + exp((1 - r)/0.1));
+    if (gain > 2) {
+      gain = 2;
+    }
+    vcr_gain_6581[i] = sound_sample(gain*(1 << 12) + 0.5);
+  }
+}
+
+
 // ----------------------------------------------------------------------------
 // Enable filter.
 // ----------------------------------------------------------------------------
@@ -151,6 +278,19 @@ void Filter::enable_filter(bool enable)
 }
 
 
+// ----------------------------------------------------------------------------
+// Enable non-linear filter model, only used with the MOS6581.
+// ----------------------------------------------------------------------------
+void Filter::enable_nonlinear(bool enable)
+{
+  if (enable) {
+    init_nonlinear();
+  }
+  nonlinear_enabled = enable;
+  set_chip_model(f0 == f0_6581 ? MOS6581 : MOS8580);
+}
+
+
 // ----------------------------------------------------------------------------
 // Set chip model.
 // ----------------------------------------------------------------------------
@@ -182,6 +322,14 @@ void Filter::set_chip_model(chip_model model)
     f0_count = sizeof(f0_points_8580)/sizeof(*f0_points_8580);
   }
 
+  // Continue from the current filter state when switching models.
+  bool nonlinear_next = nonlinear_enabled && model == MOS6581;
+  if (nonlinear_next && !nonlinear) {
+    Vbp_x = Vbp;
+    Vlp_x = Vlp;
+  }
+  nonlinear = nonlinear_next;
+
   set_w0();
   set_Q();
 }
@@ -210,11 +358,105 @@ void Filter::reset()
   Vlp = 0;
   Vnf = 0;
 
+  Vbp_x = 0;
+  Vlp_x = 0;
+
   set_w0();
   set_Q();
 }
 
 
+// ----------------------------------------------------------------------------
+// Settle to the steady state for the input of the last call to clock().
+// For constant input Vi both integrators come to rest, i.e. Vhp = Vbp = 0,
+// and thus Vlp = -Vi. Vi is recovered from the summer equation
+// Vhp = Vbp/Q - Vlp - Vi, which holds after each integration step.
+// With the non-linear filter Vlp is the op-amp output, the integrator charge
+// is the one which yields Vlp = -Vi (as close as the table allows).
+// ----------------------------------------------------------------------------
+void Filter::settle()
+{
+  sound_sample Vi = (Vbp*_1024_div_Q >> 10) - Vlp - Vhp;
+
+  Vbp = 0;
+  Vlp = -Vi;
+
+  Vbp_x = Vbp;
+  Vlp_x = Vlp;
+  if (nonlinear) {
+    Vlp_x = opamp_inverse(Vlp);
+    Vlp = opamp(Vlp_x);
+  }
+
+  Vhp = -Vlp - Vi;
+}
+
+
+// ----------------------------------------------------------------------------
+// Integrator charge x with opamp(x) closest to v (the op-amp transfer
+// function is monotonic). Only used when settling, not per cycle.
+// ----------------------------------------------------------------------------
+sound_sample Filter::opamp_inverse(sound_sample v)
+{
+  const sound_sample x_max = (OPAMP_TABLE_SIZE << OPAMP_X_SHIFT)/2 - 1;
+  sound_sample lo = -x_max, hi = x_max;
+
+  // Smallest x with opamp(x) >= v.
+  while (lo < hi) {
+    sound_sample x = lo + ((hi - lo) >> 1);
+    sound_sample y = x;
+    if (opamp(y) < v) {
+      lo = x + 1;
+    }
+    else {
+      hi = x;
+    }
+  }
+
+  sound_sample x = lo, x_prev = lo - 1;
+  if (lo > -x_max && v - opamp(x_prev) < opamp(x) - v) {
+    return lo - 1;
+  }
+  return lo;
+}
+
+
+// ----------------------------------------------------------------------------
+// Output in the steady state for the given input, see settle(). The filter
+// state is not changed.
+// ----------------------------------------------------------------------------
+sound_sample Filter::settled_output(sound_sample voice1,
+				    sound_sample voice2,
+				    sound_sample voice3,
+				    sound_sample ext_in)
+{
+  voice1 >>= 7;
+  voice2 >>= 7;
+  voice3 = voice3off && !(filt & 0x04) ? 0 : voice3 >> 7;
+  ext_in >>= 7;
+
+  if (!enabled) {
+    return (voice1 + voice2 + voice3 + ext_in + mixer_DC)*static_cast<sound_sample>(vol);
+  }
+
+  sound_sample Vi = 0, Vnf = 0;
+  (filt & 0x01 ? Vi : Vnf) += voice1;
+  (filt & 0x02 ? Vi : Vnf) += voice2;
+  (filt & 0x04 ? Vi : Vnf) += voice3;
+  (filt & 0x08 ? Vi : Vnf) += ext_in;
+
+  // Vbp = Vhp = 0, as in settle().
+  sound_sample Vlp = -Vi;
+  sound_sample Vhp = 0;
+
+  sound_sample Vf = 0;
+  if (hp_bp_lp & 0x1) Vf += Vlp;
+  if (hp_bp_lp & 0x4) Vf += Vhp;
+
+  return (Vnf + Vf + mixer_DC)*static_cast<sound_sample>(vol);
+}
+
+
 // ----------------------------------------------------------------------------
 // Register functions.
 // ----------------------------------------------------------------------------
@@ -263,6 +505,20 @@ void Filter::set_w0()
   // Limit f0 to 4kHz to keep delta_t cycle filter stable.
   const sound_sample w0_max_dt = static_cast<sound_sample>(2*pi*4000*1.048576);
   w0_ceil_dt = w0 <= w0_max_dt ? w0 : w0_max_dt;
+
+  // Gate overdrive of the cutoff VCR for the non-linear MOS6581 filter.
+  // The triode region conductance is proportional to the overdrive, which is
+  // thus approximated from the cutoff frequency (4.5V at 18kHz), with a lower
+  // limit of 1V for the subthreshold region at low FC values.
+  // vcr_scale converts filter units to the VCR table index, with Vmid being
+  // half the integrator input voltage (65536*64*1050/(2*8192) = 268800).
+  sound_sample Vgst_mV = f0[fc]*4500/18000;
+  if (Vgst_mV < 1000) {
+    Vgst_mV = 1000;
+  }
+  vcr_scale = 268800/Vgst_mV;
+
+  transition_valid = 0;
 }
 
 // Set filter resonance.
@@ -275,6 +531,92 @@ void Filter::set_Q()
   // The coefficient 1024 is dispensed of later by right-shifting 10 times
   // (2 ^ 10 = 1024).
   _1024_div_Q = static_cast<sound_sample>(1024.0/(0.707 + 1.0*res/0x0f));
+
+  transition_valid = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Compute the transition matrix for delta_t cycle clocking.
+//
+// Maximum delta cycles for the filter to work satisfactorily under current
+// cutoff frequency and resonance constraints is approximately 8. The
+// integration steps of 8 cycles (and a shorter final step) are applied to
+// the unit vectors of Vbp, Vlp, Vhp and Vi in 16.16 fixpoint; the results are
+// the columns of the transition matrix. This is cheap, and only done once per
+// delta_t after each change of FC or RES.
+// ----------------------------------------------------------------------------
+void Filter::set_transition(cycle_count delta_t)
+{
+  sound_sample col[4][2];
+
+  for (int i = 0; i < 4; i++) {
+    sound_sample bp = i == 0 ? 1 << 16 : 0;
+    sound_sample lp = i == 1 ? 1 << 16 : 0;
+    sound_sample hp = i == 2 ? 1 << 16 : 0;
+    sound_sample vi = i == 3 ? 1 << 16 : 0;
+
+    cycle_count delta_t_left = delta_t;
+    cycle_count delta_t_flt = 8;
+
+    while (delta_t_left) {
+      if (delta_t_left < delta_t_flt) {
+        delta_t_flt = delta_t_left;
+      }
+
+      // delta_t is converted to seconds given a 1MHz clock by dividing
+      // with 1 000 000. This is done in two operations to avoid integer
+      // multiplication overflow.
+
+      // Vhp = Vbp/Q - Vlp - Vi;
+      // dVbp = -w0*Vhp*dt;
+      // dVlp = -w0*Vbp*dt;
+      sound_sample w0_delta_t = w0_ceil_dt*delta_t_flt >> 6;
+
+      sound_sample dbp = (w0_delta_t*hp >> 14);
+      sound_sample dlp = (w0_delta_t*bp >> 14);
+      bp -= dbp;
+      lp -= dlp;
+      hp = (bp*_1024_div_Q >> 10) - lp - vi;
+
+      delta_t_left -= delta_t_flt;
+    }
+
+    col[i][0] = bp;
+    col[i][1] = lp;
+  }
+
+  // Subtract identity, the columns are 1.DT_FIXP_SHIFT fixpoint already.
+  // Drop the fraction bits which do not fit, see Transition.
+  col[0][0] -= 1 << 16;
+  col[1][1] -= 1 << 16;
+
+  sound_sample c_max = 0;
+  for (int i = 0; i < 8; i++) {
+    sound_sample c = col[i & 3][i >> 2];
+    if (c < 0) {
+      c = -c;
+    }
+    if (c > c_max) {
+      c_max = c;
+    }
+  }
+
+  int drop = 0;
+  while ((c_max >> drop) >= (1 << DT_COEFF_BITS) - 1) {
+    drop++;
+  }
+
+  Transition& t = transition[delta_t - 1];
+  sound_sample* c[8] = { &t.bp_bp, &t.bp_lp, &t.bp_hp, &t.bp_i,
+			 &t.lp_bp, &t.lp_lp, &t.lp_hp, &t.lp_i };
+  for (int i = 0; i < 8; i++) {
+    *c[i] = drop ? (col[i & 3][i >> 2] + (1 << (drop - 1))) >> drop
+                 : col[i & 3][i >> 2];
+  }
+  t.shift = DT_FIXP_SHIFT - drop;
+  t.round = 1 << (t.shift - 1);
+
+  transition_valid |= 1U << (delta_t - 1);
 }
 
 // ----------------------------------------------------------------------------
@@ -124,6 +124,7 @@ public:
   Filter();
 
   void enable_filter(bool enable);
+  void enable_nonlinear(bool enable);
   void set_chip_model(chip_model model);
 
   RESID_INLINE
@@ -134,6 +135,9 @@ public:
   	     sound_sample voice1, sound_sample voice2, sound_sample voice3,
 	     sound_sample ext_in);
   void reset();
+  void settle();
+  sound_sample settled_output(sound_sample voice1, sound_sample voice2,
+			      sound_sample voice3, sound_sample ext_in);
 
   // Write registers.
   void writeFC_LO(reg8);
@@ -151,10 +155,21 @@ public:
 protected:
   void set_w0();
   void set_Q();
+  void set_transition(cycle_count delta_t);
+  static void init_nonlinear();
+
+  RESID_INLINE void clock_nonlinear(cycle_count delta_t, sound_sample Vi);
+  RESID_INLINE sound_sample opamp(sound_sample& x);
+  sound_sample opamp_inverse(sound_sample v);
+  RESID_INLINE sound_sample vcr(sound_sample w, sound_sample v);
 
   // Filter enabled.
   bool enabled;
 
+  // Non-linear MOS6581 model requested / active.
+  bool nonlinear_enabled;
+  bool nonlinear;
+
   // Filter cutoff frequency.
   reg12 fc;
 
@@ -186,6 +201,57 @@ protected:
   sound_sample w0, w0_ceil_1, w0_ceil_dt;
   sound_sample _1024_div_Q;
 
+  // Transition matrices for delta_t cycle clocking.
+  // For constant input the filter is a linear system in Vbp and Vlp (Vhp
+  // only enters in the first integration step, before it is recomputed),
+  // hence the sequence of 8-cycle integration steps covering delta_t cycles
+  // collapses to one matrix-vector step plus an input term. The matrices are
+  // stored as deviation from identity (fixpoint with 'shift' fraction bits)
+  // and are computed on demand for each delta_t up to DT_CACHE_SIZE; the
+  // cache is invalidated whenever cutoff frequency or resonance change.
+  // At low cutoff frequencies the coefficients are small (w0*dt, and its
+  // square in the cross terms) and need up to DT_FIXP_SHIFT fraction bits,
+  // at high cutoff frequencies they approach 1. Each matrix therefore gets
+  // as many fraction bits as keep its coefficients below 2^DT_COEFF_BITS,
+  // such that the products with the filter state stay within 32 bits, and
+  // one multiplication per coefficient suffices.
+  static const int DT_CACHE_SIZE = 32;
+  static const int DT_FIXP_SHIFT = 16;
+  static const int DT_COEFF_BITS = 12;
+
+  struct Transition
+  {
+    sound_sample bp_bp, bp_lp, bp_hp, bp_i;
+    sound_sample lp_bp, lp_lp, lp_hp, lp_i;
+    int shift;
+    sound_sample round;
+  };
+
+  Transition transition[DT_CACHE_SIZE];
+  unsigned int transition_valid;
+
+  // Non-linear MOS6581 filter.
+  // The integrator capacitor charges Vbp_x and Vlp_x are mapped to the
+  // integrator outputs Vbp and Vlp through the op-amp transfer table, which
+  // saturates asymmetrically towards the op-amp output rails. The integration
+  // rate is modulated by the voltage across the cutoff VCR (a FET operated in
+  // the triode region), whose conductance falls with the signal level
+  // relative to the gate overdrive set by FC. Both tables are computed when
+  // the non-linear filter is enabled for the first time (about 9KB); per
+  // 8-cycle step the cost is two interpolated op-amp lookups and two VCR
+  // lookups.
+  static const int OPAMP_TABLE_SIZE = 2048;
+  static const int OPAMP_X_SHIFT = 6;
+  static const int VCR_TABLE_SIZE = 256;
+
+  static sound_sample* opamp_6581;
+  static sound_sample* vcr_gain_6581;
+  static fc_point opamp_points_6581[];
+
+  sound_sample Vbp_x; // bandpass integrator charge
+  sound_sample Vlp_x; // lowpass integrator charge
+  sound_sample vcr_scale;
+
   // Cutoff frequency tables.
   // FC is an 11 bit register.
   sound_sample f0_6581[2048];
@@ -197,6 +263,7 @@ protected:
   int f0_count;
 
 friend class SID16;
+friend class SIDBank;
 };
 
 
@@ -318,6 +385,19 @@ void Filter::clock(sound_sample voice1,
   // delta_t = 1 is converted to seconds given a 1MHz clock by dividing
   // with 1 000 000.
 
+  if (nonlinear) {
+    // As in clock_nonlinear(), with the 1 cycle cutoff frequency limit.
+    // The VCR gain is up to 2, w is scaled down to avoid overflow.
+    sound_sample dVbp = (vcr(w0_ceil_1, Vhp) >> 2)*Vhp >> 18;
+    sound_sample dVlp = (vcr(w0_ceil_1, Vbp) >> 2)*Vbp >> 18;
+    Vbp_x -= dVbp;
+    Vlp_x -= dVlp;
+    Vbp = opamp(Vbp_x);
+    Vlp = opamp(Vlp_x);
+    Vhp = (Vbp*_1024_div_Q >> 10) - Vlp - Vi;
+    return;
+  }
+
   // Calculate filter outputs.
   // Vhp = Vbp/Q - Vlp - Vi;
   // dVbp = -w0*Vhp*dt;
@@ -441,6 +521,90 @@ void Filter::clock(cycle_count delta_t,
     break;
   }
 
+  if (nonlinear) {
+    clock_nonlinear(delta_t, Vi);
+    return;
+  }
+
+  // The filter is integrated in steps of 8 cycles (see set_transition()),
+  // which are precomputed for up to DT_CACHE_SIZE cycles at once.
+  // DT_CACHE_SIZE is a multiple of 8, i.e. longer intervals are split
+  // without changing the sequence of integration steps.
+  cycle_count delta_t_flt = DT_CACHE_SIZE;
+
+  while (delta_t) {
+    if (delta_t < delta_t_flt) {
+      delta_t_flt = delta_t;
+    }
+
+    if (!(transition_valid & (1U << (delta_t_flt - 1)))) {
+      set_transition(delta_t_flt);
+    }
+    const Transition& t = transition[delta_t_flt - 1];
+
+    // Calculate filter outputs.
+    // [Vbp Vlp] += (T - I)*[Vbp Vlp Vhp Vi];
+    // Vhp = Vbp/Q - Vlp - Vi;
+    sound_sample dVbp = (t.bp_bp*Vbp + t.bp_lp*Vlp + t.bp_hp*Vhp + t.bp_i*Vi
+			 + t.round) >> t.shift;
+    sound_sample dVlp = (t.lp_bp*Vbp + t.lp_lp*Vlp + t.lp_hp*Vhp + t.lp_i*Vi
+			 + t.round) >> t.shift;
+    Vbp += dVbp;
+    Vlp += dVlp;
+    Vhp = (Vbp*_1024_div_Q >> 10) - Vlp - Vi;
+
+    delta_t -= delta_t_flt;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Op-amp transfer function, maps integrator charge to output.
+// The charge is limited to the range of the table.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+sound_sample Filter::opamp(sound_sample& x)
+{
+  const sound_sample x_max = (OPAMP_TABLE_SIZE << OPAMP_X_SHIFT)/2 - 1;
+
+  if (x > x_max) {
+    x = x_max;
+  }
+  else if (x < -x_max) {
+    x = -x_max;
+  }
+
+  sound_sample xi = x + ((OPAMP_TABLE_SIZE << OPAMP_X_SHIFT) >> 1);
+  const sound_sample* t = &opamp_6581[xi >> OPAMP_X_SHIFT];
+  sound_sample frac = xi & ((1 << OPAMP_X_SHIFT) - 1);
+
+  return t[0] + ((t[1] - t[0])*frac >> OPAMP_X_SHIFT);
+}
+
+// ----------------------------------------------------------------------------
+// Integration rate w scaled by the VCR conductance at input level v.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+sound_sample Filter::vcr(sound_sample w, sound_sample v)
+{
+  sound_sample i = (v*vcr_scale >> 16) + (VCR_TABLE_SIZE >> 1);
+
+  if (i < 0) {
+    i = 0;
+  }
+  else if (i > VCR_TABLE_SIZE - 1) {
+    i = VCR_TABLE_SIZE - 1;
+  }
+
+  return w*vcr_gain_6581[i] >> 12;
+}
+
+// ----------------------------------------------------------------------------
+// Non-linear MOS6581 filter clocking - delta_t cycles.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+void Filter::clock_nonlinear(cycle_count delta_t, sound_sample Vi)
+{
   // Maximum delta cycles for the filter to work satisfactorily under current
   // cutoff frequency and resonance constraints is approximately 8.
   cycle_count delta_t_flt = 8;
@@ -450,27 +614,23 @@ void Filter::clock(cycle_count delta_t,
       delta_t_flt = delta_t;
     }
 
-    // delta_t is converted to seconds given a 1MHz clock by dividing
-    // with 1 000 000. This is done in two operations to avoid integer
-    // multiplication overflow.
-
-    // Calculate filter outputs.
     // Vhp = Vbp/Q - Vlp - Vi;
-    // dVbp = -w0*Vhp*dt;
-    // dVlp = -w0*Vbp*dt;
+    // dVbp = -w0*vcr(Vhp)*Vhp*dt;
+    // dVlp = -w0*vcr(Vbp)*Vbp*dt;
     sound_sample w0_delta_t = w0_ceil_dt*delta_t_flt >> 6;
 
-    sound_sample dVbp = (w0_delta_t*Vhp >> 14);
-    sound_sample dVlp = (w0_delta_t*Vbp >> 14);
-    Vbp -= dVbp;
-    Vlp -= dVlp;
+    sound_sample dVbp = vcr(w0_delta_t, Vhp)*Vhp >> 14;
+    sound_sample dVlp = vcr(w0_delta_t, Vbp)*Vbp >> 14;
+    Vbp_x -= dVbp;
+    Vlp_x -= dVlp;
+    Vbp = opamp(Vbp_x);
+    Vlp = opamp(Vlp_x);
     Vhp = (Vbp*_1024_div_Q >> 10) - Vlp - Vi;
 
     delta_t -= delta_t_flt;
   }
 }
 
-
 // ----------------------------------------------------------------------------
 // SID audio output (20 bits).
 // ----------------------------------------------------------------------------
@@ -36,6 +36,19 @@ __attribute__( ( optimize( "Os" ) ) ) SID16::SID16()
   voice[1].set_sync_source(&voice[0]);
   voice[2].set_sync_source(&voice[1]);
 
+  quality = QUALITY_FULL;
+  nonlinear_filter = false;
+  voice_mask = 0;
+  voice3_readback = true;
+  voice3_lag = 0;
+  idle_rest = 0;
+  for (int i = 0; i < 7; i++) {
+    idle_filter[i] = 0;
+  }
+
+  sampling = SAMPLE_FAST;
+  v0p = 0;
+
   set_sampling_parameters(985248, SAMPLE_FAST, 44100);
 
   bus_value = 0;
@@ -83,12 +96,15 @@ void __attribute__( ( optimize( "Os" ) ) ) SID16::reset()
     forceOutput[ i ] = 0;
   }
   v0p = 0;
+  direct_mixer = false;
 
   filter.reset();
   extfilt.reset();
 
   bus_value = 0;
   bus_value_ttl = 0;
+  voice3_lag = 0;
+  idle_rest = 0;
 }
 
 
@@ -110,6 +126,18 @@ void SID16::forceDigiOutput( int voice, int value )
   forceOutput[ voice ] = value;
 }
 
+void SID16::set_direct_mixer(bool enable)
+{
+  if (direct_mixer && !enable) {
+    // Continue from the steady state for the current voice outputs.
+    int v0, v1, v2;
+    voice_outputs(v0, v1, v2);
+    filter.clock(1, v0, v1, v2, ext_in);
+    filter.settle();
+  }
+  direct_mixer = enable;
+}
+
 // ----------------------------------------------------------------------------
 // Read sample from audio output.
 // Both 16-bit and n-bit output is provided.
@@ -118,7 +146,8 @@ int SID16::output()
 {
   const int range = 1 << 16;
   const int half = range >> 1;
-  int sample = extfilt.output()/((4095*255 >> 7)*3*15*2/range) + (v0p<<0);
+  int sample = sampling == SAMPLE_DECIMATE && quality < QUALITY_POINT ?
+    decimate_output : extfilt.output()/((4095*255 >> 7)*3*15*2/range) + (v0p<<0);
   if (sample >= half) {
     return half - 1;
   }
@@ -166,8 +195,79 @@ void SID16::readRegisters( unsigned char *p )
   p[ 1 ] = voice[2].envelope.readENV();
 }
 
+void SID16::read_osc3_state(reg24& accumulator, reg24& freq, reg12& pw,
+                            reg8& waveform)
+{
+  WaveformGenerator& wave = voice[2].wave;
+
+  accumulator = wave.accumulator;
+  freq = wave.freq;
+  pw = wave.pw;
+
+  waveform = wave.waveform;
+  if (wave.test || wave.sync || (waveform != 0x1 && waveform != 0x2 && waveform != 0x4) ||
+      (waveform == 0x1 && wave.ring_mod)) {
+    waveform = 0;
+  }
+}
+
+bool SID16::idle()
+{
+  // Voices which are not clocked (masked) do not change anyway.
+  reg8 clocked = clocked_voices();
+
+  for (int i = 0; i < 3; i++) {
+    if (!(clocked & (1 << i))) {
+      continue;
+    }
+    EnvelopeGenerator& envelope = voice[i].envelope;
+    if (!envelope.hold_zero || envelope.envelope_counter != 0 ||
+        envelope.state_pipeline != 0) {
+      return false;
+    }
+  }
+
+  // The integer filters keep creeping below the output resolution long after
+  // the output has become constant, and come to rest at a fixed point of the
+  // per-sample clocking only. fast_forward would leave them where they are.
+  sound_sample state[7] = {
+    filter.Vhp, filter.Vbp, filter.Vlp, filter.Vbp_x, filter.Vlp_x,
+    extfilt.Vlp, extfilt.Vhp
+  };
+  bool changed = false;
+  for (int i = 0; i < 7; i++) {
+    changed |= state[i] != idle_filter[i];
+    idle_filter[i] = state[i];
+  }
+  if (changed) {
+    idle_rest = 0;
+    return false;
+  }
+  if (idle_rest < IDLE_REST_SAMPLES) {
+    idle_rest++;
+    return false;
+  }
+
+  // OSC3 is constant without waveform, or with the test bit set (unless the
+  // noise register is being reset).
+  WaveformGenerator& wave = voice[2].wave;
+  if (!(clocked & 0x04) || wave.waveform == 0 || (wave.test && !(wave.waveform & 0x8))) {
+    return true;
+  }
+
+  reg24 accumulator, freq;
+  reg12 pw;
+  reg8 waveform;
+  read_osc3_state(accumulator, freq, pw, waveform);
+  return waveform != 0;
+}
+
 reg8 SID16::read(reg8 offset)
 {
+  if ((offset == 0x1b || offset == 0x1c) && voice3_lag) {
+    catch_up_voice3();
+  }
+
   switch (offset) {
   case 0x19:
     return potx.readPOT();
@@ -190,6 +290,12 @@ void SID16::write(reg8 offset, reg8 value)
 {
   bus_value = value;
   bus_value_ttl = 0x2000;
+  idle_rest = 0;
+
+  // A lagging voice 3 has to reach the cycle of the write first.
+  if (offset >= 0x0e && offset <= 0x14 && voice3_lag) {
+    catch_up_voice3();
+  }
 
   switch (offset) {
   case 0x00:
@@ -298,6 +404,48 @@ SID16::State::State()
     envelope_state[i] = EnvelopeGenerator::RELEASE;
     hold_zero[i] = true;
   }
+
+  version = STATE_VERSION;
+
+  for (i = 0; i < 3; i++) {
+    msb_rising[i] = false;
+    shift_register_reset[i] = 0;
+    shift_pipeline[i] = 0;
+    noise_output[i] = 0xfff;
+    pulse_output[i] = 0xfff;
+    tri_saw_pipeline[i] = 0x555;
+    osc3[i] = 0;
+    waveform_output[i] = 0;
+    floating_output_ttl[i] = 0;
+
+    new_exponential_counter_period[i] = 0;
+    env3[i] = 0;
+    envelope_pipeline[i] = 0;
+    exponential_pipeline[i] = 0;
+    state_pipeline[i] = 0;
+    reset_rate_counter[i] = 0;
+    envelope_next_state[i] = EnvelopeGenerator::RELEASE;
+
+    force_output[i] = 0;
+  }
+
+  filter_Vhp = filter_Vbp = filter_Vlp = filter_Vnf = 0;
+  filter_Vbp_x = filter_Vlp_x = 0;
+  extfilt_Vlp = extfilt_Vhp = extfilt_Vo = 0;
+
+  ext_in = 0;
+  v0p = 0;
+
+  sample_offset = 0;
+  sample_prev = 0;
+  decimate_offset = 0;
+  decimate_len = 0;
+  decimate_acc = 0;
+  for (i = 0; i < DECIMATE_HB_N; i++) {
+    decimate_hb[i] = 0;
+  }
+  decimate_phase = 0;
+  decimate_output = 0;
 }
 
 
@@ -309,6 +457,8 @@ SID16::State SID16::read_state()
   State state;
   int i, j;
 
+  catch_up_voice3();
+
   for (i = 0, j = 0; i < 3; i++, j += 7) {
     WaveformGenerator& wave = voice[i].wave;
     EnvelopeGenerator& envelope = voice[i].envelope;
@@ -357,6 +507,54 @@ SID16::State SID16::read_state()
     state.hold_zero[i] = voice[i].envelope.hold_zero;
   }
 
+  for (i = 0; i < 3; i++) {
+    WaveformGenerator& wave = voice[i].wave;
+    EnvelopeGenerator& envelope = voice[i].envelope;
+    state.msb_rising[i] = wave.msb_rising;
+    state.shift_register_reset[i] = wave.shift_register_reset;
+    state.shift_pipeline[i] = wave.shift_pipeline;
+    state.noise_output[i] = wave.noise_output;
+    state.pulse_output[i] = wave.pulse_output;
+    state.tri_saw_pipeline[i] = wave.tri_saw_pipeline;
+    state.osc3[i] = wave.osc3;
+    state.waveform_output[i] = wave.waveform_output;
+    state.floating_output_ttl[i] = wave.floating_output_ttl;
+
+    state.new_exponential_counter_period[i] = envelope.new_exponential_counter_period;
+    state.env3[i] = envelope.env3;
+    state.envelope_pipeline[i] = envelope.envelope_pipeline;
+    state.exponential_pipeline[i] = envelope.exponential_pipeline;
+    state.state_pipeline[i] = envelope.state_pipeline;
+    state.reset_rate_counter[i] = envelope.reset_rate_counter;
+    state.envelope_next_state[i] = envelope.next_state;
+
+    state.force_output[i] = forceOutput[i];
+  }
+
+  state.filter_Vhp = filter.Vhp;
+  state.filter_Vbp = filter.Vbp;
+  state.filter_Vlp = filter.Vlp;
+  state.filter_Vnf = filter.Vnf;
+  state.filter_Vbp_x = filter.Vbp_x;
+  state.filter_Vlp_x = filter.Vlp_x;
+  state.extfilt_Vlp = extfilt.Vlp;
+  state.extfilt_Vhp = extfilt.Vhp;
+  state.extfilt_Vo = extfilt.Vo;
+
+  state.ext_in = ext_in;
+  state.v0p = v0p;
+
+  state.sample_offset = sample_offset;
+  state.sample_prev = sample_prev;
+  state.decimate_offset = decimate_offset;
+  state.decimate_len = decimate_len;
+  state.decimate_acc = decimate_acc;
+  for (i = 0; i < DECIMATE_HB_N; i++) {
+    state.decimate_hb[i] = decimate_hb[i];
+  }
+  state.decimate_phase = decimate_phase;
+  state.decimate_output = decimate_output;
+
   return state;
 }
 
@@ -371,6 +569,7 @@ void SID16::write_state(const State& state)
   for (i = 0; i <= 0x18; i++) {
     write(i, state.sid_register[i]);
   }
+  direct_mixer = false;
 
   bus_value = state.bus_value;
   bus_value_ttl = state.bus_value_ttl;
@@ -386,6 +585,55 @@ void SID16::write_state(const State& state)
     voice[i].envelope.state = state.envelope_state[i];
     voice[i].envelope.hold_zero = state.hold_zero[i];
   }
+
+  for (i = 0; i < 3; i++) {
+    WaveformGenerator& wave = voice[i].wave;
+    EnvelopeGenerator& envelope = voice[i].envelope;
+    wave.msb_rising = state.msb_rising[i];
+    wave.shift_register_reset = state.shift_register_reset[i];
+    wave.shift_pipeline = state.shift_pipeline[i];
+    wave.noise_output = state.noise_output[i];
+    wave.no_noise_or_noise_output = wave.no_noise | wave.noise_output;
+    wave.pulse_output = state.pulse_output[i];
+    wave.tri_saw_pipeline = state.tri_saw_pipeline[i];
+    wave.osc3 = state.osc3[i];
+    wave.waveform_output = state.waveform_output[i];
+    wave.floating_output_ttl = state.floating_output_ttl[i];
+
+    envelope.new_exponential_counter_period = state.new_exponential_counter_period[i];
+    envelope.env3 = state.env3[i];
+    envelope.envelope_pipeline = state.envelope_pipeline[i];
+    envelope.exponential_pipeline = state.exponential_pipeline[i];
+    envelope.state_pipeline = state.state_pipeline[i];
+    envelope.reset_rate_counter = state.reset_rate_counter[i];
+    envelope.next_state = state.envelope_next_state[i];
+
+    forceOutput[i] = state.force_output[i];
+  }
+
+  filter.Vhp = state.filter_Vhp;
+  filter.Vbp = state.filter_Vbp;
+  filter.Vlp = state.filter_Vlp;
+  filter.Vnf = state.filter_Vnf;
+  filter.Vbp_x = state.filter_Vbp_x;
+  filter.Vlp_x = state.filter_Vlp_x;
+  extfilt.Vlp = state.extfilt_Vlp;
+  extfilt.Vhp = state.extfilt_Vhp;
+  extfilt.Vo = state.extfilt_Vo;
+
+  ext_in = state.ext_in;
+  v0p = state.v0p;
+
+  sample_offset = state.sample_offset;
+  sample_prev = state.sample_prev;
+  decimate_offset = state.decimate_offset;
+  decimate_len = state.decimate_len;
+  decimate_acc = state.decimate_acc;
+  for (i = 0; i < DECIMATE_HB_N; i++) {
+    decimate_hb[i] = state.decimate_hb[i];
+  }
+  decimate_phase = state.decimate_phase;
+  decimate_output = state.decimate_output;
 }
 
 
@@ -407,6 +655,50 @@ void SID16::enable_external_filter(bool enable)
 }
 
 
+// ----------------------------------------------------------------------------
+// Enable non-linear filter model (MOS6581 only).
+// ----------------------------------------------------------------------------
+void SID16::enable_nonlinear_filter(bool enable)
+{
+  nonlinear_filter = enable;
+  filter.enable_nonlinear(enable && quality < QUALITY_LINEAR);
+}
+
+
+// ----------------------------------------------------------------------------
+// Set quality tier, used to shed load when the emulation falls behind.
+//   QUALITY_FULL   - decimation in steps of at most 8 cycles
+//   QUALITY_COARSE - decimation in one step per half sample window
+//   QUALITY_LINEAR - additionally the linear filter model is used
+//   QUALITY_POINT  - additionally the output is point sampled
+// The tiers only degrade SAMPLE_DECIMATE and the non-linear filter.
+// ----------------------------------------------------------------------------
+void SID16::set_quality(quality_level level)
+{
+  if (level == quality) {
+    return;
+  }
+
+  // Restart decimation from the current output level.
+  if (quality >= QUALITY_POINT && level < QUALITY_POINT) {
+    int sample = output();
+    for (int i = 0; i < DECIMATE_HB_N; i++) {
+      decimate_hb[i] = sample;
+    }
+    decimate_output = sample;
+    decimate_acc = 0;
+    decimate_len = 0;
+    decimate_offset = cycles_per_window;
+  }
+
+  quality = level;
+  decimate_dt = quality >= QUALITY_COARSE ?
+    (cycles_per_window + FIXP_MASK) >> FIXP_SHIFT : DECIMATE_DT;
+
+  filter.enable_nonlinear(nonlinear_filter && quality < QUALITY_LINEAR);
+}
+
+
 // ----------------------------------------------------------------------------
 // I0() computes the 0th order modified Bessel function of the first kind.
 // This function is originally from resample-1.5/filterkit.c by J. O. Smith.
@@ -486,6 +778,10 @@ bool SID16::set_sampling_parameters(float clock_freq, sampling_method method,
     }
   }
 
+  // The decimation restarts from the current output level, such that the
+  // method can be changed while playing.
+  int level = output();
+
   clock_frequency = clock_freq;
   sampling = method;
 
@@ -495,6 +791,18 @@ bool SID16::set_sampling_parameters(float clock_freq, sampling_method method,
   sample_offset = 0;
   sample_prev = 0;
 
+  cycles_per_window = cycles_per_sample >> 1;
+  decimate_offset = cycles_per_window;
+  decimate_dt = quality >= QUALITY_COARSE ?
+    (cycles_per_window + FIXP_MASK) >> FIXP_SHIFT : DECIMATE_DT;
+  decimate_len = 0;
+  decimate_acc = 0;
+  for (int i = 0; i < DECIMATE_HB_N; i++) {
+    decimate_hb[i] = level;
+  }
+  decimate_phase = 0;
+  decimate_output = level;
+
   // FIR initialization is only necessary for resampling.
   if (method != SAMPLE_RESAMPLE_INTERPOLATE && method != SAMPLE_RESAMPLE_FAST)
   {
@@ -607,6 +915,7 @@ void SID16::adjust_sampling_frequency(float sample_freq)
 {
   cycles_per_sample =
     cycle_count(clock_frequency/sample_freq*(1 << FIXP_SHIFT) + 0.5);
+  cycles_per_window = cycles_per_sample >> 1;
 }
 
 
@@ -628,11 +937,84 @@ void SID16::adjust_sampling_frequency(float sample_freq)
   return filter.fc_plotter();
 }*/
 
+// ----------------------------------------------------------------------------
+// Mask (mute) voices, bit 0 = voice 1 etc.
+// Masked voices are not only silenced, they are not clocked at all unless
+// they are needed as sync or ring modulation source, or, for voice 3, for
+// OSC3/ENV3 readback. A voice continues from its previous state when it is
+// unmasked. Forced (digi) output is not affected.
+// ----------------------------------------------------------------------------
+void SID16::set_voice_mask(reg8 mask)
+{
+  voice_mask = mask & 0x07;
+}
+
+
+// ----------------------------------------------------------------------------
+// OSC3/ENV3 are being read. While they are not, a masked voice 3 is not
+// clocked either, but only counts the cycles it is behind. It is caught up
+// when it is needed again, before writes to its registers, when OSC3/ENV3
+// are read via read(), and at the latest every 0x10000 cycles, which keeps the catch-up short and within
+// the range of WaveformGenerator::clock(delta_t). Until then
+// readRegisters() and read_osc3_state() return the state of the last
+// catch-up.
+// ----------------------------------------------------------------------------
+void SID16::set_voice3_readback(bool enable)
+{
+  voice3_readback = enable;
+}
+
+
+// ----------------------------------------------------------------------------
+// Clock voice 3 by the cycles it is behind. Hard sync of voice 3 does not
+// occur here, as voice 3 is clocked while it is synchronized.
+// ----------------------------------------------------------------------------
+void SID16::catch_up_voice3()
+{
+  while (voice3_lag) {
+    cycle_count delta_t = voice3_lag > 0xffff ? 0xffff : voice3_lag;
+    voice[2].envelope.clock(delta_t);
+    voice[2].wave.clock(delta_t);
+    voice[2].wave.set_waveform_output(delta_t);
+    voice3_lag -= delta_t;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Voices to be clocked, bit 0 = voice 1 etc.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+reg8 SID16::clocked_voices()
+{
+  if (!voice_mask) {
+    return 0x07;
+  }
+
+  reg8 clocked = ~voice_mask & 0x07;
+
+  // Voice 3 for readback, or when it is synchronized by voice 2.
+  if (voice3_readback || voice[2].wave.sync) {
+    clocked |= 0x04;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    const WaveformGenerator* dest = voice[i].wave.sync_dest;
+    if (dest->sync || dest->ring_mod) {
+      clocked |= 1 << i;
+    }
+  }
+
+  return clocked;
+}
+
+
 // ----------------------------------------------------------------------------
 // SID clocking - 1 cycle.
 // ----------------------------------------------------------------------------
 void SID16::clock()
 {
+    // Goes through clock_voices(), which keeps voice3_lag up to date.
     clock( 1 );
 
 #if 0
@@ -644,25 +1026,42 @@ void SID16::clock()
     bus_value_ttl = 0;
   }
 
+  reg8 clocked = clocked_voices();
+
+  // A masked voice 3 which is not needed only counts the cycle.
+  if (!(clocked & 0x04)) {
+    if (++voice3_lag >= 0x10000) {
+      catch_up_voice3();
+    }
+  } else if (voice3_lag) {
+    catch_up_voice3();
+  }
+
   // Clock amplitude modulators.
   for (i = 0; i < 3; i++) {
-    voice[i].envelope.clock();
+    if (clocked & (1 << i)) {
+      voice[i].envelope.clock();
+    }
   }
 
   // Clock oscillators.
   for (i = 0; i < 3; i++) {
-    voice[i].wave.clock();
+    if (clocked & (1 << i)) {
+      voice[i].wave.clock();
+    }
   }
 
   // Synchronize oscillators.
   for (i = 0; i < 3; i++) {
-    voice[i].wave.synchronize();
+    if (clocked & (1 << i)) {
+      voice[i].wave.synchronize();
+    }
   }
 
   // Clock filter.
-  int v0 = voice[0].output();
-  int v1 = voice[1].output();
-  int v2 = voice[2].output();
+  int v0 = voice_mask & 1 ? 0 : voice[0].output();
+  int v1 = voice_mask & 2 ? 0 : voice[1].output();
+  int v2 = voice_mask & 4 ? 0 : voice[2].output();
 
   if ( forceOutput[ 0 ] & 2 ) { v0 = voice[ 0 ].output( forceOutput[ 0 ] & ~3 ) + voice[ 0 ].voice_DC; }
   if ( forceOutput[ 1 ] & 2 ) { v1 = voice[ 1 ].output( forceOutput[ 1 ] & ~3 ) + voice[ 1 ].voice_DC; }
@@ -707,9 +1106,153 @@ void SID16::clock()
 static int ofs = 0;
 
 // ----------------------------------------------------------------------------
-// SID clocking - delta_t cycles.
+// Clock bus value, envelopes and oscillators, and calculate the waveform
+// outputs - delta_t cycles.
 // ----------------------------------------------------------------------------
-void SID16::clock(cycle_count delta_t)
+RESID_INLINE
+void SID16::clock_voices(cycle_count delta_t)
+{
+  int i;
+
+  // Age bus value.
+  bus_value_ttl -= delta_t;
+  if ( ( bus_value_ttl <= 0 ) ) {
+      bus_value = 0;
+      bus_value_ttl = 0;
+  }
+
+  reg8 clocked = clocked_voices();
+
+  // A masked voice 3 which is not needed only counts the cycles.
+  if ( !( clocked & 0x04 ) ) {
+      voice3_lag += delta_t;
+      if ( voice3_lag >= 0x10000 ) {
+          catch_up_voice3();
+      }
+  } else
+  if ( voice3_lag ) {
+      catch_up_voice3();
+  }
+
+  // Clock amplitude modulators.
+  for ( i = 0; i < 3; i++ ) {
+      if ( clocked & ( 1 << i ) ) {
+          voice[ i ].envelope.clock( delta_t );
+      }
+  }
+
+  // Clock and synchronize oscillators.
+  // Loop until we reach the current cycle.
+  cycle_count delta_t_osc = delta_t;
+  while ( delta_t_osc ) {
+      cycle_count delta_t_min = delta_t_osc;
+
+      // Find minimum number of cycles to an oscillator accumulator MSB toggle.
+      // We have to clock on each MSB on / MSB off for hard sync to operate
+      // correctly.
+      for ( i = 0; i < 3; i++ ) {
+          WaveformGenerator &wave = voice[ i ].wave;
+
+          // It is only necessary to clock on the MSB of an oscillator that is
+          // a sync source and has freq != 0.
+          if ( ( !( wave.sync_dest->sync && wave.freq ) ) ) {
+              continue;
+          }
+
+          reg16 freq = wave.freq;
+          reg24 accumulator = wave.accumulator;
+
+          // Clock on MSB off if MSB is on, clock on MSB on if MSB is off.
+          reg24 delta_accumulator =
+              ( accumulator & 0x800000 ? 0x1000000 : 0x800000 ) - accumulator;
+
+          cycle_count delta_t_next = delta_accumulator / freq;
+          if ( ( delta_accumulator % freq ) ) {
+              ++delta_t_next;
+          }
+
+          if ( ( delta_t_next < delta_t_min ) ) {
+              delta_t_min = delta_t_next;
+          }
+      }
+
+      // Clock oscillators.
+      for ( i = 0; i < 3; i++ ) {
+          if ( clocked & ( 1 << i ) ) {
+              voice[ i ].wave.clock( delta_t_min );
+          }
+      }
+
+      // Synchronize oscillators.
+      for ( i = 0; i < 3; i++ ) {
+          if ( clocked & ( 1 << i ) ) {
+              voice[ i ].wave.synchronize();
+          }
+      }
+
+      delta_t_osc -= delta_t_min;
+  }
+
+  // Calculate waveform output.
+  for ( i = 0; i < 3; i++ ) {
+      if ( clocked & ( 1 << i ) ) {
+          voice[ i ].wave.set_waveform_output( delta_t );
+      }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Voice outputs to the filter, including forced (digi) output.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+void SID16::voice_outputs(int& v0, int& v1, int& v2)
+{
+  v0 = voice_mask & 1 ? 0 : voice[ 0 ].output();
+  v1 = voice_mask & 2 ? 0 : voice[ 1 ].output();
+  v2 = voice_mask & 4 ? 0 : voice[ 2 ].output();
+
+  if ( forceOutput[ 0 ] & 2 ) { v0 = voice[ 0 ].output( forceOutput[ 0 ] & ~3 ); }
+  if ( forceOutput[ 1 ] & 2 ) { v1 = voice[ 1 ].output( forceOutput[ 1 ] & ~3 ); }
+  if ( forceOutput[ 2 ] & 2 ) { v2 = voice[ 2 ].output( forceOutput[ 2 ] & ~3 ); }
+
+#ifdef USE_RGB_LED
+  voiceOut[ 0 ] = v0 + voice[ 0 ].wave_zero * voice[ 0 ].envelope.output() - voice[ 0 ].voice_DC;
+  voiceOut[ 1 ] = v1 + voice[ 1 ].wave_zero * voice[ 1 ].envelope.output() - voice[ 1 ].voice_DC;
+  voiceOut[ 2 ] = v2 + voice[ 2 ].wave_zero * voice[ 2 ].envelope.output() - voice[ 2 ].voice_DC;
+#endif
+
+  v0p = 0;
+  if ( forceOutput[ 0 ] & 1 )
+  {
+      v0 = 0; v0p += forceOutput[ 0 ] & ~3;
+  #ifdef USE_RGB_LED
+      voiceOut[ 0 ] = ( ( forceOutput[ 0 ] & ~3 ) - 512 ) << 8;
+  #endif
+  }
+  if ( forceOutput[ 1 ] & 1 )
+  {
+      v1 = 0; v0p += forceOutput[ 1 ] & ~3;
+  #ifdef USE_RGB_LED
+      voiceOut[ 1 ] = ( ( forceOutput[ 1 ] & ~3 ) - 512 ) << 8;
+  #endif
+  }
+  if ( forceOutput[ 2 ] & 1 )
+  {
+      v2 = 0; v0p += forceOutput[ 2 ] & ~3;
+  #ifdef USE_RGB_LED
+      voiceOut[ 2 ] = ( ( forceOutput[ 2 ] & ~3 ) - 512 ) << 8;
+  #endif
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// SID clocking - delta_t cycles in one span, the output is the state at the
+// end of the span.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+void SID16::clock_span(cycle_count delta_t)
 {
 #if 0
   int i;
@@ -821,7 +1364,6 @@ void SID16::clock(cycle_count delta_t)
   // Clock external filter.
   extfilt.clock(delta_t, filter.output() );
 #endif
-  int i;
 
   // Pipelined writes on the MOS8580.
 /*  if ( ( write_pipeline ) && ( delta_t > 0 ) ) {
@@ -836,114 +1378,158 @@ void SID16::clock(cycle_count delta_t)
       return;
   }
 
-  // Age bus value.
-  bus_value_ttl -= delta_t;
-  if ( ( bus_value_ttl <= 0 ) ) {
-      bus_value = 0;
-      bus_value_ttl = 0;
-  }
+  clock_voices( delta_t );
 
-  // Clock amplitude modulators.
-  for ( i = 0; i < 3; i++ ) {
-      voice[ i ].envelope.clock( delta_t );
-  }
+  int v0, v1, v2;
+  voice_outputs( v0, v1, v2 );
 
-  // Clock and synchronize oscillators.
-  // Loop until we reach the current cycle.
-  cycle_count delta_t_osc = delta_t;
-  while ( delta_t_osc ) {
-      cycle_count delta_t_min = delta_t_osc;
+  if ( direct_mixer ) {
+    extfilt.clock( delta_t, filter.settled_output( v0, v1, v2, ext_in ) );
+    return;
+  }
 
-      // Find minimum number of cycles to an oscillator accumulator MSB toggle.
-      // We have to clock on each MSB on / MSB off for hard sync to operate
-      // correctly.
-      for ( i = 0; i < 3; i++ ) {
-          WaveformGenerator &wave = voice[ i ].wave;
+  // Clock filter.
+  filter.clock( delta_t, v0, v1, v2, ext_in );
+  // Clock external filter.
+  extfilt.clock( delta_t, filter.output() );
+}
 
-          // It is only necessary to clock on the MSB of an oscillator that is
-          // a sync source and has freq != 0.
-          if ( ( !( wave.sync_dest->sync && wave.freq ) ) ) {
-              continue;
-          }
 
-          reg16 freq = wave.freq;
-          reg24 accumulator = wave.accumulator;
+// ----------------------------------------------------------------------------
+// Fast forward - delta_t cycles.
+// Oscillators, noise shift registers, envelopes, and thus OSC3/ENV3, are
+// advanced exactly as by clock(delta_t) in one span, but the filter, the
+// external filter and the decimation are not clocked, except for the last
+// FAST_FORWARD_CLOCKED cycles, which are clocked as usual. This is meant for
+// idle SIDs (see idle()): the voice outputs are constant, the filters are
+// at rest already, and the result is the same as with clock(delta_t).
+// Settling the filters to their ideal steady state instead would not be: the
+// integer filters come to rest with small offsets, and dropping those is a
+// step in the output. The decimation windows are kept on the sample grid,
+// and the last cycles refill the half-band filter.
+// The voices are clocked in chunks of at most 0xffff cycles, as
+// WaveformGenerator::clock(delta_t) needs delta_t*freq to fit into 32 bits
+// (otherwise the accumulator and the number of noise register shifts are
+// wrong). The cost still grows with delta_t: one iteration per envelope rate
+// period, and one per noise register shift.
+// ----------------------------------------------------------------------------
+void SID16::fast_forward(cycle_count delta_t)
+{
+  if (delta_t <= 0) {
+    return;
+  }
 
-          // Clock on MSB off if MSB is on, clock on MSB on if MSB is off.
-          reg24 delta_accumulator =
-              ( accumulator & 0x800000 ? 0x1000000 : 0x800000 ) - accumulator;
+  cycle_count delta_t_clocked =
+    delta_t > FAST_FORWARD_CLOCKED ? FAST_FORWARD_CLOCKED : delta_t;
+  delta_t -= delta_t_clocked;
+
+  // The windows which end meanwhile only toggle the half-band phase (see
+  // clock_decimate()).
+  if (sampling == SAMPLE_DECIMATE && quality < QUALITY_POINT) {
+    long long offset = decimate_offset - ((long long)delta_t << FIXP_SHIFT);
+    if (offset <= 0) {
+      long long windows = -offset/cycles_per_window + 1;
+      offset += windows*cycles_per_window;
+      decimate_phase ^= windows & 1;
+    }
+    decimate_offset = (cycle_count)offset;
+  }
 
-          cycle_count delta_t_next = delta_accumulator / freq;
-          if ( ( delta_accumulator % freq ) ) {
-              ++delta_t_next;
-          }
+  while (delta_t > 0) {
+    cycle_count delta_t_chunk = delta_t > 0xffff ? 0xffff : delta_t;
+    clock_voices(delta_t_chunk);
+    delta_t -= delta_t_chunk;
+  }
 
-          if ( ( delta_t_next < delta_t_min ) ) {
-              delta_t_min = delta_t_next;
-          }
-      }
+  // Without decimation the caller clocks once per sample, and the integer
+  // filters rest at a fixed point of that step length, not necessarily of
+  // one step over all remaining cycles.
+  if (sampling == SAMPLE_DECIMATE && quality < QUALITY_POINT) {
+    clock(delta_t_clocked);
+    return;
+  }
 
-      // Clock oscillators.
-      for ( i = 0; i < 3; i++ ) {
-          voice[ i ].wave.clock( delta_t_min );
-      }
+  cycle_count delta_t_sample = cycles_per_sample >> FIXP_SHIFT;
+  while (delta_t_clocked > 0) {
+    cycle_count delta_t_step =
+      delta_t_clocked > delta_t_sample ? delta_t_sample : delta_t_clocked;
+    clock(delta_t_step);
+    delta_t_clocked -= delta_t_step;
+  }
+}
 
-      // Synchronize oscillators.
-      for ( i = 0; i < 3; i++ ) {
-          voice[ i ].wave.synchronize();
-      }
 
-      delta_t_osc -= delta_t_min;
-  }
+// ----------------------------------------------------------------------------
+// SID clocking with decimation - delta_t cycles.
+//
+// Point sampling the output once per sample aliases badly on noise and
+// hard sync tones. Instead the output of each step is accumulated, weighted
+// with the step length, over windows of half a sample period (a boxcar with
+// its first zero at twice the sample rate). The window averages are then
+// decimated by two with the half-band filter [-1 0 9 16 9 0 -1]/32, which
+// suppresses the remaining band from half the sample rate upwards. Window
+// boundaries are tracked in 16.16 fixpoint, and one division per window
+// is all the extra arithmetic needed.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+void SID16::clock_decimate(cycle_count delta_t)
+{
+  // Scaling of extfilt.output() to 16 bits, see output().
+  const int scale = (4095*255 >> 7)*3*15*2/(1 << 16);
+
+  while (delta_t > 0) {
+    // Clock to the end of the window, at most decimate_dt cycles.
+    cycle_count delta_t_step = (decimate_offset + FIXP_MASK) >> FIXP_SHIFT;
+    if (delta_t_step > decimate_dt) {
+      delta_t_step = decimate_dt;
+    }
+    if (delta_t_step > delta_t) {
+      delta_t_step = delta_t;
+    }
 
-  // Calculate waveform output.
-  for ( i = 0; i < 3; i++ ) {
-      voice[ i ].wave.set_waveform_output( delta_t );
-  }
+    clock_span(delta_t_step);
 
-  int v0 = voice[ 0 ].output();
-  int v1 = voice[ 1 ].output();
-  int v2 = voice[ 2 ].output();
+    decimate_acc += (extfilt.output() + v0p*scale)*delta_t_step;
+    decimate_len += delta_t_step;
+    decimate_offset -= delta_t_step << FIXP_SHIFT;
+    delta_t -= delta_t_step;
 
-  if ( forceOutput[ 0 ] & 2 ) { v0 = voice[ 0 ].output( forceOutput[ 0 ] & ~3 ); }
-  if ( forceOutput[ 1 ] & 2 ) { v1 = voice[ 1 ].output( forceOutput[ 1 ] & ~3 ); }
-  if ( forceOutput[ 2 ] & 2 ) { v2 = voice[ 2 ].output( forceOutput[ 2 ] & ~3 ); }
+    if (decimate_offset > 0) {
+      continue;
+    }
 
-#ifdef USE_RGB_LED
-  voiceOut[ 0 ] = v0 + voice[ 0 ].wave_zero * voice[ 0 ].envelope.output() - voice[ 0 ].voice_DC;
-  voiceOut[ 1 ] = v1 + voice[ 1 ].wave_zero * voice[ 1 ].envelope.output() - voice[ 1 ].voice_DC;
-  voiceOut[ 2 ] = v2 + voice[ 2 ].wave_zero * voice[ 2 ].envelope.output() - voice[ 2 ].voice_DC;
-#endif
+    // End of window.
+    decimate_offset += cycles_per_window;
 
-  v0p = 0;
-  if ( forceOutput[ 0 ] & 1 )
-  {
-      v0 = 0; v0p += forceOutput[ 0 ] & ~3;
-  #ifdef USE_RGB_LED
-      voiceOut[ 0 ] = ( ( forceOutput[ 0 ] & ~3 ) - 512 ) << 8;
-  #endif
-  }
-  if ( forceOutput[ 1 ] & 1 )
-  {
-      v1 = 0; v0p += forceOutput[ 1 ] & ~3;
-  #ifdef USE_RGB_LED
-      voiceOut[ 1 ] = ( ( forceOutput[ 1 ] & ~3 ) - 512 ) << 8;
-  #endif
-  }
-  if ( forceOutput[ 2 ] & 1 )
-  {
-      v2 = 0; v0p += forceOutput[ 2 ] & ~3;
-  #ifdef USE_RGB_LED
-      voiceOut[ 2 ] = ( ( forceOutput[ 2 ] & ~3 ) - 512 ) << 8;
-  #endif
+    for (int i = 0; i < DECIMATE_HB_N - 1; i++) {
+      decimate_hb[i] = decimate_hb[i + 1];
+    }
+    decimate_hb[DECIMATE_HB_N - 1] = decimate_acc/(decimate_len*scale);
+    decimate_acc = 0;
+    decimate_len = 0;
+
+    // Half-band output for every second window.
+    decimate_phase ^= 1;
+    if (!decimate_phase) {
+      decimate_output = (16*decimate_hb[3]
+			 + 9*(decimate_hb[2] + decimate_hb[4])
+			 - (decimate_hb[0] + decimate_hb[6])) >> 5;
+    }
   }
+}
 
 
-  // Clock filter.
-  filter.clock( delta_t, v0, v1, v2, ext_in );
-  // Clock external filter.
-  extfilt.clock( delta_t, filter.output() );
-
+// ----------------------------------------------------------------------------
+// SID clocking - delta_t cycles.
+// ----------------------------------------------------------------------------
+void SID16::clock(cycle_count delta_t)
+{
+  if (sampling == SAMPLE_DECIMATE && quality < QUALITY_POINT) {
+    clock_decimate(delta_t);
+  }
+  else {
+    clock_span(delta_t);
+  }
 }
 
 
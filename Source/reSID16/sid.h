@@ -38,16 +38,21 @@ public:
   void set_chip_model(chip_model model);
   void enable_filter(bool enable);
   void enable_external_filter(bool enable);
+  void enable_nonlinear_filter(bool enable);
   bool set_sampling_parameters(float clock_freq, sampling_method method,
 			       float sample_freq, float pass_freq = -1,
 			       float filter_scale = 0.97);
   void adjust_sampling_frequency(float sample_freq);
+  void set_quality(quality_level level);
+  void set_voice_mask(reg8 mask);
+  void set_voice3_readback(bool enable);
 
   //void fc_default(const fc_point*& points, int& count);
   //PointPlotter<sound_sample> fc_plotter();
 
   void clock();
   void clock(cycle_count delta_t);
+  void fast_forward(cycle_count delta_t);
   int clock(cycle_count& delta_t, short* buf, int n, int interleave = 1);
   void reset();
   
@@ -56,6 +61,32 @@ public:
   void write(reg8 offset, reg8 value);
   void readRegisters( unsigned char *p );
 
+  // Oscillator 3 state for predicting OSC3 between clock() calls. waveform
+  // is 0 if OSC3 does not follow from accumulator and frequency alone (noise,
+  // combined waveforms, test bit, sync, ring modulation). As in
+  // clock_voices, OSC3 follows the accumulator without pipeline delay.
+  void read_osc3_state(reg24& accumulator, reg24& freq, reg12& pw,
+                       reg8& waveform);
+
+  // True if all envelopes are frozen at zero, OSC3 is constant or
+  // predictable by read_osc3_state, and the filters have come to rest, i.e.
+  // neither the output nor ENV3 change until the next register write and
+  // clocking may be deferred to fast_forward. To be called once per sample:
+  // the filters are at rest after IDLE_REST_SAMPLES calls without change.
+  bool idle();
+
+  // Calls of idle() without change of the filter state before the filters
+  // count as at rest. Long enough to see both sample period lengths of the
+  // fixpoint sample clock.
+  static const int IDLE_REST_SAMPLES = 16;
+
+  // Cycles at the end of fast_forward which are clocked as usual, a few
+  // samples, such that the decimation restarts from the current output.
+  static const int FAST_FORWARD_CLOCKED = 256;
+
+  // Length of the decimation half-band filter, see below.
+  static const int DECIMATE_HB_N = 7;
+
   // Read/write state.
   class State
   {
@@ -76,8 +107,50 @@ public:
     reg8 envelope_counter[3];
     EnvelopeGenerator::State envelope_state[3];
     bool hold_zero[3];
+
+    // Layout version (STATE_VERSION), for states which are stored.
+    int version;
+
+    bool msb_rising[3];
+    cycle_count shift_register_reset[3];
+    cycle_count shift_pipeline[3];
+    unsigned short noise_output[3];
+    unsigned short pulse_output[3];
+    reg12 tri_saw_pipeline[3];
+    reg12 osc3[3];
+    reg12 waveform_output[3];
+    cycle_count floating_output_ttl[3];
+
+    reg8 new_exponential_counter_period[3];
+    reg8 env3[3];
+    cycle_count envelope_pipeline[3];
+    cycle_count exponential_pipeline[3];
+    cycle_count state_pipeline[3];
+    reg8 reset_rate_counter[3];
+    EnvelopeGenerator::State envelope_next_state[3];
+
+    sound_sample filter_Vhp, filter_Vbp, filter_Vlp, filter_Vnf;
+    sound_sample filter_Vbp_x, filter_Vlp_x;
+    sound_sample extfilt_Vlp, extfilt_Vhp, extfilt_Vo;
+
+    int ext_in;
+    int force_output[3];
+    int v0p;
+
+    cycle_count sample_offset;
+    short sample_prev;
+    cycle_count decimate_offset;
+    cycle_count decimate_len;
+    int decimate_acc;
+    int decimate_hb[DECIMATE_HB_N];
+    int decimate_phase;
+    int decimate_output;
   };
     
+  // Changed with every change of the State layout; stored states of a
+  // different version must not be passed to write_state.
+  static const int STATE_VERSION = 2;
+
   State read_state();
   void write_state(const State& state);
 
@@ -91,12 +164,22 @@ public:
 
   void forceDigiOutput( int voice, int value );
 
+  // Digis played via the volume register: the filter is not integrated,
+  // the mixer outputs the steady-state level of the current registers.
+  void set_direct_mixer(bool enable);
+
   #ifdef USE_RGB_LED
   int voiceOut[ 3 ];
   #endif
 
 protected:
   static float I0(float x);
+  RESID_INLINE void clock_span(cycle_count delta_t);
+  RESID_INLINE void clock_decimate(cycle_count delta_t);
+  RESID_INLINE reg8 clocked_voices();
+  void catch_up_voice3();
+  RESID_INLINE void clock_voices(cycle_count delta_t);
+  RESID_INLINE void voice_outputs(int& v0, int& v1, int& v2);
   RESID_INLINE int clock_fast(cycle_count& delta_t, short* buf, int n,
 			      int interleave);
   RESID_INLINE int clock_interpolate(cycle_count& delta_t, short* buf, int n,
@@ -148,12 +231,48 @@ protected:
 
   int v0p;
   int forceOutput[ 3 ];
+  bool direct_mixer;
+
+  // Decimation (SAMPLE_DECIMATE).
+  // The output is averaged (boxcar) over windows of half a sample period,
+  // split into steps of at most decimate_dt cycles, and the windows are
+  // decimated to the sample rate by a 7-tap half-band filter
+  // [-1 0 9 16 9 0 -1]/32.
+  static const int DECIMATE_DT = 8;
+
+  cycle_count cycles_per_window;
+  cycle_count decimate_offset;
+  cycle_count decimate_dt;
+  cycle_count decimate_len;
+  int decimate_acc;
+  int decimate_hb[DECIMATE_HB_N];
+  int decimate_phase;
+  int decimate_output;
+
+  // Masked (muted) voices, bit 0 = voice 1.
+  reg8 voice_mask;
+
+  // OSC3/ENV3 are being read, i.e. a masked voice 3 has to be clocked.
+  // Otherwise a masked voice 3 is behind by voice3_lag cycles.
+  bool voice3_readback;
+  cycle_count voice3_lag;
+
+  // Filter and external filter state at the last call of idle(), and the
+  // number of calls since it last changed (or since the last write).
+  sound_sample idle_filter[7];
+  int idle_rest;
+
+  // Current quality tier, and configured non-linear filter.
+  quality_level quality;
+  bool nonlinear_filter;
 
   // Ring buffer with overflow for contiguous storage of RINGSIZE samples.
   short* sample;
 
   // FIR_RES filter tables (FIR_N*FIR_RES).
   short* fir;
+
+friend class SIDBank;
 };
 
 #endif // not __SID_H__
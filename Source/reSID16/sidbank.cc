@@ -0,0 +1,615 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// please note that modifications have been made to this source code 
+// for the use in the SIDKick pico firmware!
+
+
+#include "sidbank_kernels.h"
+#include <string.h>
+#include <thread>
+
+#ifdef SIDBANK_AVX2
+// sidbank_avx2.cc
+extern const SIDBank::Kernels* sidbank_kernels_avx2();
+#endif
+
+// MOS6581 DAC output for all waveform outputs (WaveformGenerator::output()).
+static int dac6581[1 << 12];
+
+// ----------------------------------------------------------------------------
+// Constructor.
+// ----------------------------------------------------------------------------
+SIDBank::SIDBank(int lanes, chip_model model, float clock_freq,
+		 sampling_method method, float sample_freq)
+{
+  n_lanes = lanes;
+  n_threads = 1;
+
+  lane_sid = new SID16*[n_lanes];
+  lane_state = new Lane[n_lanes];
+  for (int i = 0; i < n_lanes; i++) {
+    lane_sid[i] = new SID16();
+    lane_sid[i]->set_chip_model(model);
+    lane_sid[i]->set_sampling_parameters(clock_freq, method, sample_freq);
+    lane_sid[i]->reset();
+    lane_state[i].next_write = 0;
+    lane_state[i].elapsed = 0;
+  }
+
+  cycles_per_sample =
+    cycle_count(clock_freq/sample_freq*(1 << 16) + 0.5);
+  sample_offset = 0;
+
+  for (int i = 0; i < (1 << 12); i++) {
+    int highp = (i >> 6) & 63;
+    dac6581[i] = short(model_dac0_8[i & 63] + model_dac1_8[highp] - 144 +
+		       highp*64);
+  }
+
+  n_groups = (n_lanes + GROUP_LANES - 1)/GROUP_LANES;
+  group = new LaneGroup[n_groups];
+  for (int i = 0; i < n_groups; i++) {
+    init_group(group[i]);
+  }
+
+  // The fastest backend of the build and the CPU.
+  if (!set_backend(BACKEND_AVX2) && !set_backend(BACKEND_SSE2)) {
+    set_backend(BACKEND_SCALAR);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Destructor.
+// ----------------------------------------------------------------------------
+SIDBank::~SIDBank()
+{
+  for (int i = 0; i < n_lanes; i++) {
+    delete lane_sid[i];
+  }
+  delete[] lane_sid;
+  delete[] lane_state;
+  delete[] group;
+}
+
+
+// ----------------------------------------------------------------------------
+// Backends.
+// ----------------------------------------------------------------------------
+bool SIDBank::backend_supported(backend b)
+{
+  switch (b) {
+  case BACKEND_SID16:
+  case BACKEND_SCALAR:
+    return true;
+  case BACKEND_SSE2:
+#ifdef __SSE2__
+    return true;
+#else
+    return false;
+#endif
+  case BACKEND_AVX2:
+#ifdef SIDBANK_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+bool SIDBank::set_backend(backend b)
+{
+  if (!backend_supported(b)) {
+    return false;
+  }
+  lane_backend = b;
+  lane_kernels = kernels(b);
+  return true;
+}
+
+const SIDBank::Kernels* SIDBank::kernels(backend b)
+{
+  if (!backend_supported(b)) {
+    return 0;
+  }
+
+  switch (b) {
+  default:
+  case BACKEND_SID16:
+    return 0;
+  case BACKEND_SCALAR:
+    return kernel_table<LaneScalar>();
+#ifdef __SSE2__
+  case BACKEND_SSE2:
+    return kernel_table<LaneSSE2>();
+#endif
+#ifdef SIDBANK_AVX2
+  case BACKEND_AVX2:
+    return sidbank_kernels_avx2();
+#endif
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Initialize a group.
+// ----------------------------------------------------------------------------
+void SIDBank::init_group(LaneGroup& g)
+{
+  static_assert(FILTER_DT == Filter::DT_CACHE_SIZE,
+		"filter transitions of the lane kernels");
+  static_assert(EXT_FILTER_DT == ExternalFilter::DT_TABLE_SIZE,
+		"external filter transitions of the lane kernels");
+
+  memset(&g, 0, sizeof(g));
+  g.dac6581 = dac6581;
+
+  // The external filter transitions are initialized by the first
+  // ExternalFilter, and are the same for all of them.
+  for (int m = 0; m < EXT_FILTER_DT; m++) {
+    const ExternalFilter::Transition& t = ExternalFilter::transition[m];
+    g.ext_transition[m][0] = t.lp_lp;
+    g.ext_transition[m][1] = t.hp_lp;
+    g.ext_transition[m][2] = t.hp_hp;
+  }
+  g.ext_lp_shift = ExternalFilter::DT_LP_SHIFT;
+  g.ext_hp_shift = ExternalFilter::DT_HP_SHIFT;
+}
+
+
+// ----------------------------------------------------------------------------
+// Load a lane into a group.
+// The kernels cover clock_span() of point sampled SID16s with the linear
+// filter and all voices clocked and mixed. Of the voices they do not cover
+// the test bit, hard sync and the combined waveforms with noise (these
+// write to the noise register).
+// ----------------------------------------------------------------------------
+bool SIDBank::load_lane(LaneGroup& g, int i, SID16& sid)
+{
+  g.loaded[i] = false;
+
+  if ((sid.sampling == SAMPLE_DECIMATE && sid.quality < QUALITY_POINT) ||
+      sid.direct_mixer || sid.voice_mask || sid.voice3_lag || sid.v0p ||
+      !sid.filter.enabled || sid.filter.nonlinear || !sid.extfilt.enabled) {
+    return false;
+  }
+
+  for (int v = 0; v < 3; v++) {
+    const WaveformGenerator& wave = sid.voice[v].wave;
+    if ((sid.forceOutput[v] & 3) || wave.test || wave.sync ||
+	wave.waveform > 0x8) {
+      return false;
+    }
+  }
+
+  for (int v = 0; v < 3; v++) {
+    const Voice& voice = sid.voice[v];
+    const WaveformGenerator& wave = voice.wave;
+    const EnvelopeGenerator& envelope = voice.envelope;
+
+    g.accumulator[v][i] = wave.accumulator;
+    g.freq[v][i] = wave.freq;
+    g.pw[v][i] = wave.pw;
+    g.msb_rising[v][i] = wave.msb_rising;
+    g.pulse_output[v][i] = wave.pulse_output;
+    g.no_pulse[v][i] = wave.no_pulse;
+    g.no_noise_or_noise_output[v][i] = wave.no_noise_or_noise_output;
+    g.ring_msb_mask[v][i] = wave.ring_msb_mask;
+    g.waveform[v][i] = wave.waveform;
+    g.waveform_output[v][i] = wave.waveform_output;
+    g.osc3[v][i] = wave.osc3;
+    g.floating_output_ttl[v][i] = wave.floating_output_ttl;
+    g.wave8[v][i] = wave.wave8;
+    g.saw_combined[v][i] = -(wave.sid_model == MOS6581 &&
+			     (wave.waveform & 0x2) && (wave.waveform & 0xd));
+
+    g.rate_counter[v][i] = envelope.rate_counter;
+    g.rate_period[v][i] = envelope.rate_period;
+    g.state_pipeline[v][i] = envelope.state_pipeline;
+    g.envelope_counter[v][i] = envelope.envelope_counter;
+    g.env3[v][i] = envelope.env3;
+
+    g.wave_zero[v][i] = voice.wave_zero;
+    g.voice_DC[v][i] = voice.voice_DC;
+  }
+  g.mos6581[i] = -(sid.voice[0].wave.sid_model == MOS6581);
+
+  const Filter& filter = sid.filter;
+  for (int k = 0; k < 4; k++) {
+    g.filt[k][i] = -((filter.filt >> k) & 1);
+  }
+  g.voice3_off[i] = -(filter.voice3off && !(filter.filt & 0x04));
+  for (int k = 0; k < 3; k++) {
+    g.mode[k][i] = -((filter.hp_bp_lp >> k) & 1);
+  }
+  g.vol[i] = filter.vol;
+  g.mixer_DC[i] = filter.mixer_DC;
+  g._1024_div_Q[i] = filter._1024_div_Q;
+  g.ext_in[i] = sid.ext_in;
+  g.Vhp[i] = filter.Vhp;
+  g.Vbp[i] = filter.Vbp;
+  g.Vlp[i] = filter.Vlp;
+  g.Vnf[i] = filter.Vnf;
+  g.transition_valid[i] = 0;
+
+  const ExternalFilter& extfilt = sid.extfilt;
+  g.w0lp[i] = extfilt.w0lp;
+  g.w0hp[i] = extfilt.w0hp;
+  g.ext_Vlp[i] = extfilt.Vlp;
+  g.ext_Vhp[i] = extfilt.Vhp;
+  g.ext_Vo[i] = extfilt.Vo;
+
+  g.loaded[i] = true;
+  g.cycles[i] = 0;
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Store a lane back into its SID16, and unload it.
+// Only the state the kernels change is written back, the envelope steps and
+// noise register shifts have been clocked in the SID16 already.
+// ----------------------------------------------------------------------------
+void SIDBank::store_lane(LaneGroup& g, int i, SID16& sid)
+{
+  for (int v = 0; v < 3; v++) {
+    WaveformGenerator& wave = sid.voice[v].wave;
+    EnvelopeGenerator& envelope = sid.voice[v].envelope;
+
+    wave.accumulator = g.accumulator[v][i];
+    wave.msb_rising = g.msb_rising[v][i] != 0;
+    wave.pulse_output = g.pulse_output[v][i];
+    wave.waveform_output = g.waveform_output[v][i];
+    wave.osc3 = g.osc3[v][i];
+    wave.floating_output_ttl = g.floating_output_ttl[v][i];
+
+    envelope.rate_counter = g.rate_counter[v][i];
+    envelope.env3 = g.env3[v][i];
+  }
+
+  sid.filter.Vhp = g.Vhp[i];
+  sid.filter.Vbp = g.Vbp[i];
+  sid.filter.Vlp = g.Vlp[i];
+  sid.filter.Vnf = g.Vnf[i];
+
+  sid.extfilt.Vlp = g.ext_Vlp[i];
+  sid.extfilt.Vhp = g.ext_Vhp[i];
+  sid.extfilt.Vo = g.ext_Vo[i];
+
+  // Age bus value.
+  sid.bus_value_ttl -= g.cycles[i];
+  if (sid.bus_value_ttl <= 0) {
+    sid.bus_value = 0;
+    sid.bus_value_ttl = 0;
+  }
+
+  g.loaded[i] = false;
+}
+
+
+// ----------------------------------------------------------------------------
+// Filter transitions of the loaded lanes, computed by their Filter on demand.
+// ----------------------------------------------------------------------------
+void SIDBank::load_transitions(LaneGroup& g, SID16* const* sid,
+			       cycle_count delta_t)
+{
+  const int k = delta_t - 1;
+
+  for (int i = 0; i < GROUP_LANES; i++) {
+    if (!g.loaded[i] || (g.transition_valid[i] & (1U << k))) {
+      continue;
+    }
+
+    Filter& filter = sid[i]->filter;
+    if (!(filter.transition_valid & (1U << k))) {
+      filter.set_transition(delta_t);
+    }
+    const Filter::Transition& t = filter.transition[k];
+    g.transition[k][0][i] = t.bp_bp;
+    g.transition[k][1][i] = t.bp_lp;
+    g.transition[k][2][i] = t.bp_hp;
+    g.transition[k][3][i] = t.bp_i;
+    g.transition[k][4][i] = t.lp_bp;
+    g.transition[k][5][i] = t.lp_lp;
+    g.transition[k][6][i] = t.lp_hp;
+    g.transition[k][7][i] = t.lp_i;
+    g.transition[k][8][i] = t.shift;
+    g.transition[k][9][i] = t.round;
+    g.transition_valid[i] |= 1U << k;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Output of a loaded lane.
+// ----------------------------------------------------------------------------
+short SIDBank::output(const LaneGroup& g, int i)
+{
+  const int range = 1 << 16;
+  const int half = range >> 1;
+  int sample = g.ext_Vo[i]/((4095*255 >> 7)*3*15*2/range);
+  if (sample >= half) {
+    return half - 1;
+  }
+  if (sample < -half) {
+    return -half;
+  }
+  return sample;
+}
+
+
+// ----------------------------------------------------------------------------
+// Queue a register write.
+// ----------------------------------------------------------------------------
+void SIDBank::write(int lane, cycle_count delta_t, reg8 offset, reg8 value)
+{
+  Lane& l = lane_state[lane];
+
+  // Drop the writes which have been applied.
+  if (l.next_write == l.writes.size()) {
+    l.writes.clear();
+    l.next_write = 0;
+  }
+
+  Write w = { delta_t, offset, value };
+  l.writes.push_back(w);
+}
+
+
+// ----------------------------------------------------------------------------
+// Number of render threads.
+// ----------------------------------------------------------------------------
+void SIDBank::set_threads(int n)
+{
+  n_threads = n < 1 ? 1 : n;
+}
+
+
+// ----------------------------------------------------------------------------
+// Render n samples of all lanes.
+// ----------------------------------------------------------------------------
+void SIDBank::render(int n, short* buf)
+{
+  // The ticks are the same for all lanes.
+  tick_delta_t.resize(n);
+  for (int i = 0; i < n; i++) {
+    cycle_count next = sample_offset + cycles_per_sample;
+    tick_delta_t[i] = next >> 16;
+    sample_offset = next & 0xffff;
+  }
+
+  // Lanes or groups of lanes.
+  int units = lane_kernels ? n_groups : n_lanes;
+  auto render_unit = [this, n, buf](int i) {
+    if (lane_kernels) {
+      render_group(i, n, buf);
+    }
+    else {
+      render_lane(i, n, buf);
+    }
+  };
+
+  // Starting the threads costs more than they save for short calls.
+  int threads = n_threads < units ? n_threads : units;
+  if (threads <= 1 || n < RENDER_THREADS_MIN) {
+    for (int i = 0; i < units; i++) {
+      render_unit(i);
+    }
+    return;
+  }
+
+  std::vector<std::thread> worker;
+  for (int t = 0; t < threads; t++) {
+    worker.push_back(std::thread([t, threads, units, &render_unit]() {
+      for (int i = t; i < units; i += threads) {
+	render_unit(i);
+      }
+    }));
+  }
+  for (int t = 0; t < threads; t++) {
+    worker[t].join();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Whether a write of the lane is due within the next delta_t cycles.
+// ----------------------------------------------------------------------------
+bool SIDBank::write_due(int lane, cycle_count delta_t) const
+{
+  const Lane& l = lane_state[lane];
+  return l.next_write < l.writes.size() &&
+    l.writes[l.next_write].delta_t - l.elapsed < delta_t;
+}
+
+
+// ----------------------------------------------------------------------------
+// One tick of one lane with its SID16, applying its writes at their cycles.
+// ----------------------------------------------------------------------------
+short SIDBank::render_tick(int lane, cycle_count delta_t)
+{
+  SID16& sid = *lane_sid[lane];
+  Lane& l = lane_state[lane];
+
+  // Writes before the tick.
+  while (l.next_write < l.writes.size()) {
+    const Write& w = l.writes[l.next_write];
+    cycle_count delta_t_write = w.delta_t - l.elapsed;
+    if (delta_t_write >= delta_t) {
+      break;
+    }
+    // Writes queued after their cycle has been rendered are applied now.
+    if (delta_t_write < 0) {
+      delta_t_write = 0;
+    }
+    sid.clock(delta_t_write);
+    sid.write(w.offset, w.value);
+    delta_t -= delta_t_write;
+    l.elapsed = 0;
+    l.next_write++;
+  }
+
+  sid.clock(delta_t);
+  l.elapsed += delta_t;
+  return sid.output();
+}
+
+
+// ----------------------------------------------------------------------------
+// Render n samples of one lane with its SID16.
+// ----------------------------------------------------------------------------
+void SIDBank::render_lane(int lane, int n, short* buf)
+{
+  for (int i = 0; i < n; i++) {
+    buf[i*n_lanes + lane] = render_tick(lane, tick_delta_t[i]);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Render n samples of a group of lanes with the lane kernels.
+// A lane leaves the group for the ticks with writes, and is loaded again
+// after them if the kernels cover its new configuration.
+// ----------------------------------------------------------------------------
+void SIDBank::render_group(int index, int n, short* buf)
+{
+  LaneGroup& g = group[index];
+  int lane0 = index*GROUP_LANES;
+  int lanes = n_lanes - lane0 < GROUP_LANES ? n_lanes - lane0 : GROUP_LANES;
+
+  for (int j = 0; j < lanes; j++) {
+    load_lane(g, j, *lane_sid[lane0 + j]);
+  }
+
+  for (int i = 0; i < n; i++) {
+    cycle_count delta_t = tick_delta_t[i];
+    bool due[GROUP_LANES];
+    bool loaded = false;
+
+    for (int j = 0; j < lanes; j++) {
+      due[j] = write_due(lane0 + j, delta_t);
+      if (due[j] && g.loaded[j]) {
+	store_lane(g, j, *lane_sid[lane0 + j]);
+      }
+      loaded |= g.loaded[j];
+    }
+
+    if (loaded) {
+      clock_group(g, lane_sid + lane0, delta_t);
+    }
+
+    for (int j = 0; j < lanes; j++) {
+      short& out = buf[i*n_lanes + lane0 + j];
+      if (g.loaded[j]) {
+	out = output(g, j);
+	lane_state[lane0 + j].elapsed += delta_t;
+      }
+      else {
+	out = render_tick(lane0 + j, delta_t);
+	if (due[j]) {
+	  load_lane(g, j, *lane_sid[lane0 + j]);
+	}
+      }
+    }
+  }
+
+  for (int j = 0; j < lanes; j++) {
+    if (g.loaded[j]) {
+      store_lane(g, j, *lane_sid[lane0 + j]);
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// clock_span(delta_t) of the loaded lanes of a group.
+// The kernels leave the voices with an envelope step or a noise register
+// shift in this tick as they were, these are clocked by the envelope and
+// waveform generators of their SID16 in between.
+// ----------------------------------------------------------------------------
+void SIDBank::clock_group(LaneGroup& g, SID16* const* sid, cycle_count delta_t)
+{
+  if (delta_t <= 0) {
+    return;
+  }
+
+  const Kernels& k = *lane_kernels;
+
+  k.envelope(g, delta_t);
+  k.accumulate(g, delta_t);
+
+  for (int i = 0; i < GROUP_LANES; i++) {
+    if (!g.loaded[i]) {
+      continue;
+    }
+    for (int v = 0; v < 3; v++) {
+      if (g.envelope_event[v][i]) {
+	EnvelopeGenerator& envelope = sid[i]->voice[v].envelope;
+	envelope.rate_counter = g.rate_counter[v][i];
+	envelope.clock(delta_t);
+	g.rate_counter[v][i] = envelope.rate_counter;
+	g.rate_period[v][i] = envelope.rate_period;
+	g.state_pipeline[v][i] = envelope.state_pipeline;
+	g.envelope_counter[v][i] = envelope.envelope_counter;
+	g.env3[v][i] = envelope.env3;
+      }
+      if (g.shift_event[v][i]) {
+	WaveformGenerator& wave = sid[i]->voice[v].wave;
+	wave.accumulator = g.accumulator[v][i];
+	wave.clock(delta_t);
+	g.accumulator[v][i] = wave.accumulator;
+	g.msb_rising[v][i] = wave.msb_rising;
+	g.no_noise_or_noise_output[v][i] = wave.no_noise_or_noise_output;
+      }
+    }
+  }
+
+  k.pulse(g);
+
+  // Combined waveforms are table lookups.
+  for (int i = 0; i < GROUP_LANES; i++) {
+    if (!g.loaded[i]) {
+      continue;
+    }
+    for (int v = 0; v < 3; v++) {
+      if ((g.waveform[v][i] & 0x3) == 0x3) {
+	int ix = (g.accumulator[v][i] ^
+		  (~g.accumulator[(v + 2) % 3][i] & g.ring_msb_mask[v][i])) >> 12;
+	g.wave8_output[v][i] = g.wave8[v][i][ix] << 4;
+      }
+    }
+  }
+
+  k.waveform(g, delta_t);
+  k.envelope_multiply(g);
+
+  const cycle_count delta_t_max = FILTER_DT;
+  for (cycle_count dt = delta_t; dt > delta_t_max; dt -= delta_t_max) {
+    load_transitions(g, sid, delta_t_max);
+  }
+  load_transitions(g, sid, (delta_t - 1) % delta_t_max + 1);
+  k.filter(g, delta_t);
+  k.external_filter(g, delta_t);
+
+  for (int i = 0; i < GROUP_LANES; i++) {
+    g.cycles[i] += delta_t;
+  }
+}
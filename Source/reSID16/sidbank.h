@@ -0,0 +1,268 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// please note that modifications have been made to this source code 
+// for the use in the SIDKick pico firmware!
+
+
+// Multi-instance rendering for host tools (regression corpora, A/B
+// comparisons, multi-SID tunes). Host only, not part of the firmware build.
+
+#ifndef __SIDBANK_H__
+#define __SIDBANK_H__
+
+#include "sid.h"
+#include <stddef.h>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// A bank of independent SID16 instances (lanes) rendered in lockstep: all
+// lanes share the clock frequency, the sampling rate and thus the cycles of
+// the sample ticks, while each lane has its own register writes.
+//
+// Every lane is a complete SID16, and the output of a lane is bit-exact with
+// a SID16 driven by the same writes (a write is applied after the sample of
+// a tick at the same cycle, as in the firmware). The backends differ in how
+// the lanes are clocked:
+// - BACKEND_SID16 clocks the SID16 of each lane.
+// - The lane backends load groups of GROUP_LANES lanes into lane-parallel
+//   arrays (LaneGroup) for the duration of render(), and clock a sample tick
+//   of all lanes of a group at once with the lane kernels (sidbank_kernels.h),
+//   either scalar or with SSE2 or AVX2 vectors.
+//   The kernels cover the regular part of the clocking: envelope rate
+//   counters, accumulator stepping, pulse compare, waveform output,
+//   envelope multiply, the linear filter and the external filter. The
+//   irregular part, envelope steps and noise register shifts, is handed to
+//   the SID16 components of the lane for the voices where it happens.
+//   Lanes with writes within a tick, and lanes in configurations the
+//   kernels do not cover (see load_lane()) are clocked by their SID16.
+// The lanes or groups of a render call are independent and are distributed
+// over set_threads() threads.
+// ----------------------------------------------------------------------------
+class SIDBank
+{
+public:
+  enum backend { BACKEND_SID16, BACKEND_SCALAR, BACKEND_SSE2, BACKEND_AVX2 };
+
+  SIDBank(int lanes, chip_model model, float clock_freq,
+	  sampling_method method, float sample_freq);
+  ~SIDBank();
+
+  int lanes() const { return n_lanes; }
+
+  // Per lane configuration (filter, voice mask, quality, ...).
+  SID16& sid(int lane) { return *lane_sid[lane]; }
+
+  // Queue a register write for a lane, delta_t cycles after the previous
+  // write of this lane (or after the start of the bank). Not to be called
+  // while render() is running.
+  void write(int lane, cycle_count delta_t, reg8 offset, reg8 value);
+
+  // Render n samples of all lanes to buf, interleaved by lane
+  // (buf[i*lanes() + lane]). Writes which are due within these samples are
+  // applied, later ones remain queued.
+  void render(int n, short* buf);
+
+  // Number of threads for render(), 1 (default) renders in the caller.
+  void set_threads(int n);
+
+  // The default backend is the fastest one supported by the build and the
+  // CPU. set_backend() returns false if b is not supported.
+  static bool backend_supported(backend b);
+  bool set_backend(backend b);
+  backend get_backend() const { return lane_backend; }
+
+  // Lanes per group of the lane backends, the widest vector.
+  static const int GROUP_LANES = 8;
+
+  // Filter integration steps of the lane kernels, Filter::DT_CACHE_SIZE.
+  static const int FILTER_DT = 32;
+
+  // External filter 8-cycle steps per transition, ExternalFilter::DT_TABLE_SIZE.
+  static const int EXT_FILTER_DT = 8;
+
+  // Lane-parallel state of a group of lanes, [lane] or [voice][lane].
+  // Fields which are copies of SID16 members have their names.
+  struct LaneGroup
+  {
+    // Waveform generators.
+    alignas(32) int accumulator[3][GROUP_LANES];
+    alignas(32) int freq[3][GROUP_LANES];
+    alignas(32) int pw[3][GROUP_LANES];
+    alignas(32) int msb_rising[3][GROUP_LANES];
+    alignas(32) int pulse_output[3][GROUP_LANES];
+    alignas(32) int no_pulse[3][GROUP_LANES];
+    alignas(32) int no_noise_or_noise_output[3][GROUP_LANES];
+    alignas(32) int ring_msb_mask[3][GROUP_LANES];
+    alignas(32) int waveform[3][GROUP_LANES];
+    alignas(32) int waveform_output[3][GROUP_LANES];
+    alignas(32) int osc3[3][GROUP_LANES];
+    alignas(32) int floating_output_ttl[3][GROUP_LANES];
+    // Combined waveform table output, looked up per lane before the
+    // waveform kernel (see wave8 in WaveformGenerator).
+    alignas(32) int wave8_output[3][GROUP_LANES];
+    const unsigned char* wave8[3][GROUP_LANES];
+    // MOS6581 combined waveforms with sawtooth, which pull the accumulator
+    // MSB down (mask).
+    alignas(32) int saw_combined[3][GROUP_LANES];
+    // Noise register shifts in the current tick (mask).
+    alignas(32) int shift_event[3][GROUP_LANES];
+
+    // Envelope generators.
+    alignas(32) int rate_counter[3][GROUP_LANES];
+    alignas(32) int rate_period[3][GROUP_LANES];
+    alignas(32) int state_pipeline[3][GROUP_LANES];
+    alignas(32) int envelope_counter[3][GROUP_LANES];
+    alignas(32) int env3[3][GROUP_LANES];
+    // Envelope steps in the current tick (mask).
+    alignas(32) int envelope_event[3][GROUP_LANES];
+
+    // Voices: DAC output of the waveform, and amplitude modulated output.
+    alignas(32) int wave_dac[3][GROUP_LANES];
+    alignas(32) int wave_zero[3][GROUP_LANES];
+    alignas(32) int voice_DC[3][GROUP_LANES];
+    alignas(32) int voice_output[3][GROUP_LANES];
+    // MOS6581 DAC (mask), and its table for all 12-bit waveform outputs.
+    alignas(32) int mos6581[GROUP_LANES];
+    const int* dac6581;
+
+    // Filter. The routing and mode bits are masks, voice3_off is voice3off
+    // unless voice 3 is filtered.
+    alignas(32) int filt[4][GROUP_LANES];
+    alignas(32) int voice3_off[GROUP_LANES];
+    alignas(32) int mode[3][GROUP_LANES];
+    alignas(32) int vol[GROUP_LANES];
+    alignas(32) int mixer_DC[GROUP_LANES];
+    alignas(32) int _1024_div_Q[GROUP_LANES];
+    alignas(32) int ext_in[GROUP_LANES];
+    alignas(32) int Vhp[GROUP_LANES];
+    alignas(32) int Vbp[GROUP_LANES];
+    alignas(32) int Vlp[GROUP_LANES];
+    alignas(32) int Vnf[GROUP_LANES];
+    alignas(32) int filter_output[GROUP_LANES];
+    // Transition coefficients for 1 .. FILTER_DT cycles (Filter::Transition:
+    // bp_bp, bp_lp, bp_hp, bp_i, lp_bp, lp_lp, lp_hp, lp_i, shift, round),
+    // and the lengths for which they have been copied, per lane.
+    alignas(32) int transition[FILTER_DT][10][GROUP_LANES];
+    unsigned int transition_valid[GROUP_LANES];
+
+    // External filter, and its transitions for 1 .. EXT_FILTER_DT 8-cycle
+    // steps (ExternalFilter::Transition: lp_lp, hp_lp, hp_hp) with their
+    // shifts, which are the same for all lanes.
+    int ext_transition[EXT_FILTER_DT][3];
+    int ext_lp_shift, ext_hp_shift;
+    alignas(32) int w0lp[GROUP_LANES];
+    alignas(32) int w0hp[GROUP_LANES];
+    alignas(32) int ext_Vlp[GROUP_LANES];
+    alignas(32) int ext_Vhp[GROUP_LANES];
+    alignas(32) int ext_Vo[GROUP_LANES];
+
+    // Lane is loaded, i.e. this state is its current state, and cycles
+    // clocked since it has been loaded.
+    bool loaded[GROUP_LANES];
+    cycle_count cycles[GROUP_LANES];
+  };
+
+  // One kernel set per backend, each kernel updates all lanes of a group.
+  struct Kernels
+  {
+    // Envelope rate counters, and envelope_event where a step is due.
+    void (*envelope)(LaneGroup& g, cycle_count delta_t);
+    // Accumulators and msb_rising, and shift_event where the noise register
+    // is shifted. Voices with events keep their accumulator.
+    void (*accumulate)(LaneGroup& g, cycle_count delta_t);
+    void (*pulse)(LaneGroup& g);
+    // Waveform output (incl. floating DAC input) and its DAC output.
+    void (*waveform)(LaneGroup& g, cycle_count delta_t);
+    void (*envelope_multiply)(LaneGroup& g);
+    // Voice routing, filter integration and mixer, for delta_t cycles in
+    // steps of at most FILTER_DT cycles.
+    void (*filter)(LaneGroup& g, cycle_count delta_t);
+    void (*external_filter)(LaneGroup& g, cycle_count delta_t);
+  };
+
+  // NULL for BACKEND_SID16 and for backends which are not supported.
+  static const Kernels* kernels(backend b);
+
+  // The lanes are loaded for the duration of render() only, the following
+  // are public for testing the kernels.
+  // Initialize a group with no lanes loaded.
+  static void init_group(LaneGroup& g);
+
+  // Copy a lane from its SID16 into a group and back. load_lane() returns
+  // false (and leaves the lane unloaded) if the kernels do not cover the
+  // configuration of the SID16.
+  static bool load_lane(LaneGroup& g, int i, SID16& sid);
+  static void store_lane(LaneGroup& g, int i, SID16& sid);
+
+  // Copy the filter transitions for delta_t cycles of the loaded lanes into
+  // the group, sid[i] being the SID16 of lane i.
+  static void load_transitions(LaneGroup& g, SID16* const* sid,
+			       cycle_count delta_t);
+
+  // SID16::output() of a loaded lane.
+  static short output(const LaneGroup& g, int i);
+
+protected:
+  struct Write
+  {
+    cycle_count delta_t;
+    reg8 offset;
+    reg8 value;
+  };
+
+  struct Lane
+  {
+    std::vector<Write> writes;
+    size_t next_write;
+    // Cycles since the previous write.
+    cycle_count elapsed;
+  };
+
+  // A write of the lane is due before the end of a tick of delta_t cycles.
+  bool write_due(int lane, cycle_count delta_t) const;
+  // One tick of one lane with its SID16, including the writes before the
+  // tick.
+  short render_tick(int lane, cycle_count delta_t);
+  void render_lane(int lane, int n, short* buf);
+  void render_group(int index, int n, short* buf);
+  // clock_span(delta_t) of the loaded lanes of a group.
+  void clock_group(LaneGroup& g, SID16* const* sid, cycle_count delta_t);
+
+  // Minimum number of samples for rendering in threads.
+  static const int RENDER_THREADS_MIN = 256;
+
+  int n_lanes;
+  int n_threads;
+  SID16** lane_sid;
+  Lane* lane_state;
+
+  backend lane_backend;
+  const Kernels* lane_kernels;
+  int n_groups;
+  LaneGroup* group;
+
+  // Sample ticks, 16.16 fixpoint.
+  cycle_count cycles_per_sample;
+  cycle_count sample_offset;
+  // Cycles to each tick of the current render call.
+  std::vector<cycle_count> tick_delta_t;
+};
+
+#endif // not __SIDBANK_H__
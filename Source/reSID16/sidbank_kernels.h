@@ -0,0 +1,458 @@
+//  ---------------------------------------------------------------------------
+//  This file is part of reSID, a MOS6581 SID emulator engine.
+//  Copyright (C) 2004  Dag Lem <resid@nimrod.no>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//  ---------------------------------------------------------------------------
+
+// please note that modifications have been made to this source code
+// for the use in the SIDKick pico firmware!
+
+
+// Lane kernels of SIDBank, instantiated for each vector type by the
+// translation unit compiled for it (sidbank.cc: scalar and SSE2,
+// sidbank_avx2.cc: AVX2). Host only.
+// Everything here has internal linkage, and nothing here may call the inline
+// functions of the reSID classes: these would be compiled for AVX2 in
+// sidbank_avx2.cc, and the linker may pick that copy for all callers.
+
+#ifndef __SIDBANK_KERNELS_H__
+#define __SIDBANK_KERNELS_H__
+
+#include "sidbank.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// ----------------------------------------------------------------------------
+// Lane vectors: W lanes of 32-bit integers. Arithmetic wraps around as in
+// the two's complement arithmetic of the scalar code, comparisons return
+// masks (all bits set in lanes where true).
+// ----------------------------------------------------------------------------
+struct LaneScalar
+{
+  typedef int T;
+  static const int W = 1;
+
+  static T load(const int* p) { return *p; }
+  static void store(int* p, T a) { *p = a; }
+  static T set1(int a) { return a; }
+  static T add(T a, T b) { return int(unsigned(a) + unsigned(b)); }
+  static T sub(T a, T b) { return int(unsigned(a) - unsigned(b)); }
+  static T mul(T a, T b) { return int(unsigned(a)*unsigned(b)); }
+  static T and_(T a, T b) { return a & b; }
+  static T or_(T a, T b) { return a | b; }
+  static T xor_(T a, T b) { return a ^ b; }
+  // ~a & b
+  static T andnot(T a, T b) { return ~a & b; }
+  static T sra(T a, int n) { return a >> n; }
+  static T srl(T a, int n) { return int(unsigned(a) >> n); }
+  static T sll(T a, int n) { return int(unsigned(a) << n); }
+  static T srav(T a, T n) { return a >> n; }
+  static T cmpgt(T a, T b) { return -(a > b); }
+  static T cmpeq(T a, T b) { return -(a == b); }
+  static T gather(const int* table, T i) { return table[i]; }
+};
+
+#if defined(__SSE2__)
+struct LaneSSE2
+{
+  typedef __m128i T;
+  static const int W = 4;
+
+  static T load(const int* p) { return _mm_load_si128((const __m128i*)p); }
+  static void store(int* p, T a) { _mm_store_si128((__m128i*)p, a); }
+  static T set1(int a) { return _mm_set1_epi32(a); }
+  static T add(T a, T b) { return _mm_add_epi32(a, b); }
+  static T sub(T a, T b) { return _mm_sub_epi32(a, b); }
+  static T mul(T a, T b)
+  {
+    // No 32-bit multiply before SSE4.1: the low halves of the products of
+    // the even and the odd lanes.
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			      _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+  }
+  static T and_(T a, T b) { return _mm_and_si128(a, b); }
+  static T or_(T a, T b) { return _mm_or_si128(a, b); }
+  static T xor_(T a, T b) { return _mm_xor_si128(a, b); }
+  static T andnot(T a, T b) { return _mm_andnot_si128(a, b); }
+  static T sra(T a, int n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+  static T srl(T a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+  static T sll(T a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+  static T srav(T a, T n)
+  {
+    // No per lane shift counts before AVX2: shift by each bit of the count.
+    for (int b = 1; b < 32; b <<= 1) {
+      __m128i m = _mm_cmpeq_epi32(_mm_and_si128(n, _mm_set1_epi32(b)),
+				  _mm_set1_epi32(b));
+      __m128i s = _mm_sra_epi32(a, _mm_cvtsi32_si128(b));
+      a = _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, a));
+    }
+    return a;
+  }
+  static T cmpgt(T a, T b) { return _mm_cmpgt_epi32(a, b); }
+  static T cmpeq(T a, T b) { return _mm_cmpeq_epi32(a, b); }
+  static T gather(const int* table, T i)
+  {
+    alignas(16) int ix[4];
+    _mm_store_si128((__m128i*)ix, i);
+    return _mm_set_epi32(table[ix[3]], table[ix[2]], table[ix[1]],
+			 table[ix[0]]);
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+struct LaneAVX2
+{
+  typedef __m256i T;
+  static const int W = 8;
+
+  static T load(const int* p) { return _mm256_load_si256((const __m256i*)p); }
+  static void store(int* p, T a) { _mm256_store_si256((__m256i*)p, a); }
+  static T set1(int a) { return _mm256_set1_epi32(a); }
+  static T add(T a, T b) { return _mm256_add_epi32(a, b); }
+  static T sub(T a, T b) { return _mm256_sub_epi32(a, b); }
+  static T mul(T a, T b) { return _mm256_mullo_epi32(a, b); }
+  static T and_(T a, T b) { return _mm256_and_si256(a, b); }
+  static T or_(T a, T b) { return _mm256_or_si256(a, b); }
+  static T xor_(T a, T b) { return _mm256_xor_si256(a, b); }
+  static T andnot(T a, T b) { return _mm256_andnot_si256(a, b); }
+  static T sra(T a, int n) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+  static T srl(T a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+  static T sll(T a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+  static T srav(T a, T n) { return _mm256_srav_epi32(a, n); }
+  static T cmpgt(T a, T b) { return _mm256_cmpgt_epi32(a, b); }
+  static T cmpeq(T a, T b) { return _mm256_cmpeq_epi32(a, b); }
+  static T gather(const int* table, T i)
+  {
+    return _mm256_i32gather_epi32(table, i, 4);
+  }
+};
+#endif
+
+
+// ----------------------------------------------------------------------------
+// The kernels, one clock_span() step of delta_t cycles of all lanes of a
+// group, split at the points where SIDBank hands voices to their SID16 (see
+// SIDBank::clock_group()). Each kernel is the lane-parallel form of the
+// scalar code it names; lanes which are not loaded are computed as well, on
+// whatever state they hold, and are ignored.
+// ----------------------------------------------------------------------------
+template<class V>
+struct LaneKernels
+{
+  typedef typename V::T T;
+  typedef SIDBank::LaneGroup LaneGroup;
+  static const int N = SIDBank::GROUP_LANES;
+
+  static T not_(T a) { return V::xor_(a, V::set1(-1)); }
+
+  // Mask ? a : b.
+  static T select(T mask, T a, T b)
+  {
+    return V::or_(V::and_(mask, a), V::andnot(mask, b));
+  }
+
+  // EnvelopeGenerator::clock(delta_t) while no envelope step is due.
+  static void envelope(LaneGroup& g, cycle_count delta_t)
+  {
+    const T dt = V::set1(delta_t);
+    const T zero = V::set1(0);
+
+    for (int v = 0; v < 3; v++) {
+      for (int i = 0; i < N; i += V::W) {
+	T rate_counter = V::load(&g.rate_counter[v][i]);
+
+	// ADSR delay bug: the counter wraps around at 0x8000 first.
+	T rate_step = V::sub(V::load(&g.rate_period[v][i]), rate_counter);
+	rate_step = V::add(rate_step, V::and_(V::cmpgt(V::set1(1), rate_step),
+					      V::set1(0x7fff)));
+
+	T event = V::or_(not_(V::cmpgt(rate_step, dt)),
+			 not_(V::cmpeq(V::load(&g.state_pipeline[v][i]), zero)));
+
+	T rc = V::add(rate_counter, dt);
+	T wrap = V::cmpeq(V::and_(rc, V::set1(0x8000)), V::set1(0x8000));
+	rc = select(wrap, V::and_(V::add(rc, V::set1(1)), V::set1(0x7fff)), rc);
+
+	V::store(&g.rate_counter[v][i], select(event, rate_counter, rc));
+	V::store(&g.env3[v][i], select(event, V::load(&g.env3[v][i]),
+				       V::load(&g.envelope_counter[v][i])));
+	V::store(&g.envelope_event[v][i], event);
+      }
+    }
+  }
+
+  // WaveformGenerator::clock(delta_t) without test bit, while the noise
+  // register is not shifted.
+  static void accumulate(LaneGroup& g, cycle_count delta_t)
+  {
+    const T dt = V::set1(delta_t);
+    const T bit19 = V::set1(0x080000);
+
+    for (int v = 0; v < 3; v++) {
+      for (int i = 0; i < N; i += V::W) {
+	T accumulator = V::load(&g.accumulator[v][i]);
+	T delta_accumulator = V::mul(dt, V::load(&g.freq[v][i]));
+	T accumulator_next =
+	  V::and_(V::add(accumulator, delta_accumulator), V::set1(0xffffff));
+	T msb_rising =
+	  V::srl(V::and_(V::andnot(accumulator, accumulator_next),
+			 V::set1(0x800000)), 23);
+
+	// Bit 19 is set high at least once for 0x100000 or more, below that
+	// when it flips from 0 to 1, and for more than 0x080000 also when it
+	// flips from 0 via 1 to 0 or from 1 via 0 to 1.
+	T bit19_old = V::cmpeq(V::and_(accumulator, bit19), bit19);
+	T bit19_new = V::cmpeq(V::and_(accumulator_next, bit19), bit19);
+	T shift =
+	  select(V::cmpgt(delta_accumulator, V::set1(0x0fffff)), V::set1(-1),
+		 select(V::cmpgt(V::set1(0x080001), delta_accumulator),
+			V::andnot(bit19_old, bit19_new),
+			not_(V::andnot(bit19_new, bit19_old))));
+
+	V::store(&g.accumulator[v][i],
+		 select(shift, accumulator, accumulator_next));
+	V::store(&g.msb_rising[v][i],
+		 select(shift, V::load(&g.msb_rising[v][i]), msb_rising));
+	V::store(&g.shift_event[v][i], shift);
+      }
+    }
+  }
+
+  static void pulse(LaneGroup& g)
+  {
+    for (int v = 0; v < 3; v++) {
+      for (int i = 0; i < N; i += V::W) {
+	T ix = V::srl(V::load(&g.accumulator[v][i]), 12);
+	V::store(&g.pulse_output[v][i],
+		 V::andnot(V::cmpgt(V::load(&g.pw[v][i]), ix), V::set1(0xfff)));
+      }
+    }
+  }
+
+  // WaveformGenerator::set_waveform_output(delta_t) and output(). The voices
+  // are computed in order, as ring modulation takes the accumulator of the
+  // previous voice after its combined waveform pull-down.
+  static void waveform(LaneGroup& g, cycle_count delta_t)
+  {
+    const T dt = V::set1(delta_t);
+    const T zero = V::set1(0);
+
+    for (int v = 0; v < 3; v++) {
+      int src = (v + 2) % 3;
+      for (int i = 0; i < N; i += V::W) {
+	T waveform = V::load(&g.waveform[v][i]);
+	T accumulator = V::load(&g.accumulator[v][i]);
+	T ix = V::srl(V::xor_(accumulator,
+			      V::andnot(V::load(&g.accumulator[src][i]),
+					V::load(&g.ring_msb_mask[v][i]))), 12);
+
+	T acc = V::sll(ix, 12);
+	T msb = V::cmpeq(V::and_(acc, V::set1(0x800000)), V::set1(0x800000));
+	T triangle = V::and_(V::srl(V::xor_(acc, msb), 11), V::set1(0xffe));
+
+	T select_class = V::and_(waveform, V::set1(3));
+	T output =
+	  select(V::cmpeq(select_class, zero), V::set1(0xfff),
+	  select(V::cmpeq(select_class, V::set1(1)), triangle,
+	  select(V::cmpeq(select_class, V::set1(2)), ix,
+		 V::load(&g.wave8_output[v][i]))));
+	output = V::and_(output,
+			 V::and_(V::or_(V::load(&g.no_pulse[v][i]),
+					V::load(&g.pulse_output[v][i])),
+				 V::load(&g.no_noise_or_noise_output[v][i])));
+
+	// MOS6581 combined waveforms with sawtooth.
+	accumulator =
+	  select(V::load(&g.saw_combined[v][i]),
+		 V::and_(accumulator,
+			 V::or_(V::sll(output, 12), V::set1(0x7fffff))),
+		 accumulator);
+	V::store(&g.accumulator[v][i], accumulator);
+
+	// Floating DAC input for waveform 0.
+	T ttl = V::load(&g.floating_output_ttl[v][i]);
+	T floating = not_(V::cmpeq(ttl, zero));
+	T ttl_next = V::sub(ttl, dt);
+	T expired = V::andnot(V::cmpgt(ttl_next, zero), floating);
+	ttl_next = V::andnot(expired, select(floating, ttl_next, ttl));
+
+	T active = not_(V::cmpeq(waveform, zero));
+	output = select(active, output,
+			V::andnot(expired, V::load(&g.waveform_output[v][i])));
+	V::store(&g.waveform_output[v][i], output);
+	V::store(&g.floating_output_ttl[v][i], select(active, ttl, ttl_next));
+	V::store(&g.osc3[v][i],
+		 select(active, output, V::load(&g.osc3[v][i])));
+
+	V::store(&g.wave_dac[v][i],
+		 select(V::load(&g.mos6581[i]),
+			V::gather(g.dac6581, V::and_(output, V::set1(0xfff))),
+			output));
+      }
+    }
+  }
+
+  // Voice::output().
+  static void envelope_multiply(LaneGroup& g)
+  {
+    for (int v = 0; v < 3; v++) {
+      for (int i = 0; i < N; i += V::W) {
+	T dac = V::sub(V::load(&g.wave_dac[v][i]), V::load(&g.wave_zero[v][i]));
+	V::store(&g.voice_output[v][i],
+		 V::add(V::mul(dac, V::load(&g.envelope_counter[v][i])),
+			V::load(&g.voice_DC[v][i])));
+      }
+    }
+  }
+
+  // Filter::clock(delta_t, ...) of the linear filter, and Filter::output().
+  // The transitions for the step lengths of delta_t are in the group (see
+  // SIDBank::load_transitions()).
+  static void filter(LaneGroup& g, cycle_count delta_t)
+  {
+    const cycle_count delta_t_max = SIDBank::FILTER_DT;
+
+    for (int i = 0; i < N; i += V::W) {
+      T voice1 = V::sra(V::load(&g.voice_output[0][i]), 7);
+      T voice2 = V::sra(V::load(&g.voice_output[1][i]), 7);
+      T voice3 = V::andnot(V::load(&g.voice3_off[i]),
+			   V::sra(V::load(&g.voice_output[2][i]), 7));
+      T ext_in = V::sra(V::load(&g.ext_in[i]), 7);
+
+      // Route voices into or around filter.
+      T filt1 = V::load(&g.filt[0][i]);
+      T filt2 = V::load(&g.filt[1][i]);
+      T filt3 = V::load(&g.filt[2][i]);
+      T filtex = V::load(&g.filt[3][i]);
+      T Vi = V::add(V::add(V::and_(filt1, voice1), V::and_(filt2, voice2)),
+		    V::add(V::and_(filt3, voice3), V::and_(filtex, ext_in)));
+      T Vnf = V::add(V::add(V::andnot(filt1, voice1), V::andnot(filt2, voice2)),
+		     V::add(V::andnot(filt3, voice3), V::andnot(filtex, ext_in)));
+
+      T Vhp = V::load(&g.Vhp[i]);
+      T Vbp = V::load(&g.Vbp[i]);
+      T Vlp = V::load(&g.Vlp[i]);
+      T _1024_div_Q = V::load(&g._1024_div_Q[i]);
+
+      for (cycle_count dt = delta_t; dt; ) {
+	cycle_count delta_t_flt = dt < delta_t_max ? dt : delta_t_max;
+	const int (*t)[N] = g.transition[delta_t_flt - 1];
+
+	T shift = V::load(&t[8][i]);
+	T round = V::load(&t[9][i]);
+	T dVbp = V::srav(V::add(V::add(V::add(V::mul(V::load(&t[0][i]), Vbp),
+					      V::mul(V::load(&t[1][i]), Vlp)),
+				       V::add(V::mul(V::load(&t[2][i]), Vhp),
+					      V::mul(V::load(&t[3][i]), Vi))),
+				round), shift);
+	T dVlp = V::srav(V::add(V::add(V::add(V::mul(V::load(&t[4][i]), Vbp),
+					      V::mul(V::load(&t[5][i]), Vlp)),
+				       V::add(V::mul(V::load(&t[6][i]), Vhp),
+					      V::mul(V::load(&t[7][i]), Vi))),
+				round), shift);
+	Vbp = V::add(Vbp, dVbp);
+	Vlp = V::add(Vlp, dVlp);
+	Vhp = V::sub(V::sub(V::sra(V::mul(Vbp, _1024_div_Q), 10), Vlp), Vi);
+
+	dt -= delta_t_flt;
+      }
+
+      V::store(&g.Vhp[i], Vhp);
+      V::store(&g.Vbp[i], Vbp);
+      V::store(&g.Vlp[i], Vlp);
+      V::store(&g.Vnf[i], Vnf);
+
+      // Mix highpass, bandpass, and lowpass outputs.
+      T Vf = V::add(V::add(V::and_(V::load(&g.mode[0][i]), Vlp),
+			   V::and_(V::load(&g.mode[1][i]), Vbp)),
+		    V::and_(V::load(&g.mode[2][i]), Vhp));
+      V::store(&g.filter_output[i],
+	       V::mul(V::add(V::add(Vnf, Vf), V::load(&g.mixer_DC[i])),
+		      V::load(&g.vol[i])));
+    }
+  }
+
+  // ExternalFilter::clock(delta_t, Vi).
+  static void external_filter(LaneGroup& g, cycle_count delta_t)
+  {
+    const cycle_count m_max = SIDBank::EXT_FILTER_DT;
+
+    // All 8-cycle steps but the last one are taken from the transitions.
+    cycle_count m = 0;
+    if (delta_t > 8) {
+      m = (delta_t - 1) >> 3;
+      delta_t -= m << 3;
+    }
+    const T dt = V::set1(delta_t);
+
+    for (int i = 0; i < N; i += V::W) {
+      T Vi = V::load(&g.filter_output[i]);
+      T Vlp = V::load(&g.ext_Vlp[i]);
+      T Vhp = V::load(&g.ext_Vhp[i]);
+
+      for (cycle_count k = m; k; ) {
+	cycle_count m_flt = k < m_max ? k : m_max;
+	const int* t = g.ext_transition[m_flt - 1];
+
+	T u = V::sub(Vlp, Vi);
+	T w = V::sub(Vhp, Vi);
+	Vlp = V::add(Vi, V::sra(V::mul(V::set1(t[0]), u), g.ext_lp_shift));
+	Vhp = V::add(Vhp, V::sra(V::add(V::mul(V::set1(t[1]), u),
+					V::mul(V::set1(t[2]), w)),
+				 g.ext_hp_shift));
+
+	k -= m_flt;
+      }
+
+      T dVlp = V::sra(V::mul(V::sra(V::mul(V::load(&g.w0lp[i]), dt), 8),
+			     V::sub(Vi, Vlp)), 12);
+      T dVhp = V::sra(V::mul(V::mul(V::load(&g.w0hp[i]), dt),
+			     V::sub(Vlp, Vhp)), 20);
+      V::store(&g.ext_Vo[i], V::sub(Vlp, Vhp));
+      V::store(&g.ext_Vlp[i], V::add(Vlp, dVlp));
+      V::store(&g.ext_Vhp[i], V::add(Vhp, dVhp));
+    }
+  }
+};
+
+template<class V>
+const SIDBank::Kernels* kernel_table()
+{
+  static const SIDBank::Kernels kernels = {
+    LaneKernels<V>::envelope,
+    LaneKernels<V>::accumulate,
+    LaneKernels<V>::pulse,
+    LaneKernels<V>::waveform,
+    LaneKernels<V>::envelope_multiply,
+    LaneKernels<V>::filter,
+    LaneKernels<V>::external_filter
+  };
+  return &kernels;
+}
+
+} // namespace
+
+#endif // not __SIDBANK_KERNELS_H__
@@ -49,7 +49,12 @@ typedef sound_sample fc_point[2];
 enum chip_model { MOS6581, MOS8580 };
 
 enum sampling_method { SAMPLE_FAST, SAMPLE_INTERPOLATE,
-		       SAMPLE_RESAMPLE_INTERPOLATE, SAMPLE_RESAMPLE_FAST };
+		       SAMPLE_RESAMPLE_INTERPOLATE, SAMPLE_RESAMPLE_FAST,
+		       SAMPLE_DECIMATE };
+
+// Quality tiers for load shedding, from best to cheapest.
+enum quality_level { QUALITY_FULL, QUALITY_COARSE, QUALITY_LINEAR,
+		     QUALITY_POINT };
 
 extern "C"
 {
@@ -56,6 +56,7 @@ protected:
 int freezedEnvelope;
 
 friend class SID16;
+friend class SIDBank;
 };
 
 
@@ -122,6 +122,7 @@ protected:
 
 friend class Voice;
 friend class SID16;
+friend class SIDBank;
 };
 
 extern const unsigned short model_wave[ 2 ][ 8 ][ 1 << 12 ];
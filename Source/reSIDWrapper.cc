@@ -33,6 +33,13 @@
 #include "reSID16/sid.h"
 
 #include "reSID_LUT.h"
+#include "osc3predict.h"
+
+// output sampling, from config: point sampling once per sample, or decimating output (boxcar + half-band
+// filter over the clocked span), which has about 9dB less aliasing but costs about 4x the emulation time
+// (2.5x in the governor's coarse tier, see tests/test_aliasing.cc and tests/test_rendercost.cc). Under load
+// the quality governor falls back to point sampling.
+#define SID_SAMPLING_METHOD     ( config[ CFG_SID_SAMPLING ] == 1 ? SAMPLE_DECIMATE : SAMPLE_INTERPOLATE )
 
 // 6581, 8580, 8580+digiboost, none
 #define CFG_SID1_TYPE           0
@@ -40,17 +47,27 @@
 #define CFG_SID1_DIGIBOOST      1
 // 0 .. 14
 #define CFG_SID1_VOLUME         3
+// 0 = linear (reSID 0.16), 1 = non-linear (6581 only)
+#define CFG_SID1_FILTER         5
+// bit 0..2 = mute voice 1..3
+#define CFG_SID1_VOICEMASK      6
 
 #define CFG_SID2_TYPE           8
 #define CFG_SID2_DIGIBOOST      9
 #define CFG_SID2_ADDRESS        10
 #define CFG_SID2_VOLUME         11
+#define CFG_SID2_FILTER         13
+#define CFG_SID2_VOICEMASK      14
 
 // 0 .. 14
 #define CFG_SID_PANNING         12
 #define CFG_SID_BALANCE         58
 
 #define CFG_REGISTER_READ       2
+// 0 = point sampling, 1 = decimating
+#define CFG_SID_SAMPLING        55
+// 0 = 44.1kHz, 1 = 48kHz, 2 = 96kHz
+#define CFG_AUDIO_RATE          56
 #define CFG_TRIGGER             57
 #define CFG_CLOCKSPEED          59
 #define CFG_POT_FILTER          60
@@ -62,6 +79,7 @@ static int32_t actVolSID1_Left, actVolSID1_Right;
 static int32_t actVolSID2_Left, actVolSID2_Right;
 
 uint32_t C64_CLOCK = 985248;
+uint32_t AUDIO_RATE = 44100;
 uint8_t  SID_DIGI_DETECT = 0;
 uint32_t SID2_FLAG = 0; 
 uint8_t  SID2_IOx_global = 0;
@@ -120,9 +138,14 @@ extern "C"
         config[ CFG_SID2_DIGIBOOST ] = 12;
         config[ CFG_SID1_VOLUME ] = 14;
         config[ CFG_SID2_VOLUME ] = 14;
+        config[ CFG_SID1_FILTER ] = 0;
+        config[ CFG_SID2_FILTER ] = 0;
+        config[ CFG_SID1_VOICEMASK ] = 0;
+        config[ CFG_SID2_VOICEMASK ] = 0;
         config[ CFG_SID_PANNING ] = 5;
         config[ CFG_SID_BALANCE ] = 7;
         config[ CFG_CLOCKSPEED ] = 0;
+        config[ CFG_AUDIO_RATE ] = 0;
         config[ CFG_POT_FILTER ] = 16;      // obvious outlier-rejection
         config[ CFG_DIGIDETECT ] = 0;
         config[ CFG_TRIGGER ] = 0;
@@ -138,7 +161,11 @@ extern "C"
             sid16->set_chip_model( MOS6581 ); else
             sid16->set_chip_model( MOS8580 );
 
+        sid16->enable_nonlinear_filter( config[ CFG_SID1_FILTER ] == 1 );
+        sid16->set_voice_mask( config[ CFG_SID1_VOICEMASK ] );
+
         const uint32_t c64clock[ 3 ] = { 985248, 1022727, 1023440 };
+        const uint32_t audioRate[ 3 ] = { 44100, 48000, 96000 };
 
         if ( config[ CFG_SID1_TYPE ] == 2 )
             sid16->input( - ( 1 << config[ CFG_SID1_DIGIBOOST ] ) ); else
@@ -148,14 +175,18 @@ extern "C"
             sid16b->set_chip_model( MOS6581 ); else
             sid16b->set_chip_model( MOS8580 );
 
+        sid16b->enable_nonlinear_filter( config[ CFG_SID2_FILTER ] == 1 );
+        sid16b->set_voice_mask( config[ CFG_SID2_VOICEMASK ] );
+
         if ( config[ CFG_SID2_TYPE ] == 2 )
             sid16b->input( - ( 1 << config[ CFG_SID2_DIGIBOOST ] ) ); else
             sid16b->input( 0 );
 
 
         C64_CLOCK = c64clock[ config[ CFG_CLOCKSPEED ] % 3 ];
-        sid16->set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, 44100 );
-        sid16b->set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, 44100 );
+        AUDIO_RATE = audioRate[ config[ CFG_AUDIO_RATE ] % 3 ];
+        sid16->set_sampling_parameters( C64_CLOCK, SID_SAMPLING_METHOD, AUDIO_RATE );
+        sid16b->set_sampling_parameters( C64_CLOCK, SID_SAMPLING_METHOD, AUDIO_RATE );
 
         extern const uint32_t sidFlags[ 6 ];
         SID2_FLAG = sidFlags[ config[ CFG_SID2_ADDRESS ] % 6 ];
@@ -235,12 +266,12 @@ extern "C"
         sid16 = new SID16();
         sid16->set_chip_model( MOS8580 );
         sid16->reset();
-        sid16->set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, 44100 );
+        sid16->set_sampling_parameters( C64_CLOCK, SID_SAMPLING_METHOD, AUDIO_RATE );
 
         sid16b = new SID16();
         sid16b->set_chip_model( MOS8580 );
         sid16b->reset();
-        sid16b->set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, 44100 );
+        sid16b->set_sampling_parameters( C64_CLOCK, SID_SAMPLING_METHOD, AUDIO_RATE );
 
         updateConfiguration();
 
@@ -263,6 +294,24 @@ extern "C"
         sid16->clock( cyclesToEmulate );
     }
 
+    void setQualityReSID( uint8_t tier )
+    {
+        sid16->set_quality( (quality_level)tier );
+        sid16b->set_quality( (quality_level)tier );
+    }
+
+    // quality tiers which change anything with the current configuration (bit n = tier n, see qgSetTiers)
+    uint8_t qualityTiersReSID()
+    {
+        uint8_t tiers = 1 << QUALITY_FULL;
+        if ( config[ CFG_SID_SAMPLING ] == 1 )
+            tiers |= ( 1 << QUALITY_COARSE ) | ( 1 << QUALITY_POINT );
+        if ( ( config[ CFG_SID1_TYPE ] == 0 && config[ CFG_SID1_FILTER ] == 1 ) ||
+             ( config[ CFG_SID2_TYPE ] == 0 && config[ CFG_SID2_FILTER ] == 1 ) )
+            tiers |= 1 << QUALITY_LINEAR;
+        return tiers;
+    }
+
     void writeReSID( uint8_t A, uint8_t D )
     {
         sid16->write( A, D );
@@ -278,6 +327,12 @@ extern "C"
         sid16->forceDigiOutput( voice, value );
     }
 
+    void setDirectMixerReSID( uint8_t enable, uint8_t enable2 )
+    {
+        sid16->set_direct_mixer( enable );
+        sid16b->set_direct_mixer( enable2 );
+    }
+
     void outputReSID( int16_t * left, int16_t * right )
     {
         int32_t sid1 = sid16->output(),
@@ -364,6 +419,58 @@ extern "C"
         sid16b->readRegisters( p2 );
     }
 
+    // a masked voice 3 is only clocked while OSC3/ENV3 are being read
+    void setVoice3ReadbackReSID( uint8_t sid1, uint8_t sid2 )
+    {
+        sid16->set_voice3_readback( sid1 );
+        sid16b->set_voice3_readback( sid2 );
+    }
+
+    static void readOSC3State( SID16 *s, OSC3_STATE *st, uint32_t cycle )
+    {
+        reg24 acc, freq;
+        reg12 pw;
+        reg8  waveform;
+        uint8_t r[ 2 ];
+
+        s->read_osc3_state( acc, freq, pw, waveform );
+        s->readRegisters( r );
+
+        st->cycle = cycle;
+        st->accumulator = acc;
+        st->freq = freq;
+        st->pw = pw;
+        st->waveform = waveform;
+        st->osc3 = r[ 0 ];
+        st->env3 = r[ 1 ];
+    }
+
+    void readOSC3StateReSID( OSC3_STATE *st1, OSC3_STATE *st2, uint32_t cycle )
+    {
+        readOSC3State( sid16, st1, cycle );
+        readOSC3State( sid16b, st2, cycle );
+    }
+
+    // SID #2 is not emulated when FM is enabled
+    uint8_t idleReSID()
+    {
+        return sid16->idle() && ( FM_ENABLE || sid16b->idle() );
+    }
+
+    void fastForwardReSID( uint64_t cycles )
+    {
+        // in chunks, cycle_count is a signed int (SID16::fast_forward clocks the voices in chunks of
+        // at most 0xffff cycles itself, only its last cycles go through the filters)
+        while ( cycles )
+        {
+            cycle_count c = cycles > 0x40000000 ? 0x40000000 : (cycle_count)cycles;
+            sid16->fast_forward( c );
+            if ( !FM_ENABLE )
+                sid16b->fast_forward( c );
+            cycles -= c;
+        }
+    }
+
     uint8_t readSID( uint8_t offset )
     {
         return sid16->read( offset );
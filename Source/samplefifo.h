@@ -0,0 +1,179 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  samplefifo.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SAMPLEFIFO_h_
+#define SAMPLEFIFO_h_
+
+#include <stdint.h>
+
+//
+// single-producer/single-consumer FIFO for rendered samples from core0 (emulation) to core1 (PWM output)
+//
+// core1 requests one sample per sample tick, core0 renders it and pushes it into the FIFO, and core1 takes
+// one entry per tick. The consumer only starts once 'ahead' entries are queued, i.e. a sample is output
+// 'ahead' ticks after it was requested and core0 may be late by up to this many ticks without audible
+// effect. If the FIFO runs empty nonetheless, core1 keeps the last output value and counts an underrun;
+// when catching up, the producer skips the ticks which would push the fill level beyond 'ahead'
+// (sfStaleTicks) such that the latency does not grow.
+//
+// The consumer records the cycle of each tick (sfTick), such that the producer can render a sample from the
+// emulation state at the cycle it was requested (sfTickCycle), also when it is late.
+//
+// Each entry is one 32-bit word: PWM level in the lower half, LED brightness in the upper half.
+//
+
+#define SAMPLE_FIFO_DEPTH_LOG2	8
+#define SAMPLE_FIFO_DEPTH		( 1 << SAMPLE_FIFO_DEPTH_LOG2 )
+#define SAMPLE_FIFO_MASK		( SAMPLE_FIFO_DEPTH - 1 )
+
+// default render-ahead: 128 samples = 2.9ms at 44.1kHz
+#define SAMPLE_FIFO_AHEAD		128
+
+#if PICO_ON_DEVICE
+#include "hardware/sync.h"
+#define SF_BARRIER()	__dmb()
+#else
+#define SF_BARRIER()	__sync_synchronize()
+#endif
+
+#define SAMPLE_ENTRY( level, led )	( ( (uint32_t)(led) << 16 ) | ( (uint32_t)(level) & 0xffff ) )
+#define SAMPLE_LEVEL( e )			( (e) & 0xffff )
+#define SAMPLE_LED( e )				( (e) >> 16 )
+
+typedef struct
+{
+	uint32_t entry[ SAMPLE_FIFO_DEPTH ];
+
+	volatile uint32_t write;		// producer only
+	volatile uint32_t read;			// consumer only
+
+	uint32_t ahead;					// render-ahead in samples, < SAMPLE_FIFO_DEPTH
+	volatile uint8_t primed;		// consumer only: 'ahead' samples have been queued once
+
+	volatile uint32_t underruns;	// consumer only
+	uint32_t overflows;				// producer only
+
+	uint32_t tickCycle[ SAMPLE_FIFO_DEPTH ];	// consumer only: cycles of the last ticks
+	volatile uint32_t ticks;		// consumer only: number of ticks (= requested samples)
+} SAMPLE_FIFO;
+
+static inline void sfInit( SAMPLE_FIFO *f, uint32_t ahead )
+{
+	f->write = f->read = 0;
+	f->ahead = ahead < SAMPLE_FIFO_DEPTH ? ahead : SAMPLE_FIFO_DEPTH - 1;
+	f->primed = 0;
+	f->underruns = f->overflows = 0;
+	f->ticks = 0;
+}
+
+//
+// producer side
+//
+
+// number of queued samples
+static inline uint32_t sfCount( const SAMPLE_FIFO *f )
+{
+	return f->write - f->read;
+}
+
+// number of samples queued ahead of the output, 'ahead' while the consumer has not started yet
+static inline uint32_t sfReserve( const SAMPLE_FIFO *f )
+{
+	return f->primed ? f->write - f->read : f->ahead;
+}
+
+// returns 0 if the FIFO was full and the sample has been dropped
+static inline uint8_t sfPush( SAMPLE_FIFO *f, uint32_t e )
+{
+	uint32_t w = f->write;
+	if ( w - f->read >= SAMPLE_FIFO_DEPTH )
+	{
+		f->overflows ++;
+		return 0;
+	}
+	f->entry[ w & SAMPLE_FIFO_MASK ] = e;
+	SF_BARRIER();
+	f->write = w + 1;
+	return 1;
+}
+
+// cycle of tick 'n' (counted from 0), valid for the last SAMPLE_FIFO_DEPTH ticks
+static inline uint32_t sfTickCycle( const SAMPLE_FIFO *f, uint32_t n )
+{
+	return f->tickCycle[ n & SAMPLE_FIFO_MASK ];
+}
+
+// number of the oldest of 'pending' requested samples which need not be rendered anymore, as they would
+// exceed the render-ahead (the most recent one is always rendered)
+static inline uint32_t sfStaleTicks( const SAMPLE_FIFO *f, uint32_t pending )
+{
+	uint32_t n = sfCount( f ) + pending;
+	if ( pending <= 1 || n <= f->ahead )
+		return 0;
+	n -= f->ahead;
+	return n < pending - 1 ? n : pending - 1;
+}
+
+//
+// consumer side
+//
+
+// requests a sample at 'cycle'
+static inline void sfTick( SAMPLE_FIFO *f, uint32_t cycle )
+{
+	uint32_t t = f->ticks;
+	f->tickCycle[ t & SAMPLE_FIFO_MASK ] = cycle;
+	SF_BARRIER();
+	f->ticks = t + 1;
+}
+
+// takes the next sample, returns 0 if there is none (yet)
+static inline uint8_t sfPop( SAMPLE_FIFO *f, uint32_t *e )
+{
+	uint32_t r = f->read;
+	uint32_t n = f->write - r;
+
+	if ( !f->primed )
+	{
+		if ( n < f->ahead )
+			return 0;
+		f->primed = 1;
+	}
+
+	if ( n == 0 )
+	{
+		f->underruns ++;
+		return 0;
+	}
+
+	SF_BARRIER();
+	*e = f->entry[ r & SAMPLE_FIFO_MASK ];
+	SF_BARRIER();
+	f->read = r + 1;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,461 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  trace.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include "trace.h"
+
+// host only, not part of the firmware build (see trace.h)
+
+#define OPL_CLOCK		3579545
+
+#define STATE_WORDS		( ( sizeof( TRACE_STATE ) + 3 ) / 4 )
+
+//
+// the engine: SIDs clocked to each write and sample tick, as emulateCyclesReSID and the render loop of core0
+//
+
+static void engineInit( TRACE_ENGINE *e, const TRACE_HEADER *h )
+{
+	e->nSIDs = h->fm ? 1 : 2;
+	for ( int i = 0; i < 2; i++ )
+	{
+		e->sid[ i ] = new SID16();
+		e->sid[ i ]->set_chip_model( h->model[ i ] ? MOS8580 : MOS6581 );
+		e->sid[ i ]->enable_nonlinear_filter( h->nonlinear[ i ] );
+		e->sid[ i ]->set_sampling_parameters( h->c64Clock, h->decimate ? SAMPLE_DECIMATE : SAMPLE_INTERPOLATE, h->audioRate );
+		e->sid[ i ]->reset();
+		e->silence[ i ] = 0;
+		e->lastOutput[ i ] = e->sid[ i ]->output();
+		e->sleeping[ i ] = 0;
+		e->sleepCycles[ i ] = 0;
+	}
+	e->opl = NULL;
+	if ( h->fm )
+	{
+		e->opl = ym3812_init( OPL_CLOCK, h->audioRate );
+		ym3812_reset_chip( e->opl );
+	}
+	e->cyclesPerSample = ( (uint64_t)h->c64Clock << 16 ) / h->audioRate;
+	e->cycle = e->samples = 0;
+	e->fastForwarded = 0;
+}
+
+// in chunks, cycle_count is a signed int
+static void clockSID( SID16 *s, uint64_t cycles, uint8_t fastForward )
+{
+	while ( cycles )
+	{
+		cycle_count c = cycles > 0x40000000 ? 0x40000000 : (cycle_count)cycles;
+		if ( fastForward )
+			s->fast_forward( c ); else
+			s->clock( c );
+		cycles -= c;
+	}
+}
+
+// a sleeping SID only counts the cycles, and is fast-forwarded when it is written to or its state is needed,
+// as by fastForwardReSID in the firmware
+static void engineWake( TRACE_ENGINE *e, int i )
+{
+	if ( !e->sleeping[ i ] )
+		return;
+	clockSID( e->sid[ i ], e->sleepCycles[ i ], 1 );
+	e->fastForwarded += e->sleepCycles[ i ];
+	e->sleepCycles[ i ] = 0;
+	e->sleeping[ i ] = 0;
+}
+
+static void engineClock( TRACE_ENGINE *e, int i, uint64_t cycles )
+{
+	if ( e->sleeping[ i ] )
+		e->sleepCycles[ i ] += cycles; else
+		clockSID( e->sid[ i ], cycles, 0 );
+}
+
+// clocks the engine up to 'cycle' and renders the samples on the way, the output is only needed for 'out';
+// without it, SIDs which are idle after TRACE_SLEEP_SILENCE constant samples go to sleep (see engineWake)
+static void engineAdvance( TRACE_ENGINE *e, uint64_t cycle, std::vector<TRACE_SAMPLE> *out )
+{
+	if ( out )
+		for ( int i = 0; i < e->nSIDs; i++ )
+			engineWake( e, i );
+
+	for ( ;; )
+	{
+		uint64_t tick = ( ( e->samples + 1 ) * e->cyclesPerSample ) >> 16;
+		if ( tick > cycle )
+			break;
+
+		TRACE_SAMPLE s = { { 0, 0 }, 0 };
+		for ( int i = 0; i < e->nSIDs; i++ )
+		{
+			engineClock( e, i, tick - e->cycle );
+			if ( e->sleeping[ i ] )
+				continue;
+			s.sid[ i ] = e->sid[ i ]->output();
+			if ( s.sid[ i ] != e->lastOutput[ i ] )
+				e->silence[ i ] = 0; else
+			if ( e->silence[ i ] < 0xffffffff )
+				e->silence[ i ] ++;
+			e->lastOutput[ i ] = s.sid[ i ];
+			if ( !out && e->silence[ i ] > TRACE_SLEEP_SILENCE && e->sid[ i ]->idle() )
+				e->sleeping[ i ] = 1;
+		}
+		if ( e->opl )
+		{
+			OPLSAMPLE fm;
+			ym3812_update_one( e->opl, &fm, 1 );
+			s.fm = fm;
+		}
+		if ( out )
+			out->push_back( s );
+
+		e->cycle = tick;
+		e->samples ++;
+	}
+
+	for ( int i = 0; i < e->nSIDs; i++ )
+		engineClock( e, i, cycle - e->cycle );
+	e->cycle = cycle;
+}
+
+// as core0 handles the commands of the queue
+static void engineWrite( TRACE_ENGINE *e, uint16_t cmd )
+{
+	uint8_t reg = ( cmd >> 8 ) & 0x1f, value = cmd & 255;
+
+	if ( cmd & ( 1 << 15 ) )
+	{
+		if ( e->opl )
+		{
+			ym3812_write( e->opl, ( ( cmd >> 8 ) >> 4 ) & 1, value );
+			return;
+		}
+		engineWake( e, 1 );
+		e->sid[ 1 ]->write( reg, value );
+		e->silence[ 1 ] = 0;
+	} else
+	{
+		engineWake( e, 0 );
+		e->sid[ 0 ]->write( reg, value );
+		e->silence[ 0 ] = 0;
+	}
+}
+
+static void engineSave( TRACE_ENGINE *e, TRACE_STATE *s )
+{
+	memset( s, 0, sizeof( TRACE_STATE ) );
+	for ( int i = 0; i < 2; i++ )
+	{
+		engineWake( e, i );
+		s->sid[ i ] = e->sid[ i ]->read_state();
+		s->silence[ i ] = e->silence[ i ];
+	}
+	if ( e->opl )
+		ym3812_read_state( e->opl, &s->opl );
+	s->cycle = e->cycle;
+	s->samples = e->samples;
+}
+
+static void engineRestore( TRACE_ENGINE *e, const TRACE_STATE *s )
+{
+	for ( int i = 0; i < 2; i++ )
+	{
+		e->sid[ i ]->write_state( s->sid[ i ] );
+		e->silence[ i ] = s->silence[ i ];
+		e->lastOutput[ i ] = e->sid[ i ]->output();
+		e->sleeping[ i ] = 0;
+		e->sleepCycles[ i ] = 0;
+	}
+	if ( e->opl )
+		ym3812_write_state( e->opl, &s->opl );
+	e->cycle = s->cycle;
+	e->samples = s->samples;
+}
+
+//
+// trace and file format: header, records, index, footer
+//
+
+void traceInit( TRACE *t, uint32_t c64Clock, uint32_t audioRate, const uint8_t model[ 2 ], const uint8_t nonlinear[ 2 ], uint8_t decimate, uint8_t fm )
+{
+	TRACE_HEADER *h = &t->header;
+	memset( h, 0, sizeof( TRACE_HEADER ) );
+	h->magic = TRACE_MAGIC;
+	h->version = TRACE_VERSION;
+	h->c64Clock = c64Clock;
+	h->audioRate = audioRate;
+	for ( int i = 0; i < 2; i++ )
+	{
+		h->model[ i ] = model[ i ];
+		h->nonlinear[ i ] = nonlinear[ i ];
+	}
+	h->decimate = decimate;
+	h->fm = fm;
+	h->stateSize = sizeof( TRACE_STATE );
+	h->sidStateVersion = SID16::STATE_VERSION;
+	h->oplStateVersion = OPL_STATE_VERSION;
+	t->records.clear();
+	t->index.clear();
+}
+
+int traceSave( const TRACE *t, FILE *f )
+{
+	TRACE_FOOTER footer;
+	footer.indexOffset = sizeof( TRACE_HEADER ) + t->records.size() * 4;
+	footer.nEntries = (uint32_t)t->index.size();
+	footer.magic = TRACE_MAGIC;
+
+	if ( fwrite( &t->header, sizeof( TRACE_HEADER ), 1, f ) != 1 ||
+		 fwrite( t->records.data(), 4, t->records.size(), f ) != t->records.size() ||
+		 fwrite( t->index.data(), sizeof( TRACE_INDEX_ENTRY ), t->index.size(), f ) != t->index.size() ||
+		 fwrite( &footer, sizeof( TRACE_FOOTER ), 1, f ) != 1 )
+		return -1;
+	return 0;
+}
+
+// returns -1 if the file is no trace or has been recorded with different state layouts
+int traceLoad( TRACE *t, FILE *f )
+{
+	TRACE_FOOTER footer;
+
+	if ( fseek( f, 0, SEEK_SET ) || fread( &t->header, sizeof( TRACE_HEADER ), 1, f ) != 1 )
+		return -1;
+	const TRACE_HEADER *h = &t->header;
+	if ( h->magic != TRACE_MAGIC || h->version != TRACE_VERSION || h->stateSize != sizeof( TRACE_STATE ) ||
+		 h->sidStateVersion != (uint32_t)SID16::STATE_VERSION || h->oplStateVersion != OPL_STATE_VERSION )
+		return -1;
+
+	if ( fseek( f, -(long)sizeof( TRACE_FOOTER ), SEEK_END ) || fread( &footer, sizeof( TRACE_FOOTER ), 1, f ) != 1 ||
+		 footer.magic != TRACE_MAGIC || footer.indexOffset < sizeof( TRACE_HEADER ) )
+		return -1;
+
+	t->records.resize( ( footer.indexOffset - sizeof( TRACE_HEADER ) ) / 4 );
+	t->index.resize( footer.nEntries );
+	if ( fseek( f, sizeof( TRACE_HEADER ), SEEK_SET ) ||
+		 fread( t->records.data(), 4, t->records.size(), f ) != t->records.size() ||
+		 fread( t->index.data(), sizeof( TRACE_INDEX_ENTRY ), t->index.size(), f ) != t->index.size() )
+		return -1;
+	return 0;
+}
+
+// cycle of the last record
+uint64_t traceEnd( const TRACE *t )
+{
+	uint64_t time = 0;
+	for ( size_t i = 0; i < t->records.size(); )
+	{
+		uint32_t w = t->records[ i ];
+		if ( TRACE_IS_WRITE( w ) )
+		{
+			time += TRACE_DELTA( w );
+			i ++;
+		} else
+		if ( w == TRACE_TIME )
+		{
+			time += t->records[ i + 1 ];
+			i += 2;
+		} else
+			i += 1 + STATE_WORDS;
+	}
+	return time;
+}
+
+//
+// replay
+//
+
+void traceStart( TRACE_PLAYER *p, const TRACE *t )
+{
+	p->trace = t;
+	engineInit( &p->engine, &t->header );
+	p->pos = 0;
+	p->time = 0;
+}
+
+void traceFree( TRACE_PLAYER *p )
+{
+	for ( int i = 0; i < 2; i++ )
+	{
+		delete p->engine.sid[ i ];
+		p->engine.sid[ i ] = NULL;
+	}
+	if ( p->engine.opl )
+		ym3812_shutdown( p->engine.opl );
+	p->engine.opl = NULL;
+}
+
+// plays the next record if it is at or before 'cycle', returns 0 otherwise
+static uint8_t playRecord( TRACE_PLAYER *p, uint64_t cycle, std::vector<TRACE_SAMPLE> *out )
+{
+	const std::vector<uint32_t> &r = p->trace->records;
+	if ( p->pos >= r.size() )
+		return 0;
+
+	uint32_t w = r[ p->pos ];
+	uint64_t time = p->time;
+	uint64_t length = 1;
+	if ( TRACE_IS_WRITE( w ) )
+		time += TRACE_DELTA( w ); else
+	if ( w == TRACE_TIME )
+	{
+		time += r[ p->pos + 1 ];
+		length = 2;
+	} else
+		length += STATE_WORDS;		// checkpoint at the time of the previous record
+
+	if ( time > cycle )
+		return 0;
+
+	engineAdvance( &p->engine, time, out );
+	if ( TRACE_IS_WRITE( w ) )
+		engineWrite( &p->engine, TRACE_CMD( w ) );
+
+	p->time = time;
+	p->pos += length;
+	return 1;
+}
+
+// cycle of the last sample tick at or before 'cycle': sample n - 1 with n ticks up to 'cycle'
+static uint64_t lastTick( const TRACE_ENGINE *e, uint64_t cycle )
+{
+	uint64_t n = ( ( ( cycle + 1 ) << 16 ) - 1 ) / e->cyclesPerSample;
+	return n ? ( n * e->cyclesPerSample ) >> 16 : 0;
+}
+
+// the engine stops at the last record or sample tick, where it is clocked to anyway: stopping in between would
+// split the clocking of the SIDs differently than rendering through
+void tracePlay( TRACE_PLAYER *p, uint64_t cycle, std::vector<TRACE_SAMPLE> *out )
+{
+	while ( playRecord( p, cycle, out ) );
+	uint64_t tick = lastTick( &p->engine, cycle );
+	if ( tick > p->engine.cycle )
+		engineAdvance( &p->engine, tick, out );
+}
+
+uint64_t traceSeek( TRACE_PLAYER *p, uint64_t cycle )
+{
+	TRACE_ENGINE *e = &p->engine;
+	uint64_t tick = lastTick( e, cycle );
+
+	// restore the last checkpoint before, unless it is behind the current position anyway
+	const std::vector<TRACE_INDEX_ENTRY> &index = p->trace->index;
+	int32_t i = traceFindCheckpoint( index.data(), (uint32_t)index.size(), tick );
+	if ( i >= 0 && ( tick < e->cycle || index[ i ].cycle > e->cycle ) )
+	{
+		TRACE_STATE s;
+		memcpy( &s, &p->trace->records[ index[ i ].offset + 1 ], sizeof( TRACE_STATE ) );
+		engineRestore( e, &s );
+		p->pos = index[ i ].offset + 1 + STATE_WORDS;
+		p->time = index[ i ].cycle;
+	}
+
+	tracePlay( p, tick, NULL );
+	for ( int i = 0; i < e->nSIDs; i++ )
+		engineWake( e, i );
+	return e->samples;
+}
+
+//
+// recording
+//
+
+static void recordTime( TRACE_RECORDER *r, uint64_t cycle )
+{
+	uint64_t delta = cycle - r->time;
+	while ( delta )
+	{
+		uint32_t d = delta > 0xffffffff ? 0xffffffff : (uint32_t)delta;
+		r->trace->records.push_back( TRACE_TIME );
+		r->trace->records.push_back( d );
+		delta -= d;
+	}
+	r->time = cycle;
+}
+
+static void recordCheckpoint( TRACE_RECORDER *r, uint64_t cycle, std::vector<TRACE_SAMPLE> *out )
+{
+	recordTime( r, cycle );
+	tracePlay( &r->player, cycle, out );
+
+	TRACE_STATE s;
+	engineSave( &r->player.engine, &s );
+
+	std::vector<uint32_t> &records = r->trace->records;
+	TRACE_INDEX_ENTRY entry = { cycle, records.size() };
+	r->trace->index.push_back( entry );
+	records.push_back( TRACE_CHECKPOINT );
+	size_t o = records.size();
+	records.resize( o + STATE_WORDS, 0 );
+	memcpy( &records[ o ], &s, sizeof( TRACE_STATE ) );
+
+	tracePlay( &r->player, cycle, out );
+}
+
+void traceRecordStart( TRACE_RECORDER *r, TRACE *t, uint32_t checkpointCycles )
+{
+	r->trace = t;
+	r->checkpointCycles = checkpointCycles;
+	t->records.clear();
+	t->index.clear();
+	traceStart( &r->player, t );
+	r->time = 0;
+	recordCheckpoint( r, 0, NULL );
+	r->nextCheckpoint = checkpointCycles;
+}
+
+static void recordCheckpoints( TRACE_RECORDER *r, uint64_t cycle, std::vector<TRACE_SAMPLE> *out )
+{
+	while ( cycle >= r->nextCheckpoint )
+	{
+		recordCheckpoint( r, r->nextCheckpoint, out );
+		r->nextCheckpoint += r->checkpointCycles;
+	}
+}
+
+void traceRecordWrite( TRACE_RECORDER *r, uint64_t cycle, uint16_t cmd, std::vector<TRACE_SAMPLE> *out )
+{
+	recordCheckpoints( r, cycle, out );
+
+	if ( cycle - r->time > TRACE_MAX_DELTA )
+		recordTime( r, cycle );
+	r->trace->records.push_back( TRACE_WRITE( cycle - r->time, cmd ) );
+	r->time = cycle;
+	tracePlay( &r->player, cycle, out );
+}
+
+void traceRecordEnd( TRACE_RECORDER *r, uint64_t cycle, std::vector<TRACE_SAMPLE> *out )
+{
+	recordCheckpoints( r, cycle, out );
+	recordTime( r, cycle );
+	tracePlay( &r->player, cycle, out );
+}
+
+void traceRecordFree( TRACE_RECORDER *r )
+{
+	traceFree( &r->player );
+}
@@ -0,0 +1,199 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  trace.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TRACE_h_
+#define TRACE_h_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "reSID16/sid.h"
+extern "C" {
+#include "fmopl.h"
+}
+
+//
+// register write traces with checkpoints, recorded and replayed on the host
+//
+// A trace holds the writes as core0 receives them from the command queue (bit 15 = SID #2 or FM, bits 8..12 =
+// address, bits 0..7 = value) with their C64 cycle. The engine replaying them is the one of the firmware: SID #1
+// and SID #2 or the YM3812, each SID clocked to its writes and to the sample ticks, one output per tick.
+//
+// Records are 32-bit words:
+// - write:      bit 31 = 0, bits 16..30 = cycles since the previous record, bits 0..15 = command
+// - time:       TRACE_TIME, followed by a 32-bit cycle delta (for gaps > TRACE_MAX_DELTA cycles)
+// - checkpoint: TRACE_CHECKPOINT, followed by the engine state (TRACE_STATE) at the cycle of the record
+// The recorder adds a checkpoint every 'checkpointCycles' C64 cycles (and one at cycle 0), the index lists them
+// with their cycle. Seeking restores the last checkpoint before the position and replays the writes from there
+// without output; a SID which is idle after TRACE_SLEEP_SILENCE constant samples sleeps until the next write to
+// it, and is then fast-forwarded (SID16::fast_forward), as in the engine sleep of the firmware.
+//
+// Each record is a point where the SIDs are clocked to, in recording and in any replay, such that seeking and
+// rendering gives the same samples as rendering the trace from the start. Checkpoints hold SID16::State and
+// OPL_STATE, i.e. a trace is only replayed by a build with the same state layouts (checked by traceLoad).
+//
+
+#define TRACE_MAGIC				0x4b534b54		// "TKSK"
+#define TRACE_VERSION			1
+
+#define TRACE_TIME				0x80000000
+#define TRACE_CHECKPOINT		0x80000001
+
+#define TRACE_MAX_DELTA			0x7fff
+
+// approx. 100ms of C64 time
+#define TRACE_CHECKPOINT_CYCLES	100000
+
+#define TRACE_SLEEP_SILENCE		4096
+
+#define TRACE_WRITE( delta, cmd )	( ( (uint32_t)(delta) << 16 ) | (uint32_t)(cmd) )
+#define TRACE_IS_WRITE( r )			( !( (r) & 0x80000000 ) )
+#define TRACE_DELTA( r )			( ( (r) >> 16 ) & TRACE_MAX_DELTA )
+#define TRACE_CMD( r )				( (r) & 0xffff )
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t c64Clock;
+	uint32_t audioRate;
+	uint8_t  model[ 2 ];		// 0 = 6581, 1 = 8580
+	uint8_t  nonlinear[ 2 ];	// non-linear 6581 filter
+	uint8_t  decimate;			// SAMPLE_DECIMATE instead of SAMPLE_INTERPOLATE
+	uint8_t  fm;				// YM3812 instead of SID #2
+	uint16_t reserved;
+	uint32_t stateSize;			// sizeof( TRACE_STATE ) of the recording build
+	uint32_t sidStateVersion;
+	uint32_t oplStateVersion;
+} TRACE_HEADER;
+
+typedef struct
+{
+	uint64_t cycle;				// C64 cycle of the checkpoint
+	uint64_t offset;			// position of the checkpoint record (in words)
+} TRACE_INDEX_ENTRY;
+
+typedef struct
+{
+	uint64_t indexOffset;		// file offset of the index
+	uint32_t nEntries;
+	uint32_t magic;
+} TRACE_FOOTER;
+
+typedef struct
+{
+	TRACE_HEADER header;
+	std::vector<uint32_t> records;
+	std::vector<TRACE_INDEX_ENTRY> index;
+} TRACE;
+
+typedef struct
+{
+	int16_t sid[ 2 ];
+	int32_t fm;
+} TRACE_SAMPLE;
+
+// state of the engine at a checkpoint
+typedef struct
+{
+	SID16::State sid[ 2 ];
+	OPL_STATE opl;
+	uint64_t cycle;
+	uint64_t samples;			// samples rendered, sample n is rendered at cycle ( ( n + 1 ) * cyclesPerSample ) >> 16
+	uint32_t silence[ 2 ];		// constant samples, such that seeking from here sleeps as seeking through
+} TRACE_STATE;
+
+typedef struct
+{
+	SID16    *sid[ 2 ];
+	FM_OPL   *opl;
+	uint8_t  nSIDs;
+	uint64_t cyclesPerSample;	// 16.16 fixpoint
+	uint64_t cycle;
+	uint64_t samples;
+	uint32_t silence[ 2 ];		// constant samples, see TRACE_SLEEP_SILENCE
+	int16_t  lastOutput[ 2 ];
+	uint8_t  sleeping[ 2 ];		// only while seeking, the cycles to fast-forward are counted in sleepCycles
+	uint64_t sleepCycles[ 2 ];
+	uint64_t fastForwarded;		// cycles fast-forwarded while seeking (statistics)
+} TRACE_ENGINE;
+
+typedef struct
+{
+	const TRACE  *trace;
+	TRACE_ENGINE engine;
+	uint64_t     pos;			// next record
+	uint64_t     time;			// cycle of the last record
+} TRACE_PLAYER;
+
+typedef struct
+{
+	TRACE        *trace;
+	TRACE_PLAYER player;		// the recorder replays what it records, which also yields the checkpoints
+	uint64_t     time;			// cycle of the last record
+	uint32_t     checkpointCycles;
+	uint64_t     nextCheckpoint;
+} TRACE_RECORDER;
+
+// returns the index of the last checkpoint at or before 'cycle', or -1 if there is none
+static inline int32_t traceFindCheckpoint( const TRACE_INDEX_ENTRY *index, uint32_t nEntries, uint64_t cycle )
+{
+	int32_t lo = 0, hi = (int32_t)nEntries - 1, r = -1;
+
+	while ( lo <= hi )
+	{
+		int32_t m = ( lo + hi ) >> 1;
+		if ( index[ m ].cycle <= cycle )
+		{
+			r = m;
+			lo = m + 1;
+		} else
+			hi = m - 1;
+	}
+	return r;
+}
+
+extern void traceInit( TRACE *t, uint32_t c64Clock, uint32_t audioRate, const uint8_t model[ 2 ], const uint8_t nonlinear[ 2 ], uint8_t decimate, uint8_t fm );
+extern int  traceSave( const TRACE *t, FILE *f );
+extern int  traceLoad( TRACE *t, FILE *f );
+
+// recording: 'out' receives the samples rendered up to the cycle of the write (may be NULL)
+extern void traceRecordStart( TRACE_RECORDER *r, TRACE *t, uint32_t checkpointCycles );
+extern void traceRecordWrite( TRACE_RECORDER *r, uint64_t cycle, uint16_t cmd, std::vector<TRACE_SAMPLE> *out );
+extern void traceRecordEnd( TRACE_RECORDER *r, uint64_t cycle, std::vector<TRACE_SAMPLE> *out );
+extern void traceRecordFree( TRACE_RECORDER *r );
+
+// replay: traceStart sets up the engine at cycle 0 (traceFree releases it), tracePlay renders the samples up
+// to 'cycle', traceSeek goes to the last sample tick at or before 'cycle' without rendering and returns the
+// number of samples up to it, i.e. the number of the sample rendered next
+extern void traceStart( TRACE_PLAYER *p, const TRACE *t );
+extern void tracePlay( TRACE_PLAYER *p, uint64_t cycle, std::vector<TRACE_SAMPLE> *out );
+extern uint64_t traceSeek( TRACE_PLAYER *p, uint64_t cycle );
+extern uint64_t traceEnd( const TRACE *t );
+extern void traceFree( TRACE_PLAYER *p );
+
+#endif
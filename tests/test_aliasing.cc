@@ -0,0 +1,181 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_aliasing.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "reSID16/sid.h"
+#include "testutil.h"
+
+//
+// aliasing of the SID output sampling: point sampling of the output at each sample tick (SAMPLE_INTERPOLATE,
+// as the firmware clocks to each tick) against the decimating output (SAMPLE_DECIMATE), at full quality and
+// in the governor's coarse tier. A sawtooth has harmonics at all multiples of its frequency, everything else
+// in the spectrum is aliasing of the harmonics above Nyquist. The sampling method can be changed in the
+// configuration while playing, which must not step the output.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+#define N_DFT			8192
+
+// ratio of the energy outside of the harmonics of f to the energy in them up to 15 kHz, in dB
+static double aliasRatio( const int32_t *x, double f )
+{
+	static double c[ N_DFT ], s[ N_DFT ], xw[ N_DFT ];
+	double harm = 0.0, alias = 0.0;
+
+	for ( int n = 0; n < N_DFT; n++ )
+	{
+		c[ n ] = cos( 2.0 * M_PI * n / N_DFT );
+		s[ n ] = sin( 2.0 * M_PI * n / N_DFT );
+		// Hann window
+		xw[ n ] = ( 0.5 - 0.5 * c[ n ] ) * x[ n ];
+	}
+
+	for ( int k = 1; k < N_DFT / 2; k++ )
+	{
+		double fk = (double)k * AUDIO_RATE / N_DFT;
+		if ( fk > 15000.0 )
+			break;
+
+		double sr = 0.0, si = 0.0;
+		for ( int n = 0, a = 0; n < N_DFT; n++, a = ( a + k ) & ( N_DFT - 1 ) )
+		{
+			sr += xw[ n ] * c[ a ];
+			si -= xw[ n ] * s[ a ];
+		}
+		double e = sr * sr + si * si;
+
+		double h = fk / f;
+		if ( h > 0.5 && fabs( h - floor( h + 0.5 ) ) * f < 4.0 * AUDIO_RATE / N_DFT )
+			harm += e; else
+			alias += e;
+	}
+	return 10.0 * log10( alias / harm );
+}
+
+// a sawtooth on voice 1 of an 8580 without filter, N_DFT samples taken as the firmware does
+static double renderSawtooth( uint16_t freq, sampling_method method, quality_level quality )
+{
+	static int32_t out[ N_DFT ];
+
+	SID16 s;
+	s.set_chip_model( MOS8580 );
+	s.set_sampling_parameters( C64_CLOCK, method, AUDIO_RATE );
+	s.reset();
+	s.set_quality( quality );
+
+	s.write( 0x00, freq & 255 );
+	s.write( 0x01, freq >> 8 );
+	s.write( 0x05, 0x00 );
+	s.write( 0x06, 0xf0 );
+	s.write( 0x18, 0x0f );
+	s.write( 0x04, 0x21 );
+	s.clock( C64_CLOCK / 10 );
+
+	const cycle_count cyclesPerSample = (cycle_count)( (float)C64_CLOCK / (float)AUDIO_RATE * ( 1 << 16 ) + 0.5 );
+	uint32_t fixp = 0;
+	for ( int i = 0; i < N_DFT; i++ )
+	{
+		fixp += cyclesPerSample;
+		s.clock( fixp >> 16 );
+		fixp &= 0xffff;
+		out[ i ] = s.output();
+	}
+
+	return aliasRatio( out, (double)freq * C64_CLOCK / 16777216.0 );
+}
+
+// a 20Hz triangle, switched between point sampling and decimation: the largest step between samples must
+// stay in the order of the triangle's slope (the decimation delays the output by about two samples)
+static int renderSwitching( bool doSwitch, int *level )
+{
+	SID16 s;
+	s.set_chip_model( MOS8580 );
+	s.set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, AUDIO_RATE );
+	s.reset();
+
+	s.write( 0x00, 340 & 255 );
+	s.write( 0x01, 340 >> 8 );
+	s.write( 0x06, 0xf0 );
+	s.write( 0x18, 0x0f );
+	s.write( 0x04, 0x11 );
+	s.clock( C64_CLOCK / 2 );
+
+	int prev = s.output(), maxStep = 0, maxLevel = 0;
+	for ( int i = 0; i < 4000; i++ )
+	{
+		if ( doSwitch && i % 1000 == 500 )
+			s.set_sampling_parameters( C64_CLOCK, ( i / 1000 ) & 1 ? SAMPLE_INTERPOLATE : SAMPLE_DECIMATE, AUDIO_RATE );
+		s.clock( 22 );
+		int o = s.output();
+		if ( abs( o - prev ) > maxStep )
+			maxStep = abs( o - prev );
+		if ( abs( o ) > maxLevel )
+			maxLevel = abs( o );
+		prev = o;
+	}
+	*level = maxLevel;
+	return maxStep;
+}
+
+static void testSwitch()
+{
+	int level;
+	int maxStepRef = renderSwitching( false, &level );
+	int maxStep = renderSwitching( true, &level );
+	CHECK( maxStep <= 3 * maxStepRef, "switching the sampling method steps the output by %d (%d without switching, level %d)",
+		maxStep, maxStepRef, level );
+}
+
+int main()
+{
+	testSwitch();
+
+	// about 1, 1.9 and 3.1 kHz
+	static const uint16_t freqs[] = { 0x4217, 0x8000, 0xce3b };
+
+	for ( auto freq : freqs )
+	{
+		double f = (double)freq * C64_CLOCK / 16777216.0;
+		double rPoint = renderSawtooth( freq, SAMPLE_INTERPOLATE, QUALITY_FULL );
+		double rFull = renderSawtooth( freq, SAMPLE_DECIMATE, QUALITY_FULL );
+		double rCoarse = renderSawtooth( freq, SAMPLE_DECIMATE, QUALITY_COARSE );
+		double rFallback = renderSawtooth( freq, SAMPLE_DECIMATE, QUALITY_POINT );
+
+		printf( "sawtooth %4.0f Hz: aliasing %.1f dB point sampled, %.1f dB decimated, %.1f dB decimated (coarse tier)\n",
+			f, rPoint, rFull, rCoarse );
+
+		CHECK( rFull < rPoint - 3.0, "sawtooth %.0f Hz: decimated %.1f dB, point sampled %.1f dB", f, rFull, rPoint );
+		CHECK( rCoarse < rPoint - 3.0, "sawtooth %.0f Hz: decimated (coarse) %.1f dB, point sampled %.1f dB", f, rCoarse, rPoint );
+		// the governor's last tier falls back to point sampling
+		CHECK( rFallback == rPoint, "sawtooth %.0f Hz: point tier of the decimator %.1f dB, point sampled %.1f dB", f, rFallback, rPoint );
+	}
+	return TEST_RESULT();
+}
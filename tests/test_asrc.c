@@ -0,0 +1,147 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_asrc.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <math.h>
+#include "asrc.h"
+#include "testutil.h"
+
+//
+// the sample rate converter with simulated clocks: samples of a sine are put at the rate of a C64 running
+// at 'phi2' times its nominal clock, the I2S side takes a buffer whenever one is due at the nominal rate
+// (at most one per input sample, as in the firmware). The nominal ratio is set from a measurement with
+// an error, the controller has to absorb the rest. After settling, the output must be the resampled sine
+// (no clicks from dropped or repeated frames) and the fill level must stay near ASRC_TARGET.
+//
+
+#define RATE			44100.0
+#define BUFFER			256
+#define SINE_HZ			1000.0
+#define AMPLITUDE		16000.0
+#define SETTLE_SECONDS	5
+#define TEST_SECONDS	20
+#define ASRC_MEASURE_BUFFERS	64
+
+#define MAX_LEVEL_ERROR	64			// frames
+#define MAX_PITCH_ERROR	500e-6		// less than one cent
+#define MIN_SNR			60			// dB
+
+static ASRC asrc;
+static int16_t out[ BUFFER * 2 ];
+static double  frameTime[ ASRC_SIZE ];
+
+// phi2: actual C64 clock relative to nominal at start and end of the run (linear drift),
+// measured: ratio passed to asrcSetRatio relative to the actual one
+static void runClocks( double phi2Start, double phi2End, double measured )
+{
+	asrcInit( &asrc );
+
+	double inTime = 0, nextBuffer = BUFFER / RATE;
+	uint32_t nIn = 0, nOut = 0;
+	int32_t  maxLevelError = 0;
+	double   maxPitchError = 0, sig = 0, err = 0;
+	uint32_t underruns = 0, overflows = 0;
+
+	double total = SETTLE_SECONDS + TEST_SECONDS;
+	while ( inTime < total )
+	{
+		double phi2 = phi2Start + ( phi2End - phi2Start ) * inTime / total;
+		double inRate = RATE * phi2;
+
+		frameTime[ asrc.write & ASRC_MASK ] = inTime;
+		asrcPut( &asrc, (uint16_t)(int16_t)lrint( AMPLITUDE * sin( 2 * M_PI * SINE_HZ * inTime ) ) * 0x10001u );
+		inTime += 1.0 / inRate;
+		nIn ++;
+
+		// once per measurement period, as trackPhi2Clock
+		if ( nIn % ( BUFFER * ASRC_MEASURE_BUFFERS ) == 1 )
+			asrcSetRatio( &asrc, (uint32_t)( 1000000 * phi2 * measured ), 1000000 );
+
+		if ( inTime < nextBuffer )
+			continue;
+
+		uint8_t settled = inTime > SETTLE_SECONDS;
+		if ( !settled )
+		{
+			underruns = asrc.underruns;
+			overflows = asrc.overflows;
+		}
+
+		uint32_t read = asrc.read, frac = asrc.frac;
+		asrcRender( &asrc, out, BUFFER );
+		nextBuffer += BUFFER / RATE;
+		nOut ++;
+
+		if ( !settled )
+			continue;
+
+		// fill level before the next buffer is rendered
+		int32_t e = asrcLevel( &asrc ) + BUFFER - ASRC_TARGET;
+		if ( e < 0 ) e = -e;
+		if ( e > maxLevelError ) maxLevelError = e;
+
+		double pitchError = fabs( (double)asrc.step / ASRC_ONE / phi2 - 1 );
+		if ( pitchError > maxPitchError ) maxPitchError = pitchError;
+
+		// compare to the sine at the exact times of the read positions
+		for ( int i = 0; i < BUFFER; i++ )
+		{
+			CHECK( out[ i * 2 ] == out[ i * 2 + 1 ], "left and right differ" );
+
+			double p = frac / (double)ASRC_ONE + i * (double)asrc.step / ASRC_ONE;
+			uint32_t k = read + (uint32_t)p;
+			double t0 = frameTime[ k & ASRC_MASK ], t1 = frameTime[ ( k + 1 ) & ASRC_MASK ];
+			double y = AMPLITUDE * sin( 2 * M_PI * SINE_HZ * ( t0 + ( p - floor( p ) ) * ( t1 - t0 ) ) );
+			sig += y * y;
+			err += ( out[ i * 2 ] - y ) * ( out[ i * 2 ] - y );
+		}
+	}
+
+	double snr = 10 * log10( sig / err );
+	printf( "phi2 %.3f..%.3f, measured x%.4f: level error <= %d, pitch error <= %.0f ppm, SNR %.1f dB, %u buffers\n",
+		phi2Start, phi2End, measured, maxLevelError, maxPitchError * 1e6, snr, nOut );
+
+	CHECK( asrc.underruns == underruns && asrc.overflows == overflows, "%u underruns, %u overflows after settling",
+		asrc.underruns - underruns, asrc.overflows - overflows );
+	CHECK( maxLevelError <= MAX_LEVEL_ERROR, "fill level off by %d frames", maxLevelError );
+	CHECK( maxPitchError <= MAX_PITCH_ERROR, "pitch off by %.0f ppm", maxPitchError * 1e6 );
+	CHECK( snr >= MIN_SNR, "SNR %.1f dB", snr );
+}
+
+int main()
+{
+	// nominal, off-nominal and accelerated boards, with exact and wrong measurements, and with a
+	// (strong) drift of the C64 clock
+	runClocks( 1.0,   1.0,   1.0 );
+	runClocks( 1.0,   1.0,   1.003 );
+	runClocks( 0.95,  0.95,  1.0 );
+	runClocks( 1.08,  1.08,  0.997 );
+	runClocks( 1.0,   1.002, 1.002 );
+	runClocks( 1.02,  1.017, 0.998 );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,279 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_blep.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "blep.h"
+#include "testutil.h"
+
+//
+// band-limited DAC steps (blep.h): the output settles exactly on the DAC value, the sub-sample position
+// moves a step smoothly, overlapping steps do not collide in the 64-entry ring, and a square-wave digi
+// aliases far less than with point sampling (the value at the sample tick, as before)
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+static int32_t rndLevel()
+{
+	return (int32_t)rnd( 65536 ) - 32768;
+}
+
+// random steps at random positions, then BLEP_TAPS quiet samples: the output is the last level exactly
+static void testSettle()
+{
+	static BLEP b;
+	blepInit( &b );
+
+	uint32_t nFail = 0;
+	for ( int i = 0; i < 2000; i++ )
+	{
+		int32_t level = 0;
+		for ( int j = rnd( 40 ); j >= 0; j-- )
+		{
+			for ( int k = rnd( 3 ); k >= 0; k-- )
+				blepStep( &b, level = rndLevel(), rnd( BLEP_POS_ONE ) );
+			blepSample( &b );
+		}
+		level = b.level;
+
+		int32_t s = 0;
+		for ( int j = 0; j < BLEP_TAPS; j++ )
+			s = blepSample( &b );
+		if ( s != level || b.sum != level * ( 1 << BLEP_FRAC_BITS ) )
+			nFail ++;
+	}
+	CHECK( nFail == 0, "%u of 2000 sequences do not settle on the DAC value", nFail );
+}
+
+// a single step with x going from 0 to one sample (earlier in time): the area under the output grows by
+// the step height times the shift, the output samples change only a little per 1/BLEP_PHASES of a sample
+static void testSubSample()
+{
+	const int32_t height = 16384;
+	const int nSamples = 2 * BLEP_TAPS;
+	double maxAreaError = 0.0;
+	int32_t maxJump = 0, prev[ 2 * BLEP_TAPS ];
+
+	for ( uint32_t x = 0; x < BLEP_POS_ONE; x += 1 << ( BLEP_INTERP_BITS - 2 ) )
+	{
+		BLEP b;
+		blepInit( &b );
+		for ( int i = 0; i < 4; i++ )
+			blepSample( &b );
+		blepStep( &b, height, x );
+
+		double area = 0.0;
+		for ( int i = 0; i < nSamples; i++ )
+		{
+			int32_t s = blepSample( &b );
+			area += s;
+			if ( x )
+			{
+				int32_t jump = abs( s - prev[ i ] );
+				if ( jump > maxJump )
+					maxJump = jump;
+			}
+			prev[ i ] = s;
+		}
+
+		// a step at the current sample (x = 0) is BLEP_TAPS / 2 + 0.5 samples into the window
+		double expected = height * ( nSamples - BLEP_TAPS / 2 - 0.5 + (double)x / BLEP_POS_ONE );
+		double error = fabs( area - expected );
+		if ( error > maxAreaError )
+			maxAreaError = error;
+	}
+
+	// a quarter of a kernel phase moves the samples by at most the steepest slope of the step response
+	// times 1/256 of a sample, i.e. about height * 0.9 / 256
+	CHECK( maxJump <= height / 200, "sub-sample position: output jumps by %d for 1/%d sample", maxJump, BLEP_PHASES * 4 );
+	CHECK( maxAreaError <= height * 0.005, "sub-sample position: step time off by %.4f samples", maxAreaError / height );
+	printf( "sub-sample position: max jump %d (height %d), time error %.4f samples\n", maxJump, height, maxAreaError / height );
+}
+
+// bursts of several steps per sample, for many samples in a row, overlap up to BLEP_TAPS kernels in the
+// ring: the output must be the superposition of the single steps, each rendered on its own
+static void testBurst()
+{
+	static BLEP b, single;
+	static int32_t ref[ 400 ];
+	static struct { uint32_t sample, x; int32_t from, to; } steps[ 400 * 4 ];
+
+	blepInit( &b );
+	uint32_t nSteps = 0;
+	memset( ref, 0, sizeof( ref ) );
+
+	for ( uint32_t i = 0; i < 400; i++ )
+	{
+		if ( i < 400 - 2 * BLEP_TAPS )
+			for ( int k = rnd( 4 ); k >= 0; k-- )
+			{
+				steps[ nSteps ].sample = i;
+				steps[ nSteps ].x = rnd( BLEP_POS_ONE );
+				steps[ nSteps ].from = b.level;
+				steps[ nSteps ].to = rndLevel();
+				blepStep( &b, steps[ nSteps ].to, steps[ nSteps ].x );
+				nSteps ++;
+			}
+		blepSample( &b );
+		ref[ i ] = b.sum;
+	}
+
+	// nothing behind the read position or beyond one kernel length
+	blepInit( &single );
+	blepStep( &single, 1000, BLEP_POS_ONE - 1 );
+	blepStep( &single, 0, 0 );
+	for ( int i = 0; i < BLEP_BUF_SIZE; i++ )
+	{
+		uint32_t d = ( i - ( single.n - BLEP_TAPS / 2 ) ) & BLEP_BUF_MASK;
+		CHECK( single.buf[ i ] == 0 || d <= BLEP_TAPS, "burst: step writes ring entry %u samples ahead", d );
+	}
+
+	int32_t sum[ 400 ];
+	memset( sum, 0, sizeof( sum ) );
+	for ( uint32_t s = 0; s < nSteps; s++ )
+	{
+		blepInit( &single );
+		for ( uint32_t i = 0; i < 400; i++ )
+		{
+			if ( i == steps[ s ].sample )
+			{
+				single.level = steps[ s ].from;
+				blepStep( &single, steps[ s ].to, steps[ s ].x );
+			}
+			blepSample( &single );
+			sum[ i ] += single.sum;
+		}
+	}
+
+	uint32_t nDiff = 0;
+	for ( uint32_t i = 0; i < 400; i++ )
+		if ( sum[ i ] != ref[ i ] )
+			nDiff ++;
+	CHECK( nDiff == 0, "burst: %u of 400 samples differ from the superposition of %u steps", nDiff, nSteps );
+}
+
+// ratio of the energy outside of the harmonics of a square wave to the energy in them, in dB; the
+// harmonics below Nyquist are at odd multiples of f, everything else is aliasing
+#define N_DFT	8192
+
+static double aliasRatio( const int32_t *x, double f )
+{
+	static double re[ N_DFT / 2 ], im[ N_DFT / 2 ];
+	double harm = 0.0, alias = 0.0;
+
+	for ( int k = 1; k < N_DFT / 2; k++ )
+	{
+		// Hann window
+		double sr = 0.0, si = 0.0;
+		for ( int n = 0; n < N_DFT; n++ )
+		{
+			double w = 0.5 - 0.5 * cos( 2.0 * M_PI * n / N_DFT );
+			double a = 2.0 * M_PI * (double)k * n / N_DFT;
+			sr += w * x[ n ] * cos( a );
+			si -= w * x[ n ] * sin( a );
+		}
+		re[ k ] = sr; im[ k ] = si;
+	}
+
+	for ( int k = 1; k < N_DFT / 2; k++ )
+	{
+		double e = re[ k ] * re[ k ] + im[ k ] * im[ k ];
+		double fk = (double)k * AUDIO_RATE / N_DFT;
+		// only up to 18 kHz, the passband of the kernel
+		if ( fk > 18000.0 )
+			break;
+		double h = fk / f;
+		int odd = ( (int)floor( h + 0.5 ) ) & 1;
+		if ( odd && fabs( h - floor( h + 0.5 ) ) * f < 4.0 * AUDIO_RATE / N_DFT )
+			harm += e; else
+			alias += e;
+	}
+	return 10.0 * log10( alias / harm );
+}
+
+static void testAliasing()
+{
+	// a square wave toggling every 93 cycles (5297 Hz), not a divisor of the sample period
+	const uint32_t halfPeriod = 93;
+	const double f = (double)C64_CLOCK / ( 2 * halfPeriod );
+	static int32_t outBLEP[ N_DFT ], outPoint[ N_DFT ];
+
+	static BLEP b;
+	blepInit( &b );
+
+	int32_t level = -8192;
+	uint64_t nextToggle = halfPeriod;
+	for ( int i = 0; i < N_DFT + BLEP_TAPS; i++ )
+	{
+		// sample tick i + 1 at ( i + 1 ) * C64_CLOCK / AUDIO_RATE cycles, in 1/AUDIO_RATE cycles
+		uint64_t tick = (uint64_t)( i + 1 ) * C64_CLOCK;
+		while ( nextToggle * AUDIO_RATE <= tick )
+		{
+			uint64_t ds = tick - nextToggle * AUDIO_RATE;
+			uint32_t x = (uint32_t)( ( ds << 8 ) / ( C64_CLOCK >> BLEP_PHASES_LOG2 ) );
+			if ( x >= BLEP_POS_ONE )
+				x = BLEP_POS_ONE - 1;
+			level = -level;
+			blepStep( &b, level, x );
+			nextToggle += halfPeriod;
+		}
+		int32_t s = blepSample( &b );
+		// the BLEP output is delayed by BLEP_TAPS / 2 samples
+		if ( i >= BLEP_TAPS / 2 && i - BLEP_TAPS / 2 < N_DFT )
+			outBLEP[ i - BLEP_TAPS / 2 ] = s;
+		if ( i < N_DFT )
+			outPoint[ i ] = level;
+	}
+
+	double rBLEP = aliasRatio( outBLEP, f );
+	double rPoint = aliasRatio( outPoint, f );
+	CHECK( rBLEP < rPoint - 20.0, "square wave: aliasing %.1f dB with BLEP, %.1f dB point sampled", rBLEP, rPoint );
+	printf( "square wave %.0f Hz: aliasing %.1f dB with BLEP, %.1f dB point sampled\n", f, rBLEP, rPoint );
+}
+
+int main()
+{
+	blepInitKernel();
+
+	testSettle();
+	testSubSample();
+	testBurst();
+	testAliasing();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,508 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_bustiming.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+//
+// host bus simulator: the bodies of handleBus (busaccess.h) run against a scripted C64 bus. The simulator keeps
+// the time in processor cycles at 300 MHz (SET_CLOCK_FAST), the edges of PHI2 are derived from the exact C64
+// clock. Bus delays and GPIO accesses are counted exactly (3n+2 cycles per BUS_DELAY, 1 cycle per SIO access),
+// the computations in between are charged with estimated Cortex-M0+ costs (see COST_*), which have to be kept
+// in line with the measurements of BUS_TIMING_PROFILE on hardware.
+//
+// Checked are the budget of each path (BUS_PATH_BUDGET, from detecting the edge to the end of the work, as
+// measured by BUS_TIMING_PROFILE), the bus timing of reads (data set up before the end of PHI2) and writes (data lines
+// sampled when valid), that no half-cycle is missed, and that reads and writes arrive where they belong.
+//
+
+#define PREDICT_OSC3
+#define SID_DAC_MODE_SUPPORT
+#define RESET		22
+#define bRESET		( 1 << RESET )
+
+#include "cmdqueue.h"
+#include "samplefifo.h"
+#include "osc3predict.h"
+#include "busdefs.h"
+#include "testutil.h"
+
+#define CLOCK_HZ		300000000
+#define C64_CLOCK_PAL	985248
+#define C64_CLOCK_NTSC	1022727
+
+// timing of the C64 bus in processor cycles at 300 MHz
+#define T_CS			30		// chip select valid after the rising edge of PHI2 (address decoding of the PLA)
+#define T_MDS			60		// write data valid after the rising edge of PHI2 (tMDS, 200 ns)
+#define T_HOLD			3		// chip select and write data held after the falling edge of PHI2 (10 ns)
+#define T_DSU			30		// read data set up before the falling edge of PHI2 (tDSU, 100 ns)
+
+// estimated costs of the computations in handleBus (processor cycles)
+#define COST_POLL		4		// one iteration of WAIT_FOR_*_HALF_CYCLE: load, test, branch taken
+#define COST_POLL_EXIT	3		// last iteration: branch not taken
+#define COST_RELEASE	8		// VIC half-cycle: release of the data lines
+#define COST_VIC		34		// VIC half-cycle: POT direction test, cycle/bus value/reset counters, loop
+#define COST_POT_DIR	12		// VIC half-cycle: change of the POT line directions
+#define COST_TICK		44		// VIC half-cycle: sample tick and output (sfTick, sfPop)
+#define COST_DECODE		16		// CPU half-cycle: address, SID2 remapping, register bank, read/write
+#define COST_DATA_OUT	6		// gpio_set_dir_masked
+#define COST_READ_VALUE	12		// register/bus value, auto detection
+#define COST_READ_OSC3	10		// $d41b: predicted value and restart of the prediction
+#define COST_OSC3		40		// VIC half-cycle: OSC3 predicted for the current cycle (published state, write check, multiply, waveform)
+#define COST_SET_DATA	2		// two SIO stores
+#define COST_READ_TAIL	12		// voice 3 readback flag, end of the read
+#define COST_WRITE		76		// $1f test, command, cqPush, OSC3 write cycle, auto detection, bus value
+#define COST_FM_WRITE	88		// OPL address/digi hack, command, cqPush, FM auto detection, bus value
+#define COST_POT		26		// paddle sampling and loop
+
+//
+// globals used by the bus handling (see SKpico.c)
+//
+uint64_t c64CycleCounter;
+uint32_t C64_CLOCK;
+#define AUDIO_RATE		44100
+volatile uint32_t sampleTickCycle, sampleTickPhase;
+SAMPLE_FIFO sampleFifo;
+uint8_t  busValue;
+int32_t  busValueTTL;
+volatile uint8_t doReset;
+uint8_t  outRegisters[ 34 * 2 ];
+uint8_t  config[ 64 ];
+uint8_t  FM_ENABLE, fmFakeOutput, fmAutoDetectStep;
+uint8_t  hack_OPL_Sample_Enabled, hack_OPL_Sample_Value[ 2 ];
+uint16_t SID_CMD;
+CMD_QUEUE cmdQueue;
+uint8_t  stateGoingTowardsTransferMode;
+const uint8_t jmpCode[ 3 ] = { 0x4c, 0x00, 0xd4 };
+OSC3_STATE osc3State[ 2 ][ 2 ];
+volatile uint8_t  osc3Published;
+volatile uint32_t osc3WriteCycle[ 2 ];
+volatile uint8_t  voice3Read[ 2 ];
+uint8_t  sidDACMode;
+uint32_t SID2_FLAG = 1 << A5;		// SID #2 at $d420
+uint8_t  SID2_IOx;
+uint8_t  POT_OUTLIER_REJECTION;
+uint8_t  newPotXCandidate, newPotYCandidate, newPotXCandidate2S, newPotYCandidate2S;
+uint8_t  skipSmoothing, smoothPotValues, paddleFilterMode;
+
+//
+// the simulated C64 bus
+//
+#define ACC_NONE	0
+#define ACC_READ	1
+#define ACC_WRITE	2
+
+typedef struct
+{
+	uint8_t  type;
+	uint8_t  addr;			// $d400 + addr, i.e. bit 5 selects SID #2
+	uint8_t  data;			// write: data, read: value the SID has to return
+} ACCESS;
+
+#define N_CYCLES		400000
+
+static ACCESS   script[ N_CYCLES ];
+static double   halfCycle;				// processor cycles per half-cycle
+static uint64_t now;					// processor cycles
+
+static double   edge( uint64_t h ) { return h * halfCycle; }
+static uint64_t halfAt( uint64_t t ) { return (uint64_t)( t / halfCycle ); }
+
+// state of the data lines driven by the SID
+static uint8_t  driven, drivenValue;
+static uint64_t drivenAt;
+
+// simulator state of the current half-cycle
+static uint8_t  simPath, simGpioReads;
+static uint64_t simHalf, simSampledAt;
+
+static uint32_t gpioAt( uint64_t t )
+{
+	uint64_t h = halfAt( t );
+	uint64_t k = h / 2;
+	uint32_t g = bRESET | bSID | bRW | bPOTX | bPOTY;
+
+	// an access is decoded from the rising edge of PHI2 until shortly after the falling edge
+	const ACCESS *a = NULL;
+	if ( h & 1 )
+	{
+		g |= bPHI;
+		if ( t >= edge( h ) + T_CS )
+			a = &script[ k ];
+	} else
+	if ( h > 0 && t < edge( h ) + T_HOLD )
+		a = &script[ k - 1 ];
+
+	uint8_t data = 0xa5 ^ (uint8_t)h;
+	if ( a && a->type != ACC_NONE )
+	{
+		g &= ~bSID;
+		g |= ( a->addr & 0x1f ) << A0;
+		if ( a->addr & 0x20 )
+			g |= 1 << A5;
+		if ( a->type == ACC_WRITE )
+		{
+			g &= ~bRW;
+			uint64_t hw = ( h & 1 ) ? h : h - 1;
+			if ( t >= edge( hw ) + T_MDS )
+				data = a->data;
+		}
+	}
+	if ( driven )
+		data = drivenValue;
+
+	return g | data;
+}
+
+static uint32_t simGpioIn()
+{
+	if ( ++ simGpioReads == 2 )
+		simSampledAt = now;
+	return gpioAt( now ++ );
+}
+
+static void simSetData( uint8_t D )
+{
+	now += COST_READ_VALUE;
+	if ( ( script[ simHalf / 2 ].addr & 0x1f ) == 0x1b )
+		now += COST_READ_OSC3;
+	drivenAt = now;
+	drivenValue = D;
+	driven = 1;
+	now += COST_SET_DATA;
+}
+
+static void simProfilePath( uint8_t p )
+{
+	if ( simPath == BUS_PATH_IDLE )
+		now += COST_DECODE;
+	simPath = p;
+}
+
+#define BUS_GPIO_IN()			simGpioIn()
+#define BUS_DATA_OUTPUT()		{ now += COST_DATA_OUT; }
+#define BUS_SET_DATA( D )		simSetData( D )
+#define BUS_DELAY( n )			{ now += 3 * (n) + 2; }
+#define BUS_SAMPLE_OUT( e )		{}
+#define BUS_ADC_RESULT()		0
+#define BUS_PROFILE_PATH( p )	simProfilePath( p );
+
+#include "busaccess.h"
+
+//
+// scripted 6510 code: SID accesses as they appear in players (absolute/indexed stores, read-modify-write,
+// OSC3/ENV3/paddle reads), SID #2 and FM (OPL address/data at $d420/$d430)
+//
+static uint32_t seed = 12345;
+static uint32_t rnd() { seed = seed * 1103515245 + 12345; return seed >> 8; }
+
+static void buildScript( uint8_t withFM )
+{
+	memset( script, 0, sizeof( script ) );
+
+	uint32_t k = 100;
+	while ( k < N_CYCLES - 16 )
+	{
+		uint8_t sid2 = ( !withFM && ( rnd() & 3 ) == 0 ) ? 0x20 : 0;
+		uint8_t r = rnd() % 0x19;
+		if ( !sid2 && r >= 0x0e && r <= 0x12 )		// keep OSC3 of SID #1 predictable
+			r -= 5;
+		switch ( rnd() % 8 )
+		{
+		case 0: case 1: case 2:						// STA $d4xx(,X): write in the last cycle
+			k += 3 + ( rnd() & 1 );
+			script[ k ] = (ACCESS){ ACC_WRITE, (uint8_t)( sid2 | r ), (uint8_t)rnd() };
+			break;
+		case 3:										// INC $d4xx: read, dummy write, write
+			k += 3;
+			script[ k ] = (ACCESS){ ACC_READ, (uint8_t)( sid2 | r ), 0 };
+			script[ k + 1 ] = (ACCESS){ ACC_WRITE, (uint8_t)( sid2 | r ), (uint8_t)rnd() };
+			script[ k + 2 ] = (ACCESS){ ACC_WRITE, (uint8_t)( sid2 | r ), (uint8_t)( script[ k + 1 ].data + 1 ) };
+			k += 2;
+			break;
+		case 4:										// LDA $d41b/$d41c/$d419/$d41a
+			k += 3 + ( rnd() & 1 );
+			script[ k ] = (ACCESS){ ACC_READ, (uint8_t)( sid2 | ( 0x19 + ( rnd() & 3 ) ) ), 0 };
+			break;
+		case 5:										// LDA $d41b,X page crossing: two reads
+			k += 3;
+			script[ k ] = (ACCESS){ ACC_READ, (uint8_t)( sid2 | 0x1b ), 0 };
+			script[ k + 1 ] = (ACCESS){ ACC_READ, (uint8_t)( sid2 | 0x1b ), 0 };
+			k ++;
+			break;
+		case 6:										// FM: address and data register
+			if ( withFM )
+			{
+				k += 4;
+				script[ k ] = (ACCESS){ ACC_WRITE, 0x20, (uint8_t)rnd() };
+				k += 4;
+				script[ k ] = (ACCESS){ ACC_WRITE, 0x30, (uint8_t)rnd() };
+			}
+			break;
+		default:									// code without SID accesses
+			k += 1 + rnd() % 12;
+			break;
+		}
+		k += 1 + rnd() % 4;
+	}
+}
+
+//
+// handleBus while communicating as SID, with the simulated time
+//
+typedef struct
+{
+	uint64_t maxCycles[ BUS_PATHS ];
+	uint32_t overruns[ BUS_PATHS ];
+	uint32_t count[ BUS_PATHS ];
+	uint32_t missedHalfCycles, lateReadData, lateRelease, badWriteSample;
+	uint32_t wrongReads, wrongWrites, reads, writes;
+	double   readMargin, writeMargin;		// minimum distance to the end of the valid bus timing
+} RESULT;
+
+// waits for a level of PHI2, returns the half-cycle in which it has been detected
+static uint64_t simWait( uint8_t cpu )
+{
+	for ( ;; )
+	{
+		uint32_t g = gpioAt( now );
+		if ( ( cpu && CPU_HALF_CYCLE( g ) ) || ( !cpu && VIC_HALF_CYCLE( g ) ) )
+			break;
+		now += COST_POLL;
+	}
+	uint64_t h = halfAt( now );
+	now += COST_POLL_EXIT;
+	return h;
+}
+
+static void simPathEnd( RESULT *r, uint64_t start, uint32_t halfCycleInt )
+{
+	uint64_t dt = now - start;
+	r->count[ simPath ] ++;
+	if ( dt > r->maxCycles[ simPath ] )
+		r->maxCycles[ simPath ] = dt;
+	if ( dt > BUS_PATH_BUDGET( simPath, halfCycleInt ) )
+		r->overruns[ simPath ] ++;
+}
+
+// value the SID has to return for a read in cycle k: OSC3 is predicted for the cycle of the read while it is
+// being read, unless a write to voice 3 is not yet included in the published state
+static uint8_t expectedRead( const BUS_STATE *b, const ACCESS *a, uint32_t k )
+{
+	uint8_t sid = ( a->addr & 0x20 ) ? 1 : 0;
+	uint8_t *reg = outRegisters + sid * 34;
+	uint8_t A = a->addr & 0x1f;
+	if ( A == 0x1b && b->osc3Active && b->osc3Sid == sid && osc3WriteCycle[ sid ] == 0 )
+		return predictOSC3( &osc3State[ 0 ][ sid ], k - 1 );
+	if ( A >= 0x19 && A <= 0x1c )
+		return reg[ A ];
+	return busValue;
+}
+
+static void runBus( RESULT *r, uint32_t c64Clock, uint8_t withFM, uint8_t delayReadBus, uint8_t delayPHI2 )
+{
+	memset( r, 0, sizeof( RESULT ) );
+	r->readMargin = r->writeMargin = 1e9;
+
+	C64_CLOCK = c64Clock;
+	halfCycle = (double)CLOCK_HZ / c64Clock / 2.0;
+	uint32_t halfCycleInt = (uint32_t)halfCycle;		// as computed by initBusTimingProfile
+
+	c64CycleCounter = 0;
+	sfInit( &sampleFifo, SAMPLE_FIFO_AHEAD );
+	cqInit( &cmdQueue, 0 );
+	memset( outRegisters, 0, sizeof( outRegisters ) );
+	memset( config, 0, sizeof( config ) );
+	outRegisters[ REG_MODEL_DETECT_VALUE ] = outRegisters[ REG_MODEL_DETECT_VALUE + 34 ] = SID_MODEL_DETECT_VALUE_8580;
+	FM_ENABLE = withFM;
+	SID2_IOx = 0;
+	busValue = 0; busValueTTL = 0; doReset = 0;
+	stateGoingTowardsTransferMode = 0;
+
+	// OSC3 predicted from a published sawtooth (SID #1) and pulse (SID #2)
+	memset( osc3State, 0, sizeof( osc3State ) );
+	osc3State[ 0 ][ 0 ] = (OSC3_STATE){ 0, 0, 7493, 0, 2, 0, 0 };
+	osc3State[ 0 ][ 1 ] = (OSC3_STATE){ 0, 0, 1234, 0x800, 4, 0, 0 };
+	osc3Published = 0;
+	osc3WriteCycle[ 0 ] = osc3WriteCycle[ 1 ] = 0;
+
+	buildScript( withFM );
+
+	BUS_STATE bus = busInit( bOE | bPWN_POT | ( 1 << LED_BUILTIN ) );
+	uint32_t gpioDirCur = 0;
+
+	driven = 0;
+	now = (uint64_t)edge( 3 ) + 1;		// CPU half-cycle of cycle 1
+	uint64_t expectedHalf = 4;
+
+	while ( halfAt( now ) < 2 * ( N_CYCLES - 8 ) )
+	{
+		//
+		// VIC half-cycle
+		//
+		uint64_t h = simWait( 0 );
+		if ( h != expectedHalf )
+			r->missedHalfCycles ++;
+		expectedHalf = h + 1;
+		uint64_t start = now;
+		simPath = BUS_PATH_VIC;
+
+		// the CPU latched the data lines at the falling edge of PHI2
+		ACCESS *prev = &script[ h / 2 - 1 ];
+		if ( prev->type == ACC_READ )
+		{
+			r->reads ++;
+			if ( !driven || drivenValue != prev->data )
+				r->wrongReads ++; else
+			if ( drivenAt + T_DSU > edge( h ) )
+				r->lateReadData ++;
+			if ( edge( h ) - T_DSU - drivenAt < r->readMargin )
+				r->readMargin = edge( h ) - T_DSU - drivenAt;
+		}
+
+		if ( bus.disableDataLines )
+		{
+			now += COST_RELEASE;
+			driven = 0;
+			if ( now + T_DSU > edge( h + 1 ) )
+				r->lateRelease ++;
+			bus.disableDataLines = 0;
+		}
+
+		if ( bus.gpioDir != gpioDirCur )
+		{
+			gpioDirCur = bus.gpioDir;
+			now += COST_POT_DIR;
+		}
+
+		uint32_t ticks = sampleFifo.ticks;
+		bus = busVICHalfCycle( bus, gpioAt( start - COST_POLL_EXIT ) );
+		now += COST_VIC;
+		if ( simPath == BUS_PATH_VIC_OSC3 )
+			now += COST_OSC3;
+		if ( sampleFifo.ticks != ticks )
+			now += COST_TICK;
+
+		simPathEnd( r, start, halfCycleInt );
+
+		//
+		// CPU half-cycle
+		//
+		h = simWait( 1 );
+		if ( h != expectedHalf )
+			r->missedHalfCycles ++;
+		expectedHalf = h + 1;
+		start = now;
+		simPath = BUS_PATH_IDLE;
+		simHalf = h;
+		simGpioReads = 0;
+
+		uint32_t k = h / 2;
+		ACCESS *a = &script[ k ];
+		if ( a->type == ACC_READ )
+			a->data = expectedRead( &bus, a, k );
+
+		bus = busCPUHalfCycle( bus, delayPHI2, delayReadBus );
+		CHECK( !bus.enterConfig, "config mode entered in cycle %u", k );
+
+		if ( simPath == BUS_PATH_SID_READ )
+			now += COST_READ_TAIL; else
+		if ( simPath == BUS_PATH_SID_WRITE )
+			now += COST_WRITE; else
+		if ( simPath == BUS_PATH_FM_WRITE )
+			now += COST_FM_WRITE; else
+			now += COST_DECODE;
+		now += COST_POT;
+
+		// the write has to be sampled while the data is valid, and queued for the cycle it happened in
+		if ( a->type == ACC_WRITE )
+		{
+			r->writes ++;
+			if ( simSampledAt < edge( h ) + T_MDS || simSampledAt >= edge( h + 1 ) + T_HOLD )
+				r->badWriteSample ++;
+			if ( edge( h + 1 ) + T_HOLD - simSampledAt < r->writeMargin )
+				r->writeMargin = edge( h + 1 ) + T_HOLD - simSampledAt;
+
+			uint16_t cmd = ( ( a->addr & 0x1f ) << 8 ) | a->data | ( ( a->addr & 0x20 ) ? 1 << 15 : 0 );
+			if ( cqCount( &cmdQueue ) == 0 )
+				r->wrongWrites ++; else
+			{
+				uint64_t t = cqPeekTime( &cmdQueue );
+				if ( cqPop( &cmdQueue ) != cmd || t != k - 1 )
+					r->wrongWrites ++;
+			}
+		}
+		while ( cqCount( &cmdQueue ) )
+		{
+			cqPop( &cmdQueue );
+			r->wrongWrites ++;
+		}
+
+		simPathEnd( r, start, halfCycleInt );
+	}
+}
+
+static const char *pathName[ BUS_PATHS ] = { "VIC", "idle", "SID read", "SID write", "FM write", "config", "transfer", "VIC+OSC3" };
+
+static void check( const char *name, uint32_t c64Clock, uint8_t withFM, uint8_t delayReadBus, uint8_t delayPHI2 )
+{
+	RESULT r;
+	runBus( &r, c64Clock, withFM, delayReadBus, delayPHI2 );
+
+	uint32_t halfCycleInt = (uint32_t)halfCycle;
+	printf( "%s (half-cycle %u cycles, bus timings %d/%d):\n", name, halfCycleInt, delayReadBus, delayPHI2 );
+	for ( int i = 0; i < BUS_PATHS; i++ )
+		if ( r.count[ i ] )
+		{
+			uint32_t budget = BUS_PATH_BUDGET( i, halfCycleInt );
+			printf( "  %-10s %7u x, max %3u of %3u cycles\n", pathName[ i ], r.count[ i ], (uint32_t)r.maxCycles[ i ], budget );
+			CHECK( r.overruns[ i ] == 0, "%s: %s path exceeds its budget %u times (max %u > %u cycles)",
+				name, pathName[ i ], r.overruns[ i ], (uint32_t)r.maxCycles[ i ], budget );
+		}
+
+	printf( "  minimum margin of read data %.0f, of write sampling %.0f cycles\n", r.readMargin, r.writeMargin );
+
+	CHECK( r.reads > 1000 && r.writes > 1000, "%s: %u reads, %u writes", name, r.reads, r.writes );
+	CHECK( r.count[ BUS_PATH_VIC_OSC3 ] > 1000, "%s: OSC3 predicted in %u VIC half-cycles", name, r.count[ BUS_PATH_VIC_OSC3 ] );
+	CHECK( r.missedHalfCycles == 0, "%s: %u half-cycles missed", name, r.missedHalfCycles );
+	CHECK( r.lateReadData == 0, "%s: %u reads not set up in time", name, r.lateReadData );
+	CHECK( r.lateRelease == 0, "%s: %u data lines released late", name, r.lateRelease );
+	CHECK( r.badWriteSample == 0, "%s: %u writes sampled outside of the valid data", name, r.badWriteSample );
+	CHECK( r.wrongReads == 0, "%s: %u wrong reads", name, r.wrongReads );
+	CHECK( r.wrongWrites == 0, "%s: %u wrong writes", name, r.wrongWrites );
+}
+
+int main()
+{
+	// default bus timings (DELAY_READ_BUS, DELAY_PHI2)
+	check( "PAL", C64_CLOCK_PAL, 0, 11, 15 );
+	check( "NTSC", C64_CLOCK_NTSC, 0, 11, 15 );
+	check( "PAL, FM", C64_CLOCK_PAL, 1, 11, 15 );
+	check( "NTSC, FM", C64_CLOCK_NTSC, 1, 11, 15 );
+
+	return TEST_RESULT();
+}
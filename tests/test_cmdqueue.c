@@ -0,0 +1,137 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_cmdqueue.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "cmdqueue.h"
+#include "testutil.h"
+
+//
+// SPSC command queue: producer and consumer on separate threads, every command has to arrive once, in
+// order and with its cycle; gaps exceeding 16 bits (extension entries) and the wrap of the 32-bit cycle
+// counter are included
+//
+
+#define N_COMMANDS		1000000
+
+static CMD_QUEUE queue;
+static uint64_t  cycles[ N_COMMANDS ];
+static uint32_t  pushFailures;
+
+static void *producer( void *arg )
+{
+	(void)arg;
+
+	for ( uint32_t i = 0; i < N_COMMANDS; )
+	{
+		if ( cqPush( &queue, (uint16_t)i, (uint32_t)cycles[ i ] ) )
+			i ++; else
+		{
+			pushFailures ++;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void testThreads()
+{
+	// mostly short gaps, some beyond 16 bits, few very long ones
+	uint64_t t = 0xfff00000ull;
+	uint32_t seed = 1;
+	for ( uint32_t i = 0; i < N_COMMANDS; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		uint32_t r = ( seed >> 8 ) % 100;
+		t += r < 80 ? r : r < 95 ? ( seed >> 4 ) & 0xfffff : (uint64_t)( seed & 0xffff ) << 12;
+		cycles[ i ] = t;
+	}
+
+	cqInit( &queue, 0xfff00000ull );
+	pushFailures = 0;
+
+	pthread_t thread;
+	pthread_create( &thread, NULL, producer, NULL );
+
+	uint32_t n = 0, wrongCmd = 0, wrongTime = 0;
+	while ( n < N_COMMANDS )
+	{
+		if ( !cqCount( &queue ) )
+		{
+			sched_yield();
+			continue;
+		}
+		uint64_t time = cqPeekTime( &queue );
+		uint16_t peek = cqPeekCmd( &queue );
+		uint16_t cmd = cqPop( &queue );
+		if ( cmd != (uint16_t)n || peek != cmd ) wrongCmd ++;
+		if ( time != cycles[ n ] ) wrongTime ++;
+		n ++;
+	}
+
+	pthread_join( thread, NULL );
+
+	CHECK( wrongCmd == 0, "%u commands out of order", wrongCmd );
+	CHECK( wrongTime == 0, "%u commands with wrong cycle", wrongTime );
+	CHECK( queue.overflows == pushFailures, "overflows %u, failed pushes %u", queue.overflows, pushFailures );
+	CHECK( queue.highWater <= CMD_QUEUE_DEPTH, "high-water mark %u", queue.highWater );
+	printf( "threads: %u commands, %u overflows, high-water mark %u\n", N_COMMANDS, queue.overflows, queue.highWater );
+}
+
+// a full queue drops new commands (and counts them) instead of overwriting unprocessed ones
+static void testOverflow()
+{
+	cqInit( &queue, 0 );
+
+	for ( uint32_t i = 0; i < CMD_QUEUE_DEPTH; i++ )
+		CHECK( cqPush( &queue, (uint16_t)i, i ), "push %u into non-full queue failed", i );
+
+	CHECK( !cqPush( &queue, 0xffff, CMD_QUEUE_DEPTH ), "push into full queue succeeded" );
+	CHECK( queue.overflows == 1, "overflows %u", queue.overflows );
+	CHECK( queue.highWater == CMD_QUEUE_DEPTH, "high-water mark %u", queue.highWater );
+
+	// one free entry is not enough for a command with an extension entry
+	cqPop( &queue );
+	CHECK( !cqPush( &queue, 0xffff, 0x1000000 ), "push of extended entry into queue with one free entry succeeded" );
+	CHECK( queue.overflows == 2, "overflows %u", queue.overflows );
+
+	for ( uint32_t i = 1; i < CMD_QUEUE_DEPTH; i++ )
+	{
+		CHECK( cqPeekTime( &queue ) == i, "cycle %llu, expected %u", (unsigned long long)cqPeekTime( &queue ), i );
+		CHECK( cqPop( &queue ) == i, "wrong command after overflow" );
+	}
+	CHECK( cqCount( &queue ) == 0, "queue not empty" );
+}
+
+int main()
+{
+	testOverflow();
+	testThreads();
+	return TEST_RESULT();
+}
@@ -0,0 +1,164 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_dacmode.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include "dacmode.h"
+#include "testutil.h"
+
+//
+// decoding of the DAC mode writes (dacmode.h): 16-bit samples are paired low byte first, a high byte alone
+// reuses the last low byte, MONO16 ignores the right channel registers, and mode changes clear the low bytes
+//
+
+// expects a write to complete a sample on channel 'ch' with 'level' (ch = -1: no sample)
+#define EXPECT( d, reg, value, ch, level ) {											\
+	int32_t l_ = 0x7fffffff;															\
+	int c_ = dacWrite( d, reg, value, &l_ );											\
+	CHECK( c_ == (ch) && ( c_ < 0 || l_ == (level) ),									\
+		"write $%02x = $%02x: channel %d level %d, expected %d / %d", reg, value, c_, c_ < 0 ? 0 : l_, ch, level ); }
+
+static void testPairing()
+{
+	DAC_DECODER d;
+	dacInit( &d );
+
+	// not in a DAC mode
+	EXPECT( &d, 0x18, 0x34, -1, 0 );
+	EXPECT( &d, 0x19, 0x12, -1, 0 );
+
+	dacSetMode( &d, SID_DAC_MONO16 );
+
+	// low byte first, the high byte completes the sample
+	EXPECT( &d, 0x18, 0x34, -1, 0 );
+	EXPECT( &d, 0x19, 0x12, 0, 0x1234 );
+	EXPECT( &d, 0x18, 0x00, -1, 0 );
+	EXPECT( &d, 0x19, 0x80, 0, -32768 );
+	EXPECT( &d, 0x18, 0xff, -1, 0 );
+	EXPECT( &d, 0x19, 0x7f, 0, 32767 );
+
+	// a high byte without a new low byte reuses the stale one
+	EXPECT( &d, 0x19, 0x01, 0, 0x01ff );
+	EXPECT( &d, 0x19, 0xfe, 0, (int16_t)0xfeff );
+
+	// a low byte alone does not output anything, the next high byte uses the latest low byte
+	EXPECT( &d, 0x18, 0x11, -1, 0 );
+	EXPECT( &d, 0x18, 0x22, -1, 0 );
+	EXPECT( &d, 0x19, 0x03, 0, 0x0322 );
+}
+
+static void testMono16()
+{
+	DAC_DECODER d;
+	dacInit( &d );
+	dacSetMode( &d, SID_DAC_MONO16 );
+
+	// $1a/$1b are ignored, they neither output nor change the low byte of the mono channel
+	EXPECT( &d, 0x18, 0x44, -1, 0 );
+	EXPECT( &d, 0x1a, 0x99, -1, 0 );
+	EXPECT( &d, 0x1b, 0x55, -1, 0 );
+	EXPECT( &d, 0x19, 0x05, 0, 0x0544 );
+
+	// other registers are ignored as well
+	for ( int reg = 0; reg < 0x18; reg++ )
+		EXPECT( &d, reg, 0x12, -1, 0 );
+	EXPECT( &d, 0x1c, 0x12, -1, 0 );
+}
+
+static void testStereo16()
+{
+	DAC_DECODER d;
+	dacInit( &d );
+	dacSetMode( &d, SID_DAC_STEREO16 );
+
+	// the channels are paired independently, also interleaved
+	EXPECT( &d, 0x1a, 0x78, -1, 0 );
+	EXPECT( &d, 0x18, 0x34, -1, 0 );
+	EXPECT( &d, 0x1b, 0x56, 1, 0x5678 );
+	EXPECT( &d, 0x19, 0x12, 0, 0x1234 );
+	EXPECT( &d, 0x1b, 0x9a, 1, (int16_t)0x9a78 );
+}
+
+static void testModeSwitch()
+{
+	DAC_DECODER d;
+	dacInit( &d );
+
+	// $fe (MONO16) -> $fd (STEREO16): the low byte written before the switch is not used
+	dacSetMode( &d, SID_DAC_MONO16 );
+	EXPECT( &d, 0x18, 0xab, -1, 0 );
+	dacSetMode( &d, SID_DAC_STEREO16 );
+	EXPECT( &d, 0x19, 0x01, 0, 0x0100 );
+
+	// $fd -> $fe, both channels
+	EXPECT( &d, 0x18, 0xcd, -1, 0 );
+	EXPECT( &d, 0x1a, 0xef, -1, 0 );
+	dacSetMode( &d, SID_DAC_MONO16 );
+	EXPECT( &d, 0x19, 0x02, 0, 0x0200 );
+	dacSetMode( &d, SID_DAC_STEREO16 );
+	EXPECT( &d, 0x1b, 0x03, 1, 0x0300 );
+
+	// via an 8-bit mode and back
+	EXPECT( &d, 0x18, 0x77, -1, 0 );
+	dacSetMode( &d, SID_DAC_MONO8 );
+	dacSetMode( &d, SID_DAC_MONO16 );
+	EXPECT( &d, 0x19, 0x04, 0, 0x0400 );
+
+	// setting the same mode again is not a switch
+	EXPECT( &d, 0x18, 0x66, -1, 0 );
+	dacSetMode( &d, SID_DAC_MONO16 );
+	EXPECT( &d, 0x19, 0x05, 0, 0x0566 );
+}
+
+static void test8Bit()
+{
+	DAC_DECODER d;
+	dacInit( &d );
+
+	// unsigned samples, $18 only in mono
+	dacSetMode( &d, SID_DAC_MONO8 );
+	EXPECT( &d, 0x18, 0x80, 0, 0 );
+	EXPECT( &d, 0x18, 0xff, 0, 127 << 7 );
+	EXPECT( &d, 0x18, 0x00, 0, -128 << 7 );
+	EXPECT( &d, 0x19, 0x40, -1, 0 );
+	EXPECT( &d, 0x1a, 0x40, -1, 0 );
+
+	// $18 left, $19 right
+	dacSetMode( &d, SID_DAC_STEREO8 );
+	EXPECT( &d, 0x18, 0x90, 0, 16 << 7 );
+	EXPECT( &d, 0x19, 0x70, 1, -16 << 7 );
+	EXPECT( &d, 0x1b, 0x70, -1, 0 );
+}
+
+int main()
+{
+	testPairing();
+	testMono16();
+	testStereo16();
+	testModeSwitch();
+	test8Bit();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,263 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_digidetect.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "digidetect.h"
+#include "testutil.h"
+
+//
+// precision/recall of the digi detection on a synthetic corpus: the register writes of the player routines
+// of each technique (a few variants, sample rates and code timings), interrupted by badlines and IRQs, and
+// the writes of ordinary music players (with hard restarts, pulse width modulation, test bit effects and
+// multispeed). Each write which completes a sample is labeled with the sample value; a detection is correct
+// if it happens on such a write with the right value and technique. Samples whose writes are stretched
+// beyond the rules' timeouts by a badline or an IRQ are missed, i.e. the recall cannot reach 1.
+//
+
+#define C64_CLOCK_PAL	985248
+#define PAL_FRAME		19656
+#define CYCLES			( PAL_FRAME * 50 * 10 )		// 10 seconds per corpus entry
+
+static uint32_t rnd = 12345;
+static uint32_t random32()
+{
+	rnd = rnd * 1664525 + 1013904223;
+	return rnd >> 8;
+}
+static uint32_t randomRange( uint32_t a, uint32_t b )
+{
+	return a + random32() % ( b - a + 1 );
+}
+
+typedef struct
+{
+	DD_VOICE voice[ DD_TECHNIQUES ];
+	uint32_t cycle;
+	uint8_t  irqChance;		// percent per routine
+	uint32_t samples, detected, correct;
+} STREAM;
+
+static void streamInit( STREAM *s, uint8_t irqChance )
+{
+	for ( int t = 0; t < DD_TECHNIQUES; t++ )
+	{
+		s->voice[ t ].state = DD_IDLE;
+		s->voice[ t ].cycle = 0;
+	}
+	s->cycle = 0;
+	s->irqChance = irqChance;
+	s->samples = s->detected = s->correct = 0;
+}
+
+// CPU time passes: 'cycles' of code, stretched by badlines (40 cycles stolen on every 8th raster line)
+static void streamWait( STREAM *s, uint32_t cycles )
+{
+	if ( (int32_t)cycles < 0 )
+		return;
+	while ( cycles -- )
+	{
+		s->cycle ++;
+		uint32_t line = ( s->cycle / 63 ) % 312, x = s->cycle % 63;
+		if ( line >= 48 && line < 248 && ( line & 7 ) == 3 && x == 12 )
+			s->cycle += 40;
+	}
+}
+
+// a write of the player; 'technique' and 'sample' label the write which completes a sample (technique 0: none)
+static void streamWrite( STREAM *s, uint8_t reg, uint8_t value, uint8_t technique, uint8_t sample )
+{
+	uint8_t detected, id = ddWrite( s->voice, reg, value, s->cycle, &detected );
+
+	if ( technique )
+		s->samples ++;
+	if ( id )
+	{
+		s->detected ++;
+		if ( id == technique && detected == sample )
+			s->correct ++;
+	}
+}
+
+// a routine may be interrupted between two of its writes
+static void streamGap( STREAM *s, uint32_t cycles )
+{
+	streamWait( s, cycles );
+	if ( s->irqChance && randomRange( 1, 100 * 4 ) <= s->irqChance )
+		streamWait( s, randomRange( 30, 400 ) );
+}
+
+// test-bit player: 0x11, test bit (0x09 or 0x08), sample into the frequency, 0x01 (or frequency after 0x01)
+static void playTestBit( STREAM *s, uint32_t rate, uint8_t variant )
+{
+	uint8_t timing = randomRange( 0, 2 ) * 2;
+	uint8_t testValue = randomRange( 0, 1 ) ? 0x09 : 0x08;
+	while ( s->cycle < CYCLES )
+	{
+		uint32_t start = s->cycle;
+		uint8_t sample = random32();
+		streamWrite( s, 4, 0x11, 0, 0 );
+		streamGap( s, 6 + timing );
+		streamWrite( s, 4, testValue, 0, 0 );
+		streamGap( s, 6 + timing );
+		if ( variant == 0 )
+		{
+			streamWrite( s, 1, sample, 0, 0 );
+			streamGap( s, 6 );
+			streamWrite( s, 4, 0x01, 2, sample );
+		} else
+		{
+			streamWrite( s, 4, 0x01, 0, 0 );
+			streamGap( s, 6 );
+			streamWrite( s, 1, sample, 2, sample );
+		}
+		streamWait( s, start + C64_CLOCK_PAL / rate - s->cycle );
+	}
+}
+
+// pulse player: sample into the pulse width, 0x49, 0x41 (or 0x49 first)
+static void playPulse( STREAM *s, uint32_t rate, uint8_t variant )
+{
+	uint8_t timing = randomRange( 0, 2 ) * 2;
+	while ( s->cycle < CYCLES )
+	{
+		uint32_t start = s->cycle;
+		uint8_t sample = random32();
+		if ( variant == 0 )
+		{
+			streamWrite( s, 2, sample, 0, 0 );
+			streamGap( s, 6 + timing );
+			streamWrite( s, 4, 0x49, 0, 0 );
+		} else
+		{
+			streamWrite( s, 4, 0x49, 0, 0 );
+			streamGap( s, 6 + timing );
+			streamWrite( s, 2, sample, 0, 0 );
+		}
+		streamGap( s, 6 + timing );
+		streamWrite( s, 4, 0x41, 1, sample );
+		streamWait( s, start + C64_CLOCK_PAL / rate - s->cycle );
+	}
+}
+
+// music player: all registers of the voice once per call, hard restart before new notes
+static void playMusic( STREAM *s, uint8_t speed, uint8_t pwm )
+{
+	static const uint8_t waveforms[] = { 0x11, 0x21, 0x41, 0x81, 0x15, 0x43, 0x10, 0x20, 0x40, 0x80 };
+	uint8_t wave = 0x41, hardRestart = 0;
+	uint16_t pw = 0x800;
+
+	while ( s->cycle < CYCLES )
+	{
+		uint32_t start = s->cycle;
+
+		if ( hardRestart )
+		{
+			// new note: test bit for one call, then the waveform with gate
+			wave = waveforms[ randomRange( 0, sizeof( waveforms ) - 1 ) ] | 1;
+			streamWrite( s, 4, wave, 0, 0 );
+			hardRestart = 0;
+		} else
+		if ( randomRange( 0, 15 ) == 0 )
+		{
+			streamWrite( s, 5, 0x00, 0, 0 );
+			streamGap( s, 4 );
+			streamWrite( s, 6, 0x00, 0, 0 );
+			streamGap( s, 4 );
+			streamWrite( s, 4, randomRange( 0, 1 ) ? 0x09 : 0x08, 0, 0 );
+			hardRestart = 1;
+		} else
+		{
+			// vibrato/arpeggio, pulse width modulation, waveform changes within the note
+			streamWrite( s, 0, random32(), 0, 0 );
+			streamGap( s, 4 );
+			streamWrite( s, 1, random32(), 0, 0 );
+			streamGap( s, 4 );
+			if ( pwm )
+			{
+				pw += 0x40;
+				streamWrite( s, 2, pw & 255, 0, 0 );
+				streamGap( s, 4 );
+				streamWrite( s, 3, ( pw >> 8 ) & 15, 0, 0 );
+				streamGap( s, 4 );
+			}
+			if ( randomRange( 0, 3 ) == 0 )
+				wave = ( waveforms[ randomRange( 0, sizeof( waveforms ) - 1 ) ] & 0xf0 ) | ( wave & 1 );
+			if ( randomRange( 0, 7 ) == 0 )
+				wave &= ~1;
+			streamWrite( s, 4, wave, 0, 0 );
+			streamGap( s, 4 );
+			streamWrite( s, 5, random32(), 0, 0 );
+			streamGap( s, 4 );
+			streamWrite( s, 6, random32(), 0, 0 );
+		}
+		streamWait( s, start + PAL_FRAME / speed - s->cycle );
+	}
+}
+
+int main()
+{
+	STREAM s;
+	uint32_t samples = 0, detected = 0, correct = 0, falseMusic = 0;
+
+	// digi players: techniques, variants, sample rates, with and without interrupts
+	static const uint32_t rates[] = { 4000, 6000, 8000, 11000 };
+	for ( int technique = 0; technique < 2; technique++ )
+		for ( int variant = 0; variant < 2; variant++ )
+			for ( int r = 0; r < 4; r++ )
+				for ( int irq = 0; irq < 2; irq++ )
+				{
+					streamInit( &s, irq ? 5 : 0 );
+					if ( technique == 0 )
+						playTestBit( &s, rates[ r ], variant ); else
+						playPulse( &s, rates[ r ], variant );
+					samples += s.samples;
+					detected += s.detected;
+					correct += s.correct;
+				}
+
+	// music players: no samples, every detection is a false positive
+	for ( int speed = 1; speed <= 8; speed *= 2 )
+		for ( int pwm = 0; pwm < 2; pwm++ )
+		{
+			streamInit( &s, 5 );
+			playMusic( &s, speed, pwm );
+			detected += s.detected;
+			falseMusic += s.detected;
+		}
+
+	double precision = (double)correct / detected;
+	double recall = (double)correct / samples;
+	printf( "%u samples, %u detections, %u correct (%u in music): precision %.4f, recall %.4f\n",
+		samples, detected, correct, falseMusic, precision, recall );
+
+	CHECK( falseMusic == 0, "%u detections in music", falseMusic );
+	CHECK( precision >= 0.999, "precision %.4f", precision );
+	CHECK( recall >= 0.94, "recall %.4f", recall );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,185 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_directmixer.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include "reSID16/sid.h"
+#include "testutil.h"
+
+//
+// direct mixer for Mahoney's $d418 digis (SID16::set_direct_mixer, Filter::settled_output): the voices are
+// constant and routed through the filter at its highest cutoff, each $d418 write selects a level. The direct
+// mixer outputs the steady state of the filter for each level instead of integrating it. Compared against the
+// full filter emulation of a reference instance, for an 8kHz sample stream (a sine and random bytes), and
+// when leaving the mode, where the filter must continue without a step. The emulation time of both is
+// reported.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+#define DIGI_RATE		8000
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+static void sidInit( SID16 *s, chip_model model )
+{
+	s->set_chip_model( model );
+	s->enable_nonlinear_filter( model == MOS6581 );
+	s->set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, AUDIO_RATE );
+	s->reset();
+}
+
+// the register setup the firmware's heuristic detects (SKpico.c)
+static void mahoneySetup( SID16 *s )
+{
+	static const uint8_t regs[][ 2 ] = {
+		{ 0x05, 0x00 }, { 0x06, 0xfb }, { 0x0c, 0x00 }, { 0x0d, 0xfb }, { 0x13, 0x00 }, { 0x14, 0xfb },
+		{ 0x04, 0x49 }, { 0x0b, 0x49 }, { 0x12, 0x49 },
+		{ 0x15, 0xfe }, { 0x16, 0xff }, { 0x17, 0x03 }, { 0x18, 0x1f } };
+	for ( auto &r : regs )
+		s->write( r[ 0 ], r[ 1 ] );
+}
+
+typedef struct
+{
+	double   signal, noise, timeRef, timeDirect;
+	int      maxStep;
+} RESULT;
+
+// renders nDigi samples of the stream with both instances, the second one in direct mixer mode, and the
+// following 'tail' samples after leaving the mode
+static void render( SID16 *ref, SID16 *dir, uint32_t nDigi, uint8_t ( *digi )( uint32_t ), RESULT *r )
+{
+	uint64_t tickPhase = 0, digiPhase = 0;
+	uint32_t n = 0;
+	int      prevRef = ref->output();
+
+	dir->set_direct_mixer( true );
+
+	while ( n < nDigi )
+	{
+		uint32_t toTick = (uint32_t)( ( C64_CLOCK - tickPhase + AUDIO_RATE - 1 ) / AUDIO_RATE );
+		uint32_t toDigi = (uint32_t)( ( C64_CLOCK - digiPhase + DIGI_RATE - 1 ) / DIGI_RATE );
+		uint32_t delta = toTick < toDigi ? toTick : toDigi;
+
+		auto t0 = std::chrono::steady_clock::now();
+		ref->clock( delta );
+		auto t1 = std::chrono::steady_clock::now();
+		dir->clock( delta );
+		auto t2 = std::chrono::steady_clock::now();
+		r->timeRef += std::chrono::duration<double>( t1 - t0 ).count();
+		r->timeDirect += std::chrono::duration<double>( t2 - t1 ).count();
+
+		tickPhase += (uint64_t)delta * AUDIO_RATE;
+		digiPhase += (uint64_t)delta * DIGI_RATE;
+
+		if ( delta == toTick )
+		{
+			tickPhase -= C64_CLOCK;
+			int a = ref->output(), b = dir->output();
+			r->signal += (double)( a - prevRef ) * ( a - prevRef );
+			r->noise += (double)( a - b ) * ( a - b );
+			prevRef = a;
+		}
+		if ( delta == toDigi )
+		{
+			digiPhase -= C64_CLOCK;
+			uint8_t v = digi( n ++ );
+			ref->write( 0x18, v );
+			dir->write( 0x18, v );
+		}
+	}
+
+	// leave the mode, the filter continues from the steady state of the last level
+	dir->set_direct_mixer( false );
+	r->maxStep = 0;
+	for ( int i = 0; i < 4410; i++ )
+	{
+		ref->clock( 22 );
+		dir->clock( 22 );
+		int a = ref->output(), b = dir->output();
+		if ( abs( a - b ) > r->maxStep )
+			r->maxStep = abs( a - b );
+	}
+}
+
+// a 440Hz sine on volume only, as most players do; random levels, filter modes and voice 3 off
+static uint8_t digiSine( uint32_t n )
+{
+	return 0x10 | (uint8_t)lrint( 7.5 + 7.49 * sin( 2 * M_PI * 440 * n / DIGI_RATE ) );
+}
+
+static uint8_t digiRandom( uint32_t n )
+{
+	(void)n;
+	return rnd( 256 );
+}
+
+static void testDirectMixer( chip_model model, const char *stream, uint8_t ( *digi )( uint32_t ) )
+{
+	const char *name = model == MOS6581 ? "6581" : "8580";
+
+	SID16 ref, dir;
+	sidInit( &ref, model );
+	sidInit( &dir, model );
+	mahoneySetup( &ref );
+	mahoneySetup( &dir );
+
+	// attack to the sustain level, the filter settles
+	ref.clock( C64_CLOCK / 10 );
+	dir.clock( C64_CLOCK / 10 );
+
+	RESULT r = { 0, 0, 0, 0, 0 };
+	render( &ref, &dir, DIGI_RATE * 3, digi, &r );
+
+	// against the signal's sample-to-sample changes: the DC offset of the output is not part of the signal
+	double snr = r.noise ? 10 * log10( r.signal / r.noise ) : INFINITY;
+	if ( r.noise == 0 )
+		printf( "%s %s: direct mixer identical to the filter", name, stream ); else
+		printf( "%s %s: direct mixer vs. filter %.1f dB", name, stream, snr );
+	printf( ", max. difference after leaving %d, emulation time %.0f%% of the filter's\n", r.maxStep, 100 * r.timeDirect / r.timeRef );
+
+	CHECK( snr > 60, "%s %s: direct mixer differs from the filter by %.1f dB", name, stream, snr );
+	CHECK( r.maxStep <= 8, "%s %s: step of %d after leaving the direct mixer", name, stream, r.maxStep );
+}
+
+int main()
+{
+	testDirectMixer( MOS6581, "sine", digiSine );
+	testDirectMixer( MOS8580, "sine", digiSine );
+	testDirectMixer( MOS6581, "random", digiRandom );
+	testDirectMixer( MOS8580, "random", digiRandom );
+	return TEST_RESULT();
+}
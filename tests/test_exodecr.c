@@ -0,0 +1,82 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_exodecr.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "exodecr.h"
+#include "prgconfig.h"
+#include "reSID_LUT.h"
+#include "testutil.h"
+
+//
+// resumable decruncher: decrunching in slices of any budget has to give the same output as the one-shot
+// exo_decrunch, and no slice may write more than its budget
+//
+
+static char reference[ 65536 ], sliced[ 65536 ];
+
+static void testSliced( const char *name, const unsigned char *in, long inSize, int outSize, int budget )
+{
+	memset( reference, 0x55, sizeof( reference ) );
+	memset( sliced, 0xaa, sizeof( sliced ) );
+
+	char *refStart = exo_decrunch( (const char *)&in[ inSize ], &reference[ outSize ] );
+	CHECK( refStart == reference, "%s: one-shot output size %d, expected %d", name, (int)( &reference[ outSize ] - refStart ), outSize );
+
+	EXO_DECRUNCH ctx;
+	exo_decrunch_init( &ctx, (const char *)&in[ inSize ], &sliced[ outSize ] );
+
+	int steps = 0, overBudget = 0;
+	for ( ;; )
+	{
+		char *out = ctx.out;
+		int done = exo_decrunch_step( &ctx, budget );
+		if ( out - ctx.out > budget )
+			overBudget ++;
+		steps ++;
+		if ( done || steps > outSize + 1 )
+			break;
+	}
+
+	CHECK( ctx.out == sliced, "%s, budget %d: output size %d, expected %d", name, budget, (int)( &sliced[ outSize ] - ctx.out ), outSize );
+	CHECK( memcmp( reference, sliced, outSize ) == 0, "%s, budget %d: output differs from exo_decrunch", name, budget );
+	CHECK( overBudget == 0, "%s, budget %d: %d slices exceed the budget", name, budget, overBudget );
+}
+
+int main()
+{
+	const int budgets[] = { 1, 2, 7, 64, 256, 1000, 0x7fffffff };
+
+	for ( unsigned i = 0; i < sizeof( budgets ) / sizeof( budgets[ 0 ] ); i++ )
+	{
+		testSliced( "config tool", prgCodeCompressed, prgCodeCompressed_size, prgCode_size, budgets[ i ] );
+		testSliced( "reSID LUTs", reSID_LUTs_exo, reSID_LUTs_exo_size, 32768, budgets[ i ] );
+	}
+
+	return TEST_RESULT();
+}
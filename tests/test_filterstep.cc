@@ -0,0 +1,221 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_filterstep.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include "reSID16/filter.h"
+#include "testutil.h"
+
+//
+// delta_t clocking of the linear filter (Filter::clock): the integration steps of up to 8 cycles are
+// collapsed into one transition step per span. Both this step and the step-by-step loop it replaces are
+// compared against the same recurrence in floating point, i.e. without the truncation of the fixpoint
+// products, over the range of cutoff frequencies and resonances. The emulation time of both is reported.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+
+// access to the filter state, and the loop Filter::clock used before
+class FilterProbe : public Filter
+{
+public:
+	sound_sample bp() const { return Vbp; }
+	sound_sample lp() const { return Vlp; }
+	sound_sample hp() const { return Vhp; }
+	sound_sample w0dt() const { return w0_ceil_dt; }
+	sound_sample div_Q() const { return _1024_div_Q; }
+
+	void clock_loop( cycle_count delta_t, sound_sample voice1, sound_sample voice2, sound_sample voice3 )
+	{
+		// routing as in Filter::clock, which does this with a switch
+		sound_sample Vi = 0;
+		if ( filt & 1 ) Vi += voice1 >> 7;
+		if ( filt & 2 ) Vi += voice2 >> 7;
+		if ( filt & 4 ) Vi += voice3 >> 7;
+
+		cycle_count delta_t_flt = 8;
+		while ( delta_t )
+		{
+			if ( delta_t < delta_t_flt )
+				delta_t_flt = delta_t;
+
+			sound_sample w0_delta_t = w0_ceil_dt * delta_t_flt >> 6;
+
+			sound_sample dVbp = ( w0_delta_t * Vhp >> 14 );
+			sound_sample dVlp = ( w0_delta_t * Vbp >> 14 );
+			Vbp -= dVbp;
+			Vlp -= dVlp;
+			Vhp = ( Vbp * _1024_div_Q >> 10 ) - Vlp - Vi;
+
+			delta_t -= delta_t_flt;
+		}
+	}
+};
+
+// the recurrence of clock_loop without truncation
+typedef struct
+{
+	double bp, lp, hp;
+} FILTER_REF;
+
+static void clockRef( FILTER_REF *f, const FilterProbe *p, cycle_count delta_t, double Vi )
+{
+	cycle_count delta_t_flt = 8;
+	while ( delta_t )
+	{
+		if ( delta_t < delta_t_flt )
+			delta_t_flt = delta_t;
+
+		double w0_delta_t = p->w0dt() * delta_t_flt / 64.0;
+		double dbp = w0_delta_t * f->hp / 16384.0;
+		double dlp = w0_delta_t * f->bp / 16384.0;
+		f->bp -= dbp;
+		f->lp -= dlp;
+		f->hp = f->bp * p->div_Q() / 1024.0 - f->lp - Vi;
+
+		delta_t -= delta_t_flt;
+	}
+}
+
+typedef struct
+{
+	double signal, errStep, errLoop;
+	double timeStep, timeLoop;
+} RESULT;
+
+#define N_SPANS		( AUDIO_RATE / 2 )
+
+static void filterInit( FilterProbe *f, chip_model model, reg8 fc_hi, reg8 res )
+{
+	f->enable_filter( true );
+	f->set_chip_model( model );
+	f->reset();
+
+	// voices 1-3 through the filter, lowpass + bandpass + highpass
+	f->writeFC_LO( 7 );
+	f->writeFC_HI( fc_hi );
+	f->writeRES_FILT( ( res << 4 ) | 7 );
+	f->writeMODE_VOL( 0x7f );
+}
+
+static void testFilter( chip_model model, reg8 fc_hi, reg8 res, RESULT *total, double *minSNRStep, double *minSNRLoop )
+{
+	FilterProbe step, loop;
+	FILTER_REF ref = { 0, 0, 0 };
+
+	filterInit( &step, model, fc_hi, res );
+	filterInit( &loop, model, fc_hi, res );
+
+	// the voice outputs: three sawtooth waves (20 bits)
+	static sound_sample voice[ N_SPANS ][ 3 ];
+	static cycle_count span[ N_SPANS ];
+	uint32_t acc[ 3 ] = { 0, 0, 0 }, tickPhase = 0;
+	static const uint32_t freq[ 3 ] = { 0x1167, 0x4c2d, 0x0457 };
+	for ( int n = 0; n < N_SPANS; n++ )
+	{
+		span[ n ] = ( C64_CLOCK - tickPhase + AUDIO_RATE - 1 ) / AUDIO_RATE;
+		tickPhase += span[ n ] * AUDIO_RATE - C64_CLOCK;
+		for ( int v = 0; v < 3; v++ )
+		{
+			acc[ v ] = ( acc[ v ] + freq[ v ] * span[ n ] ) & 0xffffff;
+			voice[ n ][ v ] = ( (sound_sample)( acc[ v ] >> 12 ) - 0x800 ) * 0xff;
+		}
+	}
+
+	RESULT r = { 0, 0, 0, 0, 0 };
+
+	// the fastest of a few runs
+	for ( int run = 0; run < 64; run++ )
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		for ( int n = 0; n < N_SPANS; n++ )
+			step.clock( span[ n ], voice[ n ][ 0 ], voice[ n ][ 1 ], voice[ n ][ 2 ], 0 );
+		auto t1 = std::chrono::steady_clock::now();
+		for ( int n = 0; n < N_SPANS; n++ )
+			loop.clock_loop( span[ n ], voice[ n ][ 0 ], voice[ n ][ 1 ], voice[ n ][ 2 ] );
+		auto t2 = std::chrono::steady_clock::now();
+		double ts = std::chrono::duration<double>( t1 - t0 ).count();
+		double tl = std::chrono::duration<double>( t2 - t1 ).count();
+		if ( !run || ts < r.timeStep ) r.timeStep = ts;
+		if ( !run || tl < r.timeLoop ) r.timeLoop = tl;
+	}
+
+	// again, span by span against the reference
+	filterInit( &step, model, fc_hi, res );
+	filterInit( &loop, model, fc_hi, res );
+	for ( int n = 0; n < N_SPANS; n++ )
+	{
+		step.clock( span[ n ], voice[ n ][ 0 ], voice[ n ][ 1 ], voice[ n ][ 2 ], 0 );
+		loop.clock_loop( span[ n ], voice[ n ][ 0 ], voice[ n ][ 1 ], voice[ n ][ 2 ] );
+		clockRef( &ref, &step, span[ n ], ( voice[ n ][ 0 ] >> 7 ) + ( voice[ n ][ 1 ] >> 7 ) + ( voice[ n ][ 2 ] >> 7 ) );
+
+		double y = ref.bp + ref.lp + ref.hp;
+		double eStep = step.bp() + step.lp() + step.hp() - y;
+		double eLoop = loop.bp() + loop.lp() + loop.hp() - y;
+		r.signal += y * y;
+		r.errStep += eStep * eStep;
+		r.errLoop += eLoop * eLoop;
+	}
+
+	double snrStep = 10 * log10( r.signal / r.errStep );
+	double snrLoop = 10 * log10( r.signal / r.errLoop );
+	if ( snrStep < *minSNRStep ) *minSNRStep = snrStep;
+	if ( snrLoop < *minSNRLoop ) *minSNRLoop = snrLoop;
+
+	printf( "%s FC $%02x RES %2d: transition step %5.1f dB, 8-cycle loop %5.1f dB, time %3.0f%% of the loop\n",
+		model == MOS6581 ? "6581" : "8580", fc_hi, res, snrStep, snrLoop, 100 * r.timeStep / r.timeLoop );
+
+	total->timeStep += r.timeStep;
+	total->timeLoop += r.timeLoop;
+}
+
+int main()
+{
+	static const reg8 fcs[] = { 0x00, 0x08, 0x20, 0x60, 0xc0, 0xff };
+	static const reg8 ress[] = { 0, 8, 15 };
+
+	for ( int m = 0; m < 2; m++ )
+	{
+		chip_model model = m ? MOS8580 : MOS6581;
+		RESULT total = { 0, 0, 0, 0, 0 };
+		double minSNRStep = 1e9, minSNRLoop = 1e9;
+
+		for ( auto fc : fcs )
+			for ( auto res : ress )
+				testFilter( model, fc, res, &total, &minSNRStep, &minSNRLoop );
+
+		printf( "%s: lowest SNR transition step %.1f dB, 8-cycle loop %.1f dB, time %.0f%% of the loop\n",
+			m ? "8580" : "6581", minSNRStep, minSNRLoop, 100 * total.timeStep / total.timeLoop );
+
+		// at least as close to the recurrence as the loop it replaces
+		CHECK( minSNRStep >= minSNRLoop, "%s: transition step (%.1f dB) less accurate than the loop (%.1f dB)", m ? "8580" : "6581", minSNRStep, minSNRLoop );
+	}
+	return TEST_RESULT();
+}
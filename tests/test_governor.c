@@ -0,0 +1,178 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_governor.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include "governor.h"
+#include "testutil.h"
+
+//
+// the quality governor driven by a synthetic renderer: the cost of a sample depends on the
+// tier (relative to the full-quality cost) and on a load which the test scripts over time;
+// the sample FIFO is modelled by how far the renderer is behind the ticks
+//
+
+#define BUDGET	3016		// processor cycles per sample at 133 MHz and 44.1 kHz
+#define AHEAD	128			// render-ahead of the sample FIFO
+
+static const int32_t tierCost[ QG_TIERS ] = { 100, 70, 50, 30 };	// percent of the full-quality cost
+
+typedef struct
+{
+	QUALITY_GOVERNOR qg;
+	uint8_t  tier;
+	uint32_t changes;
+	uint32_t lateSamples;		// samples which took longer than the budget
+	uint32_t underruns;			// samples which the FIFO could not absorb
+	int32_t  lag;				// cycles behind the ticks
+} RUN;
+
+static void runInit( RUN *r, uint8_t tiers )
+{
+	qgInit( &r->qg );
+	qgSetTiers( &r->qg, tiers );
+	r->tier = QG_TIER_FULL;
+	r->changes = r->lateSamples = r->underruns = 0;
+	r->lag = 0;
+}
+
+// renders n samples with a full-quality cost of 'load' percent of the budget
+static void runSamples( RUN *r, uint32_t n, int32_t load )
+{
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		int32_t cost = BUDGET * load / 100 * tierCost[ r->tier ] / 100;
+		if ( cost > BUDGET )
+			r->lateSamples ++;
+
+		// the FIFO runs empty if the renderer falls behind by the render-ahead, then stale ticks are skipped
+		r->lag += cost - BUDGET;
+		if ( r->lag < 0 )
+			r->lag = 0;
+		if ( r->lag >= AHEAD * BUDGET )
+		{
+			r->underruns ++;
+			r->lag = AHEAD * BUDGET - 1;
+		}
+		uint32_t reserve = AHEAD - ( r->lag + BUDGET - 1 ) / BUDGET;
+
+		uint8_t tier = qgUpdate( &r->qg, BUDGET - cost, BUDGET, reserve, AHEAD );
+		if ( tier != r->tier )
+			r->changes ++;
+		r->tier = tier;
+	}
+}
+
+#define ALL_TIERS	( ( 1 << QG_TIERS ) - 1 )
+
+int main()
+{
+	RUN r;
+
+	// light load: stays at full quality
+	runInit( &r, ALL_TIERS );
+	runSamples( &r, 100000, 60 );
+	CHECK( r.tier == QG_TIER_FULL && r.changes == 0, "light load: tier %d, %u changes", r.tier, r.changes );
+
+	// overload: drops within the first block and no sample is late afterwards
+	runInit( &r, ALL_TIERS );
+	runSamples( &r, QG_BLOCK_SIZE, 120 );
+	CHECK( r.tier == QG_TIER_COARSE, "overload: tier %d after one block", r.tier );
+	r.lateSamples = 0;
+	runSamples( &r, 100000, 120 );
+	CHECK( r.lateSamples == 0 && r.underruns == 0, "overload: %u late samples, %u underruns after the first block", r.lateSamples, r.underruns );
+	CHECK( r.changes <= 2, "overload: %u tier changes", r.changes );
+
+	// heavy overload: goes down as far as needed, one tier per block
+	runInit( &r, ALL_TIERS );
+	runSamples( &r, QG_BLOCK_SIZE * 2, 250 );
+	CHECK( r.tier == QG_TIER_LINEAR, "heavy overload: tier %d after two blocks", r.tier );
+	runSamples( &r, QG_BLOCK_SIZE * 2, 250 );
+	CHECK( r.tier == QG_TIER_POINT, "heavy overload: tier %d after four blocks", r.tier );
+
+	// the load goes away: full quality again, but only after the hold time per tier (plus the blocks
+	// which refill the FIFO)
+	runSamples( &r, QG_BLOCK_SIZE * QG_HOLD_BLOCKS - 1, 60 );
+	CHECK( r.tier == QG_TIER_POINT, "recovery: tier %d before the hold time", r.tier );
+	runSamples( &r, QG_BLOCK_SIZE * 4, 60 );
+	CHECK( r.tier == QG_TIER_LINEAR, "recovery: tier %d after the hold time", r.tier );
+	runSamples( &r, QG_BLOCK_SIZE * QG_HOLD_BLOCKS * 2, 60 );
+	CHECK( r.tier == QG_TIER_FULL, "recovery: tier %d", r.tier );
+
+	// a single expensive sample per block (an OPL write, a decruncher slice) is absorbed by the FIFO
+	runInit( &r, ALL_TIERS );
+	for ( int b = 0; b < 1000; b++ )
+	{
+		runSamples( &r, QG_BLOCK_SIZE - 1, 50 );
+		runSamples( &r, 1, 400 );
+	}
+	CHECK( r.tier == QG_TIER_FULL && r.underruns == 0, "spikes: tier %d, %u underruns", r.tier, r.underruns );
+
+	// ... but a burst which eats up half of the render-ahead drops a tier
+	runInit( &r, ALL_TIERS );
+	runSamples( &r, QG_BLOCK_SIZE * 4, 50 );
+	runSamples( &r, 1, 100 * ( AHEAD / 2 + 2 ) );
+	runSamples( &r, QG_BLOCK_SIZE, 50 );
+	CHECK( r.tier == QG_TIER_COARSE && r.underruns == 0, "burst: tier %d, %u underruns", r.tier, r.underruns );
+
+	// load at the border of two tiers (full is too slow, the next one leaves less than half of the
+	// budget): settles without oscillating
+	runInit( &r, ALL_TIERS );
+	runSamples( &r, 1000000, 95 );
+	CHECK( r.tier == QG_TIER_COARSE && r.changes == 1, "border: tier %d, %u changes", r.tier, r.changes );
+
+	// load alternating faster than the hold time: stays at the lower tier instead of following it
+	runInit( &r, ALL_TIERS );
+	for ( int b = 0; b < 1000; b++ )
+		runSamples( &r, QG_BLOCK_SIZE * 4, ( b & 1 ) ? 95 : 40 );
+	CHECK( r.tier == QG_TIER_COARSE && r.changes == 1, "alternating load: tier %d, %u changes", r.tier, r.changes );
+
+	// default configuration (point sampling, linear filter): nothing to trade, stays at full quality
+	runInit( &r, 1 << QG_TIER_FULL );
+	runSamples( &r, QG_BLOCK_SIZE * 16, 250 );
+	CHECK( r.tier == QG_TIER_FULL && r.changes == 0, "full only: tier %d, %u changes", r.tier, r.changes );
+
+	// non-linear filter without decimation: only switches the filter
+	runInit( &r, ( 1 << QG_TIER_FULL ) | ( 1 << QG_TIER_LINEAR ) );
+	runSamples( &r, QG_BLOCK_SIZE, 250 );
+	CHECK( r.tier == QG_TIER_LINEAR, "filter only: tier %d after one block", r.tier );
+	runSamples( &r, QG_BLOCK_SIZE * 16, 250 );
+	CHECK( r.tier == QG_TIER_LINEAR && r.changes == 1, "filter only: tier %d, %u changes", r.tier, r.changes );
+	runSamples( &r, QG_BLOCK_SIZE * ( QG_HOLD_BLOCKS + 4 ), 40 );
+	CHECK( r.tier == QG_TIER_FULL, "filter only: tier %d after recovery", r.tier );
+
+	// configuration changed at a tier which is not used anymore: the next cheaper one, else full quality
+	runInit( &r, ALL_TIERS );
+	runSamples( &r, QG_BLOCK_SIZE, 120 );
+	qgSetTiers( &r.qg, ( 1 << QG_TIER_FULL ) | ( 1 << QG_TIER_COARSE ) | ( 1 << QG_TIER_POINT ) );
+	CHECK( r.qg.tier == QG_TIER_COARSE, "tiers changed: tier %d", r.qg.tier );
+	qgSetTiers( &r.qg, ( 1 << QG_TIER_FULL ) | ( 1 << QG_TIER_LINEAR ) );
+	CHECK( r.qg.tier == QG_TIER_LINEAR, "tiers changed: tier %d", r.qg.tier );
+	qgSetTiers( &r.qg, 1 << QG_TIER_COARSE );
+	CHECK( r.qg.tier == QG_TIER_FULL, "tiers changed: tier %d", r.qg.tier );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,179 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_noiseshape.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "noiseshape.h"
+#include "testutil.h"
+
+//
+// in-band SNR of the PWM output: a sine is quantized to PWM levels as in the firmware, once by plain
+// truncation to AUDIO_VALS levels at the lower carrier rate, once by the noise shaper at the 4x carrier
+// rate. The PWM stream is modeled by its duty cycles (one value per carrier period), the DMA reads the
+// ring at the carrier rate. The noise is the difference to the unquantized levels held in the same way,
+// i.e. it does not include the jitter from holding samples for a whole number of periods, which both
+// outputs have. The SNR is measured in 20Hz..20kHz with a windowed FFT.
+//
+
+#define CLK_SYS			300000000
+#define AUDIO_RATE		44100
+#define AUDIO_VALS		2834
+#define FFT_LOG2		19
+#define FFT_SIZE		( 1 << FFT_LOG2 )
+
+static NOISE_SHAPER ns;
+static double re[ FFT_SIZE ], im[ FFT_SIZE ];
+
+static void fft( double *re, double *im, int log2n )
+{
+	int n = 1 << log2n;
+	for ( int i = 1, j = 0; i < n; i++ )
+	{
+		int bit = n >> 1;
+		for ( ; j & bit; bit >>= 1 )
+			j ^= bit;
+		j ^= bit;
+		if ( i < j )
+		{
+			double t = re[ i ]; re[ i ] = re[ j ]; re[ j ] = t;
+			t = im[ i ]; im[ i ] = im[ j ]; im[ j ] = t;
+		}
+	}
+	for ( int len = 2; len <= n; len <<= 1 )
+	{
+		double a = -2 * M_PI / len;
+		for ( int i = 0; i < n; i += len )
+			for ( int k = 0; k < len / 2; k++ )
+			{
+				double wr = cos( a * k ), wi = sin( a * k );
+				double *ur = &re[ i + k ], *ui = &im[ i + k ], *vr = &re[ i + k + len / 2 ], *vi = &im[ i + k + len / 2 ];
+				double xr = *vr * wr - *vi * wi, xi = *vr * wi + *vi * wr;
+				*vr = *ur - xr; *vi = *ui - xi;
+				*ur += xr; *ui += xi;
+			}
+	}
+}
+
+// in-band power of x at rate carrierHz, without the bins around sineHz if 'signal' is 0, of only these otherwise
+static double inBandPower( const double *x, double carrierHz, double sineHz, int signal )
+{
+	double mean = 0;
+	for ( int i = 0; i < FFT_SIZE; i++ )
+		mean += x[ i ];
+	mean /= FFT_SIZE;
+
+	// Blackman-Harris window
+	for ( int i = 0; i < FFT_SIZE; i++ )
+	{
+		double p = 2 * M_PI * i / FFT_SIZE;
+		double w = 0.35875 - 0.48829 * cos( p ) + 0.14128 * cos( 2 * p ) - 0.01168 * cos( 3 * p );
+		re[ i ] = ( x[ i ] - mean ) * w;
+		im[ i ] = 0;
+	}
+	fft( re, im, FFT_LOG2 );
+
+	double binHz = carrierHz / FFT_SIZE;
+	int sineBin = (int)lrint( sineHz / binHz );
+	double power = 0;
+	for ( int k = (int)( 20 / binHz ) + 1; k <= (int)( 20000 / binHz ); k++ )
+		if ( ( abs( k - sineBin ) <= 4 ) == signal )
+			power += re[ k ] * re[ k ] + im[ k ] * im[ k ];
+	return power;
+}
+
+// SNR of the output 'out' with the unquantized levels 'ideal' (overwritten)
+static double inBandSNR( const double *out, double *ideal, double carrierHz, double sineHz )
+{
+	double sig = inBandPower( ideal, carrierHz, sineHz, 1 );
+	for ( int i = 0; i < FFT_SIZE; i++ )
+		ideal[ i ] = out[ i ] - ideal[ i ];
+	return 10 * log10( sig / inBandPower( ideal, carrierHz, sineHz, 0 ) );
+}
+
+// sample s of a sine with amplitude a (full scale 1) in the firmware's L + R format (17 bits signed)
+static int32_t sample( int i, double sineHz, double a )
+{
+	return (int32_t)lrint( 65535 * a * sin( 2 * M_PI * sineHz * i / AUDIO_RATE ) );
+}
+
+static void runSine( double sineHz, double a )
+{
+	static double plain[ FFT_SIZE ], plainIdeal[ FFT_SIZE ], shaped[ FFT_SIZE ], shapedIdeal[ FFT_SIZE ];
+	static double ringIdeal[ NS_RING_SIZE ];
+	// plain: one level per sample, held for the carrier periods it covers
+	double plainHz = (double)CLK_SYS / ( AUDIO_VALS + 1 );
+	for ( int p = 0, i = 0; p < FFT_SIZE; p++ )
+	{
+		while ( (double)( i + 1 ) * plainHz < (double)p * AUDIO_RATE )
+			i ++;
+		int32_t s = sample( i, sineHz, a ) + 65536;
+		plain[ p ] = ( s * AUDIO_VALS ) >> 17;
+		plainIdeal[ p ] = (double)s * AUDIO_VALS / 131072;
+	}
+
+	// noise shaped: the DMA reads one period per carrier period, core0 renders a sample whenever one is due
+	uint32_t carrierHz = CLK_SYS / ( NS_PWM_WRAP + 1 );
+	nsInit( &ns, 0, carrierHz, AUDIO_RATE );
+	uint32_t read = 0;
+	int i = 0;
+	for ( uint64_t p = 0; p < (uint64_t)FFT_SIZE + NS_AHEAD; p++ )
+	{
+		if ( p * AUDIO_RATE >= (uint64_t)i * carrierHz )
+		{
+			int32_t x = nsLevel( sample( i ++, sineHz, a ) );
+			uint32_t w = ns.write;
+			nsRender( &ns, x, read & NS_RING_MASK );
+			for ( ; w != ns.write; w++ )
+				ringIdeal[ w & NS_RING_MASK ] = (double)x / NS_ONE;
+		}
+
+		// skip the periods output before the ring was filled
+		if ( p >= NS_AHEAD )
+		{
+			shaped[ p - NS_AHEAD ] = ns.ring[ read & NS_RING_MASK ];
+			shapedIdeal[ p - NS_AHEAD ] = ringIdeal[ read & NS_RING_MASK ];
+		}
+		read ++;
+	}
+
+	double snrPlain = inBandSNR( plain, plainIdeal, plainHz, sineHz );
+	double snrShaped = inBandSNR( shaped, shapedIdeal, carrierHz, sineHz );
+	printf( "%.0f Hz at %.0f dBFS, in-band SNR: plain %.1f dB (%.0f kHz carrier), noise shaped %.1f dB (%u kHz carrier)\n",
+		sineHz, 20 * log10( a ), snrPlain, plainHz / 1000, snrShaped, carrierHz / 1000 );
+
+	CHECK( ns.underruns == 0, "%u underruns", ns.underruns );
+	CHECK( snrShaped >= snrPlain + 18, "noise shaping gains only %.1f dB", snrShaped - snrPlain );
+}
+
+int main()
+{
+	runSine( 997, 0.5 );
+	runSine( 5003, 0.01 );
+
+	return TEST_RESULT();
+}
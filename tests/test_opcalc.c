@@ -0,0 +1,120 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_opcalc.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include "testutil.h"
+
+// the operator functions are static, the test is compiled with fmopl.c
+#include "fmopl.c"
+
+//
+// op_calc/op_calc1 look up the sine and total-level tables via interpolator 0 (interp.h, on host its software
+// model). Both are compared against the lookups by shift and mask which they replaced, for all table indices,
+// waveforms and envelope levels, and for phase modulation over its full range.
+//
+
+static signed int op_calc_ref( UINT32 phase, unsigned int env, signed int pm, unsigned int wave_tab )
+{
+	UINT32 p;
+	int i = ( ( ( (signed int)( ( phase & ~FREQ_MASK ) + ( pm << 16 ) ) ) >> FREQ_SH ) & SIN_MASK );
+
+	switch ( wave_tab )
+	{
+	default:
+	case 0: p = sin_tab[ i ]; break;
+	case 1: if ( i & ( 1 << ( SIN_BITS - 1 ) ) ) return 0; p = sin_tab[ i ]; break;
+	case 2: p = sin_tab[ i & ( SIN_MASK >> 1 ) ]; break;
+	case 3: if ( i & ( 1 << ( SIN_BITS - 2 ) ) ) return 0; p = sin_tab[ i & ( SIN_MASK >> 2 ) ]; break;
+	}
+	p += env << 4;
+
+	if ( p >= TL_TAB_LEN )
+		return 0;
+
+	int16_t sign = p & 1;
+	p >>= 1;
+	uint8_t s = p >> 8;
+	signed int o = tl_tab[ p & 255 ] >> s;
+	return sign ? -o : o;
+}
+
+static signed int op_calc1_ref( UINT32 phase, unsigned int env, signed int pm, unsigned int wave_tab )
+{
+	return op_calc_ref( ( phase & ~FREQ_MASK ) + pm, env, 0, wave_tab );
+}
+
+static uint32_t rng = 1;
+
+static uint32_t rnd32()
+{
+	rng = rng * 1664525 + 1013904223;
+	return rng;
+}
+
+int main()
+{
+	init_tables();
+
+	uint32_t nCalls = 0, nDiff = 0;
+	#define COMPARE( f, ref, phase, env, pm, wave ) {								\
+		signed int a_ = f( phase, env, pm, wave ), b_ = ref( phase, env, pm, wave );	\
+		nCalls ++;																	\
+		if ( a_ != b_ && nDiff ++ < 5 )												\
+			printf( #f "( %08x, %u, %d, %u ) = %d, expected %d\n", phase, env, pm, wave, a_, b_ ); }
+
+	// every sine index (with random bits below), waveform and envelope level; env << 4 goes beyond TL_TAB_LEN
+	for ( unsigned int wave = 0; wave < 4; wave++ )
+		for ( unsigned int env = 0; env <= ( TL_TAB_LEN >> 4 ) + 16; env++ )
+			for ( UINT32 i = 0; i < SIN_LEN; i++ )
+			{
+				UINT32 phase = ( i << FREQ_SH ) | ( rnd32() & FREQ_MASK ) | ( rnd32() & ~( ( 1u << ( FREQ_SH + SIN_BITS ) ) - 1 ) );
+				COMPARE( op_calc, op_calc_ref, phase, env, 0, wave );
+				COMPARE( op_calc1, op_calc1_ref, phase, env, 0, wave );
+			}
+
+	// phase modulation: op_calc takes it in table index units (feedback and modulator output), op_calc1 in phase units
+	for ( unsigned int wave = 0; wave < 4; wave++ )
+	{
+		for ( signed int pm = -65536; pm < 65536; pm++ )
+		{
+			UINT32 phase = rnd32();
+			unsigned int env = rnd32() % 64;
+			COMPARE( op_calc, op_calc_ref, phase, env, pm, wave );
+		}
+		for ( signed int pm = -( 1 << 27 ); pm < ( 1 << 27 ); pm += 997 )
+		{
+			UINT32 phase = rnd32();
+			unsigned int env = rnd32() % 64;
+			COMPARE( op_calc1, op_calc1_ref, phase, env, pm, wave );
+		}
+	}
+
+	CHECK( nDiff == 0, "%u of %u operator lookups differ", nDiff, nCalls );
+	if ( !nDiff )
+		printf( "%u operator lookups identical\n", nCalls );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,181 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_osc3predict.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "reSID16/sid.h"
+#include "osc3predict.h"
+#include "testutil.h"
+
+//
+// OSC3/ENV3 readback between emulation steps (osc3predict.h): core0 publishes the state of voice 3 after each
+// step, core1 answers reads at later cycles from it. A reference SID16 is clocked to each read cycle and read
+// directly. OSC3 of triangle, sawtooth and pulse is predicted and must be exact. ENV3 is not predicted: it is
+// the published value, which is exact while the envelope rests (sustain level or zero) and stale by the
+// envelope steps since the last emulation step while it moves, which is measured here.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+static void sidInit( SID16 *s, chip_model model )
+{
+	s->set_chip_model( model );
+	s->set_sampling_parameters( C64_CLOCK, SAMPLE_DECIMATE, AUDIO_RATE );
+	s->reset();
+}
+
+// as readOSC3StateReSID in the firmware
+static void publish( SID16 *s, OSC3_STATE *st, uint32_t cycle )
+{
+	reg24 acc, freq;
+	reg12 pw;
+	reg8  waveform;
+	uint8_t r[ 2 ];
+
+	s->read_osc3_state( acc, freq, pw, waveform );
+	s->readRegisters( r );
+
+	st->cycle = cycle;
+	st->accumulator = acc;
+	st->freq = freq;
+	st->pw = pw;
+	st->waveform = waveform;
+	st->osc3 = r[ 0 ];
+	st->env3 = r[ 1 ];
+}
+
+static void testPrediction( chip_model model )
+{
+	const char *name = model == MOS6581 ? "6581" : "8580";
+	static const uint8_t waveforms[] = { 0x10, 0x20, 0x40, 0x10, 0x20, 0x40, 0x80, 0x50, 0x14, 0x12, 0x18 };
+
+	SID16 emu, ref;
+	sidInit( &emu, model );
+	sidInit( &ref, model );
+
+	uint32_t cycle = 0, refCycle = 0;
+	uint32_t nOSC3 = 0, nOSC3Diff = 0, nOSC3Fallback = 0;
+	uint32_t nENV3Rest = 0, nENV3RestDiff = 0, nENV3Moving = 0, nENV3Stale = 0, maxENV3Error = 0;
+
+	OSC3_STATE st;
+	publish( &emu, &st, cycle );
+
+	for ( int step = 0; step < 200000; step++ )
+	{
+		// a write to voice 3 now and then, applied at a step boundary as core0 does
+		bool wrote = rnd( 64 ) == 0;
+		if ( wrote )
+		{
+			uint8_t reg, value = rnd( 256 );
+			switch ( rnd( 5 ) )
+			{
+				case 0: reg = 14 + rnd( 4 ); break;
+				case 1: reg = 18; value = waveforms[ rnd( 11 ) ] | rnd( 2 ); break;
+				case 2: reg = 19; break;
+				case 3: reg = 20; break;
+				default: reg = 18; value = ( st.waveform ? waveforms[ rnd( 3 ) ] : 0x20 ) | ( rnd( 2 ) ); break;
+			}
+			emu.write( reg, value );
+			ref.write( reg, value );
+			publish( &emu, &st, cycle );
+		}
+
+		// reads at random cycles until the next step, which is up to a few samples later (core0 is late)
+		uint32_t len = rnd( 8 ) == 0 ? 1 + rnd( 2000 ) : 1 + rnd( 60 );
+		SID16::State es = emu.read_state();
+		// the envelope pipeline settles within 2 cycles of a write
+		bool rest = !wrote && ( es.hold_zero[ 2 ] ||
+			( es.envelope_state[ 2 ] == EnvelopeGenerator::DECAY_SUSTAIN &&
+			  es.envelope_counter[ 2 ] == ( ( es.sid_register[ 0x14 ] >> 4 ) & 15 ) * 0x11 ) );
+
+		for ( int r = rnd( 3 ); r >= 0; r-- )
+		{
+			uint32_t readCycle = cycle + 1 + rnd( len );
+			if ( readCycle <= refCycle )
+				continue;
+			ref.clock( readCycle - refCycle );
+			refCycle = readCycle;
+
+			uint8_t osc3 = ref.read( 0x1b ), env3 = ref.read( 0x1c );
+
+			if ( st.waveform )
+			{
+				uint8_t p = predictOSC3( &st, readCycle );
+				nOSC3 ++;
+				if ( p != osc3 && nOSC3Diff ++ == 0 )
+					printf( "%s: OSC3 predicted %02x, actual %02x (waveform %d, %u cycles)\n", name, p, osc3, st.waveform, readCycle - st.cycle );
+			} else
+				nOSC3Fallback ++;
+
+			uint32_t err = abs( (int)env3 - (int)st.env3 );
+			if ( rest )
+			{
+				nENV3Rest ++;
+				if ( err ) nENV3RestDiff ++;
+			} else
+			{
+				nENV3Moving ++;
+				if ( err ) nENV3Stale ++;
+				if ( err > maxENV3Error ) maxENV3Error = err;
+			}
+		}
+
+		// the next emulation step
+		cycle += len + 1;
+		emu.clock( len + 1 );
+		if ( cycle > refCycle )
+		{
+			ref.clock( cycle - refCycle );
+			refCycle = cycle;
+		}
+		publish( &emu, &st, cycle );
+	}
+
+	CHECK( nOSC3 > 100000, "%s: only %u predicted OSC3 reads", name, nOSC3 );
+	CHECK( nOSC3Diff == 0, "%s: %u of %u predicted OSC3 reads differ", name, nOSC3Diff, nOSC3 );
+	CHECK( nENV3Rest > 10000 && nENV3RestDiff == 0, "%s: %u of %u ENV3 reads of a resting envelope differ", name, nENV3RestDiff, nENV3Rest );
+	printf( "%s: %u OSC3 reads predicted exactly, %u from the published state\n", name, nOSC3, nOSC3Fallback );
+	printf( "%s: ENV3 exact in %u reads of a resting envelope; stale in %u of %u reads of a moving one, by up to %u\n",
+		name, nENV3Rest, nENV3Stale, nENV3Moving, maxENV3Error );
+}
+
+int main()
+{
+	testPrediction( MOS6581 );
+	testPrediction( MOS8580 );
+	return TEST_RESULT();
+}
@@ -0,0 +1,179 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_rendercost.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <chrono>
+#include "reSID16/sid.h"
+#include "testutil.h"
+
+//
+// rendering cost of the SID emulation per configuration: the same scripted tune is rendered the way the
+// firmware does (clock to each sample tick, then output()), the time per second of audio is reported
+// relative to the 6581 with the linear filter at 44.1kHz, also for the other sample rates of CFG_AUDIO_RATE.
+// Host timings only show the relative cost of each option, not whether it fits on the RP2040.
+//
+
+#define C64_CLOCK		985248
+#define SECONDS			4
+#define WRITES			( SECONDS * 600 )
+
+typedef struct
+{
+	cycle_count delta;	// cycles after the previous write
+	uint8_t reg, value;
+} WRITE;
+
+typedef struct
+{
+	const char      *name;
+	chip_model      model;
+	bool            nonlinear;
+	sampling_method method;
+	quality_level   quality;
+	uint32_t        rate;
+} CONFIG;
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+// notes on three voices, filter sweeps with varying resonance and routing
+static void scriptTune( WRITE *w, uint32_t n )
+{
+	static const uint8_t waveforms[] = { 0x10, 0x20, 0x40, 0x80, 0x20, 0x40 };
+
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		w[ i ].delta = rnd( 2 * C64_CLOCK / 600 );
+		uint32_t v = rnd( 3 ) * 7;
+		switch ( rnd( 7 ) )
+		{
+			case 0: w[ i ].reg = v + 1; w[ i ].value = 4 + rnd( 60 ); break;
+			case 1: w[ i ].reg = v + 3; w[ i ].value = rnd( 16 ); break;
+			case 2: w[ i ].reg = v + 4; w[ i ].value = waveforms[ rnd( 6 ) ] | rnd( 2 ); break;
+			case 3: w[ i ].reg = v + 5 + rnd( 2 ); w[ i ].value = rnd( 256 ); break;
+			case 4: w[ i ].reg = 0x16; w[ i ].value = rnd( 256 ); break;
+			case 5: w[ i ].reg = 0x17; w[ i ].value = ( rnd( 16 ) << 4 ) | rnd( 8 ); break;
+			case 6: w[ i ].reg = 0x18; w[ i ].value = 0x0f | ( ( 1 + rnd( 7 ) ) << 4 ); break;
+		}
+	}
+}
+
+// renders the tune as the firmware does, returns the time in seconds and the sum of the output
+static double render( const CONFIG *c, const WRITE *w, uint32_t n, int64_t *sum )
+{
+	SID16 s;
+	s.set_chip_model( c->model );
+	s.enable_nonlinear_filter( c->nonlinear );
+	s.set_sampling_parameters( C64_CLOCK, c->method, c->rate );
+	s.reset();
+	s.set_quality( c->quality );
+
+	const cycle_count cyclesPerSample = (cycle_count)( (float)C64_CLOCK / (float)c->rate * ( 1 << 16 ) + 0.5 );
+	uint64_t cycle = 0, tick = 0, fixp = 0;
+
+	*sum = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		uint64_t writeCycle = cycle + w[ i ].delta;
+		for ( ;; )
+		{
+			uint64_t nextFixp = fixp + cyclesPerSample;
+			uint64_t nextTick = tick + ( nextFixp >> 16 );
+			if ( nextTick > writeCycle )
+				break;
+			s.clock( (cycle_count)( nextTick - cycle ) );
+			cycle = tick = nextTick;
+			fixp = nextFixp & 0xffff;
+			*sum += s.output();
+		}
+		s.clock( (cycle_count)( writeCycle - cycle ) );
+		cycle = writeCycle;
+		s.write( w[ i ].reg, w[ i ].value );
+	}
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+}
+
+int main()
+{
+	static WRITE w[ WRITES ];
+	scriptTune( w, WRITES );
+
+	// the tables of the non-linear 6581 filter are built when it is enabled for the first time
+	SID16 *first = new SID16();
+	auto t0 = std::chrono::steady_clock::now();
+	first->enable_nonlinear_filter( true );
+	double tInit = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+	delete first;
+	printf( "non-linear 6581 filter tables built in %.2f ms\n", tInit * 1000 );
+
+	static const CONFIG configs[] = {
+		{ "6581, linear filter",     MOS6581, false, SAMPLE_INTERPOLATE, QUALITY_FULL, 44100 },
+		{ "6581, non-linear filter", MOS6581, true,  SAMPLE_INTERPOLATE, QUALITY_FULL, 44100 },
+		{ "8580",                    MOS8580, false, SAMPLE_INTERPOLATE, QUALITY_FULL, 44100 },
+		{ "8580, non-linear enabled", MOS8580, true, SAMPLE_INTERPOLATE, QUALITY_FULL, 44100 },
+		{ "6581, decimating",         MOS6581, false, SAMPLE_DECIMATE, QUALITY_FULL, 44100 },
+		{ "8580, decimating",         MOS8580, false, SAMPLE_DECIMATE, QUALITY_FULL, 44100 },
+		{ "6581 non-linear, decimating", MOS6581, true, SAMPLE_DECIMATE, QUALITY_FULL, 44100 },
+		{ "6581, decimating (coarse)", MOS6581, false, SAMPLE_DECIMATE, QUALITY_COARSE, 44100 },
+		{ "8580, decimating (coarse)", MOS8580, false, SAMPLE_DECIMATE, QUALITY_COARSE, 44100 },
+		{ "6581, linear filter",     MOS6581, false, SAMPLE_INTERPOLATE, QUALITY_FULL, 48000 },
+		{ "6581, linear filter",     MOS6581, false, SAMPLE_INTERPOLATE, QUALITY_FULL, 96000 },
+		{ "6581, non-linear filter", MOS6581, true,  SAMPLE_INTERPOLATE, QUALITY_FULL, 96000 },
+		{ "8580",                    MOS8580, false, SAMPLE_INTERPOLATE, QUALITY_FULL, 48000 },
+		{ "8580",                    MOS8580, false, SAMPLE_INTERPOLATE, QUALITY_FULL, 96000 },
+		{ "6581, decimating",         MOS6581, false, SAMPLE_DECIMATE, QUALITY_FULL, 96000 },
+		{ "6581, decimating (coarse)", MOS6581, false, SAMPLE_DECIMATE, QUALITY_COARSE, 96000 },
+	};
+	const int nConfigs = sizeof( configs ) / sizeof( CONFIG );
+
+	// the fastest of a few runs, interleaved so that changes of the host's load hit all configurations
+	double  t[ nConfigs ];
+	int64_t sum[ nConfigs ];
+	for ( int run = 0; run < 15; run++ )
+		for ( int i = 0; i < nConfigs; i++ )
+		{
+			double tr = render( &configs[ i ], w, WRITES, &sum[ i ] );
+			if ( !run || tr < t[ i ] ) t[ i ] = tr;
+		}
+
+	for ( int i = 0; i < nConfigs; i++ )
+		printf( "%-28s %5.1f kHz: %6.2f ms per second of audio, %3.0f%%\n", configs[ i ].name, configs[ i ].rate / 1000.0,
+			t[ i ] * 1000 / SECONDS, 100 * t[ i ] / t[ 0 ] );
+
+	// the non-linear model changes the 6581's output, and only the 6581's
+	CHECK( sum[ 1 ] != sum[ 0 ], "non-linear 6581 filter renders the same as the linear one" );
+	CHECK( sum[ 3 ] == sum[ 2 ], "non-linear filter enabled changes the 8580's output" );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,145 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_samplefifo.c
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "samplefifo.h"
+#include "testutil.h"
+
+//
+// sample FIFO with render-ahead: a consumer thread (core1) ticks at a fixed rate of simulated cycles and
+// takes one sample per tick, a producer thread (core0) renders each requested sample for the cycle of its
+// tick and stalls now and then. Every sample which is output has to belong to the tick it was rendered
+// for (no repeated samples), samples are only dropped as counted stale ticks or underruns, and once the
+// producer has caught up the latency does not exceed the render-ahead.
+//
+
+#define N_TICKS			200000
+#define AHEAD			16
+#define TICK_CYCLES		22
+
+static SAMPLE_FIFO fifo;
+static uint32_t    cycleOfTick[ N_TICKS ];
+static volatile uint8_t done;
+
+static uint32_t staleTicks, wrongCycle, stalls;
+
+// entries are the number of the tick they were rendered for
+static void *producer( void *arg )
+{
+	(void)arg;
+	uint32_t rendered = 0, seed = 7;
+
+	while ( !done )
+	{
+		uint32_t pending = fifo.ticks - rendered;
+		if ( !pending )
+		{
+			sched_yield();
+			continue;
+		}
+
+		uint32_t stale = sfStaleTicks( &fifo, pending );
+		rendered += stale;
+		staleTicks += stale;
+
+		if ( sfTickCycle( &fifo, rendered ) != cycleOfTick[ rendered ] )
+			wrongCycle ++;
+
+		sfPush( &fifo, rendered );
+		rendered ++;
+
+		// occasionally a slow iteration
+		seed = seed * 1103515245 + 12345;
+		if ( ( ( seed >> 16 ) & 1023 ) == 0 )
+		{
+			stalls ++;
+			uint32_t until = fifo.ticks + ( ( seed >> 8 ) & 63 );
+			while ( !done && (int32_t)( until - fifo.ticks ) > 0 )
+				sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int main()
+{
+	sfInit( &fifo, AHEAD );
+	done = 0;
+
+	pthread_t thread;
+	pthread_create( &thread, NULL, producer, NULL );
+
+	uint32_t cycle = 0, last = 0, popped = 0, repeated = 0, maxLatency = 0, latencyExceeded = 0;
+	uint8_t  first = 1;
+
+	for ( uint32_t t = 0; t < N_TICKS; t++ )
+	{
+		cycle += TICK_CYCLES;
+		cycleOfTick[ t ] = cycle;
+		sfTick( &fifo, cycle );
+
+		uint32_t e;
+		if ( sfPop( &fifo, &e ) )
+		{
+			if ( !first && e <= last )
+				repeated ++;
+
+			// latency in ticks from the request to the output of the sample
+			uint32_t latency = t - e;
+			if ( latency > maxLatency )
+				maxLatency = latency;
+			if ( latency > AHEAD + 1 )
+				latencyExceeded ++;
+
+			first = 0;
+			last = e;
+			popped ++;
+		}
+
+		// give the producer a chance on single-core hosts
+		if ( ( t & 3 ) == 0 )
+			sched_yield();
+	}
+
+	done = 1;
+	pthread_join( thread, NULL );
+
+	uint32_t notOutput = N_TICKS - popped;
+
+	CHECK( repeated == 0, "%u samples output twice or out of order", repeated );
+	CHECK( wrongCycle == 0, "%u samples rendered for the wrong cycle", wrongCycle );
+	CHECK( latencyExceeded == 0, "%u samples with latency beyond the render-ahead (max %u)", latencyExceeded, maxLatency );
+	CHECK( fifo.overflows == 0, "%u overflows", fifo.overflows );
+	CHECK( notOutput <= AHEAD + fifo.underruns + sfCount( &fifo ) + 1, "%u ticks without output, %u underruns", notOutput, fifo.underruns );
+
+	printf( "%u ticks, %u stalls, %u stale ticks, %u underruns, max latency %u\n", N_TICKS, stalls, staleTicks, fifo.underruns, maxLatency );
+
+	return TEST_RESULT();
+}
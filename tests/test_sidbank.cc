@@ -0,0 +1,406 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_sidbank.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <chrono>
+#include "reSID16/sidbank.h"
+#include "testutil.h"
+
+//
+// the multi-instance backends against standalone SID16s: each lane plays its own scripted write
+// sequence, the reference renders the same sequence with a SID16 and the firmware's order of writes
+// and sample ticks. The output must be identical for any backend, block size and number of threads.
+// The lane kernels are also checked one by one against SID16::clock() of the lanes they are loaded from.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+#define LANES			10
+#define WRITES			20000
+#define KERNEL_TRIALS	4000
+
+typedef struct
+{
+	cycle_count delta;	// cycles after the previous write
+	uint8_t reg, value;
+} WRITE;
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+// all waveforms, and the ones the lane kernels cover (no test bit, sync or combined noise)
+static const uint8_t waveformsAll[ 8 ] = { 0x10, 0x20, 0x40, 0x80, 0x50, 0x30, 0x14, 0x12 };
+static const uint8_t waveformsKernel[ 8 ] = { 0x00, 0x10, 0x20, 0x40, 0x80, 0x50, 0x30, 0x14 };
+
+static void scriptWrite( WRITE *w, const uint8_t *waveforms )
+{
+	w->delta = rnd( 400 );
+	uint32_t v = rnd( 3 ) * 7;
+	switch ( rnd( 8 ) )
+	{
+		case 0: w->reg = v + 0; w->value = rnd( 256 ); break;
+		case 1: w->reg = v + 1; w->value = rnd( 256 ); break;
+		case 2: w->reg = v + 2 + rnd( 2 ); w->value = rnd( 256 ); break;
+		case 3: w->reg = v + 4; w->value = waveforms[ rnd( 8 ) ] | rnd( 2 ); break;
+		case 4: w->reg = v + 5 + rnd( 2 ); w->value = rnd( 256 ); break;
+		case 5: w->reg = 0x15 + rnd( 2 ); w->value = rnd( 256 ); break;
+		case 6: w->reg = 0x17; w->value = rnd( 256 ); break;
+		case 7: w->reg = 0x18; w->value = 0x0f | ( rnd( 8 ) << 4 ); break;
+	}
+}
+
+static void scriptSID( WRITE *w, uint32_t n )
+{
+	for ( uint32_t i = 0; i < n; i++ )
+		scriptWrite( &w[ i ], waveformsAll );
+}
+
+static void configure( SID16 *s, int lane, int decimate )
+{
+	s->set_chip_model( lane & 1 ? MOS8580 : MOS6581 );
+	if ( decimate )
+	{
+		// even lanes 6581 with the non-linear filter, odd lanes 8580, one with a masked voice
+		s->enable_nonlinear_filter( !( lane & 1 ) );
+		if ( lane == 3 )
+			s->set_voice_mask( 2 );
+	} else
+	{
+		// point sampling for the lane kernels, except for a non-linear 6581 and a masked voice
+		s->enable_nonlinear_filter( lane == 4 );
+		if ( lane == 3 )
+			s->set_voice_mask( 2 );
+	}
+}
+
+// reference: a standalone SID16, writes at the cycle of a tick are applied after its sample
+static uint32_t renderReference( int lane, int decimate, const WRITE *w, uint32_t n, int16_t *out )
+{
+	SID16 s;
+	s.set_chip_model( MOS6581 );
+	s.set_sampling_parameters( C64_CLOCK, decimate ? SAMPLE_DECIMATE : SAMPLE_INTERPOLATE, AUDIO_RATE );
+	s.reset();
+	configure( &s, lane, decimate );
+
+	const cycle_count cyclesPerSample = (cycle_count)( (float)C64_CLOCK / (float)AUDIO_RATE * ( 1 << 16 ) + 0.5 );
+	uint64_t cycle = 0, tick = 0, fixp = 0;
+	uint32_t nOut = 0;
+
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		uint64_t writeCycle = cycle + w[ i ].delta;
+		for ( ;; )
+		{
+			uint64_t nextFixp = fixp + cyclesPerSample;
+			uint64_t nextTick = tick + ( nextFixp >> 16 );
+			if ( nextTick > writeCycle )
+				break;
+			s.clock( (cycle_count)( nextTick - cycle ) );
+			cycle = tick = nextTick;
+			fixp = nextFixp & 0xffff;
+			out[ nOut ++ ] = s.output();
+		}
+		s.clock( (cycle_count)( writeCycle - cycle ) );
+		cycle = writeCycle;
+		s.write( w[ i ].reg, w[ i ].value );
+	}
+	return nOut;
+}
+
+// renders the bank in blocks of varying size, returns the rendering time in seconds
+static double renderBank( SIDBank *bank, int threads, uint32_t nSamples, int16_t *out )
+{
+	static const uint32_t blockSize[] = { 4096, 1, 777, 2048, 3 };
+
+	bank->set_threads( threads );
+	auto t0 = std::chrono::steady_clock::now();
+	for ( uint32_t i = 0, b = 0; i < nSamples; b++ )
+	{
+		uint32_t n = blockSize[ b % 5 ];
+		if ( n > nSamples - i )
+			n = nSamples - i;
+		bank->render( n, &out[ i * LANES ] );
+		i += n;
+	}
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+}
+
+static const char *backendName[] = { "SID16", "scalar", "SSE2", "AVX2" };
+
+// the kernels one by one: a group is loaded from random states of SID16 lanes, each kernel gets the inputs
+// which SID16::clock( dt ) of the lanes has at that point, and its outputs must match those of SID16::clock
+static void testKernels( SIDBank::backend b )
+{
+	static const char *kernelName[ 7 ] = { "envelope", "accumulate", "pulse", "waveform", "envelope multiply", "filter", "external filter" };
+	const int N = SIDBank::GROUP_LANES;
+	const cycle_count filterDt = SIDBank::FILTER_DT;
+	const SIDBank::Kernels *k = SIDBank::kernels( b );
+
+	static SIDBank::LaneGroup pre, post, g;
+	static SID16 lane[ N ];
+	static SID16::State s0[ N ], s1[ N ];
+	SID16 *lanes[ N ];
+	uint32_t checked[ 7 ] = { 0 }, diffs[ 7 ] = { 0 }, events[ 2 ] = { 0 };
+
+	for ( int i = 0; i < N; i++ )
+	{
+		lane[ i ].set_chip_model( i & 1 ? MOS8580 : MOS6581 );
+		lane[ i ].set_sampling_parameters( C64_CLOCK, SAMPLE_INTERPOLATE, AUDIO_RATE );
+		lane[ i ].reset();
+		lanes[ i ] = &lane[ i ];
+	}
+
+	for ( int trial = 0; trial < KERNEL_TRIALS; trial++ )
+	{
+		for ( int i = 0; i < N; i++ )
+		{
+			for ( int j = rnd( 4 ); j > 0; j-- )
+			{
+				WRITE w;
+				scriptWrite( &w, waveformsKernel );
+				lane[ i ].clock( w.delta );
+				lane[ i ].write( w.reg, w.value );
+			}
+			if ( rnd( 8 ) == 0 )
+				lane[ i ].input( (int)rnd( 65536 ) - 32768 );
+		}
+
+		// the lanes before and after SID16::clock( dt )
+		cycle_count dt = 1 + rnd( 150 );
+		SIDBank::init_group( pre );
+		SIDBank::init_group( post );
+		for ( int i = 0; i < N; i++ )
+		{
+			bool loaded = SIDBank::load_lane( pre, i, lane[ i ] );
+			CHECK( loaded, "lane %d is not covered by the kernels", i );
+			s0[ i ] = lane[ i ].read_state();
+			lane[ i ].clock( dt );
+			s1[ i ] = lane[ i ].read_state();
+			SIDBank::load_lane( post, i, lane[ i ] );
+		}
+
+		// rate counters, the envelope steps are left to the SID16
+		g = pre;
+		k->envelope( g, dt );
+		for ( int i = 0; i < N; i++ )
+			for ( int v = 0; v < 3; v++ )
+			{
+				if ( g.envelope_event[ v ][ i ] )
+				{
+					events[ 0 ] ++;
+					continue;
+				}
+				checked[ 0 ] ++;
+				diffs[ 0 ] += g.rate_counter[ v ][ i ] != s1[ i ].rate_counter[ v ] ||
+							  g.env3[ v ][ i ] != s1[ i ].env3[ v ] ||
+							  s1[ i ].envelope_counter[ v ] != s0[ i ].envelope_counter[ v ] ||
+							  s1[ i ].envelope_state[ v ] != s0[ i ].envelope_state[ v ];
+			}
+
+		// accumulators, the noise register shifts are left to the SID16 (the 6581 combined waveforms pull the
+		// MSB down after the clock)
+		g = pre;
+		k->accumulate( g, dt );
+		for ( int i = 0; i < N; i++ )
+			for ( int v = 0; v < 3; v++ )
+			{
+				if ( g.shift_event[ v ][ i ] )
+				{
+					events[ 1 ] ++;
+					continue;
+				}
+				checked[ 1 ] ++;
+				diffs[ 1 ] += ( ( g.accumulator[ v ][ i ] ^ (int)s1[ i ].accumulator[ v ] ) & ( g.saw_combined[ v ][ i ] ? 0x7fffff : 0xffffff ) ) != 0 ||
+							  ( g.msb_rising[ v ][ i ] != 0 ) != s1[ i ].msb_rising[ v ] ||
+							  s1[ i ].shift_register[ v ] != s0[ i ].shift_register[ v ];
+			}
+
+		// pulse compare of the clocked accumulators
+		g = post;
+		k->pulse( g );
+		for ( int i = 0; i < N; i++ )
+			for ( int v = 0; v < 3; v++ )
+				if ( !g.saw_combined[ v ][ i ] )
+				{
+					checked[ 2 ] ++;
+					diffs[ 2 ] += g.pulse_output[ v ][ i ] != s1[ i ].pulse_output[ v ];
+				}
+
+		// waveform outputs (incl. the floating DAC input) of the clocked generators, skipping the lanes where
+		// the 6581 combined waveforms have changed the clocked accumulators
+		bool combined[ N ];
+		g = post;
+		for ( int i = 0; i < N; i++ )
+		{
+			combined[ i ] = false;
+			for ( int v = 0; v < 3; v++ )
+			{
+				combined[ i ] |= g.saw_combined[ v ][ i ] != 0;
+				g.waveform_output[ v ][ i ] = pre.waveform_output[ v ][ i ];
+				g.floating_output_ttl[ v ][ i ] = pre.floating_output_ttl[ v ][ i ];
+				g.osc3[ v ][ i ] = pre.osc3[ v ][ i ];
+				if ( ( g.waveform[ v ][ i ] & 3 ) == 3 )
+					g.wave8_output[ v ][ i ] = g.wave8[ v ][ i ][ g.accumulator[ v ][ i ] >> 12 ] << 4;
+			}
+		}
+		k->waveform( g, dt );
+		for ( int i = 0; i < N; i++ )
+			for ( int v = 0; v < 3 && !combined[ i ]; v++ )
+			{
+				checked[ 3 ] ++;
+				diffs[ 3 ] += g.waveform_output[ v ][ i ] != s1[ i ].waveform_output[ v ] ||
+							  g.osc3[ v ][ i ] != s1[ i ].osc3[ v ] ||
+							  g.floating_output_ttl[ v ][ i ] != s1[ i ].floating_output_ttl[ v ];
+			}
+
+		// voice outputs, seen as the unfiltered sum, and the filter integration from the state before the clock
+		for ( int i = 0; i < N; i++ )
+		{
+			g.Vhp[ i ] = pre.Vhp[ i ];
+			g.Vbp[ i ] = pre.Vbp[ i ];
+			g.Vlp[ i ] = pre.Vlp[ i ];
+		}
+		k->envelope_multiply( g );
+		for ( cycle_count d = dt; d > 0; d -= filterDt )
+			SIDBank::load_transitions( g, lanes, d < filterDt ? d : filterDt );
+		k->filter( g, dt );
+		for ( int i = 0; i < N; i++ )
+			if ( !combined[ i ] )
+			{
+				checked[ 4 ] ++;
+				diffs[ 4 ] += g.Vnf[ i ] != s1[ i ].filter_Vnf;
+				checked[ 5 ] ++;
+				diffs[ 5 ] += g.Vhp[ i ] != s1[ i ].filter_Vhp || g.Vbp[ i ] != s1[ i ].filter_Vbp || g.Vlp[ i ] != s1[ i ].filter_Vlp;
+			}
+
+		// external filter and output
+		for ( int i = 0; i < N; i++ )
+		{
+			g.ext_Vlp[ i ] = pre.ext_Vlp[ i ];
+			g.ext_Vhp[ i ] = pre.ext_Vhp[ i ];
+		}
+		k->external_filter( g, dt );
+		for ( int i = 0; i < N; i++ )
+			if ( !combined[ i ] )
+			{
+				checked[ 6 ] ++;
+				diffs[ 6 ] += g.ext_Vlp[ i ] != s1[ i ].extfilt_Vlp || g.ext_Vhp[ i ] != s1[ i ].extfilt_Vhp ||
+							  g.ext_Vo[ i ] != s1[ i ].extfilt_Vo || SIDBank::output( g, i ) != lane[ i ].output();
+			}
+	}
+
+	for ( int i = 0; i < 7; i++ )
+	{
+		CHECK( checked[ i ] > KERNEL_TRIALS, "%s: %s kernel checked only %u times", backendName[ b ], kernelName[ i ], checked[ i ] );
+		CHECK( diffs[ i ] == 0, "%s: %s kernel differs from SID16 in %u of %u cases", backendName[ b ], kernelName[ i ], diffs[ i ], checked[ i ] );
+	}
+	CHECK( events[ 0 ] > 0 && events[ 1 ] > 0, "%s: no envelope steps / noise shifts (%u / %u)", backendName[ b ], events[ 0 ], events[ 1 ] );
+	printf( "%s: kernels identical to SID16 (%u envelope steps, %u noise shifts left to SID16)\n", backendName[ b ], events[ 0 ], events[ 1 ] );
+}
+
+// all lanes rendered by each backend against the standalone SID16s
+static void testRender( int decimate )
+{
+	static WRITE w[ LANES ][ WRITES ];
+	static int16_t ref[ LANES ][ WRITES * 10 ];
+	static int16_t out[ LANES * WRITES * 10 ];
+	uint32_t nRef = WRITES * 10;
+
+	for ( int l = 0; l < LANES; l++ )
+	{
+		scriptSID( w[ l ], WRITES );
+		uint32_t n = renderReference( l, decimate, w[ l ], WRITES, ref[ l ] );
+		if ( n < nRef )
+			nRef = n;
+	}
+	CHECK( nRef > 100000, "reference: only %u samples", nRef );
+
+	for ( int b = SIDBank::BACKEND_SID16; b <= SIDBank::BACKEND_AVX2; b++ )
+	{
+		if ( !SIDBank::backend_supported( (SIDBank::backend)b ) )
+		{
+			printf( "%s: not supported by the build or the CPU\n", backendName[ b ] );
+			continue;
+		}
+
+		const int threadCounts[] = { 1, 4 };
+		double seconds[ 2 ];
+
+		for ( int t = 0; t < 2; t++ )
+		{
+			SIDBank bank( LANES, MOS6581, C64_CLOCK, decimate ? SAMPLE_DECIMATE : SAMPLE_INTERPOLATE, AUDIO_RATE );
+			CHECK( bank.set_backend( (SIDBank::backend)b ), "%s: not set", backendName[ b ] );
+			for ( int l = 0; l < LANES; l++ )
+			{
+				configure( &bank.sid( l ), l, decimate );
+				for ( uint32_t i = 0; i < WRITES; i++ )
+					bank.write( l, w[ l ][ i ].delta, w[ l ][ i ].reg, w[ l ][ i ].value );
+			}
+			CHECK( bank.lanes() == LANES, "%d lanes", bank.lanes() );
+
+			seconds[ t ] = renderBank( &bank, threadCounts[ t ], nRef, out );
+
+			uint32_t diffs = 0;
+			for ( int l = 0; l < LANES; l++ )
+				for ( uint32_t i = 0; i < nRef; i++ )
+					if ( out[ i * LANES + l ] != ref[ l ][ i ] && diffs ++ == 0 )
+						printf( "lane %d, sample %u: %d / %d\n", l, i, out[ i * LANES + l ], ref[ l ][ i ] );
+			CHECK( diffs == 0, "%s, %d threads: %u samples differ from the standalone SID16", backendName[ b ], threadCounts[ t ], diffs );
+		}
+
+		printf( "%s%s: %d lanes x %u samples identical to SID16, %.1f / %.1f x real time (1 / %d threads)\n",
+				backendName[ b ], decimate ? ", decimating" : "", LANES, nRef, LANES * nRef / (double)AUDIO_RATE / seconds[ 0 ],
+				LANES * nRef / (double)AUDIO_RATE / seconds[ 1 ], threadCounts[ 1 ] );
+	}
+}
+
+int main()
+{
+	// the default is the fastest backend
+	{
+		SIDBank bank( 1, MOS6581, C64_CLOCK, SAMPLE_INTERPOLATE, AUDIO_RATE );
+		int fastest = SIDBank::BACKEND_AVX2;
+		while ( !SIDBank::backend_supported( (SIDBank::backend)fastest ) )
+			fastest --;
+		CHECK( bank.get_backend() == fastest, "default backend %s", backendName[ bank.get_backend() ] );
+	}
+
+	for ( int b = SIDBank::BACKEND_SCALAR; b <= SIDBank::BACKEND_AVX2; b++ )
+		if ( SIDBank::backend_supported( (SIDBank::backend)b ) )
+			testKernels( (SIDBank::backend)b );
+
+	testRender( 0 );
+	testRender( 1 );
+
+	return TEST_RESULT();
+}
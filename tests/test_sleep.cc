@@ -0,0 +1,255 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_sleep.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "reSID16/sid.h"
+#include "testutil.h"
+
+//
+// engine sleep: after SLEEP_SILENCE constant samples of idle SIDs the firmware stops emulating and only counts
+// the cycles, the first register write afterwards fast-forwards the SIDs (fastForwardReSID = SID16::fast_forward).
+// A SID16 driven like this must end up in the same state as one which never slept, and render the same
+// samples afterwards.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+#define SLEEP_SILENCE	4096
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+static void sidInit( SID16 *s, chip_model model, sampling_method sampling )
+{
+	s->set_chip_model( model );
+	s->enable_nonlinear_filter( model == MOS6581 );
+	s->set_sampling_parameters( C64_CLOCK, sampling, AUDIO_RATE );
+	s->reset();
+}
+
+// the firmware main loop for one SID: clocks to the sample ticks, sleeps and wakes up
+typedef struct
+{
+	SID16    *sid;
+	bool     canSleep, sleeping;
+	uint32_t silence, nSleeps;
+	int      lastSample;
+	uint64_t sleepCycles;
+} ENGINE;
+
+static void engineClock( ENGINE *e, uint32_t cycles )
+{
+	if ( e->sleeping )
+		e->sleepCycles += cycles; else
+		e->sid->clock( cycles );
+}
+
+static int engineSample( ENGINE *e )
+{
+	if ( e->sleeping )
+		return e->lastSample;
+
+	int s = e->sid->output();
+	if ( s == e->lastSample )
+	{
+		if ( e->silence < 65530 ) e->silence ++;
+	} else
+		e->silence = 0;
+	e->lastSample = s;
+
+	if ( e->canSleep && e->silence > SLEEP_SILENCE && e->sid->idle() )
+	{
+		e->sleeping = true;
+		e->nSleeps ++;
+	}
+	return s;
+}
+
+static void engineWake( ENGINE *e )
+{
+	if ( !e->sleeping )
+		return;
+	// in chunks, as fastForwardReSID does
+	while ( e->sleepCycles )
+	{
+		cycle_count c = e->sleepCycles > 0x40000000 ? 0x40000000 : (cycle_count)e->sleepCycles;
+		e->sid->fast_forward( c );
+		e->sleepCycles -= c;
+	}
+	e->sleeping = false;
+	e->silence = 0;
+}
+
+// compares the states after a wake-up, returns the number of differing fields
+static int compareStates( const SID16::State &a, const SID16::State &b, const char *name, uint32_t wake )
+{
+	int nDiff = 0;
+	#define CMP( f ) if ( a.f != b.f ) { if ( !nDiff ++ ) printf( "%s wake-up %u: " #f " differs (%d / %d)\n", name, wake, (int)a.f, (int)b.f ); }
+	for ( int i = 0; i < 0x19; i++ )
+		CMP( sid_register[ i ] );
+	for ( int i = 0; i < 3; i++ )
+	{
+		CMP( accumulator[ i ] );
+		CMP( shift_register[ i ] );
+		CMP( rate_counter[ i ] );
+		CMP( rate_counter_period[ i ] );
+		CMP( exponential_counter[ i ] );
+		CMP( exponential_counter_period[ i ] );
+		CMP( envelope_counter[ i ] );
+		CMP( envelope_state[ i ] );
+		CMP( hold_zero[ i ] );
+		CMP( pulse_output[ i ] );
+		CMP( waveform_output[ i ] );
+		CMP( osc3[ i ] );
+	}
+	CMP( filter_Vhp ); CMP( filter_Vbp ); CMP( filter_Vlp ); CMP( filter_Vnf );
+	CMP( filter_Vbp_x ); CMP( filter_Vlp_x );
+	CMP( extfilt_Vlp ); CMP( extfilt_Vhp ); CMP( extfilt_Vo );
+	CMP( decimate_offset ); CMP( decimate_phase ); CMP( decimate_output );
+	for ( int i = 0; i < SID16::DECIMATE_HB_N; i++ )
+		CMP( decimate_hb[ i ] );
+	#undef CMP
+	return nDiff;
+}
+
+// phrases of notes, each followed by a release to zero and a pause long enough to sleep; the oscillators keep
+// running through the pauses (voice 3 without waveform, such that the SIDs are idle)
+static void testSleep( chip_model model, sampling_method sampling )
+{
+	const char *name = model == MOS6581 ?
+		( sampling == SAMPLE_DECIMATE ? "6581, decimating" : "6581" ) :
+		( sampling == SAMPLE_DECIMATE ? "8580, decimating" : "8580" );
+	static const uint8_t waveforms[] = { 0x10, 0x20, 0x40, 0x80 };
+
+	SID16 sidA, sidB;
+	sidInit( &sidA, model, sampling );
+	sidInit( &sidB, model, sampling );
+
+	ENGINE ref = { &sidA, false, false, 0, 0, 0, 0 };
+	ENGINE eng = { &sidB, true, false, 0, 0, 0, 0 };
+
+	// sample ticks in 1/AUDIO_RATE cycles
+	uint64_t tickPhase = 0;
+	uint32_t nWakes = 0, nSamples = 0, maxSampleDiff = 0, nStateDiff = 0;
+	uint32_t afterWake = ~0u;
+
+	for ( int phrase = 0; phrase < 40; phrase++ )
+	{
+		// a pause of 0.2 to 1.5 seconds
+		uint32_t nWrites = 20 + rnd( 60 );
+		for ( uint32_t w = 0; w < nWrites + 1; w++ )
+		{
+			uint32_t delta = w == 0 ? 200000 + rnd( 1300000 ) : rnd( 4000 );
+
+			while ( delta )
+			{
+				uint32_t toTick = (uint32_t)( ( C64_CLOCK - tickPhase + AUDIO_RATE - 1 ) / AUDIO_RATE );
+				if ( toTick > delta )
+				{
+					engineClock( &ref, delta );
+					engineClock( &eng, delta );
+					tickPhase += (uint64_t)delta * AUDIO_RATE;
+					break;
+				}
+				engineClock( &ref, toTick );
+				engineClock( &eng, toTick );
+				tickPhase += (uint64_t)toTick * AUDIO_RATE - C64_CLOCK;
+				delta -= toTick;
+
+				int a = engineSample( &ref ), b = engineSample( &eng );
+				nSamples ++;
+				if ( afterWake < 4096 )
+				{
+					afterWake ++;
+					if ( (uint32_t)abs( a - b ) > maxSampleDiff )
+						maxSampleDiff = abs( a - b );
+				}
+			}
+
+			uint8_t reg, value;
+			if ( w == nWrites )
+			{
+				// release, voice 3 without waveform
+				reg = 7 * rnd( 3 ) + 4;
+				value = reg == 18 ? 0x00 : waveforms[ rnd( 4 ) ];
+			} else
+			switch ( rnd( 6 ) )
+			{
+				case 0: reg = 7 * rnd( 3 ) + rnd( 4 ); value = rnd( 256 ); break;
+				case 1: reg = 7 * rnd( 3 ) + 5; value = rnd( 256 ); break;
+				case 2: reg = 7 * rnd( 3 ) + 6; value = rnd( 256 ) & 0xf7; break;
+				case 3: reg = 0x15 + rnd( 3 ); value = rnd( 256 ); break;
+				case 4: reg = 0x18; value = 0x0f | ( rnd( 8 ) << 4 ); break;
+				default: reg = 7 * rnd( 3 ) + 4; value = waveforms[ rnd( 4 ) ] | rnd( 2 ); break;
+			}
+
+			if ( eng.sleeping )
+			{
+				engineWake( &eng );
+				if ( compareStates( sidA.read_state(), sidB.read_state(), name, nWakes ) )
+					nStateDiff ++;
+				nWakes ++;
+				afterWake = 0;
+			}
+			sidA.write( reg, value );
+			sidB.write( reg, value );
+
+			// all voices released before the pause
+			if ( w == nWrites )
+				for ( int v = 0; v < 3; v++ )
+				{
+					uint8_t ctrl = v == 2 ? 0x00 : sidA.read_state().sid_register[ 7 * v + 4 ] & 0xfe;
+					sidA.write( 7 * v + 4, ctrl );
+					sidB.write( 7 * v + 4, ctrl );
+				}
+		}
+	}
+
+	CHECK( nWakes >= 30, "%s: only %u of 40 pauses slept", name, nWakes );
+	CHECK( nStateDiff == 0, "%s: state differs after %u of %u wake-ups", name, nStateDiff, nWakes );
+	CHECK( maxSampleDiff == 0, "%s: samples after waking up differ by up to %u", name, maxSampleDiff );
+	if ( !nStateDiff && !maxSampleDiff )
+		printf( "%s: %u samples, %u wake-ups, identical to the engine which never slept\n", name, nSamples, nWakes );
+}
+
+int main()
+{
+	// without decimation (the default, see CFG_SID_SAMPLING) the filters rest at a fixed point of the
+	// per-sample clocking, see SID16::fast_forward
+	testSleep( MOS6581, SAMPLE_INTERPOLATE );
+	testSleep( MOS8580, SAMPLE_INTERPOLATE );
+	testSleep( MOS6581, SAMPLE_DECIMATE );
+	testSleep( MOS8580, SAMPLE_DECIMATE );
+	return TEST_RESULT();
+}
@@ -0,0 +1,255 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_snapshot.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include <string.h>
+#include "reSID16/sid.h"
+extern "C" {
+#include "fmopl.h"
+}
+#include "testutil.h"
+
+//
+// snapshot and restore of SID16 and the YM3812: an engine is driven by a scripted register write
+// sequence, its state is saved in the middle, and a second engine with a different history continues
+// from the restored state. The outputs (and OSC3/ENV3) after the snapshot must be identical.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+#define CYCLES_PER_SAMPLE	( C64_CLOCK / AUDIO_RATE )
+
+typedef struct
+{
+	uint32_t delta;		// cycles before the write
+	uint8_t  reg, value;
+} WRITE;
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+// a tune-like sequence: frequencies, pulse widths, ADSR, gate toggles, filter sweeps, all waveforms
+static void scriptSID( WRITE *w, uint32_t n )
+{
+	static const uint8_t waveforms[] = { 0x10, 0x20, 0x40, 0x80, 0x50, 0x30, 0x14, 0x12 };
+
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		w[ i ].delta = rnd( 400 );
+		uint32_t v = rnd( 3 ) * 7;
+		switch ( rnd( 8 ) )
+		{
+			case 0: w[ i ].reg = v + 0; w[ i ].value = rnd( 256 ); break;
+			case 1: w[ i ].reg = v + 1; w[ i ].value = rnd( 256 ); break;
+			case 2: w[ i ].reg = v + 2 + rnd( 2 ); w[ i ].value = rnd( 256 ); break;
+			case 3: w[ i ].reg = v + 4; w[ i ].value = waveforms[ rnd( 8 ) ] | rnd( 2 ); break;
+			case 4: w[ i ].reg = v + 5 + rnd( 2 ); w[ i ].value = rnd( 256 ); break;
+			case 5: w[ i ].reg = 0x15 + rnd( 2 ); w[ i ].value = rnd( 256 ); break;
+			case 6: w[ i ].reg = 0x17; w[ i ].value = rnd( 256 ); break;
+			case 7: w[ i ].reg = 0x18; w[ i ].value = 0x0f | ( rnd( 8 ) << 4 ); break;
+		}
+	}
+}
+
+static void sidInit( SID16 *s, chip_model model )
+{
+	s->set_chip_model( model );
+	s->enable_nonlinear_filter( model == MOS6581 );
+	s->set_sampling_parameters( C64_CLOCK, SAMPLE_DECIMATE, AUDIO_RATE );
+	s->reset();
+}
+
+// runs the writes as the firmware does (clock up to each write or sample tick), stores the samples and
+// OSC3/ENV3 after each write; 'cycle' is the C64 cycle within the current sample period
+static uint32_t sidRun( SID16 *s, const WRITE *w, uint32_t n, int16_t *out, uint8_t *osc3, uint32_t *cycle )
+{
+	uint32_t nOut = 0;
+
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		uint32_t delta = w[ i ].delta;
+		while ( *cycle + delta >= CYCLES_PER_SAMPLE )
+		{
+			uint32_t c = CYCLES_PER_SAMPLE - *cycle;
+			s->clock( c );
+			delta -= c;
+			*cycle = 0;
+			out[ nOut ++ ] = s->output();
+		}
+		s->clock( delta );
+		*cycle += delta;
+		s->write( w[ i ].reg, w[ i ].value );
+		osc3[ 2 * i + 0 ] = s->read( 0x1b );
+		osc3[ 2 * i + 1 ] = s->read( 0x1c );
+	}
+	return nOut;
+}
+
+static void testSID( chip_model model )
+{
+	const char *name = model == MOS6581 ? "6581" : "8580";
+	const uint32_t N = 40000, M = 23456;
+	static WRITE w[ N ], other[ N ];
+	static int16_t outA[ N * 20 ], outB[ N * 20 ];
+	static uint8_t osc3A[ 2 * N ], osc3B[ 2 * N ];
+
+	scriptSID( w, N );
+	scriptSID( other, N );
+
+	SID16 a, b;
+	sidInit( &a, model );
+	sidInit( &b, model );
+
+	uint32_t cycleA = 0, cycleB = 0;
+	sidRun( &a, w, M, outA, osc3A, &cycleA );
+	SID16::State state = a.read_state();
+	uint32_t cycleM = cycleA;		// the sample phase is part of the script, not of the SID state
+	uint32_t nA = sidRun( &a, &w[ M ], N - M, outA, osc3A, &cycleA );
+
+	// a different history, then the state from above
+	sidRun( &b, other, N, outB, osc3B, &cycleB );
+	b.write_state( state );
+	cycleB = cycleM;
+	uint32_t nB = sidRun( &b, &w[ M ], N - M, outB, osc3B, &cycleB );
+
+	CHECK( state.version == SID16::STATE_VERSION, "SID state version %d", state.version );
+	CHECK( nA == nB && nA > 100000, "%s: %u / %u samples", name, nA, nB );
+
+	uint32_t firstDiff = nA;
+	for ( uint32_t i = 0; i < nA && firstDiff == nA; i++ )
+		if ( outA[ i ] != outB[ i ] )
+			firstDiff = i;
+	CHECK( firstDiff == nA, "%s: output differs after restore from sample %u on (%d / %d)", name, firstDiff, outA[ firstDiff ], outB[ firstDiff ] );
+	CHECK( memcmp( osc3A, osc3B, 2 * ( N - M ) ) == 0, "%s: OSC3/ENV3 differ after restore", name );
+
+	printf( "%s: %u samples identical after restore\n", name, nA );
+}
+
+//
+// YM3812
+//
+
+// operator, channel and rhythm registers, key on/off in between
+static void scriptOPL( WRITE *w, uint32_t n )
+{
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		w[ i ].delta = rnd( 4 );		// in samples
+		uint32_t ofs = rnd( 9 );
+		uint32_t op = ( ofs / 3 ) * 8 + ( ofs % 3 ) + rnd( 2 ) * 3;
+		switch ( rnd( 10 ) )
+		{
+			case 0: w[ i ].reg = 0x20 + op; w[ i ].value = rnd( 256 ); break;
+			case 1: w[ i ].reg = 0x40 + op; w[ i ].value = rnd( 256 ); break;
+			case 2: w[ i ].reg = 0x60 + op; w[ i ].value = rnd( 256 ); break;
+			case 3: w[ i ].reg = 0x80 + op; w[ i ].value = rnd( 256 ); break;
+			case 4: w[ i ].reg = 0xe0 + op; w[ i ].value = rnd( 4 ); break;
+			case 5: w[ i ].reg = 0xa0 + ofs; w[ i ].value = rnd( 256 ); break;
+			case 6:
+			case 7: w[ i ].reg = 0xb0 + ofs; w[ i ].value = rnd( 64 ); break;
+			case 8: w[ i ].reg = 0xc0 + ofs; w[ i ].value = rnd( 16 ); break;
+			case 9: w[ i ].reg = 0xbd; w[ i ].value = rnd( 256 ); break;
+		}
+	}
+}
+
+static uint32_t oplRun( FM_OPL *chip, const WRITE *w, uint32_t n, OPLSAMPLE *out )
+{
+	uint32_t nOut = 0;
+
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		for ( uint32_t j = 0; j < w[ i ].delta; j++ )
+			ym3812_update_one( chip, &out[ nOut ++ ], 1 );
+		ym3812_write( chip, 0, w[ i ].reg );
+		ym3812_write( chip, 1, w[ i ].value );
+	}
+	return nOut;
+}
+
+static void testOPL()
+{
+	const uint32_t N = 40000, M = 17000;
+	static WRITE w[ N ], other[ N ];
+	static OPLSAMPLE outA[ N * 4 ], outB[ N * 4 ];
+
+	scriptOPL( w, N );
+	scriptOPL( other, N );
+
+	// there is only one chip (static memory), the two runs are sequential
+	FM_OPL *chip = ym3812_init( 3579545, AUDIO_RATE );
+	ym3812_write( chip, 0, 0x01 );
+	ym3812_write( chip, 1, 0x20 );		// waveform select enable
+
+	OPL_STATE state;
+	oplRun( chip, w, M, outA );
+	ym3812_read_state( chip, &state );
+	uint32_t nA = oplRun( chip, &w[ M ], N - M, outA );
+
+	ym3812_reset_chip( chip );
+	oplRun( chip, other, N, outB );
+	CHECK( ym3812_write_state( chip, &state ) == 0, "OPL: state rejected" );
+	uint32_t nB = oplRun( chip, &w[ M ], N - M, outB );
+
+	CHECK( nA == nB && nA > 10000, "OPL: %u / %u samples", nA, nB );
+
+	uint32_t firstDiff = nA, nonZero = 0;
+	for ( uint32_t i = 0; i < nA; i++ )
+	{
+		if ( outA[ i ] != outB[ i ] && firstDiff == nA )
+			firstDiff = i;
+		nonZero += outA[ i ] != 0;
+	}
+	CHECK( firstDiff == nA, "OPL: output differs after restore from sample %u on (%d / %d)", firstDiff, outA[ firstDiff ], outB[ firstDiff ] );
+	CHECK( nonZero > nA / 4, "OPL: only %u of %u samples are not silent", nonZero, nA );
+
+	// the rate dependent values are those of the restoring chip
+	ym3812_set_rate( chip, 48000 );
+	uint32_t egTimerAdd = chip->eg_timer_add;
+	ym3812_write_state( chip, &state );
+	CHECK( chip->rate == 48000 && chip->eg_timer_add == egTimerAdd, "OPL: restore changed the sampling rate" );
+
+	state.version ++;
+	CHECK( ym3812_write_state( chip, &state ) != 0, "OPL: state of another version accepted" );
+
+	printf( "OPL:  %u samples identical after restore, state size %u bytes (FM_OPL %u bytes)\n",
+			nA, (uint32_t)sizeof( OPL_STATE ), (uint32_t)sizeof( FM_OPL ) );
+}
+
+int main()
+{
+	testSID( MOS6581 );
+	testSID( MOS8580 );
+	testOPL();
+	return TEST_RESULT();
+}
@@ -0,0 +1,222 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_trace.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include "trace.h"
+#include "testutil.h"
+
+//
+// register write traces: a scripted session is recorded with checkpoints, saved and loaded again. Rendering the
+// loaded trace from the start must give the samples of the recording, and seeking to any position and rendering
+// from there the same samples as rendering from the start (also across silent pauses, where seeking
+// fast-forwards the SIDs).
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+// a tune-like write sequence for the SID(s) or SID + FM, with pauses where all voices are released
+static uint64_t record( TRACE_RECORDER *r, uint8_t fm, uint32_t nWrites, std::vector<TRACE_SAMPLE> *out )
+{
+	static const uint8_t waveforms[] = { 0x10, 0x20, 0x40, 0x80, 0x50, 0x30, 0x14, 0x12 };
+	uint64_t cycle = 0;
+
+	for ( uint32_t i = 0; i < nWrites; i++ )
+	{
+		if ( rnd( 2000 ) == 0 )
+		{
+			// pause: gates off, short release, long silence
+			for ( uint32_t s = 0; s < 2; s++ )
+				for ( uint32_t v = 0; v < 3; v++ )
+				{
+					uint16_t sid = s ? ( 1 << 15 ) : 0;
+					if ( s && fm )
+						break;
+					traceRecordWrite( r, cycle += 10, sid | ( ( v * 7 + 6 ) << 8 ) | 0x00, out );
+					traceRecordWrite( r, cycle += 10, sid | ( ( v * 7 + 4 ) << 8 ) | 0x20, out );
+				}
+			cycle += 800000 + rnd( 800000 );
+			continue;
+		}
+
+		cycle += rnd( 400 );
+		uint16_t cmd;
+		if ( fm && rnd( 2 ) )
+		{
+			// OPL register and value: operator and channel registers, key on/off
+			static const uint8_t regs[] = { 0x20, 0x40, 0x60, 0x80, 0xa0, 0xb0, 0xc0 };
+			uint8_t reg = regs[ rnd( 7 ) ] + rnd( 9 );
+			traceRecordWrite( r, cycle, ( 1 << 15 ) | ( 0x00 << 8 ) | reg, out );
+			cmd = ( 1 << 15 ) | ( 0x10 << 8 ) | ( ( reg & 0xf0 ) == 0xb0 ? rnd( 64 ) : rnd( 256 ) );
+		} else
+		{
+			uint16_t sid = ( !fm && rnd( 2 ) ) ? ( 1 << 15 ) : 0;
+			uint32_t v = rnd( 3 ) * 7, reg, value;
+			switch ( rnd( 8 ) )
+			{
+				default:
+				case 0: reg = v + 0; value = rnd( 256 ); break;
+				case 1: reg = v + 1; value = rnd( 256 ); break;
+				case 2: reg = v + 2 + rnd( 2 ); value = rnd( 256 ); break;
+				case 3: reg = v + 4; value = waveforms[ rnd( 8 ) ] | rnd( 2 ); break;
+				case 4: reg = v + 5 + rnd( 2 ); value = rnd( 256 ); break;
+				case 5: reg = 0x15 + rnd( 2 ); value = rnd( 256 ); break;
+				case 6: reg = 0x17; value = rnd( 256 ); break;
+				case 7: reg = 0x18; value = 0x0f | ( rnd( 8 ) << 4 ); break;
+			}
+			cmd = sid | ( reg << 8 ) | value;
+		}
+		traceRecordWrite( r, cycle, cmd, out );
+	}
+
+	cycle += 1000;
+	traceRecordEnd( r, cycle, out );
+	return cycle;
+}
+
+static uint32_t firstDiff( const TRACE_SAMPLE *a, const TRACE_SAMPLE *b, uint32_t n )
+{
+	for ( uint32_t i = 0; i < n; i++ )
+		if ( memcmp( &a[ i ], &b[ i ], sizeof( TRACE_SAMPLE ) ) )
+			return i;
+	return n;
+}
+
+static void testTrace( const char *name, const uint8_t model[ 2 ], const uint8_t nonlinear[ 2 ], uint8_t decimate, uint8_t fm )
+{
+	// record
+	static TRACE t;
+	traceInit( &t, C64_CLOCK, AUDIO_RATE, model, nonlinear, decimate, fm );
+	static TRACE_RECORDER r;
+	std::vector<TRACE_SAMPLE> recorded;
+	traceRecordStart( &r, &t, TRACE_CHECKPOINT_CYCLES );
+	uint64_t end = record( &r, fm, 40000, &recorded );
+	traceRecordFree( &r );
+
+	// save and load
+	FILE *f = tmpfile();
+	CHECK( f && traceSave( &t, f ) == 0, "%s: trace not saved", name );
+	static TRACE loaded;
+	CHECK( traceLoad( &loaded, f ) == 0, "%s: trace not loaded", name );
+	CHECK( loaded.records == t.records && loaded.index.size() == t.index.size() && traceEnd( &loaded ) == end,
+		"%s: loaded trace differs", name );
+
+	// a build with a different state layout must not load it
+	TRACE_HEADER h = t.header;
+	h.stateSize ++;
+	fseek( f, 0, SEEK_SET );
+	fwrite( &h, sizeof( TRACE_HEADER ), 1, f );
+	static TRACE other;
+	CHECK( traceLoad( &other, f ) != 0, "%s: trace with a different state layout loaded", name );
+	fclose( f );
+
+	// straight render of the loaded trace
+	static TRACE_PLAYER p;
+	std::vector<TRACE_SAMPLE> straight;
+	auto t0 = std::chrono::steady_clock::now();
+	traceStart( &p, &loaded );
+	tracePlay( &p, end, &straight );
+	double tStraight = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+	traceFree( &p );
+
+	uint32_t n = (uint32_t)straight.size();
+	CHECK( n == recorded.size() && firstDiff( recorded.data(), straight.data(), n ) == n,
+		"%s: replay differs from the recording (%u / %u samples)", name, n, (uint32_t)recorded.size() );
+
+	// seek forwards and backwards, then render a while
+	traceStart( &p, &loaded );
+	uint32_t errors = 0, seeks = 0;
+	double tSeek = 0;
+	uint64_t seekCycles = 0;
+	for ( int i = 0; i < 60; i++ )
+	{
+		uint64_t cycle;
+		switch ( i % 4 )
+		{
+			case 0: cycle = loaded.index[ rnd( (uint32_t)loaded.index.size() ) ].cycle; break;	// at a checkpoint
+			case 1: cycle = p.engine.cycle + rnd( 50000 ); break;								// a bit ahead
+			default: cycle = (uint64_t)rnd( 1 << 20 ) * end >> 20; break;						// anywhere
+		}
+		if ( i == 0 )
+			cycle = 0;
+
+		auto t1 = std::chrono::steady_clock::now();
+		uint64_t s = traceSeek( &p, cycle );
+		tSeek += std::chrono::duration<double>( std::chrono::steady_clock::now() - t1 ).count();
+		seekCycles += cycle;
+		seeks ++;
+
+		uint64_t tick = p.engine.cycle;
+		if ( tick > cycle || ( s < n && ( ( s + 1 ) * p.engine.cyclesPerSample >> 16 ) <= cycle ) )
+		{
+			printf( "%s: seek to %llu ended at %llu\n", name, (unsigned long long)cycle, (unsigned long long)tick );
+			errors ++;
+			continue;
+		}
+
+		std::vector<TRACE_SAMPLE> part;
+		uint64_t until = cycle + 20000 < end ? cycle + 20000 : end;
+		tracePlay( &p, until, &part );
+		uint32_t m = (uint32_t)part.size();
+		if ( s + m > n || firstDiff( part.data(), &straight[ s ], m ) != m )
+		{
+			printf( "%s: render after seek to %llu differs from sample %u on\n", name, (unsigned long long)cycle,
+				s + m > n ? 0 : firstDiff( part.data(), &straight[ s ], m ) );
+			errors ++;
+		}
+	}
+	uint64_t fastForwarded = p.engine.fastForwarded;
+	traceFree( &p );
+
+	CHECK( errors == 0, "%s: %u of %u seeks render differently", name, errors, seeks );
+	CHECK( fastForwarded > 0, "%s: no SID fast-forwarded while seeking", name );
+
+	printf( "%s: %u samples, %u checkpoints, %.1f KB; %u seeks identical, %.1f ms per seek (%.1f ms straight render), %.1fM cycles fast-forwarded\n",
+		name, n, (uint32_t)loaded.index.size(), ( loaded.records.size() * 4 + loaded.index.size() * sizeof( TRACE_INDEX_ENTRY ) ) / 1024.0,
+		seeks, tSeek * 1000 / seeks, tStraight * 1000, fastForwarded / 1e6 );
+}
+
+int main()
+{
+	static const uint8_t dual[ 2 ] = { 0, 1 }, nonlinear[ 2 ] = { 1, 0 }, linear[ 2 ] = { 0, 0 };
+
+	testTrace( "6581+8580, non-linear, decimating", dual, nonlinear, 1, 0 );
+	testTrace( "6581+8580", dual, linear, 0, 0 );
+	testTrace( "6581+FM", dual, linear, 0, 1 );
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,140 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  test_voice3.cc
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdint.h>
+#include "reSID16/sid.h"
+#include "testutil.h"
+
+//
+// a masked voice 3 (set_voice_mask(4)) is not clocked while OSC3/ENV3 are not being read, but only counts
+// the cycles it is behind (voice3_lag). Its OSC3/ENV3 readback must still match an unmasked SID16 which is
+// driven by the same writes, both when the SIDs are clocked one cycle at a time via clock() and in spans
+// via clock(delta_t), including spans above 0x10000 cycles and readback being switched on and off.
+//
+
+#define C64_CLOCK		985248
+#define AUDIO_RATE		44100
+
+static uint32_t rng = 1;
+
+static uint32_t rnd( uint32_t n )
+{
+	rng = rng * 1664525 + 1013904223;
+	return ( rng >> 8 ) % n;
+}
+
+static void sidInit( SID16 *s, chip_model model )
+{
+	s->set_chip_model( model );
+	s->set_sampling_parameters( C64_CLOCK, SAMPLE_DECIMATE, AUDIO_RATE );
+	s->reset();
+}
+
+// a random write, voice 3 and sync/ring modulation of and by voice 3 more often than the rest. Combined
+// waveforms with noise or (on the 6581) sawtooth are left out: their writes to the shift register and the
+// accumulator depend on how the cycles are split into clock(delta_t) calls, in the reference as well.
+static void randomWrite( SID16 *a, SID16 *b )
+{
+	static const uint8_t waveforms[] = { 0x00, 0x10, 0x20, 0x40, 0x80, 0x50 };
+	uint8_t reg, value = rnd( 256 );
+
+	switch ( rnd( 6 ) )
+	{
+		case 0: reg = 14 + rnd( 7 ); break;
+		case 1: case 2: reg = 14 + ( rnd( 2 ) ? 4 : rnd( 4 ) ); break;
+		case 3: reg = 18; break;
+		case 4: reg = 7 * rnd( 2 ) + 4; break;
+		default: reg = rnd( 0x19 ); break;
+	}
+	if ( reg == 4 || reg == 11 || reg == 18 )
+		value = waveforms[ rnd( 6 ) ] | ( value & 0x0f );
+
+	a->write( reg, value );
+	b->write( reg, value );
+}
+
+static void testVoice3( chip_model model, bool singleCycle )
+{
+	const char *name = model == MOS6581 ? "6581" : "8580";
+	const char *path = singleCycle ? "clock()" : "clock(delta_t)";
+
+	SID16 ref, masked;
+	sidInit( &ref, model );
+	sidInit( &masked, model );
+	masked.set_voice_mask( 4 );
+	masked.set_voice3_readback( false );
+
+	uint32_t nReads = 0, nDiff = 0;
+	for ( uint32_t i = 0; i < ( singleCycle ? 5000u : 8000u ); i++ )
+	{
+		uint32_t cycles = rnd( 16 ) == 0 ? 0x10000 + rnd( 0x20000 ) : rnd( 3000 );
+		if ( singleCycle && cycles > 5000 )
+			cycles = 5000;
+
+		if ( singleCycle )
+		{
+			for ( uint32_t c = 0; c < cycles; c++ )
+			{
+				ref.clock();
+				masked.clock();
+			}
+		} else
+		{
+			ref.clock( cycles );
+			masked.clock( cycles );
+		}
+
+		switch ( rnd( 4 ) )
+		{
+			case 0: randomWrite( &ref, &masked ); break;
+			case 1: masked.set_voice3_readback( rnd( 2 ) ); break;
+			default:
+			{
+				// the reads catch up a lagging voice 3
+				uint8_t r = 0x1b + rnd( 2 );
+				uint8_t vr = ref.read( r ), vm = masked.read( r );
+				if ( vr != vm && nDiff ++ == 0 )
+					printf( "%s %s: $d4%02x differs at step %u (%02x / %02x)\n", name, path, r, i, vr, vm );
+				nReads ++;
+			}
+		}
+	}
+
+	CHECK( nDiff == 0, "%s %s: %u of %u OSC3/ENV3 reads differ", name, path, nDiff, nReads );
+	if ( nDiff == 0 )
+		printf( "%s %s: %u OSC3/ENV3 reads identical\n", name, path, nReads );
+}
+
+int main()
+{
+	testVoice3( MOS6581, false );
+	testVoice3( MOS8580, false );
+	testVoice3( MOS6581, true );
+	testVoice3( MOS8580, true );
+	return TEST_RESULT();
+}
@@ -0,0 +1,50 @@
+/*
+       ______/  _____/  _____/     /   _/    /             /
+     _/           /     /     /   /  _/     /   ______/   /  _/             ____/     /   ______/   ____/
+      ___/       /     /     /   ___/      /   /         __/                    _/   /   /         /     /
+         _/    _/    _/    _/   /  _/     /  _/         /  _/             _____/    /  _/        _/    _/
+  ______/   _____/  ______/   _/    _/  _/    _____/  _/    _/          _/        _/    _____/    ____/
+
+  testutil.h
+
+  SIDKick pico - SID-replacement with dual-SID/SID+fm emulation using a RPi pico, reSID 0.16 and fmopl
+  Copyright (c) 2023/2024 Carsten Dachsbacher <frenetic@dachsbacher.de>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TESTUTIL_h_
+#define TESTUTIL_h_
+
+#include <stdio.h>
+
+//
+// minimal checks for the host tests: a failed check is reported with its location, the test returns
+// TEST_RESULT() from main (0 = passed)
+//
+
+static int testFailures = 0;
+
+#define CHECK( cond, ... ) {											\
+	if ( !( cond ) ) {													\
+		printf( "%s:%d: check failed: ", __FILE__, __LINE__ );			\
+		printf( __VA_ARGS__ );											\
+		printf( "\n" );													\
+		testFailures ++;												\
+	} }
+
+#define TEST_RESULT()	( testFailures ? 1 : 0 )
+
+#endif